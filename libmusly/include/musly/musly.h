@@ -30,6 +30,7 @@ similarity measures. It is our reference implementation.
 #ifndef MUSLY_H_
 #define MUSLY_H_
 
+#include <stddef.h>  // to define size_t
 #include <musly/musly_types.h>
 
 #ifdef MUSLY_SUPPORT_STDIO
@@ -77,6 +78,23 @@ musly_debug(
         int level);
 
 
+/** Set the number of threads Musly runs its parallel computations on, such
+ * as musly_track_analyze_pcm_batch() and musly_jukebox_similarity_batch().
+ * The threads are started on first use and kept for later calls. Only one
+ * parallel computation runs at a time; if another thread calls a parallel
+ * function meanwhile, it computes the result on its own, without the
+ * threads. Waits for a running parallel computation.
+ *
+ * \param[in] num_threads The number of threads including the calling one,
+ * or 0 for one per hardware thread (the default)
+ *
+ * \returns 0 on success, -1 if \p num_threads is negative
+ */
+MUSLY_EXPORT int
+musly_set_threads(
+        int num_threads);
+
+
 /** Lists all available music similarity methods. The methods are returned as
  * a single null terminated string. The methods are separated by a comma (,).
  * Use a method name to power on a Musly jukebox.
@@ -166,6 +184,42 @@ MUSLY_EXPORT void
 musly_jukebox_poweroff(
         musly_jukebox* jukebox);
 
+
+/** Set the options tuning how the decoder of the jukebox decodes audio
+ * files, for all following calls decoding files with the jukebox or its
+ * analyzers. To decode some files with other options, set the options
+ * before decoding them. The options must not be changed while files are
+ * being decoded, e.g. by musly_track_analyze_audiofiles() or analyzers on
+ * other threads.
+ *
+ * \param[in] jukebox A reference to an initialized musly_jukebox object
+ * with a decoder
+ * \param[in] options The options to set, or NULL to reset the options to
+ * the decoder's defaults
+ *
+ * \returns 0 on success, -1 on failure
+ *
+ * \sa musly_decoder_options, musly_jukebox_getdecoderoptions()
+ */
+MUSLY_EXPORT int
+musly_jukebox_setdecoderoptions(
+        musly_jukebox* jukebox,
+        const musly_decoder_options* options);
+
+
+/** Get the options set with musly_jukebox_setdecoderoptions().
+ *
+ * \param[in] jukebox A reference to an initialized musly_jukebox object
+ * with a decoder
+ * \param[out] options The options of the decoder
+ *
+ * \returns 0 on success, -1 on failure
+ */
+MUSLY_EXPORT int
+musly_jukebox_getdecoderoptions(
+        musly_jukebox* jukebox,
+        musly_decoder_options* options);
+
 /** Initialize the jukebox music style. To properly use the similarity
  * function, it is necessary to give the algorithms a hint about the music we
  * are working with. Do this by passing a representative sample of the tracks
@@ -219,11 +273,12 @@ musly_jukebox_setmusicstyle(
  * \returns 0 on success, -1 on an error. When an error is returned, no
  * track was added to Musly.
  *
- * \note The tracks themselves are not stored in the jukebox, just some
- * information needed to provide musly_jukebox_guessneighbors() and to
- * improve musly_jukebox_similarity(). This design allows Musly to compute
- * recommendations for collections too large to fit all tracks into memory
- * at once.
+ * \note Besides some information needed to provide
+ * musly_jukebox_guessneighbors() and to improve musly_jukebox_similarity(),
+ * similarity methods supporting musly_jukebox_similarity_byid() keep a copy
+ * of the features of each registered track in a contiguous store. The
+ * features are not written by musly_jukebox_tostream(); after restoring a
+ * jukebox, they can be given again with musly_jukebox_storetracks().
  *
  * \sa musly_jukebox_removetracks(), musly_jukebox_trackcount(),
  * musly_jukebox_setmusicstyle(), musly_jukebox_similarity()
@@ -353,6 +408,172 @@ musly_jukebox_similarity(
         float* similarities);
 
 
+/** Computes the similarity between a registered seed track and a list of
+ * other registered tracks, given by their identifiers only. In contrast to
+ * musly_jukebox_similarity(), the features are read from the jukebox's own
+ * track store, which keeps them contiguous and cache-aligned. This avoids
+ * gathering musly_track objects scattered over memory, and is the fastest
+ * way to compare a seed against a whole collection that fits into memory.
+ *
+ * \param[in] jukebox An initialized Musly jukebox object with tracks added
+ * through musly_jukebox_addtracks() or musly_jukebox_storetracks()
+ * \param[in] seed_trackid The id of the seed track
+ * \param[in] trackids An array of musly_trackids to compute the similarities
+ * to, or NULL to compare against all registered tracks in the order returned
+ * by musly_jukebox_gettrackids()
+ * \param[in] num_tracks The size of the \p trackids and \p similarities
+ * arrays. If \p trackids is NULL, this must equal
+ * musly_jukebox_trackcount().
+ * \param[out] similarities A preallocated float array to write the computed
+ * similarities to
+ * \returns 0 on success, -1 on an error, including any unknown trackid,
+ * tracks whose features are not stored in the jukebox, and similarity
+ * methods not supporting this call
+ *
+ * \sa musly_jukebox_similarity(), musly_jukebox_storetracks(),
+ * musly_jukebox_gettrackids()
+ */
+MUSLY_EXPORT int
+musly_jukebox_similarity_byid(
+        musly_jukebox* jukebox,
+        musly_trackid seed_trackid,
+        musly_trackid* trackids,
+        int num_tracks,
+        float* similarities);
+
+
+/** Computes the similarities between several registered seed tracks and a
+ * list of registered tracks at once, given by their identifiers only. The
+ * result equals calling musly_jukebox_similarity_byid() for each seed, but
+ * the seeds x tracks matrix is computed in cache-sized tiles, so the features
+ * of each track are read from memory only once per tile of seeds instead of
+ * once per seed. The tiles are computed in parallel on all available cores.
+ * Use this for offline jobs like computing full similarity matrices.
+ *
+ * \param[in] jukebox An initialized Musly jukebox object with tracks added
+ * through musly_jukebox_addtracks() or musly_jukebox_storetracks()
+ * \param[in] seed_trackids An array of ids of the seed tracks
+ * \param[in] num_seeds The size of the \p seed_trackids array
+ * \param[in] trackids An array of musly_trackids to compute the similarities
+ * to, or NULL to compare against all registered tracks in the order returned
+ * by musly_jukebox_gettrackids()
+ * \param[in] num_tracks The size of the \p trackids array. If \p trackids is
+ * NULL, this must equal musly_jukebox_trackcount().
+ * \param[out] similarities A preallocated float array of
+ * <tt>num_seeds * num_tracks</tt> elements to write the computed similarities
+ * to, one row of \p num_tracks similarities per seed
+ * \returns 0 on success, -1 on an error (see musly_jukebox_similarity_byid())
+ *
+ * \sa musly_jukebox_similarity_byid(), musly_jukebox_storetracks()
+ */
+MUSLY_EXPORT int
+musly_jukebox_similarity_batch(
+        musly_jukebox* jukebox,
+        musly_trackid* seed_trackids,
+        int num_seeds,
+        musly_trackid* trackids,
+        int num_tracks,
+        float* similarities);
+
+
+/** Computes the similarities between all pairs of a list of registered
+ * tracks. As similarities are symmetric, each pair is computed only once,
+ * which takes half the time of computing the full matrix with
+ * musly_jukebox_similarity_batch(). The result is streamed to a callback in
+ * blocks of rows of the upper triangle of the matrix, so the full matrix
+ * never has to be held in memory. Each block is computed in parallel.
+ *
+ * \param[in] jukebox An initialized Musly jukebox object with tracks added
+ * through musly_jukebox_addtracks() or musly_jukebox_storetracks()
+ * \param[in] trackids An array of ids of the tracks, or NULL to use all
+ * registered tracks in the order returned by musly_jukebox_gettrackids()
+ * \param[in] num_tracks The size of the \p trackids array. If \p trackids is
+ * NULL, this must equal musly_jukebox_trackcount().
+ * \param[in] block_rows The number of rows of the upper triangle to compute
+ * and pass to \p sink at once. Memory use is about
+ * <tt>block_rows * num_tracks</tt> floats. Suggested value: 32.
+ * \param[in] sink The callback to pass the blocks of rows to, in order. Row
+ * \p i holds the similarities of track <tt>trackids[i]</tt> to the tracks
+ * <tt>trackids[i+1]</tt> to <tt>trackids[num_tracks-1]</tt>. The
+ * similarity of a track to itself is always 0.
+ * \param[in] user_data A pointer passed on to \p sink
+ * \returns 0 on success, -1 on an error (see musly_jukebox_similarity_byid())
+ * or if \p sink returned nonzero
+ *
+ * \sa musly_similarity_sink, musly_jukebox_similarity_batch()
+ */
+MUSLY_EXPORT int
+musly_jukebox_similarity_allpairs(
+        musly_jukebox* jukebox,
+        musly_trackid* trackids,
+        int num_tracks,
+        int block_rows,
+        musly_similarity_sink sink,
+        void* user_data);
+
+
+/** Finds the tracks most similar to a registered seed track. This gives the
+ * same result as musly_jukebox_similarity_byid() followed by
+ * musly_findmin() with \p ordered set, but never materializes the full list
+ * of similarities: raw similarities are computed for small blocks of tracks
+ * at a time, and only the \p k best tracks are kept. Tracks that cannot be
+ * among them are discarded without computing their normalized similarity.
+ * This is the fastest way to ask for the nearest neighbors of a track in a
+ * large jukebox.
+ *
+ * \param[in] jukebox An initialized Musly jukebox object with tracks added
+ * through musly_jukebox_addtracks() or musly_jukebox_storetracks()
+ * \param[in] seed_trackid The id of the seed track
+ * \param[in] trackids An array of musly_trackids of the candidate tracks, or
+ * NULL to consider all registered tracks
+ * \param[in] num_tracks The size of the \p trackids array. If \p trackids is
+ * NULL, this must equal musly_jukebox_trackcount().
+ * \param[out] knn_similarities An array to write the \p k smallest
+ * similarities to, in ascending order
+ * \param[out] knn_trackids An array to write the ids of the corresponding
+ * tracks to
+ * \param[in] k The number of most similar tracks to find. Note that the seed
+ * track itself is included if it is among the candidates.
+ * \returns the number of tracks written to \p knn_similarities and
+ * \p knn_trackids, which is less than \p k only if there are fewer
+ * candidates, or -1 on an error (see musly_jukebox_similarity_byid())
+ *
+ * \sa musly_jukebox_similarity_byid(), musly_findmin()
+ */
+MUSLY_EXPORT int
+musly_jukebox_knn(
+        musly_jukebox* jukebox,
+        musly_trackid seed_trackid,
+        musly_trackid* trackids,
+        int num_tracks,
+        float* knn_similarities,
+        musly_trackid* knn_trackids,
+        int k);
+
+
+/** Stores the features of tracks already registered with the Musly jukebox
+ * in its track store, to enable musly_jukebox_similarity_byid() for them.
+ * This is only needed for jukeboxes restored with musly_jukebox_fromstream(),
+ * as musly_jukebox_addtracks() stores the features on its own.
+ *
+ * \param[in] jukebox The Musly jukebox to store the tracks in
+ * \param[in] tracks An array of musly_track objects
+ * \param[in] trackids The track identifiers the \p tracks were registered
+ * with; unknown identifiers will be silently ignored
+ * \param[in] num_tracks The length of the \p tracks and \p trackids array
+ * \returns the number of tracks stored, or -1 on an error or if the
+ * similarity method does not support a track store
+ *
+ * \sa musly_jukebox_similarity_byid(), musly_jukebox_fromstream()
+ */
+MUSLY_EXPORT int
+musly_jukebox_storetracks(
+        musly_jukebox* jukebox,
+        musly_track** tracks,
+        musly_trackid* trackids,
+        int num_tracks);
+
+
 /** Tries to guess the most similar neighbors to the given trackid. If
  * similarity measures implement this call, it is usually a very efficient
  * way to pre-filter the whole jukebox collection for possible matches
@@ -366,6 +587,15 @@ musly_jukebox_similarity(
  * -1 is returned. In that case consider all musly_tracks as possible nearest
  * neighbors and thus as input to musly_jukebox_similarity().
  *
+ * The "timbre" method answers this call from a graph index of approximate
+ * nearest neighbors (HNSW) over the raw similarities, which can be tuned
+ * with musly_jukebox_setoption(). The index needs the features of the
+ * tracks, so for a jukebox restored with musly_jukebox_fromstream(), give
+ * them via musly_jukebox_storetracks() first. The seed itself is never
+ * returned. With the "vptree.enabled" option, "timbre" returns the exact
+ * nearest neighbors by raw similarity instead, both with and without
+ * \p limit_to.
+ *
  * \param[in] jukebox An initialized Musly jukebox object with tracks added
  * through musly_jukebox_addtracks()
  * \param[in] seed The seed track id to search for its nearest neighbors
@@ -425,6 +655,88 @@ musly_jukebox_guessneighbors_filtered(
         int num_limit_to);
 
 
+/** Sets an option of the music similarity method of a jukebox. Options are
+ * specific to the method. The "timbre" method supports:
+ *
+ *  - "covar.encoding": how tracks keep their covariances in the jukebox:
+ *    0 as floats (default), 1 as half precision floats, or 2 as one signed
+ *    byte per element scaled by the standard deviations. Halves, or cuts
+ *    to about a quarter, the memory and bandwidth the covariances take up,
+ *    at the cost of slightly less exact similarities of the tracks stored
+ *    in the jukebox (not of those passed to musly_jukebox_similarity()).
+ *    Can only be changed before adding tracks.
+ *  - "covar.rerank": the number of candidates beyond k that
+ *    musly_jukebox_knn() compares again with the exact covariances, which
+ *    tracks then keep in addition to the compact ones (default: 0). Only
+ *    used with a "covar.encoding" other than 0. Mostly pays off with
+ *    musly_jukebox_frommmap(), which leaves the exact covariances on disk
+ *    until they are needed. Can only be changed before adding tracks.
+ *  - "hnsw.m": the number of links per track and layer of the neighbor
+ *    search index (default: 16). More links give better results of
+ *    musly_jukebox_guessneighbors() at higher memory and insertion cost. Set
+ *    to 0 to disable the index. Can only be changed before adding tracks.
+ *  - "hnsw.ef_construction": the beam width when inserting tracks into the
+ *    index (default: 64). Larger values give a better index, but make
+ *    musly_jukebox_addtracks() slower.
+ *  - "hnsw.ef_search": the minimum beam width when searching the index
+ *    (default: 64). Larger values give better results of
+ *    musly_jukebox_guessneighbors(), but make it slower.
+ *  - "pivots.count": the number of music style tracks to use as pivots
+ *    (default: 0). Each track keeps its similarities to the pivots, one
+ *    byte each, which proves many tracks to be too far away to be among
+ *    the results of musly_jukebox_knn() and
+ *    musly_jukebox_guessneighbors_filtered() without comparing them. Costs
+ *    nothing when adding tracks, as the similarities to the music style
+ *    are computed anyway. Like with "vptree.enabled", this pays off for
+ *    collections with many close neighbors per track. Can only be changed
+ *    before adding tracks.
+ *  - "vptree.enabled": set to 1 to answer musly_jukebox_guessneighbors()
+ *    and musly_jukebox_guessneighbors_filtered() exactly, and to speed up
+ *    musly_jukebox_knn(), with a vantage point tree over the raw
+ *    similarities (default: 0). The tree is built on the first query after
+ *    tracks were added or removed, and skips tracks that the triangle
+ *    inequality proves to be too far away. Tracks with nearly singular
+ *    covariances (e.g., from silence) violate it, so they are always
+ *    compared. Pays off for collections with many close neighbors per
+ *    track; otherwise, few tracks can be skipped.
+ *  - "vptree.distances", "vptree.candidates": read only, except for a reset
+ *    by setting either to 0. The number of similarities computed by the
+ *    queries answered with the vantage point tree, and the number a linear
+ *    scan would have computed. One minus their ratio is the fraction of
+ *    similarity computations saved. Saturates at the largest int.
+ *
+ * The "covar", "hnsw" and "pivots" options are part of the jukebox state written by
+ * musly_jukebox_tostream().
+ *
+ * \param[in] jukebox The Musly jukebox to configure
+ * \param[in] name The name of the option
+ * \param[in] value The value to set
+ * \returns 0 on success, -1 if the option is unknown or the value is invalid
+ *
+ * \sa musly_jukebox_getoption()
+ */
+MUSLY_EXPORT int
+musly_jukebox_setoption(
+        musly_jukebox* jukebox,
+        const char* name,
+        int value);
+
+
+/** Returns the value of an option of the music similarity method of a
+ * jukebox, see musly_jukebox_setoption().
+ *
+ * \param[in] jukebox The Musly jukebox to query
+ * \param[in] name The name of the option
+ * \returns the value of the option, or -1 if the option is unknown
+ *
+ * \sa musly_jukebox_setoption()
+ */
+MUSLY_EXPORT int
+musly_jukebox_getoption(
+        musly_jukebox* jukebox,
+        const char* name);
+
+
 /**
  * Returns the size in bytes needed for serializing the jukebox state.
  *
@@ -569,6 +881,88 @@ musly_jukebox_tostream(
 MUSLY_EXPORT musly_jukebox*
 musly_jukebox_fromstream(
         FILE* stream);
+
+
+/**
+ * Appends a journal record of tracks added to a jukebox to a stream, so a
+ * jukebox state written with musly_jukebox_tostream() can be brought up to
+ * date without writing it anew. The record holds the same state of the
+ * tracks as musly_jukebox_tobin(), and is replayed with
+ * musly_jukebox_journal_replay().
+ *
+ * \param jukebox An initialized Musly jukebox object the tracks have been
+ * added to with musly_jukebox_addtracks()
+ * \param stream The file stream to append to, opened in binary mode,
+ * typically positioned after the jukebox state and the records before
+ * \param trackids The ids of the tracks added
+ * \param num_tracks The number of tracks added
+ *
+ * \returns the number of bytes written, or -1 in case of an error, such as
+ * a track id not registered with the jukebox or given twice
+ *
+ * \note A journal grows with every record, and replaying it takes longer
+ * than reading the same state with musly_jukebox_fromstream(). Write the
+ * jukebox anew with musly_jukebox_tostream() from time to time to compact
+ * it, for example when the journal gets larger than a fraction of the
+ * jukebox state.
+ *
+ * \sa musly_jukebox_journal_removetracks(), musly_jukebox_journal_replay()
+ */
+MUSLY_EXPORT int
+musly_jukebox_journal_addtracks(
+        musly_jukebox* jukebox,
+        FILE* stream,
+        const musly_trackid* trackids,
+        int num_tracks);
+
+
+/**
+ * Appends a journal record of tracks removed from a jukebox to a stream.
+ * See musly_jukebox_journal_addtracks().
+ *
+ * \param jukebox An initialized Musly jukebox object
+ * \param stream The file stream to append to, opened in binary mode
+ * \param trackids The ids of the tracks removed
+ * \param num_tracks The number of tracks removed
+ *
+ * \returns the number of bytes written, or -1 in case of an error
+ *
+ * \sa musly_jukebox_journal_addtracks(), musly_jukebox_journal_replay()
+ */
+MUSLY_EXPORT int
+musly_jukebox_journal_removetracks(
+        musly_jukebox* jukebox,
+        FILE* stream,
+        const musly_trackid* trackids,
+        int num_tracks);
+
+
+/**
+ * Replays the journal records of a stream up to its end, adding and
+ * removing tracks like they were added to and removed from the jukebox the
+ * records were written for.
+ *
+ * \param jukebox The Musly jukebox to replay the records for, usually just
+ * restored with musly_jukebox_fromstream() from the same stream
+ * \param stream The file stream to read from, positioned at the first
+ * record
+ *
+ * \returns the number of records replayed, or -1 if a record was incomplete
+ * or damaged, as after an interrupted write. The jukebox then holds the
+ * state of the records before, and can be written anew with
+ * musly_jukebox_tostream() to drop the rest.
+ *
+ * \note Like musly_jukebox_fromstream(), replaying does not restore the
+ * features of the tracks. Tracks added by replaying are found by
+ * musly_jukebox_guessneighbors() once their features are given to
+ * musly_jukebox_storetracks().
+ *
+ * \sa musly_jukebox_journal_addtracks()
+ */
+MUSLY_EXPORT int
+musly_jukebox_journal_replay(
+        musly_jukebox* jukebox,
+        FILE* stream);
 #endif  // MUSLY_SUPPORT_STDIO
 
 
@@ -608,6 +1002,104 @@ musly_jukebox_fromfile(
         const char* filename);
 
 
+/**
+ * Writes a jukebox to a file laid out to be memory-mapped, for restoring it
+ * with musly_jukebox_frommmap(). Unlike musly_jukebox_tofile(), the file
+ * includes the features of the tracks stored with
+ * musly_jukebox_storetracks().
+ *
+ * \param jukebox An initialized Musly jukebox object
+ * \param filename The name of the file to write to
+ *
+ * \returns 0 on success, or -1 in case of an error or if the music
+ * similarity method does not support mapped files
+ *
+ * \note The numbers in the file are little-endian, and aligned for use in
+ * place. Files can only be written and mapped on little-endian platforms.
+ * The file is written as \p filename with ".tmp" appended, then renamed to
+ * \p filename, so a jukebox mapping the file it replaces, including
+ * \p jukebox itself, can go on using it.
+ *
+ * \sa musly_jukebox_frommmap()
+ */
+MUSLY_EXPORT int
+musly_jukebox_tommap(
+        musly_jukebox* jukebox,
+        const char* filename);
+
+
+/**
+ * Restores a jukebox from a file written by musly_jukebox_tommap(), mapping
+ * the file into memory and using the track ids, normalization factors,
+ * pivot codes and stored features in place instead of reading and copying
+ * them. Restoring takes about as long for millions of tracks as for a few,
+ * and the pages of the file are read as they are first used. They are
+ * copied into memory of the jukebox only before they first change, for
+ * example when adding or removing tracks.
+ *
+ * \param filename The name of the file to map
+ *
+ * \returns a reference to an initialized Musly jukebox object, or NULL in
+ * case of an error
+ *
+ * \note The file stays mapped until the jukebox is powered off, and must
+ * not be changed or truncated until then. Replacing it, as
+ * musly_jukebox_tommap() does, is fine.
+ *
+ * \sa musly_jukebox_tommap()
+ */
+MUSLY_EXPORT musly_jukebox*
+musly_jukebox_frommmap(
+        const char* filename);
+
+
+/**
+ * Maps a file read-only into memory. The operating system reads its pages
+ * as they are first accessed and may drop them again under memory pressure,
+ * so files of millions of tracks can be used in place, the way
+ * musly_jukebox_frommmap() does for jukeboxes. Tracks in the file can be
+ * passed to any call taking a musly_track if they are aligned to 4 bytes.
+ *
+ * \param filename The name of the file to map
+ *
+ * \returns the mapped file, or NULL in case of an error. Unmap it with
+ * musly_mappedfile_close().
+ *
+ * \sa musly_mappedfile_data(), musly_mappedfile_size()
+ */
+MUSLY_EXPORT musly_mappedfile*
+musly_mappedfile_open(
+        const char* filename);
+
+
+/**
+ * Returns the contents of a file mapped with musly_mappedfile_open(), or
+ * NULL if \p file is NULL or the file is empty. The contents are valid
+ * until the file is unmapped, and must not be written to.
+ */
+MUSLY_EXPORT const unsigned char*
+musly_mappedfile_data(
+        const musly_mappedfile* file);
+
+
+/**
+ * Returns the size in bytes of a file mapped with musly_mappedfile_open(),
+ * or 0 if \p file is NULL.
+ */
+MUSLY_EXPORT size_t
+musly_mappedfile_size(
+        const musly_mappedfile* file);
+
+
+/**
+ * Unmaps a file mapped with musly_mappedfile_open(). Does nothing if
+ * \p file is NULL.
+ */
+MUSLY_EXPORT void
+musly_mappedfile_close(
+        musly_mappedfile* file);
+
+
 /** Allocates a musly_track in memory. As the size of a musly_track varies for
  * each music similarity method, an initialized Musly jukebox object reference
  * needs to be passed as an argument. You need to free the allocated
@@ -721,6 +1213,62 @@ musly_track_frombin(
         musly_track* to_track);
 
 
+/** Serializes many musly_track objects into one contiguous byte buffer,
+ * musly_track_binsize() bytes after another. Unless \p native is set, each
+ * is converted to network byte order like by musly_track_tobin(), but many
+ * words at once.
+ *
+ * \param[in] jukebox A reference to an initialized Musly jukebox object
+ * \param[in] from_tracks The tracks to serialize
+ * \param[in] num_tracks The number of tracks
+ * \param[out] to_buffer The buffer receiving the serialized tracks, of at
+ * least <tt>num_tracks * musly_track_binsize()</tt> bytes
+ * \param[in] native If nonzero, the tracks are copied as they are, in the
+ * byte order of the host, to be read on the same platform only.
+ *
+ * \returns the number of tracks serialized, or -1 in case of an error
+ *
+ * \sa musly_tracks_frombin_batch(), musly_track_tobin()
+ */
+MUSLY_EXPORT int
+musly_tracks_tobin_batch(
+        musly_jukebox* jukebox,
+        musly_track** from_tracks,
+        int num_tracks,
+        unsigned char* to_buffer,
+        int native);
+
+
+/** Deserializes many musly_track objects from a contiguous byte buffer
+ * written by musly_tracks_tobin_batch() or, unless \p native is set, by
+ * consecutive calls to musly_track_tobin().
+ *
+ * \param[in] jukebox A reference to an initialized Musly jukebox object
+ * \param[in] from_buffer The buffer to read
+ * <tt>num_tracks * musly_track_binsize()</tt> bytes from
+ * \param[in] num_tracks The number of tracks
+ * \param[out] to_tracks The musly_track objects to store the tracks in
+ * \param[in] native If nonzero, the tracks were written in the byte order of
+ * the host and are copied as they are.
+ *
+ * \returns the number of tracks deserialized, or -1 in case of an error
+ *
+ * \note Tracks in the byte order of the host need not be copied at all:
+ * if \p from_buffer is aligned to 4 bytes,
+ * <tt>(musly_track*)(from_buffer + i * musly_track_binsize())</tt> can be
+ * used as the i-th track directly, as long as the buffer is.
+ *
+ * \sa musly_tracks_tobin_batch(), musly_track_frombin()
+ */
+MUSLY_EXPORT int
+musly_tracks_frombin_batch(
+        musly_jukebox* jukebox,
+        unsigned char* from_buffer,
+        int num_tracks,
+        musly_track** to_tracks,
+        int native);
+
+
 /** This function displays a string representation of the given musly_track.
  * The data is displayed in a flat format. All data structures (matrices,
  * covariance matrices) are exported as vectors. This call can be used to
@@ -773,6 +1321,70 @@ musly_track_analyze_pcm(
         musly_track* track);
 
 
+/** Compute a music similarity model (musly_track) from a mono PCM signal of
+ * 22050 Hz or more, like musly_track_analyze_pcm() does for a signal of
+ * 22050 Hz. The signal is analyzed at its own rate, with a window of about
+ * the same duration and filters of the same frequencies as at 22050 Hz, so
+ * it need not be resampled: for a 44100 or 48000 Hz signal, this is
+ * cheaper than resampling it, and gives features close to those of the
+ * resampled signal. The frequencies above 11025 Hz are ignored. At
+ * 22050 Hz, the features are those of musly_track_analyze_pcm().
+ *
+ * \param[in] jukebox A reference to an initialized musly_jukebox object
+ * \param[in] mono_pcm The mono audio signal to analyze, with float values
+ * between -1.0 and +1.0
+ * \param[in] length_pcm The length of the input float array
+ * \param[in] sample_rate The sample rate of the signal in Hz, between
+ * 22050 and 384000
+ * \param[out] track The musly_track to write the music similarity features to
+ *
+ * \returns 0 on success, -1 on failure, including for a sample rate the
+ * method does not support
+ *
+ * \sa musly_track_analyze_pcm(), musly_decoder_options
+ */
+MUSLY_EXPORT int
+musly_track_analyze_pcm_rate(
+        musly_jukebox* jukebox,
+        float* mono_pcm,
+        int length_pcm,
+        int sample_rate,
+        musly_track* track);
+
+
+/** Compute the music similarity models (musly_track) of several PCM
+ * signals in parallel, like musly_track_analyze_pcm() does for each. The
+ * signals are analyzed on the threads set with musly_set_threads(). Threads
+ * that are done with their share of signals take over signals of others,
+ * so the work is balanced even if the signals differ a lot in length. A
+ * failure to analyze a signal does not affect the others.
+ *
+ * \param[in] jukebox A reference to an initialized musly_jukebox object
+ * \param[in] mono_22khz_pcm An array of \p num_tracks signals, mono and
+ * sampled at 22050 Hz, see musly_track_analyze_pcm()
+ * \param[in] lengths_pcm The lengths of the signals
+ * \param[out] tracks The \p num_tracks musly_tracks to write the music
+ * similarity features of the signals to
+ * \param[in] num_tracks The number of signals
+ * \param[out] results An array of \p num_tracks elements to write the result
+ * of each analysis to: 0 on success, nonzero on failure (as returned by
+ * musly_track_analyze_pcm()). May be NULL.
+ *
+ * \returns the number of signals that could not be analyzed, or -1 on an
+ * error of the arguments
+ *
+ * \sa musly_track_analyze_pcm(), musly_set_threads()
+ */
+MUSLY_EXPORT int
+musly_track_analyze_pcm_batch(
+        musly_jukebox* jukebox,
+        float** mono_22khz_pcm,
+        int* lengths_pcm,
+        musly_track** tracks,
+        int num_tracks,
+        int* results);
+
+
 /** Compute a music similarity model (musly_track) from the audio file.
  * The audio file is decoded with the decoder selected when initializing
  * the musly_jukebox, down- and re-sampled to a 22050Hz mono signal before
@@ -816,6 +1428,275 @@ musly_track_analyze_audiofile(
         musly_track* track);
 
 
+/** Compute a music similarity model (musly_track) from an encoded audio
+ * file held in memory, such as an object fetched from a network store,
+ * like musly_track_analyze_audiofile() does for a file on disk. The decoder
+ * reads and seeks within the buffer directly, without writing it to a
+ * temporary file. Decoding from memory is supported by the libav decoder.
+ *
+ * \param[in] jukebox A reference to an initialized musly_jukebox object
+ * \param[in] buffer The encoded audio file, as it would be stored on disk
+ * \param[in] size The number of bytes in \p buffer
+ * \param[in] excerpt_length The maximum length in seconds of the excerpt to
+ * decode, see musly_track_analyze_audiofile()
+ * \param[in] excerpt_start The starting position in seconds of the excerpt to
+ * decode, see musly_track_analyze_audiofile()
+ * \param[out] track The musly_track to write the music similarity features to
+ *
+ * \returns 0 on success, -1 on failure, including if the decoder cannot
+ * decode from memory
+ *
+ * \sa musly_track_analyze_audiofile(), musly_analyzer_analyze_audiobuffer()
+ */
+MUSLY_EXPORT int
+musly_track_analyze_audiobuffer(
+        musly_jukebox* jukebox,
+        const unsigned char* buffer,
+        size_t size,
+        float excerpt_length,
+        float excerpt_start,
+        musly_track* track);
+
+
+/** Analyze a list of audio files like musly_track_analyze_audiofile() does,
+ * in a pipeline that decodes, analyzes and serializes the files on
+ * separate threads. Decoding the next files thus overlaps with analyzing
+ * the previous ones. The stages pass the files on through bounded queues,
+ * and the decoded signals and tracks are kept in buffers reused from one
+ * file to the next. The results are passed to \p sink in the order the
+ * files are done, which may differ from the order of the list.
+ *
+ * \param[in] jukebox A reference to an initialized musly_jukebox object
+ * with a decoder
+ * \param[in] audiofiles The \p num_files audio files to analyze
+ * \param[in] num_files The number of files
+ * \param[in] excerpt_length The maximum length in seconds of the excerpt to
+ * decode of each file, see musly_track_analyze_audiofile()
+ * \param[in] excerpt_start The starting position in seconds of the excerpt
+ * to decode of each file, see musly_track_analyze_audiofile()
+ * \param[in] decode_threads The number of threads decoding files, or 0 for
+ * one. Raise it if decoding is slower than the analysis, e.g. for files
+ * on network storage.
+ * \param[in] analyze_threads The number of threads analyzing decoded
+ * signals, or 0 for one per hardware thread
+ * \param[in] serialize_threads The number of threads serializing tracks, or
+ * 0 for one
+ * \param[in] sink The callback to pass the results to
+ * \param[in] user_data A pointer passed on to \p sink
+ *
+ * \returns the number of files that could not be analyzed, or -1 on an
+ * argument error or if \p sink returned nonzero
+ *
+ * \sa musly_audiofile_sink, musly_track_analyze_audiofile()
+ */
+MUSLY_EXPORT int
+musly_track_analyze_audiofiles(
+        musly_jukebox* jukebox,
+        const char** audiofiles,
+        int num_files,
+        float excerpt_length,
+        float excerpt_start,
+        int decode_threads,
+        int analyze_threads,
+        int serialize_threads,
+        musly_audiofile_sink sink,
+        void* user_data);
+
+
+/** Create an analyzer for the music similarity method of the given jukebox.
+ * The analyzer owns the scratch memory needed to compute musly_track
+ * features, and reuses it from one call to the next. While a jukebox must
+ * not be modified concurrently, any number of threads may analyze tracks
+ * for it in parallel, as long as each uses an analyzer of its own.
+ * Free the analyzer with musly_analyzer_free() before powering off the
+ * jukebox.
+ *
+ * \param[in] jukebox A reference to an initialized musly_jukebox object
+ *
+ * \returns the analyzer, or NULL on failure
+ *
+ * \sa musly_analyzer_analyze_pcm(), musly_analyzer_analyze_audiofile()
+ */
+MUSLY_EXPORT musly_analyzer*
+musly_analyzer_create(
+        musly_jukebox* jukebox);
+
+
+/** Free an analyzer created with musly_analyzer_create().
+ *
+ * \param[in] analyzer The analyzer to free, or NULL
+ */
+MUSLY_EXPORT void
+musly_analyzer_free(
+        musly_analyzer* analyzer);
+
+
+/** Compute a music similarity model (musly_track) from the given PCM signal,
+ * like musly_track_analyze_pcm() does, but using the scratch memory of the
+ * given analyzer.
+ *
+ * \param[in] analyzer An analyzer created with musly_analyzer_create()
+ * \param[in] mono_22khz_pcm The mono 22050 Hz audio signal to analyze
+ * \param[in] length_pcm The length of the input float array
+ * \param[out] track The musly_track to write the music similarity features to
+ *
+ * \returns 0 on success, -1 on failure
+ *
+ * \sa musly_track_analyze_pcm()
+ */
+MUSLY_EXPORT int
+musly_analyzer_analyze_pcm(
+        musly_analyzer* analyzer,
+        float* mono_22khz_pcm,
+        int length_pcm,
+        musly_track* track);
+
+
+/** Compute a music similarity model (musly_track) from a mono PCM signal of
+ * any sample rate, like musly_track_analyze_pcm_rate() does, but using the
+ * scratch memory of the given analyzer.
+ *
+ * \param[in] analyzer An analyzer created with musly_analyzer_create()
+ * \param[in] mono_pcm The mono audio signal to analyze
+ * \param[in] length_pcm The length of the input float array
+ * \param[in] sample_rate The sample rate of the signal in Hz
+ * \param[out] track The musly_track to write the music similarity features to
+ *
+ * \returns 0 on success, -1 on failure
+ *
+ * \sa musly_track_analyze_pcm_rate()
+ */
+MUSLY_EXPORT int
+musly_analyzer_analyze_pcm_rate(
+        musly_analyzer* analyzer,
+        float* mono_pcm,
+        int length_pcm,
+        int sample_rate,
+        musly_track* track);
+
+
+/** Decode an audio file and compute a music similarity model (musly_track)
+ * from it, like musly_track_analyze_audiofile() does, but using the scratch
+ * memory of the given analyzer.
+ *
+ * \param[in] analyzer An analyzer created with musly_analyzer_create()
+ * \param[in] audiofile An audio file
+ * \param[in] excerpt_length The maximum length in seconds of the excerpt to
+ * decode, see musly_track_analyze_audiofile()
+ * \param[in] excerpt_start The starting position in seconds of the excerpt
+ * to decode, see musly_track_analyze_audiofile()
+ * \param[out] track The musly_track to write the music similarity features to
+ *
+ * \returns 0 on success, -1 on failure
+ *
+ * \sa musly_track_analyze_audiofile()
+ */
+MUSLY_EXPORT int
+musly_analyzer_analyze_audiofile(
+        musly_analyzer* analyzer,
+        const char* audiofile,
+        float excerpt_length,
+        float excerpt_start,
+        musly_track* track);
+
+
+/** Decode an encoded audio file held in memory and compute a music
+ * similarity model (musly_track) from it, like
+ * musly_track_analyze_audiobuffer() does, but using the scratch memory of
+ * the given analyzer.
+ *
+ * \param[in] analyzer An analyzer created with musly_analyzer_create()
+ * \param[in] buffer The encoded audio file
+ * \param[in] size The number of bytes in \p buffer
+ * \param[in] excerpt_length The maximum length in seconds of the excerpt to
+ * decode, see musly_track_analyze_audiofile()
+ * \param[in] excerpt_start The starting position in seconds of the excerpt
+ * to decode, see musly_track_analyze_audiofile()
+ * \param[out] track The musly_track to write the music similarity features to
+ *
+ * \returns 0 on success, -1 on failure
+ *
+ * \sa musly_track_analyze_audiobuffer()
+ */
+MUSLY_EXPORT int
+musly_analyzer_analyze_audiobuffer(
+        musly_analyzer* analyzer,
+        const unsigned char* buffer,
+        size_t size,
+        float excerpt_length,
+        float excerpt_start,
+        musly_track* track);
+
+
+/** Start computing a music similarity model (musly_track) from a PCM signal
+ * that is passed chunk by chunk with musly_analyzer_feed(), e.g., while it
+ * is being decoded or received. The analyzer keeps the overlap between
+ * chunks and accumulates the statistics of the features on the fly. If the
+ * peak of the signal is given, its memory use does not grow with the length
+ * of the signal. Otherwise, it keeps compressed spectra of the signal until
+ * the peak is known, about a fourteenth of the size of the signal. Call
+ * musly_analyzer_finish() to obtain the musly_track. Starting a new
+ * analysis discards any unfinished one of the analyzer.
+ *
+ * \note
+ * For the same signal, the result matches the one of
+ * musly_analyzer_analyze_pcm() up to floating point rounding, as long as the
+ * \p length_pcm and the \p peak given here (if any) are correct.
+ *
+ * \param[in] analyzer An analyzer created with musly_analyzer_create()
+ * \param[in] length_pcm The number of samples that will be fed, or 0 if
+ * unknown. As for musly_track_analyze_pcm(), the music similarity method may
+ * only use the central part of a long signal. If the length is unknown, it
+ * uses the beginning of the signal instead.
+ * \param[in] peak The largest absolute sample value of the signal, or 0 if
+ * unknown. Signals are normalized to their peak before the analysis.
+ *
+ * \returns 0 on success, -1 on failure, e.g., if the music similarity method
+ * does not support analyzing signals chunk by chunk
+ *
+ * \sa musly_analyzer_feed(), musly_analyzer_finish()
+ */
+MUSLY_EXPORT int
+musly_analyzer_begin(
+        musly_analyzer* analyzer,
+        int length_pcm,
+        float peak);
+
+
+/** Pass the next chunk of a PCM signal to an analysis started with
+ * musly_analyzer_begin(). Chunks can have any size.
+ *
+ * \param[in] analyzer An analyzer created with musly_analyzer_create()
+ * \param[in] mono_22khz_pcm The next samples of the mono 22050 Hz signal
+ * \param[in] length_pcm The number of samples in \p mono_22khz_pcm
+ *
+ * \returns 0 on success, -1 on failure
+ *
+ * \sa musly_analyzer_begin(), musly_analyzer_finish()
+ */
+MUSLY_EXPORT int
+musly_analyzer_feed(
+        musly_analyzer* analyzer,
+        const float* mono_22khz_pcm,
+        int length_pcm);
+
+
+/** Finish an analysis started with musly_analyzer_begin() and write the
+ * music similarity features of the signal fed to \p track.
+ *
+ * \param[in] analyzer An analyzer created with musly_analyzer_create()
+ * \param[out] track The musly_track to write the music similarity features to
+ *
+ * \returns 0 on success, -1 on failure
+ *
+ * \sa musly_analyzer_begin(), musly_analyzer_feed()
+ */
+MUSLY_EXPORT int
+musly_analyzer_finish(
+        musly_analyzer* analyzer,
+        musly_track* track);
+
+
 /** Utility function to find the smallest items in an unordered list of values.
  * This can be used to find the top few tracks in the results of a similarity
  * computation done via one or more musly_jukebox_similarity() calls.
@@ -21,6 +21,23 @@
 typedef struct _musly_jukebox musly_jukebox;
 
 
+/** A Musly analyzer holds the scratch memory (FFT plans, buffers) needed to
+ * compute musly_track features for the music similarity method of a jukebox.
+ * Each thread analyzing tracks in parallel uses an analyzer of its own.
+ *
+ * \sa musly_analyzer_create(), musly_analyzer_free()
+ */
+typedef struct _musly_analyzer musly_analyzer;
+
+
+/** A file mapped read-only into memory, to use the musly_track objects it
+ * holds in place instead of reading them into memory of their own.
+ *
+ * \sa musly_mappedfile_open(), musly_mappedfile_close()
+ */
+typedef struct _musly_mappedfile musly_mappedfile;
+
+
 /** A musly_track object typically represents the features extracted with an
  * music similarity method. The features are stored linearly in a float* array.
  * Each music similarity method may write different features into this
@@ -36,4 +53,96 @@ typedef float musly_track;
 typedef int musly_trackid;
 
 
+/** A callback receiving blocks of rows of the upper triangle of a
+ * similarity matrix, as computed by musly_jukebox_similarity_allpairs().
+ * Row \p i of a matrix over \p n tracks holds the similarities of track
+ * \p i to tracks <tt>i+1</tt> to <tt>n-1</tt>, so it has <tt>n-1-i</tt>
+ * elements. The \p num_rows rows starting at \p first_row are given
+ * back-to-back in \p similarities, which is only valid during the call.
+ * Return 0 to continue, or nonzero to abort the computation.
+ */
+typedef int (*musly_similarity_sink)(
+        void* user_data,
+        int first_row,
+        int num_rows,
+        const float* similarities);
+
+
+/** A callback receiving the result of analyzing an audio file with
+ * musly_track_analyze_audiofiles(), as soon as it is done. \p index is the
+ * position of the file in the list, and \p result is 0 on success or
+ * nonzero if the file could not be decoded or analyzed. On success,
+ * \p track holds the features and \p bin the musly_track_binsize() bytes
+ * written by musly_track_tobin(); both are only valid during the call and
+ * NULL on failure. The callback is never called concurrently.
+ * Return 0 to continue, or nonzero to abort the analysis.
+ */
+typedef int (*musly_audiofile_sink)(
+        void* user_data,
+        int index,
+        int result,
+        const musly_track* track,
+        const unsigned char* bin);
+
+
+/** Flags for musly_decoder_options::codec_thread_type, selecting how a
+ * codec may decode with several threads: several frames at once, or
+ * several slices of each frame.
+ */
+#define MUSLY_DECODER_THREAD_FRAME 1
+#define MUSLY_DECODER_THREAD_SLICE 2
+
+
+/** Options tuning how a decoder decodes audio files, trading accuracy of
+ * the stream information and of the resampling for speed. A field left 0
+ * keeps the decoder's default, so zero-initialize the structure and set
+ * only the fields to change. Decoders ignore options they do not support.
+ *
+ * \sa musly_jukebox_setdecoderoptions()
+ */
+typedef struct {
+    /** The maximum number of bytes to read when probing the format and
+     * streams of a file, at least 32. Lower it to open files faster,
+     * at the risk of missing streams that start late.
+     */
+    int probe_size;
+
+    /** The maximum number of seconds of each stream to decode when probing
+     * the streams of a file.
+     */
+    float analyze_duration;
+
+    /** The number of threads decoding each file, or -1 to let the codec
+     * choose. Only some codecs can decode with several threads.
+     */
+    int codec_threads;
+
+    /** The kind of threading the codec may use with several threads, a
+     * combination of #MUSLY_DECODER_THREAD_FRAME and
+     * #MUSLY_DECODER_THREAD_SLICE.
+     */
+    int codec_thread_type;
+
+    /** If nonzero, the data between the position a file could be seeked to
+     * and the start of the excerpt is skipped instead of being decoded, and
+     * the excerpt starts exactly at the requested position.
+     */
+    int skip_to_excerpt;
+
+    /** The number of taps of the resampling filter at the lower of the two
+     * sample rates. Shorter filters resample faster but let more of the
+     * frequencies above the lower Nyquist frequency alias.
+     */
+    int resampler_filter_length;
+
+    /** If nonzero, files of sample rates above 22050 Hz are decoded at
+     * their own rate instead of being resampled to 22050 Hz, and analyzed
+     * at that rate, which saves the time of resampling. Only supported by
+     * some decoders; the others keep resampling. The features differ
+     * slightly from those of the resampled signal.
+     */
+    int native_sample_rate;
+} musly_decoder_options;
+
+
 #endif // MUSLY_TYPES_H_
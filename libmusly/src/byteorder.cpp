@@ -0,0 +1,66 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <cstdint>
+#include <cstring>
+
+#include "simd.h"
+#include "byteorder.h"
+
+namespace musly {
+
+namespace {
+
+/** Reverse the bytes of \p count 32-bit words. Written byte by byte so the
+ * buffers need no alignment; compilers turn the loop into byte shuffles
+ * (pshufb) of whole vectors.
+ */
+MUSLY_TARGET_CLONES
+void
+swap_bytes32(
+        const unsigned char* MUSLY_RESTRICT in,
+        unsigned char* MUSLY_RESTRICT out,
+        size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        out[4*i] = in[4*i + 3];
+        out[4*i + 1] = in[4*i + 2];
+        out[4*i + 2] = in[4*i + 1];
+        out[4*i + 3] = in[4*i];
+    }
+}
+
+} /* anonymous namespace */
+
+bool
+host_is_network_order()
+{
+    const uint32_t word = 0x01020304;
+    unsigned char first;
+    std::memcpy(&first, &word, 1);
+    return first == 0x01;
+}
+
+void
+copy_network_order(
+        const void* in,
+        void* out,
+        size_t count)
+{
+    if (host_is_network_order()) {
+        std::memcpy(out, in, count * sizeof(uint32_t));
+    } else {
+        swap_bytes32(static_cast<const unsigned char*>(in),
+                static_cast<unsigned char*>(out), count);
+    }
+}
+
+} /* namespace musly */
@@ -0,0 +1,38 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_BYTEORDER_H_
+#define MUSLY_BYTEORDER_H_
+
+#include <cstddef>
+
+namespace musly {
+
+/** Return whether the host stores numbers in network byte order, that is,
+ * big-endian.
+ */
+bool
+host_is_network_order();
+
+/** Copy \p count 32-bit words from \p in to \p out, converting them from
+ * host to network byte order or back, which is the same. On little-endian
+ * hosts, this reverses the bytes of each word with vectorized byte
+ * shuffles; on big-endian hosts, it is a plain copy. The buffers may be
+ * unaligned, but must not overlap.
+ */
+void
+copy_network_order(
+        const void* in,
+        void* out,
+        size_t count);
+
+} /* namespace musly */
+#endif /* MUSLY_BYTEORDER_H_ */
@@ -0,0 +1,233 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "simd.h"
+#include "compactcovar.h"
+
+namespace musly {
+
+namespace {
+
+/** The smallest normal and the largest finite half */
+const float half_min = 6.103515625e-05f;
+const float half_max = 65504.0f;
+
+/** The code of the diagonal of covar_int8 */
+const float int8_diagonal = 127;
+
+/** Return the dimension of a matrix whose packed upper triangle has
+ * \p elems elements.
+ */
+int
+packed_dim(
+        int elems)
+{
+    return (int)((std::sqrt(8.0 * elems + 1) - 1) / 2 + 0.5);
+}
+
+uint16_t
+float_to_half(
+        float f)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(float));
+    const uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    const float a = std::fabs(f);
+    if (!(a >= half_min)) {
+        return sign;  // flushed to zero, as is NaN
+    }
+    if (a >= half_max) {
+        return sign | 0x7bff;
+    }
+    std::memcpy(&bits, &a, sizeof(float));
+    // rebias the exponent and round the mantissa to nearest even; a carry
+    // into the exponent is what rounding up to the next power of two needs
+    uint32_t h = (((bits >> 23) - 112) << 10) | ((bits >> 13) & 0x3ff);
+    const uint32_t rest = bits & 0x1fff;
+    if ((rest > 0x1000) || ((rest == 0x1000) && (h & 1))) {
+        h++;
+    }
+    return sign | (uint16_t)h;
+}
+
+/** Return the float of the half \p h, which is neither subnormal, infinite
+ * nor NaN, as float_to_half() ensures. The exponent is rebiased by a single
+ * multiplication, so loops over halfs vectorize.
+ */
+MUSLY_INLINE float
+half_to_float(
+        uint16_t h)
+{
+    const uint32_t magnitude_bits = (uint32_t)(h & 0x7fff) << 13;
+    float magnitude;
+    std::memcpy(&magnitude, &magnitude_bits, sizeof(float));
+    // 2^112 turns the half exponent bias of 15 into the float one of 127
+    magnitude *= 5.192296858534828e+33f;
+    uint32_t bits;
+    std::memcpy(&bits, &magnitude, sizeof(float));
+    bits |= (uint32_t)(h & 0x8000) << 16;
+    float f;
+    std::memcpy(&f, &bits, sizeof(float));
+    return f;
+}
+
+/** Return the half at \p in, which may be unaligned: int8 codes leave odd
+ * offsets in packed buffers of several encoded covariances.
+ */
+MUSLY_INLINE uint16_t
+load_half(
+        const unsigned char* in)
+{
+    uint16_t h;
+    std::memcpy(&h, in, sizeof(uint16_t));
+    return h;
+}
+
+MUSLY_INLINE void
+store_half(
+        unsigned char* out,
+        uint16_t h)
+{
+    std::memcpy(out, &h, sizeof(uint16_t));
+}
+
+MUSLY_TARGET_CLONES
+void
+decode_float16(
+        const unsigned char* MUSLY_RESTRICT in,
+        int elems,
+        float* MUSLY_RESTRICT covar)
+{
+    for (int e = 0; e < elems; e++) {
+        covar[e] = half_to_float(load_half(in + e * sizeof(uint16_t)));
+    }
+}
+
+/** Decode covar_int8, with room for the \p d scales of the dimensions at
+ * \p t.
+ */
+MUSLY_TARGET_CLONES
+void
+decode_int8(
+        const unsigned char* MUSLY_RESTRICT scale,
+        const int8_t* MUSLY_RESTRICT codes,
+        int d,
+        float* MUSLY_RESTRICT t,
+        float* MUSLY_RESTRICT covar)
+{
+    for (int i = 0; i < d; i++) {
+        t[i] = half_to_float(load_half(scale + i * sizeof(uint16_t)));
+    }
+    int idx_ii = 0;
+    for (int i = 0; i < d; i++) {
+        const float t_i = t[i];
+        const int8_t* MUSLY_RESTRICT q = codes + idx_ii - i;
+        float* MUSLY_RESTRICT c = covar + idx_ii - i;
+        for (int j = i; j < d; j++) {
+            c[j] = q[j] * (t_i * t[j]);
+        }
+        idx_ii += d - i;
+    }
+}
+
+} /* anonymous namespace */
+
+size_t
+covar_encoded_size(
+        covar_encoding encoding,
+        int elems)
+{
+    switch (encoding) {
+    case covar_float16:
+        return elems * sizeof(uint16_t);
+    case covar_int8:
+        return packed_dim(elems) * sizeof(uint16_t) + elems;
+    default:
+        return elems * sizeof(float);
+    }
+}
+
+void
+encode_covar(
+        covar_encoding encoding,
+        const float* covar,
+        int elems,
+        void* out)
+{
+    if (encoding == covar_float16) {
+        unsigned char* h = static_cast<unsigned char*>(out);
+        for (int e = 0; e < elems; e++) {
+            store_half(h + e * sizeof(uint16_t), float_to_half(covar[e]));
+        }
+    } else if (encoding == covar_int8) {
+        // the scales of the dimensions, as they will be decoded
+        const int d = packed_dim(elems);
+        unsigned char* scale = static_cast<unsigned char*>(out);
+        int8_t* codes = reinterpret_cast<int8_t*>(scale + d * sizeof(uint16_t));
+        std::vector<float> t(d);
+        int idx_ii = 0;
+        for (int i = 0; i < d; i++) {
+            const uint16_t h = float_to_half(
+                    std::sqrt(std::max(0.0f, covar[idx_ii]) / int8_diagonal));
+            store_half(scale + i * sizeof(uint16_t), h);
+            t[i] = half_to_float(h);
+            idx_ii += d - i;
+        }
+        int idx_ij = 0;
+        for (int i = 0; i < d; i++) {
+            for (int j = i; j < d; j++) {
+                const float unit = t[i] * t[j];
+                const float q = (unit > 0) ? std::round(covar[idx_ij] / unit)
+                        : 0;
+                codes[idx_ij] = (int8_t)std::min(int8_diagonal,
+                        std::max(-int8_diagonal, q));
+                idx_ij++;
+            }
+        }
+    } else {
+        std::memcpy(out, covar, elems * sizeof(float));
+    }
+}
+
+void
+decode_covar(
+        covar_encoding encoding,
+        const void* in,
+        int elems,
+        float* covar)
+{
+    if (encoding == covar_float16) {
+        decode_float16(static_cast<const unsigned char*>(in), elems, covar);
+    } else if (encoding == covar_int8) {
+        const int d = packed_dim(elems);
+        const unsigned char* scale = static_cast<const unsigned char*>(in);
+        float t_stack[64];
+        std::vector<float> t_heap;
+        float* t = t_stack;
+        if (d > 64) {
+            t_heap.resize(d);
+            t = t_heap.data();
+        }
+        decode_int8(scale,
+                reinterpret_cast<const int8_t*>(scale + d * sizeof(uint16_t)),
+                d, t, covar);
+    } else {
+        std::memcpy(covar, in, elems * sizeof(float));
+    }
+}
+
+} /* namespace musly */
@@ -0,0 +1,73 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_COMPACTCOVAR_H_
+#define MUSLY_COMPACTCOVAR_H_
+
+#include <cstddef>
+
+namespace musly {
+
+/** The ways to store the packed upper triangle of a covariance matrix.
+ *
+ *  - covar_float32: as it is.
+ *  - covar_float16: as IEEE half precision floats, rounded to nearest.
+ *    Magnitudes beyond the range of halfs are clamped to the largest one,
+ *    and those below the smallest normal half (about 6.1e-5) are flushed
+ *    to zero, so decoding never involves subnormal arithmetic.
+ *  - covar_int8: as the correlations of the dimensions, one signed byte
+ *    each, scaled by the standard deviations of the dimensions, one half
+ *    each. The d halfs t(i) = sqrt(C(i,i) / 127) come first, followed by
+ *    all elements C(i,j), rounded to multiples of t(i)*t(j), so the
+ *    diagonal is 127 and the other elements are 127 times the correlation.
+ *    Scaling each element by its own dimensions rather than all of them by
+ *    the largest one keeps the small elements, which the log-determinant
+ *    of nearly singular covariances depends on, about as accurate as the
+ *    large ones.
+ */
+enum covar_encoding {
+    covar_float32 = 0,
+    covar_float16 = 1,
+    covar_int8 = 2
+};
+
+/** Return the number of bytes the \p elems packed elements of a covariance
+ * take up with \p encoding.
+ */
+size_t
+covar_encoded_size(
+        covar_encoding encoding,
+        int elems);
+
+/** Encode the \p elems packed elements of the covariance at \p covar to
+ * covar_encoded_size() bytes at \p out, which needs no particular
+ * alignment.
+ */
+void
+encode_covar(
+        covar_encoding encoding,
+        const float* covar,
+        int elems,
+        void* out);
+
+/** Decode \p elems packed elements encoded with encode_covar() from \p in,
+ * which needs no particular alignment. Vectorized to decode covariances on
+ * the fly while comparing them.
+ */
+void
+decode_covar(
+        covar_encoding encoding,
+        const void* in,
+        int elems,
+        float* covar);
+
+} /* namespace musly */
+#endif /* MUSLY_COMPACTCOVAR_H_ */
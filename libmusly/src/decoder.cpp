@@ -9,6 +9,8 @@
  * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
+#include <algorithm>
+
 #include "decoder.h"
 #include "plugins.h"
 
@@ -48,17 +50,115 @@ void adjustExcerptBounds(const float total_duration, float& excerpt_start, float
 namespace musly
 {
 
+void
+decoder::set_options(
+        const musly_decoder_options& options)
+{
+    this->options = options;
+}
+
+const musly_decoder_options&
+decoder::get_options() const
+{
+    return options;
+}
+
 std::vector<float>
 decoder::decodeto_22050hz_mono_float(
         const std::string& filename,
         float excerpt_length,
         float excerpt_start)
+{
+    std::vector<float> decoded_pcm;
+    decodeto_22050hz_mono_float(filename, excerpt_length, excerpt_start,
+            decoded_pcm);
+    return decoded_pcm;
+}
+
+size_t
+decoder::decodeto_22050hz_mono_float(
+        const std::string& filename,
+        float excerpt_length,
+        float excerpt_start,
+        std::vector<float>& decoded_pcm)
 {
     const std::unique_ptr<decoder_file> file = open_file(filename);
+    int sample_rate;
+    return decode_excerpt(file.get(), filename, excerpt_length, excerpt_start,
+            false, decoded_pcm, sample_rate);
+}
+
+size_t
+decoder::decodeto_22050hz_mono_float(
+        const unsigned char* data,
+        size_t size,
+        float excerpt_length,
+        float excerpt_start,
+        std::vector<float>& decoded_pcm)
+{
+    const std::unique_ptr<decoder_file> file = open_buffer(data, size);
+    int sample_rate;
+    return decode_excerpt(file.get(), "<memory buffer>", excerpt_length,
+            excerpt_start, false, decoded_pcm, sample_rate);
+}
+
+size_t
+decoder::decodeto_mono_float(
+        const std::string& filename,
+        float excerpt_length,
+        float excerpt_start,
+        std::vector<float>& decoded_pcm,
+        int& sample_rate)
+{
+    const std::unique_ptr<decoder_file> file = open_file(filename);
+    return decode_excerpt(file.get(), filename, excerpt_length, excerpt_start,
+            options.native_sample_rate != 0, decoded_pcm, sample_rate);
+}
+
+size_t
+decoder::decodeto_mono_float(
+        const unsigned char* data,
+        size_t size,
+        float excerpt_length,
+        float excerpt_start,
+        std::vector<float>& decoded_pcm,
+        int& sample_rate)
+{
+    const std::unique_ptr<decoder_file> file = open_buffer(data, size);
+    return decode_excerpt(file.get(), "<memory buffer>", excerpt_length,
+            excerpt_start, options.native_sample_rate != 0, decoded_pcm,
+            sample_rate);
+}
+
+std::unique_ptr<decoder_file>
+decoder::open_buffer(const unsigned char*, size_t)
+{
+    MINILOG(logERROR) << "This decoder cannot decode from memory.";
+    return nullptr;
+}
+
+size_t
+decoder::decode_excerpt(
+        decoder_file* file,
+        const std::string& name,
+        float excerpt_length,
+        float excerpt_start,
+        bool native,
+        std::vector<float>& decoded_pcm,
+        int& sample_rate)
+{
+    sample_rate = 0;
+    if (file)
+    {
+        musly_decoder_options file_options = options;
+        file_options.native_sample_rate = native;
+        file->set_options(file_options);
+    }
     if (!file || !file->open())
     {
-        MINILOG(logERROR) << "Could not open file for decoding: " << filename;
-        return std::vector<float>(0);
+        MINILOG(logERROR) << "Could not open file for decoding: " << name;
+        decoded_pcm.clear();
+        return 0;
     }
 
     adjustExcerptBounds(file->duration(), excerpt_start, excerpt_length);
@@ -66,13 +166,15 @@ decoder::decodeto_22050hz_mono_float(
 
     file->seek(excerpt_start);
 
-    const auto samples_needed = static_cast<size_t>(excerpt_length * 22050);
-    std::vector<float> decoded_pcm(samples_needed);
+    sample_rate = file->sample_rate();
+    const auto samples_needed = static_cast<size_t>(excerpt_length * sample_rate);
+    decoded_pcm.resize(samples_needed);
 
-    const auto samples_read = file->read(samples_needed, &decoded_pcm[0]);
-    MINILOG(logTRACE) << "decoder: " << filename << " decoding finalized.";
+    const auto samples_read = file->read(samples_needed, decoded_pcm.data());
+    MINILOG(logTRACE) << "decoder: " << name << " decoding finalized.";
 
-    return {decoded_pcm.begin(), decoded_pcm.begin() + samples_read};
+    decoded_pcm.resize(std::max<int64_t>(samples_read, 0));
+    return decoded_pcm.size();
 }
 
 
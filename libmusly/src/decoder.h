@@ -14,6 +14,7 @@
 #define MUSLY_DECODER_H_
 
 #include "plugins.h"
+#include "musly/musly_types.h"
 
 #include <minilog.h>
 #include <string>
@@ -35,11 +36,39 @@ public:
     virtual bool seek(float position) = 0;
     virtual int64_t read(size_t samples, float* buffer) = 0;
 
+    /** Return the sample rate of the samples read, known after open().
+     * Files decode at TARGET_SAMPLE_RATE unless they support the
+     * native_sample_rate option.
+     */
+    virtual int sample_rate() const { return TARGET_SAMPLE_RATE; }
+
+    /** Set the options to decode with, before calling open().
+     */
+    void set_options(const musly_decoder_options& options) { _options = options; }
+
 protected:
     const std::string _filename;
+    musly_decoder_options _options = {};
 
     static constexpr int TARGET_SAMPLE_RATE = 22050;
     static constexpr int TARGET_CHANNELS = 1;
+
+    /** The highest sample rate the methods analyze signals at, as
+     * spectrumbank::max_rate.
+     */
+    static constexpr int MAX_NATIVE_SAMPLE_RATE = 384000;
+
+    /** Return the sample rate to decode a file of \p rate Hz at: its own
+     * if the native_sample_rate option is set and the methods analyze
+     * signals at it, and TARGET_SAMPLE_RATE otherwise.
+     */
+    int
+    output_rate(int rate) const
+    {
+        const bool native = _options.native_sample_rate &&
+                rate >= TARGET_SAMPLE_RATE && rate <= MAX_NATIVE_SAMPLE_RATE;
+        return native ? rate : TARGET_SAMPLE_RATE;
+    }
 };
 
 class decoder :
@@ -49,14 +78,91 @@ public:
     decoder() = default;
     virtual ~decoder() = default;
 
+    /** Set the options for decoding the following files. Must not be
+     * called while files are being decoded.
+     */
+    void
+    set_options(
+            const musly_decoder_options& options);
+
+    const musly_decoder_options&
+    get_options() const;
+
     std::vector<float>
     decodeto_22050hz_mono_float(
             const std::string& filename,
             float excerpt_length,
             float excerpt_start);
 
+    /** Decode like above into \p pcm, which is resized to the number of
+     * samples decoded. Its memory is reused if large enough, so decoding
+     * many files into the same buffers does not allocate once they have
+     * grown to the longest excerpt.
+     * \returns the number of samples decoded, 0 if the file could not be
+     * decoded.
+     */
+    size_t
+    decodeto_22050hz_mono_float(
+            const std::string& filename,
+            float excerpt_length,
+            float excerpt_start,
+            std::vector<float>& pcm);
+
+    /** Decode like above from the encoded audio file held in memory at
+     * \p data, of \p size bytes, which must stay valid during the call.
+     * \returns the number of samples decoded, 0 if the data could not be
+     * decoded or the decoder does not support decoding from memory.
+     */
+    size_t
+    decodeto_22050hz_mono_float(
+            const unsigned char* data,
+            size_t size,
+            float excerpt_length,
+            float excerpt_start,
+            std::vector<float>& pcm);
+
+    /** Decode like above, but at the sample rate of the file if the
+     * native_sample_rate option is set, and at 22050 Hz otherwise.
+     * \param sample_rate The sample rate of the samples decoded.
+     */
+    size_t
+    decodeto_mono_float(
+            const std::string& filename,
+            float excerpt_length,
+            float excerpt_start,
+            std::vector<float>& pcm,
+            int& sample_rate);
+
+    size_t
+    decodeto_mono_float(
+            const unsigned char* data,
+            size_t size,
+            float excerpt_length,
+            float excerpt_start,
+            std::vector<float>& pcm,
+            int& sample_rate);
+
 protected:
     virtual std::unique_ptr<decoder_file> open_file(const std::string& filename) = 0;
+
+    /** Return a file reading the encoded audio file held in memory at
+     * \p data, of \p size bytes. The default implementation returns
+     * nullptr, for decoders that only read from files.
+     */
+    virtual std::unique_ptr<decoder_file> open_buffer(const unsigned char* data, size_t size);
+
+private:
+    musly_decoder_options options = {};
+
+    size_t
+    decode_excerpt(
+            decoder_file* file,
+            const std::string& name,
+            float excerpt_length,
+            float excerpt_start,
+            bool native,
+            std::vector<float>& pcm,
+            int& sample_rate);
 };
 
 /** A macro to facilitating registering a decoder class with musly. This macro
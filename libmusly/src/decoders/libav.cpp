@@ -43,8 +43,8 @@ libav_log_callback(void* ptr, int level, const char* fmt, va_list vargs)
     }
 }
 
-std::unique_ptr<decoder_file>
-libav::open_file(const std::string& filename)
+static void
+set_log_level()
 {
     // show libav messages only in verbose mode
     if (MiniLog::current_level() >= logTRACE)
@@ -56,9 +56,20 @@ libav::open_file(const std::string& filename)
     {
         av_log_set_level(AV_LOG_PANIC);
     }
+}
 
+std::unique_ptr<decoder_file>
+libav::open_file(const std::string& filename)
+{
+    set_log_level();
     return std::make_unique<libav_file>(filename);
+}
 
+std::unique_ptr<decoder_file>
+libav::open_buffer(const unsigned char* data, size_t size)
+{
+    set_log_level();
+    return std::make_unique<libav_file>(data, size);
 }
 } /* namespace musly::decoders */
 
@@ -34,6 +34,8 @@ public:
 private:
     std::unique_ptr<decoder_file> open_file(const std::string& filename) override;
 
+    std::unique_ptr<decoder_file> open_buffer(const unsigned char* data, size_t size) override;
+
 };
 
 } /* namespace decoders */
@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+
 #include "libav_file.h"
 #include "libav_functions.h"
 
@@ -14,6 +19,54 @@ libav_file::libav_file(const std::string& filename) : decoder_file(filename)
 {
 }
 
+libav_file::libav_file(const unsigned char* data, size_t size) :
+    decoder_file("<memory buffer>"), _data(data), _size(size)
+{
+}
+
+int
+libav_file::read_buffer(void* opaque, uint8_t* buf, int buf_size)
+{
+    libav_file* file = static_cast<libav_file*>(opaque);
+    const size_t count = std::min(file->_size - file->_position, (size_t)std::max(buf_size, 0));
+    if (count == 0)
+    {
+        return AVERROR_EOF;
+    }
+    std::memcpy(buf, file->_data + file->_position, count);
+    file->_position += count;
+    return (int)count;
+}
+
+int64_t
+libav_file::seek_buffer(void* opaque, int64_t offset, int whence)
+{
+    libav_file* file = static_cast<libav_file*>(opaque);
+    int64_t position;
+    switch (whence & ~AVSEEK_FORCE)
+    {
+    case AVSEEK_SIZE:
+        return (int64_t)file->_size;
+    case SEEK_SET:
+        position = offset;
+        break;
+    case SEEK_CUR:
+        position = (int64_t)file->_position + offset;
+        break;
+    case SEEK_END:
+        position = (int64_t)file->_size + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (position < 0 || position > (int64_t)file->_size)
+    {
+        return AVERROR(EINVAL);
+    }
+    file->_position = (size_t)position;
+    return position;
+}
+
 libav_file::~libav_file()
 {
     if (_swr)
@@ -33,12 +86,53 @@ libav_file::~libav_file()
     {
         avformat_close_input(&_format_context);
     }
+    if (_io)
+    {
+        // the buffer may have been replaced by libav, so free the current one
+        av_freep(&_io->buffer);
+        avio_context_free(&_io);
+    }
 }
 
 bool
 libav_file::open()
 {
-    if (avformat_open_input(&_format_context, _filename.c_str(), nullptr, nullptr) < 0)
+    _format_context = avformat_alloc_context();
+    if (!_format_context)
+    {
+        return false;
+    }
+    if (_options.probe_size > 0)
+    {
+        _format_context->probesize = _options.probe_size;
+    }
+    if (_options.analyze_duration > 0)
+    {
+        _format_context->max_analyze_duration = (int64_t)(_options.analyze_duration * AV_TIME_BASE);
+    }
+    if (_data)
+    {
+        // read from memory: libav reads through a small buffer of its own,
+        // calling back into read_buffer() and seek_buffer()
+        const int io_buffer_size = 32768;
+        unsigned char* io_buffer = (unsigned char*)av_malloc(io_buffer_size);
+        if (!io_buffer)
+        {
+            return false;
+        }
+        _io = avio_alloc_context(io_buffer, io_buffer_size, 0, this,
+                                 read_buffer, nullptr, seek_buffer);
+        if (!_io)
+        {
+            av_free(io_buffer);
+            return false;
+        }
+        _format_context->pb = _io;
+        _format_context->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+    // on failure, avformat_open_input() frees the format context but
+    // leaves a custom AVIOContext to us
+    if (avformat_open_input(&_format_context, _data ? nullptr : _filename.c_str(), nullptr, nullptr) < 0)
     {
         return false;
     }
@@ -69,6 +163,17 @@ libav_file::open()
     {
         return false;
     }
+    if (_options.codec_threads != 0)
+    {
+        // libav chooses the number of threads for a count of 0
+        _context->thread_count = std::max(_options.codec_threads, 0);
+    }
+    if (_options.codec_thread_type != 0)
+    {
+        _context->thread_type =
+                ((_options.codec_thread_type & MUSLY_DECODER_THREAD_FRAME) ? FF_THREAD_FRAME : 0) |
+                ((_options.codec_thread_type & MUSLY_DECODER_THREAD_SLICE) ? FF_THREAD_SLICE : 0);
+    }
     if (avcodec_open2(_context, decoder, nullptr) < 0)
     {
         return false;
@@ -82,13 +187,23 @@ libav_file::open()
     _frame = av_frame_alloc();
     _pkt = av_packet_alloc();
 
+    // at the native rate, libswresample only downmixes and converts
+    _out_rate = output_rate(_context->sample_rate);
     _swr = swr_alloc_set_opts(nullptr,
-                              AV_CH_LAYOUT_MONO, AV_SAMPLE_FMT_FLT, TARGET_SAMPLE_RATE,
+                              AV_CH_LAYOUT_MONO, AV_SAMPLE_FMT_FLT, _out_rate,
                               av_get_default_channel_layout(_context->channels), _context->sample_fmt,
                               _context->sample_rate,
                               0, nullptr);
 
-    if (!_swr || swr_init(_swr) < 0)
+    if (!_swr)
+    {
+        return false;
+    }
+    if (_options.resampler_filter_length > 0)
+    {
+        av_opt_set_int(_swr, "filter_size", _options.resampler_filter_length, 0);
+    }
+    if (swr_init(_swr) < 0)
     {
         return false;
     }
@@ -106,9 +221,37 @@ libav_file::seek(float seconds)
         return false;
     }
     avcodec_flush_buffers(_context);
+
+    _skipping = _options.skip_to_excerpt != 0;
+    if (_skipping)
+    {
+        // packets ending shortly before the excerpt are still decoded, as
+        // codecs like mp3 need the previous frames to decode a frame
+        const double preroll = 0.1;
+        _skip_until = (int64_t)(seconds * st->time_base.den / st->time_base.num);
+        _skip_packets_until = (int64_t)((seconds - preroll) * st->time_base.den / st->time_base.num);
+    }
     return true;
 }
 
+int64_t
+libav_file::samples_to_skip() const
+{
+    // the excerpt starts at _skip_until, in units of the stream time base
+    const AVStream* st = _format_context->streams[_stream_idx];
+    const int64_t start = _frame->best_effort_timestamp;
+    if (start == AV_NOPTS_VALUE || start >= _skip_until)
+    {
+        return 0;
+    }
+    const double skipped = (double)(_skip_until - start) * st->time_base.num / st->time_base.den;
+    if (skipped * _context->sample_rate >= _frame->nb_samples)
+    {
+        return -1;
+    }
+    return std::llround(skipped * _out_rate);
+}
+
 int64_t
 libav_file::read(size_t samples, float* buffer)
 {
@@ -118,7 +261,8 @@ libav_file::read(size_t samples, float* buffer)
     while (samples_read < samples)
     {
         if ((avret = av_read_frame(_format_context, _pkt)) < 0) break;
-        if (_pkt->stream_index != _stream_idx)
+        if (_pkt->stream_index != _stream_idx ||
+            (_skipping && _pkt->pts != AV_NOPTS_VALUE && _pkt->pts + _pkt->duration < _skip_packets_until))
         {
             av_packet_unref(_pkt);
             continue;
@@ -131,10 +275,38 @@ libav_file::read(size_t samples, float* buffer)
             if (avret == AVERROR(EAGAIN) || avret == AVERROR_EOF) break;
             if (avret < 0) return samples_read;
 
-            float* out[] = {buffer + samples_read};
+            int64_t skip = 0;
+            if (_skipping)
+            {
+                skip = samples_to_skip();
+                if (skip < 0)
+                {
+                    // the whole frame lies before the excerpt
+                    continue;
+                }
+                _skipping = false;
+            }
+
             int out_samples = std::min((int)(samples - samples_read), _frame->nb_samples);
-            int converted = swr_convert(_swr, (uint8_t**)out, out_samples, (const uint8_t**)_frame->data,
+            int converted;
+            if (skip == 0)
+            {
+                float* out[] = {buffer + samples_read};
+                converted = swr_convert(_swr, (uint8_t**)out, out_samples, (const uint8_t**)_frame->data,
                                         _frame->nb_samples);
+            }
+            else
+            {
+                // convert the frame the excerpt starts in aside, then keep
+                // the samples from the start of the excerpt on
+                _skipped.resize(skip + out_samples);
+                float* out[] = {_skipped.data()};
+                converted = swr_convert(_swr, (uint8_t**)out, (int)_skipped.size(),
+                                        (const uint8_t**)_frame->data, _frame->nb_samples);
+                converted = std::max(converted - (int)skip, 0);
+                std::copy(_skipped.begin() + skip, _skipped.begin() + skip + converted,
+                          buffer + samples_read);
+            }
 
             if (converted > 0)
             {
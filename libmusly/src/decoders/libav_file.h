@@ -3,8 +3,10 @@
 
 #include <decoder.h>
 #include <string>
+#include <vector>
 
 typedef struct AVFormatContext AVFormatContext;
+typedef struct AVIOContext AVIOContext;
 typedef struct AVCodecContext AVCodecContext;
 typedef struct AVFrame AVFrame;
 typedef struct AVPacket AVPacket;
@@ -17,6 +19,11 @@ class libav_file : public decoder_file
 public:
     libav_file(const std::string& filename);
 
+    /** Read the encoded file held in memory at \p data, of \p size bytes,
+     * through a custom AVIOContext instead of opening a file.
+     */
+    libav_file(const unsigned char* data, size_t size);
+
     ~libav_file();
 
     bool
@@ -31,7 +38,27 @@ public:
     int64_t
     read(size_t samples, float* buffer) override;
 
+    int
+    sample_rate() const override { return _out_rate; }
+
 private:
+    static int
+    read_buffer(void* opaque, uint8_t* buf, int buf_size);
+
+    static int64_t
+    seek_buffer(void* opaque, int64_t offset, int whence);
+
+    /** Return the number of samples at the output rate to drop from the
+     * start of the decoded frame to start at the excerpt, or -1 if the
+     * whole frame lies before the excerpt.
+     */
+    int64_t
+    samples_to_skip() const;
+
+    const unsigned char* _data = nullptr;
+    size_t _size = 0;
+    size_t _position = 0;
+    AVIOContext* _io = nullptr;
     AVCodecContext* _context = nullptr;
     AVFormatContext* _format_context = nullptr;
     AVPacket* _pkt = nullptr;
@@ -39,6 +66,16 @@ private:
     SwrContext* _swr = nullptr;
     int _stream_idx = -1;
     float _duration = 0;
+    int _out_rate = TARGET_SAMPLE_RATE;
+
+    /** Whether data before the excerpt is still to be skipped, and the
+     * times of the excerpt and of the first packet to decode in units of
+     * the stream time base.
+     */
+    bool _skipping = false;
+    int64_t _skip_until = 0;
+    int64_t _skip_packets_until = 0;
+    std::vector<float> _skipped;
 };
 } // musly::decoders
 
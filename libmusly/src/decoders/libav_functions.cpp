@@ -36,6 +36,13 @@ namespace decoders {
 int (*ptr_av_log_get_level)() = nullptr;
 void (*ptr_av_log_set_level)(int level) = nullptr;
 void (*ptr_av_log_set_callback)(void (*callback)(void*, int, const char*, va_list)) = nullptr;
+void *(*ptr_av_malloc)(size_t size) = nullptr;
+void (*ptr_av_free)(void *ptr) = nullptr;
+void (*ptr_av_freep)(void *ptr) = nullptr;
+int (*ptr_av_opt_set_int)(void *obj, const char *name, int64_t val, int search_flags) = nullptr;
+AVFormatContext *(*ptr_avformat_alloc_context)() = nullptr;
+AVIOContext *(*ptr_avio_alloc_context)(unsigned char *buffer, int buffer_size, int write_flag, void *opaque, int (*read_packet)(void *opaque, uint8_t *buf, int buf_size), int (*write_packet)(void *opaque, uint8_t *buf, int buf_size), int64_t (*seek)(void *opaque, int64_t offset, int whence)) = nullptr;
+void (*ptr_avio_context_free)(AVIOContext **s) = nullptr;
 int (*ptr_avformat_open_input)(AVFormatContext **ps, const char *url, const AVInputFormat *fmt, AVDictionary **options) = nullptr;
 int (*ptr_avformat_find_stream_info)(AVFormatContext *ic, AVDictionary **options) = nullptr;
 int (*ptr_av_find_best_stream)(AVFormatContext *ic, AVMediaType type, int wanted_stream_nb, int related_stream, const AVCodec **decoder_ret, int flags) = nullptr;
@@ -138,6 +145,10 @@ static bool load_libav() {
         BIND(handle_avutil, av_frame_unref);
         BIND(handle_avutil, av_frame_free);
         BIND(handle_avutil, av_get_default_channel_layout);
+        BIND(handle_avutil, av_malloc);
+        BIND(handle_avutil, av_free);
+        BIND(handle_avutil, av_freep);
+        BIND(handle_avutil, av_opt_set_int);
 
         BIND(handle_avcodec, avcodec_alloc_context3);
         BIND(handle_avcodec, avcodec_parameters_to_context);
@@ -158,6 +169,9 @@ static bool load_libav() {
         BIND(handle_avformat, av_seek_frame);
         BIND(handle_avformat, av_read_frame);
         BIND(handle_avformat, avformat_close_input);
+        BIND(handle_avformat, avformat_alloc_context);
+        BIND(handle_avformat, avio_alloc_context);
+        BIND(handle_avformat, avio_context_free);
 
         BIND(handle_swresample, swr_alloc_set_opts);
         BIND(handle_swresample, swr_init);
@@ -18,6 +18,7 @@ extern "C" {
     #include <libavutil/samplefmt.h>
     #include <libavutil/frame.h>
     #include <libavutil/log.h>
+    #include <libavutil/opt.h>
     #include <libswresample/swresample.h>
 }
 
@@ -29,6 +30,13 @@ bool libav_is_available();
 extern int (*ptr_av_log_get_level)(void);
 extern void (*ptr_av_log_set_level)(int level);
 extern void (*ptr_av_log_set_callback)(void (*callback)(void*, int, const char*, va_list));
+extern void *(*ptr_av_malloc)(size_t size);
+extern void (*ptr_av_free)(void *ptr);
+extern void (*ptr_av_freep)(void *ptr);
+extern int (*ptr_av_opt_set_int)(void *obj, const char *name, int64_t val, int search_flags);
+extern AVFormatContext *(*ptr_avformat_alloc_context)(void);
+extern AVIOContext *(*ptr_avio_alloc_context)(unsigned char *buffer, int buffer_size, int write_flag, void *opaque, int (*read_packet)(void *opaque, uint8_t *buf, int buf_size), int (*write_packet)(void *opaque, uint8_t *buf, int buf_size), int64_t (*seek)(void *opaque, int64_t offset, int whence));
+extern void (*ptr_avio_context_free)(AVIOContext **s);
 extern int (*ptr_avformat_open_input)(AVFormatContext **ps, const char *url, const AVInputFormat *fmt, AVDictionary **options);
 extern int (*ptr_avformat_find_stream_info)(AVFormatContext *ic, AVDictionary **options);
 extern int (*ptr_av_find_best_stream)(AVFormatContext *ic, enum AVMediaType type, int wanted_stream_nb, int related_stream, const AVCodec **decoder_ret, int flags);
@@ -62,6 +70,13 @@ extern int (*ptr_swr_convert)(struct SwrContext *s, uint8_t **out, int out_count
 #define av_log_get_level ptr_av_log_get_level
 #define av_log_set_level ptr_av_log_set_level
 #define av_log_set_callback ptr_av_log_set_callback
+#define av_malloc ptr_av_malloc
+#define av_free ptr_av_free
+#define av_freep ptr_av_freep
+#define av_opt_set_int ptr_av_opt_set_int
+#define avformat_alloc_context ptr_avformat_alloc_context
+#define avio_alloc_context ptr_avio_alloc_context
+#define avio_context_free ptr_avio_context_free
 #define avformat_open_input ptr_avformat_open_input
 #define avformat_find_stream_info ptr_avformat_find_stream_info
 #define av_find_best_stream ptr_av_find_best_stream
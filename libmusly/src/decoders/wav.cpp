@@ -0,0 +1,37 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "wav.h"
+#include "minilog.h"
+#include "wav_file.h"
+
+namespace musly::decoders {
+
+MUSLY_DECODER_REGIMPL(wav, -1);
+
+wav::wav()
+{
+    MINILOG(logTRACE) << "wav: Created WAV decoder.";
+}
+
+std::unique_ptr<decoder_file>
+wav::open_file(const std::string& filename)
+{
+    return std::make_unique<wav_file>(filename);
+}
+
+std::unique_ptr<decoder_file>
+wav::open_buffer(const unsigned char* data, size_t size)
+{
+    return std::make_unique<wav_file>(data, size);
+}
+
+} // namespace musly::decoders
@@ -0,0 +1,40 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_DECODERS_WAV_H_
+#define MUSLY_DECODERS_WAV_H_
+
+#include "decoder.h"
+
+namespace musly { namespace decoders {
+
+/** A decoder for WAV files of uncompressed PCM samples, with no dependencies.
+ * It maps the file into memory, reads the samples of the excerpt in place,
+ * and downmixes and resamples them itself, so it has none of the probing
+ * and per-packet overhead of a general decoder. Its priority is below the
+ * other decoders, so it is the default only if there is no other.
+ */
+class wav : public decoder
+{
+    MUSLY_DECODER_REGCLASS(wav);
+
+public:
+    wav();
+
+private:
+    std::unique_ptr<decoder_file> open_file(const std::string& filename) override;
+
+    std::unique_ptr<decoder_file> open_buffer(const unsigned char* data, size_t size) override;
+};
+
+}} // namespace musly::decoders
+
+#endif /* MUSLY_DECODERS_WAV_H_ */
@@ -0,0 +1,285 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "wav_file.h"
+
+#include "minilog.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace musly::decoders
+{
+namespace
+{
+const int WAVE_FORMAT_PCM = 0x0001;
+const int WAVE_FORMAT_IEEE_FLOAT = 0x0003;
+const int WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+uint32_t
+load_u16(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+uint32_t
+load_u32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/** Decode a little-endian sample to a float in [-1, 1].
+ */
+template<wav_file::sample_format F>
+inline float
+load_sample(const unsigned char* p)
+{
+    switch (F)
+    {
+    case wav_file::PCM_U8:
+        return (p[0] - 128) * (1.0f / 128);
+    case wav_file::PCM_S16:
+        return (int16_t)load_u16(p) * (1.0f / 32768);
+    case wav_file::PCM_S24:
+        return (int32_t)((p[0] << 8) | (p[1] << 16) | ((uint32_t)p[2] << 24)) * (1.0f / 2147483648.0f);
+    case wav_file::PCM_S32:
+        return (int32_t)load_u32(p) * (1.0f / 2147483648.0f);
+    case wav_file::FLOAT_32:
+    {
+        uint32_t bits = load_u32(p);
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    case wav_file::FLOAT_64:
+    {
+        uint64_t bits = load_u32(p) | ((uint64_t)load_u32(p + 4) << 32);
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return (float)value;
+    }
+    }
+    return 0;
+}
+
+/** Average the channels of \p count frames of \p channels samples of
+ * \p bytes bytes each, as stored in the file.
+ */
+template<wav_file::sample_format F>
+void
+downmix(const unsigned char* frames, int64_t count, int channels, int bytes, float* out)
+{
+    if (channels == 1)
+    {
+        for (int64_t i = 0; i < count; i++)
+        {
+            out[i] = load_sample<F>(frames + i * bytes);
+        }
+        return;
+    }
+    const float scale = 1.0f / channels;
+    const int frame_bytes = channels * bytes;
+    for (int64_t i = 0; i < count; i++)
+    {
+        const unsigned char* frame = frames + i * frame_bytes;
+        float sum = 0;
+        for (int c = 0; c < channels; c++)
+        {
+            sum += load_sample<F>(frame + c * bytes);
+        }
+        out[i] = sum * scale;
+    }
+}
+} // anonymous namespace
+
+wav_file::wav_file(const std::string& filename) : decoder_file(filename)
+{
+}
+
+wav_file::wav_file(const unsigned char* data, size_t size) :
+    decoder_file("<memory buffer>"), _data(data), _size(size)
+{
+}
+
+bool
+wav_file::open()
+{
+    if (!_data)
+    {
+        if (!_file.open(_filename))
+        {
+            return false;
+        }
+        _data = _file.data();
+        _size = _file.size();
+    }
+    if (!_data || !parse())
+    {
+        return false;
+    }
+
+    _duration = (float)_frames / _sample_rate;
+    _out_rate = output_rate(_sample_rate);
+    if (_sample_rate != _out_rate)
+    {
+        _resampler = std::make_unique<resampler>(_sample_rate, TARGET_SAMPLE_RATE,
+                                                 _options.resampler_filter_length);
+    }
+    MINILOG(logTRACE) << "wav: " << _filename << ": " << _channels << " channels, "
+            << _sample_rate << " Hz, " << _frames << " frames.";
+    return true;
+}
+
+bool
+wav_file::parse()
+{
+    if (_size < 12 || std::memcmp(_data, "RIFF", 4) != 0 || std::memcmp(_data + 8, "WAVE", 4) != 0)
+    {
+        MINILOG(logERROR) << "wav: Not a RIFF WAVE file: " << _filename;
+        return false;
+    }
+
+    int format_tag = 0;
+    int block_align = 0;
+    size_t data_size = 0;
+    size_t offset = 12;
+    while (offset + 8 <= _size && !_samples)
+    {
+        const unsigned char* chunk = _data + offset;
+        const size_t body = offset + 8;
+        size_t chunk_size = load_u32(chunk + 4);
+        if (std::memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16 && body + 16 <= _size)
+        {
+            format_tag = load_u16(_data + body);
+            _channels = load_u16(_data + body + 2);
+            _sample_rate = load_u32(_data + body + 4);
+            block_align = load_u16(_data + body + 12);
+            if (format_tag == WAVE_FORMAT_EXTENSIBLE && chunk_size >= 40 && body + 40 <= _size)
+            {
+                // the format tag is the start of the sub format GUID
+                format_tag = load_u16(_data + body + 24);
+            }
+        }
+        else if (std::memcmp(chunk, "data", 4) == 0 && format_tag != 0)
+        {
+            // the size may be a placeholder for files written as a stream
+            _samples = _data + body;
+            data_size = std::min(chunk_size, _size - body);
+        }
+        offset = body + chunk_size + (chunk_size & 1);
+    }
+
+    if (!_samples || _channels <= 0 || _sample_rate <= 0 || block_align <= 0 ||
+        block_align % _channels != 0)
+    {
+        MINILOG(logERROR) << "wav: Missing or invalid format or data: " << _filename;
+        return false;
+    }
+    _bytes_per_sample = block_align / _channels;
+    if (format_tag == WAVE_FORMAT_PCM && _bytes_per_sample <= 4)
+    {
+        // samples narrower than their container are left-aligned, so they
+        // are read as samples of the container width
+        const sample_format formats[] = {PCM_U8, PCM_S16, PCM_S24, PCM_S32};
+        _format = formats[_bytes_per_sample - 1];
+    }
+    else if (format_tag == WAVE_FORMAT_IEEE_FLOAT && _bytes_per_sample == 4)
+    {
+        _format = FLOAT_32;
+    }
+    else if (format_tag == WAVE_FORMAT_IEEE_FLOAT && _bytes_per_sample == 8)
+    {
+        _format = FLOAT_64;
+    }
+    else
+    {
+        MINILOG(logERROR) << "wav: Unsupported sample format " << format_tag << " with "
+                << _bytes_per_sample << " bytes per sample: " << _filename;
+        return false;
+    }
+    _frames = data_size / block_align;
+    return true;
+}
+
+bool
+wav_file::seek(float seconds)
+{
+    _start = std::min(std::max((int64_t)std::llround(seconds * _sample_rate), (int64_t)0), _frames);
+    _position = 0;
+    return true;
+}
+
+void
+wav_file::read_mono(int64_t begin, int64_t end, float* out) const
+{
+    // zeros before and after the file
+    const int64_t first = std::min(std::max(begin, (int64_t)0), end);
+    const int64_t last = std::max(std::min(end, _frames), first);
+    std::fill(out, out + (first - begin), 0.0f);
+    std::fill(out + (last - begin), out + (end - begin), 0.0f);
+
+    const unsigned char* frames = _samples + first * _channels * _bytes_per_sample;
+    float* dest = out + (first - begin);
+    const int64_t count = last - first;
+    switch (_format)
+    {
+    case PCM_U8:
+        downmix<PCM_U8>(frames, count, _channels, _bytes_per_sample, dest);
+        break;
+    case PCM_S16:
+        downmix<PCM_S16>(frames, count, _channels, _bytes_per_sample, dest);
+        break;
+    case PCM_S24:
+        downmix<PCM_S24>(frames, count, _channels, _bytes_per_sample, dest);
+        break;
+    case PCM_S32:
+        downmix<PCM_S32>(frames, count, _channels, _bytes_per_sample, dest);
+        break;
+    case FLOAT_32:
+        downmix<FLOAT_32>(frames, count, _channels, _bytes_per_sample, dest);
+        break;
+    case FLOAT_64:
+        downmix<FLOAT_64>(frames, count, _channels, _bytes_per_sample, dest);
+        break;
+    }
+}
+
+int64_t
+wav_file::read(size_t samples, float* buffer)
+{
+    const int64_t left = _frames - _start;
+    const int64_t available = _resampler ? _resampler->output_length(left) : left;
+    const int64_t count = std::max(std::min((int64_t)samples, available - _position), (int64_t)0);
+
+    if (!_resampler)
+    {
+        read_mono(_start + _position, _start + _position + count, buffer);
+        _position += count;
+        return count;
+    }
+
+    // resample block by block, converting the frames each block needs
+    const int block = 8192;
+    for (int64_t done = 0; done < count; done += block)
+    {
+        const int n = (int)std::min((int64_t)block, count - done);
+        int64_t begin;
+        int64_t end;
+        _resampler->input_range(_position, n, begin, end);
+        _mono.resize(end - begin);
+        read_mono(_start + begin, _start + end, _mono.data());
+        _resampler->process(_mono.data(), _position, n, buffer + done);
+        _position += n;
+    }
+    return count;
+}
+} // musly::decoders
@@ -0,0 +1,92 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_DECODERS_WAV_FILE_H
+#define MUSLY_DECODERS_WAV_FILE_H
+
+#include <decoder.h>
+#include <mappedfile.h>
+#include <resampler.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace musly::decoders
+{
+class wav_file : public decoder_file
+{
+public:
+    /** The encodings of the samples supported.
+     */
+    enum sample_format {
+        PCM_U8,
+        PCM_S16,
+        PCM_S24,
+        PCM_S32,
+        FLOAT_32,
+        FLOAT_64
+    };
+
+    wav_file(const std::string& filename);
+
+    /** Read the WAV file held in memory at \p data, of \p size bytes.
+     */
+    wav_file(const unsigned char* data, size_t size);
+
+    bool
+    open() override;
+
+    float
+    duration() const override { return _duration; }
+
+    bool
+    seek(float seconds) override;
+
+    int64_t
+    read(size_t samples, float* buffer) override;
+
+    int
+    sample_rate() const override { return _out_rate; }
+
+private:
+    /** Find the format and the samples in the RIFF chunks.
+     */
+    bool
+    parse();
+
+    /** Write the frames [begin, end) downmixed to mono to \p out, with
+     * zeros for frames outside of the file.
+     */
+    void
+    read_mono(int64_t begin, int64_t end, float* out) const;
+
+    mapped_file _file;
+    const unsigned char* _data = nullptr;
+    size_t _size = 0;
+
+    const unsigned char* _samples = nullptr;
+    int64_t _frames = 0;
+    int _channels = 0;
+    int _sample_rate = 0;
+    int _bytes_per_sample = 0;
+    sample_format _format = PCM_S16;
+    float _duration = 0;
+
+    int _out_rate = TARGET_SAMPLE_RATE;
+    std::unique_ptr<resampler> _resampler;
+    int64_t _start = 0;
+    int64_t _position = 0;
+    std::vector<float> _mono;
+};
+} // musly::decoders
+
+#endif //MUSLY_DECODERS_WAV_FILE_H
@@ -34,7 +34,7 @@ discretecosinetransform::discretecosinetransform(int in_bins, int out_bins) :
     MINILOG(logTRACE) << "DCT-II filterbank: " << m;
 }
 
-Eigen::MatrixXf discretecosinetransform::compress(const Eigen::MatrixXf& in)
+Eigen::MatrixXf discretecosinetransform::compress(const Eigen::MatrixXf& in) const
 {
     MINILOG(logTRACE) << "Computing DCT, input=" << in.rows()
             << "x" << in.cols();
@@ -46,5 +46,11 @@ Eigen::MatrixXf discretecosinetransform::compress(const Eigen::MatrixXf& in)
     return out;
 }
 
+void discretecosinetransform::compress_frame(const float* in, float* out) const
+{
+    Eigen::Map<Eigen::VectorXf>(out, m.rows()).noalias() =
+            m * Eigen::Map<const Eigen::VectorXf>(in, m.cols());
+}
+
 
 } /* namespace musly */
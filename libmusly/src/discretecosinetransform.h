@@ -35,7 +35,13 @@ public:
      * matrix has to have in_bins rows.
      * \returns The compressed matrix with out_bins rows.
      */
-    Eigen::MatrixXf compress(const Eigen::MatrixXf& in);
+    Eigen::MatrixXf compress(const Eigen::MatrixXf& in) const;
+
+    /** Compress a single vector using a DCT-II, without allocating.
+     * \param in The in_bins input values.
+     * \param out The out_bins output values.
+     */
+    void compress_frame(const float* in, float* out) const;
 };
 
 } /* namespace musly */
@@ -12,12 +12,136 @@
 #include <cmath>
 #include <limits>
 #include <algorithm>
+#include <vector>
 #include <Eigen/Core>
 #include <Eigen/QR>
 #include "minilog.h"
+#include "simd.h"
+#include "compactcovar.h"
 #include "gaussianstatistics.h"
 
 
+namespace {
+
+const int L = musly::gaussian_statistics::jsd_lanes;
+
+/** Merge the seed Gaussian with jsd_lanes others, writing the mean
+ * differences and the merged covariances to interleaved lanes (see
+ * cholesky_lanes()).
+ */
+MUSLY_TARGET_CLONES
+void
+merge_lanes(
+        int d,
+        const float* MUSLY_RESTRICT mu0,
+        const float* MUSLY_RESTRICT covar0,
+        const float* const* mu,
+        const float* const* covar,
+        float* MUSLY_RESTRICT mu_diff,
+        float* MUSLY_RESTRICT merged)
+{
+    for (int i = 0; i < d; i++) {
+        for (int l = 0; l < L; l++) {
+            mu_diff[i*L + l] = 0.5f*(mu0[i] - mu[l][i]);
+        }
+    }
+    int idx_covar = 0;
+    for (int i = 0; i < d; i++) {
+        for (int j = i; j < d; j++) {
+            const float c0 = covar0[idx_covar];
+            const float* MUSLY_RESTRICT mu_i = &mu_diff[i*L];
+            const float* MUSLY_RESTRICT mu_j = &mu_diff[j*L];
+            float* MUSLY_RESTRICT c = &merged[idx_covar*L];
+            for (int l = 0; l < L; l++) {
+                c[l] = 0.5f*(c0 + covar[l][idx_covar]) + mu_i[l]*mu_j[l];
+            }
+            idx_covar++;
+        }
+    }
+}
+
+/** Cholesky-factor jsd_lanes symmetric matrices at once and return half the
+ * log-determinant of each. The packed upper triangles are stored
+ * interleaved: element \p e of lane \p l is at <tt>covar[e*L + l]</tt>.
+ * The factorization is done in its square-root free form, keeping the
+ * rows of R scaled by their diagonal element, so the loops over the lanes
+ * consist of multiplications, subtractions and a single division per pivot
+ * only and vectorize completely.
+ */
+MUSLY_TARGET_CLONES
+void
+cholesky_lanes(
+        int d,
+        float* MUSLY_RESTRICT covar,
+        float* MUSLY_RESTRICT scale,
+        float* MUSLY_RESTRICT inv_pivot,
+        float* MUSLY_RESTRICT halflogdet,
+        int* MUSLY_RESTRICT failed)
+{
+    double det[L];
+    for (int l = 0; l < L; l++) {
+        det[l] = 1.0;
+        failed[l] = 0;
+    }
+
+    int idx_ii = 0;
+    for (int i = 0; i < d; i++) {
+        // scale[k] = R(k,i) / R(k,k) for all previous rows k
+        int idx_ki = i;
+        for (int k = 0; k < i; k++) {
+            const float* MUSLY_RESTRICT s_ki = &covar[idx_ki*L];
+            const float* MUSLY_RESTRICT p_k = &inv_pivot[k*L];
+            float* MUSLY_RESTRICT u_k = &scale[k*L];
+            for (int l = 0; l < L; l++) {
+                u_k[l] = s_ki[l] * p_k[l];
+            }
+            idx_ki += d - k - 1;
+        }
+
+        // row i, scaled by R(i,i)
+        for (int j = i; j < d; j++) {
+            float* MUSLY_RESTRICT s_ij = &covar[(idx_ii + j - i)*L];
+            float acc[L];
+            for (int l = 0; l < L; l++) {
+                acc[l] = s_ij[l];
+            }
+            int idx_kj = j;
+            for (int k = 0; k < i; k++) {
+                const float* MUSLY_RESTRICT s_kj = &covar[idx_kj*L];
+                const float* MUSLY_RESTRICT u_k = &scale[k*L];
+                for (int l = 0; l < L; l++) {
+                    acc[l] -= u_k[l] * s_kj[l];
+                }
+                idx_kj += d - k - 1;
+            }
+            for (int l = 0; l < L; l++) {
+                s_ij[l] = acc[l];
+            }
+        }
+
+        // the pivot is R(i,i)^2; a non-positive one means the merged
+        // covariance is not positive definite
+        float* MUSLY_RESTRICT p_ii = &covar[idx_ii*L];
+        float* MUSLY_RESTRICT p_i = &inv_pivot[i*L];
+        for (int l = 0; l < L; l++) {
+            int nonpositive = p_ii[l] <= 0;
+            failed[l] |= nonpositive;
+            float p = nonpositive ? 1.0f : p_ii[l];
+            p_i[l] = 1.0f / p;
+            det[l] *= p;
+        }
+
+        idx_ii += d - i;
+    }
+
+    for (int l = 0; l < L; l++) {
+        halflogdet[l] = static_cast<float>(0.5 * std::log(det[l]));
+    }
+}
+
+} /* namespace */
+
+
 namespace musly {
 
 gaussian_statistics::gaussian_statistics(
@@ -43,7 +167,7 @@ gaussian_statistics::get_dim()
 bool
 gaussian_statistics::estimate_gaussian(
         const Eigen::MatrixXf& m,
-        gaussian& g)
+        gaussian& g) const
 {
     MINILOG(logTRACE) << "Estimating Gaussian from matrix: " << m.rows()
             << "x" << m.cols();
@@ -63,16 +187,33 @@ gaussian_statistics::estimate_gaussian(
 
     // always compute sample mean
     Eigen::VectorXf mu = m.rowwise().mean();
+
+    // always compute sample covariance
+    Eigen::MatrixXf covar  = (m.colwise()-mu) * (m.colwise()-mu).transpose()
+            / (static_cast<float>(m.cols()) - 1.0f);
+
+    return estimate_gaussian(mu, covar, g);
+}
+
+bool
+gaussian_statistics::estimate_gaussian(
+        const Eigen::VectorXf& mu,
+        Eigen::MatrixXf covar,
+        gaussian& g) const
+{
+    if ((mu.size() != d) || (covar.rows() != d) || (covar.cols() != d)) {
+        MINILOG(logTRACE) << "could not estimate Gaussian. "
+                << "Wrong dimension (d=" << d << " vs. mu.size="
+                << mu.size() << ")";
+        return false;
+    }
+
     if (g.mu) {
         for (int i = 0; i < d; i++) {
             g.mu[i] = mu(i);
         }
     }
 
-    // always compute sample covariance
-    Eigen::MatrixXf covar  = (m.colwise()-mu) * (m.colwise()-mu).transpose()
-            / (static_cast<float>(m.cols()) - 1.0f);
-
     // Add Gaussian noise to the data to avoid singular covariance matrices
     // in case the input data was silence.
     covar.diagonal().array() += 1e-4;
@@ -183,6 +324,118 @@ gaussian_statistics::jensenshannon(
     return std::sqrt(std::max(0.0f, jsd));
 }
 
+void
+gaussian_statistics::jensenshannon_batch(
+        const gaussian& g0,
+        const gaussian* g1,
+        int length,
+        float* jsd,
+        covar_encoding encoding)
+{
+    // workspace of the interleaved lanes
+    std::vector<float> mu_diff(d*L);
+    std::vector<float> covar(covar_elems*L);
+    std::vector<float> scale(d*L);
+    std::vector<float> inv_pivot(d*L);
+    float halflogdet[L];
+    int failed[L];
+
+    // encoded covariances are decoded a block at a time, which stays in the
+    // L1 cache, and the seed once
+    std::vector<float> decoded;
+    const float* covar0 = g0.covar;
+    if (encoding != covar_float32) {
+        decoded.resize(covar_elems*(L + 1));
+        decode_covar(encoding, g0.covar, covar_elems, &decoded[covar_elems*L]);
+        covar0 = &decoded[covar_elems*L];
+    }
+
+    for (int block = 0; block < length; block += L) {
+        const int lanes = std::min(L, length - block);
+        const gaussian* gb = &g1[block];
+
+        // gather the candidates into the lanes, padding a partial block
+        // with copies of its last candidate
+        const float* mu[L];
+        const float* c[L];
+        for (int l = 0; l < L; l++) {
+            mu[l] = gb[std::min(l, lanes-1)].mu;
+            c[l] = gb[std::min(l, lanes-1)].covar;
+        }
+        if (encoding != covar_float32) {
+            for (int l = 0; l < lanes; l++) {
+                decode_covar(encoding, c[l], covar_elems,
+                        &decoded[covar_elems*l]);
+            }
+            for (int l = 0; l < L; l++) {
+                c[l] = &decoded[covar_elems*std::min(l, lanes-1)];
+            }
+        }
+        merge_lanes(d, g0.mu, covar0, mu, c, mu_diff.data(), covar.data());
+
+        cholesky_lanes(d, covar.data(), scale.data(), inv_pivot.data(),
+                halflogdet, failed);
+
+        for (int l = 0; l < lanes; l++) {
+            const gaussian& gl = gb[l];
+            if ((g0.covar == gl.covar) && (g0.mu == gl.mu)) {
+                jsd[block + l] = 0;
+                continue;
+            }
+            if (failed[l]) {
+                jsd[block + l] = -1;
+                continue;
+            }
+            float v = -0.25f * (*(g0.covar_logdet) + *(gl.covar_logdet))
+                    + halflogdet[l];
+            if (std::isnan(v) || std::isinf(v)) {
+                jsd[block + l] = std::numeric_limits<float>::max();
+            } else {
+                jsd[block + l] = std::sqrt(std::max(0.0f, v));
+            }
+        }
+    }
+}
+
+float
+gaussian_statistics::logdet_error(
+        const gaussian& g,
+        covar_encoding encoding)
+{
+    // Cholesky decomposition of the packed upper triangle, as in
+    // jensenshannon(), but in double precision
+    std::vector<float> decoded(covar_elems);
+    decode_covar(encoding, g.covar, covar_elems, decoded.data());
+    std::vector<double> c(decoded.begin(), decoded.end());
+    double logdet = 0;
+    int idx_ii = 0;
+    for (int i = 0; i < d; i++) {
+        int idx_k = i;
+        for (int k = 0; k < i; k++) {
+            c[idx_ii] -= c[idx_k]*c[idx_k];
+            idx_k += d - k - 1;
+        }
+        if (c[idx_ii] <= 0) {
+            return std::numeric_limits<float>::max();
+        }
+        c[idx_ii] = std::sqrt(c[idx_ii]);
+        logdet += 2*std::log(c[idx_ii]);
+
+        int idx_ij = idx_ii;
+        for (int j = i+1; j < d; j++) {
+            idx_ij++;
+            int idx_k = 0;
+            for (int k = 0; k < i; k++) {
+                c[idx_ij] -= c[idx_k+i] * c[idx_k+j];
+                idx_k += d - k - 1;
+            }
+            c[idx_ij] /= c[idx_ii];
+        }
+        idx_ii += d - i;
+    }
+    return std::fabs(logdet - *(g.covar_logdet));
+}
+
 float
 gaussian_statistics::symmetric_kullbackleibler(
         const gaussian& g0,
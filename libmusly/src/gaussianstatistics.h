@@ -14,6 +14,7 @@
 
 #include <Eigen/Core>
 #include "gaussian.h"
+#include "compactcovar.h"
 
 
 namespace musly {
@@ -41,7 +42,18 @@ public:
     bool
     estimate_gaussian(
             const Eigen::MatrixXf& m,
-            gaussian& g);
+            gaussian& g) const;
+
+    /** Fill the Gaussian \p g from the sample mean \p mu and the sample
+     * covariance \p covar of some data, for data that was never held in a
+     * matrix at once. Regularizes the covariance like estimate_gaussian().
+     * \returns false if the dimensions do not match.
+     */
+    bool
+    estimate_gaussian(
+            const Eigen::VectorXf& mu,
+            Eigen::MatrixXf covar,
+            gaussian& g) const;
 
     float
     jensenshannon(
@@ -49,6 +61,46 @@ public:
             const gaussian &g1,
             gaussian &tmp);
 
+    /** The number of candidate Gaussians jensenshannon_batch() factors
+     * together. The merged covariances of a block of candidates are stored
+     * interleaved, so each step of the Cholesky decomposition is one
+     * (AVX-512) or a few (AVX2, SSE) vector instructions.
+     */
+    static const int jsd_lanes = 16;
+
+    /** Compute the Jensen-Shannon divergence between the seed \p g0 and
+     * \p length other Gaussians. The result for each pair is the same as the
+     * one of jensenshannon(), which serves as the scalar reference, up to
+     * floating point rounding.
+     * \param g0 The seed Gaussian.
+     * \param g1 An array of \p length Gaussians to compare to.
+     * \param length The number of Gaussians in \p g1.
+     * \param jsd The output array of \p length divergences.
+     * \param encoding How the covariances of \p g0 and \p g1 are stored.
+     * If they are encoded, the covar of each Gaussian points to the bytes
+     * of encode_covar() instead, which are decoded on the fly.
+     */
+    void
+    jensenshannon_batch(
+            const gaussian& g0,
+            const gaussian* g1,
+            int length,
+            float* jsd,
+            covar_encoding encoding = covar_float32);
+
+    /** Return how far the stored log-determinant of \p g is off from the
+     * one of its covariance, computed in double precision. Both agree
+     * closely for well-conditioned covariances. For nearly singular ones,
+     * as estimated from silence or pure tones, they do not, and the
+     * Jensen-Shannon divergences involving \p g are dominated by rounding
+     * errors. Returns the largest float if the covariance is not positive
+     * definite. The covariance of \p g is stored with \p encoding.
+     */
+    float
+    logdet_error(
+            const gaussian& g,
+            covar_encoding encoding = covar_float32);
+
     float
     symmetric_kullbackleibler(
             const gaussian& g0,
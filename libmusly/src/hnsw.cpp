@@ -0,0 +1,679 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *                2014, Jan Schlueter <jan.schlueter@ofai.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <unordered_set>
+
+#include "hnsw.h"
+
+namespace musly {
+
+hnsw::hnsw(
+        track_metric* metric) :
+        metric(metric),
+        m(16),
+        ef_construction(64),
+        ef_search(64),
+        rng(42),
+        entry(-1),
+        num_nodes(0)
+{
+}
+
+int
+hnsw::get_size() const
+{
+    return num_nodes;
+}
+
+int
+hnsw::get_m() const
+{
+    return m;
+}
+
+int
+hnsw::get_ef_construction() const
+{
+    return ef_construction;
+}
+
+int
+hnsw::get_ef_search() const
+{
+    return ef_search;
+}
+
+int
+hnsw::set_m(
+        int m)
+{
+    if ((m < 0) || (m == 1) || (num_nodes > 0)) {
+        return -1;
+    }
+    this->m = m;
+    return 0;
+}
+
+int
+hnsw::set_ef_construction(
+        int ef)
+{
+    if (ef < 1) {
+        return -1;
+    }
+    ef_construction = ef;
+    return 0;
+}
+
+int
+hnsw::set_ef_search(
+        int ef)
+{
+    if (ef < 1) {
+        return -1;
+    }
+    ef_search = ef;
+    return 0;
+}
+
+bool
+hnsw::contains(
+        musly_trackid id) const
+{
+    return node_of.find(id) != node_of.end();
+}
+
+int
+hnsw::max_links(
+        int level) const
+{
+    return (level == 0) ? 2*m : m;
+}
+
+int
+hnsw::random_level()
+{
+    // exponentially decaying level distribution with a normalization
+    // factor of 1/ln(m), as suggested by the authors
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    double r = std::max(uniform(rng), DBL_MIN);
+    return std::min(static_cast<int>(-std::log(r) / std::log((double)m)), 16);
+}
+
+void
+hnsw::node_distances(
+        musly_trackid from,
+        const std::vector<int>& to,
+        std::vector<float>& distances)
+{
+    std::vector<musly_trackid> ids(to.size());
+    for (int i = 0; i < (int)to.size(); i++) {
+        ids[i] = nodes[to[i]].id;
+    }
+    distances.resize(to.size());
+    if (!to.empty()) {
+        metric->distances(from, ids.data(), ids.size(), distances.data());
+    }
+}
+
+int
+hnsw::greedy_closest(
+        musly_trackid query,
+        int entry_node,
+        float entry_dist,
+        int level,
+        float* dist)
+{
+    // move to the closest neighbor until there is no closer one
+    int current = entry_node;
+    *dist = entry_dist;
+    std::vector<float> d;
+    for (bool changed = true; changed; ) {
+        changed = false;
+        const std::vector<int>& links = nodes[current].links[level];
+        node_distances(query, links, d);
+        for (int i = 0; i < (int)links.size(); i++) {
+            if (d[i] < *dist) {
+                *dist = d[i];
+                current = links[i];
+                changed = true;
+            }
+        }
+    }
+    return current;
+}
+
+void
+hnsw::search_layer(
+        musly_trackid query,
+        const std::vector<candidate>& entry_points,
+        int ef,
+        int level,
+        std::vector<candidate>& result)
+{
+    std::unordered_set<int> visited;
+    // candidates to expand, closest first
+    std::priority_queue<candidate, std::vector<candidate>,
+            std::greater<candidate> > expand;
+    // best results found so far, furthest first
+    std::priority_queue<candidate> best;
+    for (int i = 0; i < (int)entry_points.size(); i++) {
+        visited.insert(entry_points[i].second);
+        expand.push(entry_points[i]);
+        best.push(entry_points[i]);
+        if ((int)best.size() > ef) {
+            best.pop();
+        }
+    }
+
+    std::vector<int> unvisited;
+    std::vector<float> d;
+    while (!expand.empty()) {
+        candidate c = expand.top();
+        if (((int)best.size() >= ef) && (c.first > best.top().first)) {
+            break;  // all remaining candidates are further than our results
+        }
+        expand.pop();
+
+        // compute distances to all unvisited neighbors at once
+        const std::vector<int>& links = nodes[c.second].links[level];
+        unvisited.clear();
+        for (int i = 0; i < (int)links.size(); i++) {
+            if (visited.insert(links[i]).second) {
+                unvisited.push_back(links[i]);
+            }
+        }
+        node_distances(query, unvisited, d);
+        for (int i = 0; i < (int)unvisited.size(); i++) {
+            if (((int)best.size() < ef) || (d[i] < best.top().first)) {
+                expand.push(candidate(d[i], unvisited[i]));
+                best.push(candidate(d[i], unvisited[i]));
+                if ((int)best.size() > ef) {
+                    best.pop();
+                }
+            }
+        }
+    }
+
+    result.resize(best.size());
+    for (int i = result.size() - 1; i >= 0; i--) {
+        result[i] = best.top();
+        best.pop();
+    }
+}
+
+void
+hnsw::select_neighbors(
+        std::vector<candidate>& candidates,
+        int max_count,
+        std::vector<int>& selected)
+{
+    // Keep the closest candidates that are closer to the node linked from
+    // (the distances the candidates hold) than to any candidate kept before.
+    // This spreads links over different directions, which keeps the graph
+    // navigable for clustered data.
+    std::sort(candidates.begin(), candidates.end());
+    selected.clear();
+    std::vector<int> pruned;
+    std::vector<float> d;
+    for (int i = 0; i < (int)candidates.size(); i++) {
+        if ((int)selected.size() >= max_count) {
+            break;
+        }
+        if (candidates[i].first == FLT_MAX) {
+            break;
+        }
+        node_distances(nodes[candidates[i].second].id, selected, d);
+        bool keep = true;
+        for (int j = 0; j < (int)selected.size(); j++) {
+            if (d[j] < candidates[i].first) {
+                keep = false;
+                break;
+            }
+        }
+        if (keep) {
+            selected.push_back(candidates[i].second);
+        } else {
+            pruned.push_back(candidates[i].second);
+        }
+    }
+    // Fill the remaining links with the closest pruned candidates. The
+    // Jensen-Shannon space has strong hubs that would otherwise cut off
+    // many tracks from the graph (keepPrunedConnections in the paper).
+    for (int i = 0; (i < (int)pruned.size()) &&
+            ((int)selected.size() < max_count); i++) {
+        selected.push_back(pruned[i]);
+    }
+}
+
+void
+hnsw::add_link(
+        int from,
+        int to,
+        int level)
+{
+    nodes[from].links[level].push_back(to);
+    if (level == 0) {
+        nodes[to].in_degree++;
+    }
+    if ((int)nodes[from].links[level].size() > max_links(level)) {
+        shrink_links(from, level);
+    }
+}
+
+void
+hnsw::set_links(
+        int n,
+        int level,
+        std::vector<int>& links)
+{
+    if (level == 0) {
+        const std::vector<int>& old = nodes[n].links[0];
+        for (int i = 0; i < (int)old.size(); i++) {
+            nodes[old[i]].in_degree--;
+        }
+        for (int i = 0; i < (int)links.size(); i++) {
+            nodes[links[i]].in_degree++;
+        }
+    }
+    nodes[n].links[level].swap(links);
+}
+
+void
+hnsw::shrink_links(
+        int n,
+        int level)
+{
+    std::vector<int>& links = nodes[n].links[level];
+    std::vector<float> d;
+    node_distances(nodes[n].id, links, d);
+    std::vector<candidate> candidates(links.size());
+    for (int i = 0; i < (int)links.size(); i++) {
+        candidates[i] = candidate(d[i], links[i]);
+    }
+    // Keep the closest links. Running the selection heuristic again costs
+    // a quadratic number of distances per overflow, but did not improve
+    // the recall on timbre features.
+    std::sort(candidates.begin(), candidates.end());
+    std::vector<int> selected(max_links(level));
+    for (int i = 0; i < (int)selected.size(); i++) {
+        selected[i] = candidates[i].second;
+    }
+
+    // Never drop the last link to a track on the bottom level, it could
+    // not be found any more. Give up the farthest link to a track that is
+    // also linked from elsewhere instead.
+    if (level == 0) {
+        int replace = selected.size() - 1;
+        for (int i = 0; i < (int)links.size(); i++) {
+            int t = links[i];
+            if ((nodes[t].in_degree > 1) || (std::find(selected.begin(),
+                    selected.end(), t) != selected.end())) {
+                continue;
+            }
+            while ((replace >= 0) && (nodes[selected[replace]].in_degree < 2)) {
+                replace--;
+            }
+            if (replace < 0) {
+                break;
+            }
+            selected[replace--] = t;
+        }
+    }
+    set_links(n, level, selected);
+}
+
+void
+hnsw::insert(
+        musly_trackid id)
+{
+    if ((m == 0) || contains(id)) {
+        return;
+    }
+
+    // create the node
+    int level = random_level();
+    int idx;
+    if (free_nodes.empty()) {
+        idx = nodes.size();
+        nodes.push_back(node());
+    } else {
+        idx = free_nodes.back();
+        free_nodes.pop_back();
+    }
+    nodes[idx].id = id;
+    nodes[idx].links.assign(level + 1, std::vector<int>());
+    nodes[idx].in_degree = 0;
+    node_of[id] = idx;
+    num_nodes++;
+    if (entry < 0) {
+        entry = idx;
+        return;
+    }
+
+    // descend to the node's top level
+    int top = nodes[entry].links.size() - 1;
+    std::vector<float> d;
+    node_distances(id, std::vector<int>(1, entry), d);
+    float dist;
+    int closest = entry;
+    dist = d[0];
+    for (int l = top; l > level; l--) {
+        closest = greedy_closest(id, closest, dist, l, &dist);
+    }
+
+    // link the node on each of its levels
+    std::vector<candidate> entry_points(1, candidate(dist, closest));
+    std::vector<candidate> found;
+    std::vector<int> selected;
+    for (int l = std::min(top, level); l >= 0; l--) {
+        search_layer(id, entry_points, ef_construction, l, found);
+        entry_points = found;
+        select_neighbors(found, m, selected);
+        for (int i = 0; i < (int)selected.size(); i++) {
+            add_link(selected[i], idx, l);
+        }
+        set_links(idx, l, selected);
+    }
+    if (level > top) {
+        entry = idx;
+    }
+}
+
+void
+hnsw::remove(
+        const musly_trackid* ids,
+        int length)
+{
+    // mark the nodes to remove
+    std::vector<char> removed(nodes.size(), 0);
+    int num_removed = 0;
+    for (int i = 0; i < length; i++) {
+        std::unordered_map<musly_trackid, int>::iterator it =
+                node_of.find(ids[i]);
+        if (it != node_of.end()) {
+            removed[it->second] = 1;
+            node_of.erase(it);
+            num_removed++;
+        }
+    }
+    if (!num_removed) {
+        return;
+    }
+    for (int n = 0; n < (int)nodes.size(); n++) {
+        if (removed[n]) {
+            const std::vector<int>& links = nodes[n].links[0];
+            for (int i = 0; i < (int)links.size(); i++) {
+                nodes[links[i]].in_degree--;
+            }
+        }
+    }
+
+    // Links are not necessarily mutual, so we have to check all nodes for
+    // links to removed nodes. Nodes that lost links are reconnected to the
+    // best of their remaining links and the links of the removed nodes.
+    std::vector<int> pool;
+    std::vector<float> d;
+    std::vector<candidate> candidates;
+    std::vector<int> selected;
+    for (int n = 0; n < (int)nodes.size(); n++) {
+        if (removed[n] || nodes[n].links.empty()) {
+            continue;
+        }
+        for (int l = 0; l < (int)nodes[n].links.size(); l++) {
+            const std::vector<int>& links = nodes[n].links[l];
+            bool affected = false;
+            for (int i = 0; i < (int)links.size(); i++) {
+                if (removed[links[i]]) {
+                    affected = true;
+                    break;
+                }
+            }
+            if (!affected) {
+                continue;
+            }
+            pool.clear();
+            for (int i = 0; i < (int)links.size(); i++) {
+                if (!removed[links[i]]) {
+                    pool.push_back(links[i]);
+                    continue;
+                }
+                const std::vector<int>& second = nodes[links[i]].links[l];
+                for (int j = 0; j < (int)second.size(); j++) {
+                    if (!removed[second[j]] && (second[j] != n)) {
+                        pool.push_back(second[j]);
+                    }
+                }
+            }
+            std::sort(pool.begin(), pool.end());
+            pool.erase(std::unique(pool.begin(), pool.end()), pool.end());
+            node_distances(nodes[n].id, pool, d);
+            candidates.resize(pool.size());
+            for (int i = 0; i < (int)pool.size(); i++) {
+                candidates[i] = candidate(d[i], pool[i]);
+            }
+            select_neighbors(candidates, max_links(l), selected);
+            set_links(n, l, selected);
+        }
+    }
+
+    // reconnect tracks that were only linked from removed tracks on the
+    // bottom level to their closest neighbor
+    for (int n = 0; n < (int)nodes.size(); n++) {
+        if (removed[n] || nodes[n].links.empty() ||
+                (nodes[n].in_degree > 0) || nodes[n].links[0].empty()) {
+            continue;
+        }
+        const std::vector<int>& links = nodes[n].links[0];
+        node_distances(nodes[n].id, links, d);
+        int closest = std::min_element(d.begin(), d.end()) - d.begin();
+        add_link(links[closest], n, 0);
+    }
+
+    // free the removed nodes
+    for (int n = 0; n < (int)removed.size(); n++) {
+        if (removed[n]) {
+            nodes[n].links.clear();
+            free_nodes.push_back(n);
+            num_nodes--;
+        }
+    }
+
+    // find a new entry point on the highest level if needed
+    if (removed[entry]) {
+        entry = -1;
+        for (int n = 0; n < (int)nodes.size(); n++) {
+            if (!nodes[n].links.empty() && ((entry < 0) ||
+                    (nodes[n].links.size() > nodes[entry].links.size()))) {
+                entry = n;
+            }
+        }
+    }
+}
+
+int
+hnsw::search(
+        musly_trackid query,
+        int k,
+        musly_trackid* neighbors)
+{
+    if ((entry < 0) || (k <= 0)) {
+        return 0;
+    }
+
+    // descend greedily to the bottom level
+    std::vector<float> d;
+    node_distances(query, std::vector<int>(1, entry), d);
+    float dist = d[0];
+    int closest = entry;
+    for (int l = nodes[entry].links.size() - 1; l > 0; l--) {
+        closest = greedy_closest(query, closest, dist, l, &dist);
+    }
+
+    // explore the bottom level, leaving room for the query itself
+    std::vector<candidate> found;
+    search_layer(query, std::vector<candidate>(1, candidate(dist, closest)),
+            std::max(ef_search, k + 1), 0, found);
+    int count = 0;
+    for (int i = 0; (i < (int)found.size()) && (count < k); i++) {
+        const node& n = nodes[found[i].second];
+        if ((n.id != query) && (found[i].first != FLT_MAX)) {
+            neighbors[count++] = n.id;
+        }
+    }
+    return count;
+}
+
+int
+hnsw::serialize(
+        unsigned char* buffer) const
+{
+    // number the nodes in use consecutively
+    std::vector<int> number(nodes.size(), -1);
+    int count = 0;
+    for (int n = 0; n < (int)nodes.size(); n++) {
+        if (!nodes[n].links.empty()) {
+            number[n] = count++;
+        }
+    }
+
+    // parameters, number of nodes, entry point
+    int size = 5 * sizeof(int);
+    if (buffer) {
+        int* header = (int*)buffer;
+        header[0] = m;
+        header[1] = ef_construction;
+        header[2] = ef_search;
+        header[3] = count;
+        header[4] = (entry < 0) ? -1 : number[entry];
+    }
+
+    // for each node: its track id, number of levels, and links per level
+    for (int n = 0; n < (int)nodes.size(); n++) {
+        if (nodes[n].links.empty()) {
+            continue;
+        }
+        if (buffer) {
+            *(musly_trackid*)(buffer + size) = nodes[n].id;
+            *(int*)(buffer + size + sizeof(musly_trackid)) =
+                    nodes[n].links.size();
+        }
+        size += sizeof(musly_trackid) + sizeof(int);
+        for (int l = 0; l < (int)nodes[n].links.size(); l++) {
+            const std::vector<int>& links = nodes[n].links[l];
+            if (buffer) {
+                int* out = (int*)(buffer + size);
+                out[0] = links.size();
+                for (int i = 0; i < (int)links.size(); i++) {
+                    out[1 + i] = number[links[i]];
+                }
+            }
+            size += (1 + links.size()) * sizeof(int);
+        }
+    }
+    return size;
+}
+
+int
+hnsw::deserialize(
+        const unsigned char* buffer,
+        int size)
+{
+    int header[5];
+    if (size < (int)sizeof(header)) {
+        return -1;
+    }
+    std::memcpy(header, buffer, sizeof(header));
+    // every node takes up at least its id, levels and count of links
+    const int min_node = sizeof(musly_trackid) + 2 * sizeof(int);
+    if ((header[0] < 0) || (header[0] == 1) || (header[1] < 1) ||
+            (header[2] < 1) || (header[3] < 0) ||
+            (header[4] < ((header[3] > 0) ? 0 : -1)) ||
+            (header[4] >= header[3]) ||
+            (header[3] > (size - (int)sizeof(header)) / min_node)) {
+        return -1;
+    }
+    m = header[0];
+    ef_construction = header[1];
+    ef_search = header[2];
+    num_nodes = header[3];
+    entry = header[4];
+    int pos = sizeof(header);
+
+    nodes.assign(num_nodes, node());
+    free_nodes.clear();
+    node_of.clear();
+    for (int n = 0; n < num_nodes; n++) {
+        int levels;
+        if (size - pos < (int)(sizeof(musly_trackid) + sizeof(int))) {
+            return -1;
+        }
+        std::memcpy(&nodes[n].id, buffer + pos, sizeof(musly_trackid));
+        std::memcpy(&levels, buffer + pos + sizeof(musly_trackid),
+                sizeof(int));
+        pos += sizeof(musly_trackid) + sizeof(int);
+        if ((levels < 1) || (levels > (size - pos) / (int)sizeof(int))) {
+            return -1;
+        }
+        nodes[n].links.resize(levels);
+        for (int l = 0; l < levels; l++) {
+            int count;
+            if (size - pos < (int)sizeof(int)) {
+                return -1;
+            }
+            std::memcpy(&count, buffer + pos, sizeof(int));
+            pos += sizeof(int);
+            if ((count < 0) || (count > max_links(l)) ||
+                    (count > (size - pos) / (int)sizeof(int))) {
+                return -1;
+            }
+            std::vector<int>& links = nodes[n].links[l];
+            links.resize(count);
+            if (count) {
+                std::memcpy(links.data(), buffer + pos, count * sizeof(int));
+            }
+            pos += count * sizeof(int);
+        }
+        if (!node_of.insert(std::make_pair(nodes[n].id, n)).second) {
+            return -1;
+        }
+    }
+
+    // links on a level may only lead to nodes that have this level
+    for (int n = 0; n < num_nodes; n++) {
+        for (int l = 0; l < (int)nodes[n].links.size(); l++) {
+            const std::vector<int>& links = nodes[n].links[l];
+            for (int i = 0; i < (int)links.size(); i++) {
+                if ((links[i] < 0) || (links[i] >= num_nodes) ||
+                        ((int)nodes[links[i]].links.size() <= l)) {
+                    return -1;
+                }
+            }
+        }
+        nodes[n].in_degree = 0;
+    }
+    for (int n = 0; n < num_nodes; n++) {
+        const std::vector<int>& links = nodes[n].links[0];
+        for (int i = 0; i < (int)links.size(); i++) {
+            nodes[links[i]].in_degree++;
+        }
+    }
+    return pos;
+}
+
+} /* namespace musly */
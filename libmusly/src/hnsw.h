@@ -0,0 +1,205 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *                2014, Jan Schlueter <jan.schlueter@ofai.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_HNSW_H_
+#define MUSLY_HNSW_H_
+
+#include <vector>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include "musly/musly_types.h"
+#include "trackmetric.h"
+
+namespace musly {
+
+/** A hierarchical navigable small world graph over track ids, to find
+ * approximate nearest neighbors in sub-linear time:
+ * Y. A. Malkov and D. A. Yashunin: Efficient and robust approximate nearest
+ * neighbor search using Hierarchical Navigable Small World graphs. IEEE
+ * Transactions on Pattern Analysis and Machine Intelligence, 2018.
+ *
+ * Each track is linked to up to \p m close tracks per layer of the graph
+ * (2 * \p m in the bottom layer). Searches descend greedily through the
+ * sparse upper layers and then explore the bottom layer with a beam of
+ * \p ef tracks. Distances are computed by a track_metric, which is called
+ * with whole neighbor lists at once.
+ */
+class hnsw
+{
+public:
+    hnsw(
+            track_metric* metric);
+
+    /** Return the number of tracks in the graph.
+     */
+    int
+    get_size() const;
+
+    int
+    get_m() const;
+
+    int
+    get_ef_construction() const;
+
+    int
+    get_ef_search() const;
+
+    /** Set the number of links per track and layer. Can only be changed
+     * while the graph is empty. Returns 0 on success, -1 on an error.
+     */
+    int
+    set_m(
+            int m);
+
+    /** Set the beam width used when inserting tracks. Returns 0 on
+     * success, -1 on an error.
+     */
+    int
+    set_ef_construction(
+            int ef);
+
+    /** Set the default beam width used when searching. Returns 0 on
+     * success, -1 on an error.
+     */
+    int
+    set_ef_search(
+            int ef);
+
+    /** Return whether a track is part of the graph.
+     */
+    bool
+    contains(
+            musly_trackid id) const;
+
+    /** Add a track to the graph. Its distances to the tracks in the graph
+     * have to be available from the metric. Tracks already in the graph
+     * are ignored.
+     */
+    void
+    insert(
+            musly_trackid id);
+
+    /** Remove tracks from the graph, reconnecting their former neighbors.
+     * Unknown tracks are ignored.
+     */
+    void
+    remove(
+            const musly_trackid* ids,
+            int length);
+
+    /** Find up to \p k tracks close to the track \p query, which does not
+     * need to be part of the graph, and write them to \p neighbors in
+     * ascending order of distance. The query itself is never returned.
+     * Uses a beam width of at least \p k and get_ef_search().
+     * Returns the number of neighbors written.
+     */
+    int
+    search(
+            musly_trackid query,
+            int k,
+            musly_trackid* neighbors);
+
+    /** Write the graph to \p buffer, or only return the required size if
+     * \p buffer is <tt>NULL</tt>. Returns the number of bytes.
+     */
+    int
+    serialize(
+            unsigned char* buffer) const;
+
+    /** Restore the graph from the \p size bytes at \p buffer. Returns the
+     * number of bytes read, or -1 in case of an error, including a graph
+     * that does not fit into \p size bytes and one that is inconsistent,
+     * such as a link to a node without the level of the link.
+     */
+    int
+    deserialize(
+            const unsigned char* buffer,
+            int size);
+
+private:
+    typedef std::pair<float, int> candidate;
+
+    struct node {
+        musly_trackid id;
+        std::vector<std::vector<int> > links;
+        /** number of links to this node on the bottom level */
+        int in_degree;
+    };
+
+    track_metric* metric;
+    int m;
+    int ef_construction;
+    int ef_search;
+    std::mt19937 rng;
+
+    std::vector<node> nodes;
+    std::vector<int> free_nodes;
+    std::unordered_map<musly_trackid, int> node_of;
+    int entry;
+    int num_nodes;
+
+    int
+    max_links(
+            int level) const;
+
+    int
+    random_level();
+
+    void
+    node_distances(
+            musly_trackid from,
+            const std::vector<int>& to,
+            std::vector<float>& distances);
+
+    int
+    greedy_closest(
+            musly_trackid query,
+            int entry_node,
+            float entry_dist,
+            int level,
+            float* dist);
+
+    void
+    search_layer(
+            musly_trackid query,
+            const std::vector<candidate>& entry_points,
+            int ef,
+            int level,
+            std::vector<candidate>& result);
+
+    void
+    select_neighbors(
+            std::vector<candidate>& candidates,
+            int max_count,
+            std::vector<int>& selected);
+
+    void
+    add_link(
+            int from,
+            int to,
+            int level);
+
+    void
+    set_links(
+            int n,
+            int level,
+            std::vector<int>& links);
+
+    void
+    shrink_links(
+            int n,
+            int level);
+};
+
+} /* namespace musly */
+#endif /* MUSLY_HNSW_H_ */
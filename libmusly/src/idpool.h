@@ -25,9 +25,11 @@
 #ifndef MUSLY_IDPOOL_H_
 #define MUSLY_IDPOOL_H_
 
+#include <algorithm>
+#include <cstdint>
 #include <set>
-#include <map>
 #include <vector>
+#include "mappedarray.h"
 
 namespace musly {
 
@@ -149,17 +151,179 @@ public:
 };
 
 
+/** Maps ids to positions. Non-negative ids up to a few times the number of
+ * registered ids are looked up in a flat vector, all others in an
+ * open-addressing hash table with linear probing.
+ */
+template <typename T>
+class idindex
+{
+private:
+    struct slot {
+        T id;
+        int position;  // -1 for an empty slot
+    };
+
+    std::vector<int> dense;
+    std::vector<slot> sparse;
+    int sparse_count;
+    int sparse_shift;
+
+    inline size_t
+    home(T id) const {
+        // Fibonacci hashing spreads consecutive ids over the table
+        return static_cast<size_t>((static_cast<uint64_t>(id) *
+                11400714819323198485ull) >> sparse_shift);
+    }
+
+    inline size_t
+    find_slot(T id) const {
+        const size_t mask = sparse.size() - 1;
+        size_t i = home(id);
+        while ((sparse[i].position >= 0) && (sparse[i].id != id)) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void
+    rehash(int bits) {
+        std::vector<slot> old(size_t(1) << bits);
+        old.swap(sparse);
+        for (size_t i = 0; i < sparse.size(); i++) {
+            sparse[i].position = -1;
+        }
+        sparse_shift = 64 - bits;
+        for (size_t i = 0; i < old.size(); i++) {
+            if (old[i].position >= 0) {
+                sparse[find_slot(old[i].id)] = old[i];
+            }
+        }
+    }
+
+    void
+    set_sparse(T id, int position) {
+        // keep the load factor at or below 1/2
+        if (2 * (sparse_count + 1) > (int)sparse.size()) {
+            rehash(std::max(4, 65 - sparse_shift));
+        }
+        size_t i = find_slot(id);
+        if (sparse[i].position < 0) {
+            sparse[i].id = id;
+            sparse_count++;
+        }
+        sparse[i].position = position;
+    }
+
+    void
+    erase_sparse(T id) {
+        if (sparse_count == 0) {
+            return;
+        }
+        const size_t mask = sparse.size() - 1;
+        size_t i = find_slot(id);
+        if (sparse[i].position < 0) {
+            return;
+        }
+        // shift back the following entries that could not be found across
+        // the emptied slot otherwise
+        for (size_t j = (i + 1) & mask; sparse[j].position >= 0;
+                j = (j + 1) & mask) {
+            size_t k = home(sparse[j].id);
+            bool stays = (i <= j) ? ((i < k) && (k <= j)) :
+                    ((i < k) || (k <= j));
+            if (!stays) {
+                sparse[i] = sparse[j];
+                i = j;
+            }
+        }
+        sparse[i].position = -1;
+        sparse_count--;
+    }
+
+public:
+    idindex() : sparse_count(0), sparse_shift(64) {}
+
+    /** Forget about all ids
+     */
+    void
+    clear() {
+        std::vector<int>().swap(dense);
+        std::vector<slot>().swap(sparse);
+        sparse_count = 0;
+        sparse_shift = 64;
+    }
+
+    /** Return the position of \p id, or -1 if it is unknown
+     */
+    inline int
+    get(T id) const {
+        if (static_cast<size_t>(id) < dense.size()) {
+            return dense[static_cast<size_t>(id)];
+        }
+        if (sparse_count == 0) {
+            return -1;
+        }
+        return sparse[find_slot(id)].position;
+    }
+
+    /** Map \p id to \p position. \p registered is the number of
+     * registered ids, which decides how far the flat vector may grow.
+     */
+    void
+    set(T id, int position, int registered) {
+        if ((id >= 0) && (static_cast<size_t>(id) >= dense.size()) &&
+                (static_cast<size_t>(id) < 4 * static_cast<size_t>(registered)
+                        + 1024)) {
+            // grow the flat vector geometrically, and take over the ids of
+            // the hash table that it covers now
+            size_t size = std::max(static_cast<size_t>(id) + 1,
+                    2 * dense.size());
+            size = std::min(size, 4 * static_cast<size_t>(registered) + 1024);
+            dense.resize(size, -1);
+            if (sparse_count > 0) {
+                std::vector<slot> old(sparse);
+                for (size_t i = 0; i < old.size(); i++) {
+                    if ((old[i].position >= 0) && (old[i].id >= 0) &&
+                            (static_cast<size_t>(old[i].id) < size)) {
+                        erase_sparse(old[i].id);
+                        dense[static_cast<size_t>(old[i].id)] =
+                                old[i].position;
+                    }
+                }
+            }
+        }
+        if (static_cast<size_t>(id) < dense.size()) {
+            dense[static_cast<size_t>(id)] = position;
+        } else {
+            set_sparse(id, position);
+        }
+    }
+
+    /** Forget about \p id
+     */
+    void
+    erase(T id) {
+        if (static_cast<size_t>(id) < dense.size()) {
+            dense[static_cast<size_t>(id)] = -1;
+        } else {
+            erase_sparse(id);
+        }
+    }
+};
+
+
 template <typename T>
 class ordered_idpool :
         public idpool<T>
 {
 private:
     ordered_idpool_observer* observer;
-    std::vector<T> registered_ids;
-    std::map<T,int> positions;
+    mapped_array<T> registered_ids;
+    idindex<T> positions;
 
     void
-    swap_positions(int pos_a, int pos_b, typename std::map<T,int>::iterator map_a) {
+    swap_positions(int pos_a, int pos_b) {
         if (pos_a == pos_b) {
             return;
         }
@@ -167,11 +331,12 @@ private:
         T id_a = registered_ids[pos_a];
         T id_b = registered_ids[pos_b];
         // swap in `registered_ids`
-        registered_ids[pos_a] = id_b;
-        registered_ids[pos_b] = id_a;
+        std::vector<T>& ids = registered_ids.own();
+        ids[pos_a] = id_b;
+        ids[pos_b] = id_a;
         // swap in `positions`
-        map_a->second = pos_b;
-        positions[id_b] = pos_a;
+        positions.set(id_a, pos_b, registered_ids.size());
+        positions.set(id_b, pos_a, registered_ids.size());
         // notify observer (if any)
         if (observer) {
             observer->swapped_positions(pos_a, pos_b);
@@ -186,12 +351,31 @@ public:
         this->observer = observer;
     }
 
-    inline const std::vector<T>& idlist() const {
+    inline const mapped_array<T>& idlist() const {
         return registered_ids;
     }
 
-    inline const std::map<T,int>& posmap() const {
-        return positions;
+    /** Register the \p size ids at \p ids in this order, replacing all
+     * registered ids, and use them in place until they change; the memory
+     * must stay valid until then. \p max_seen is the largest id ever
+     * registered. Returns false and registers nothing if an id is given
+     * twice or exceeds \p max_seen.
+     */
+    bool
+    map(const T* ids, int size, T max_seen) {
+        positions.clear();
+        for (int i = 0; i < size; i++) {
+            if ((ids[i] > max_seen) || (positions.get(ids[i]) >= 0)) {
+                positions.clear();
+                registered_ids.map(NULL, 0);
+                idpool<T>::max_seen = -1;
+                return false;
+            }
+            positions.set(ids[i], i, size);
+        }
+        registered_ids.map(ids, size);
+        idpool<T>::max_seen = max_seen;
+        return true;
     }
 
     inline const T& operator[](int const& index) const {
@@ -199,12 +383,27 @@ public:
     }
 
     inline int
-    position_of(T id) {
-        typename std::map<T,int>::iterator it = positions.find(id);
-        if (it != positions.end()) {
-            return it->second;
+    position_of(T id) const {
+        return positions.get(id);
+    }
+
+    /** Write the positions of \p length ids to \p positions, -1 for
+     * unknown ids. Ids in storage order, i.e., with
+     * <tt>ids[i] == idlist()[first + i]</tt>, are recognized without a
+     * lookup, so passing (a part of) idlist() itself is cheapest.
+     */
+    void
+    positions_of(const T* ids, int length, int* positions, int first = 0)
+            const {
+        const int size = registered_ids.size();
+        for (int i = 0; i < length; i++) {
+            const int pos = first + i;
+            if ((pos >= 0) && (pos < size) && (registered_ids[pos] == ids[i])) {
+                positions[i] = pos;
+            } else {
+                positions[i] = this->positions.get(ids[i]);
+            }
         }
-        return -1;
     }
 
     inline int
@@ -219,10 +418,10 @@ public:
     move_to_end(T* ids, int length) {
         int start = registered_ids.size();
         for (int i = length - 1; i >= 0; i--) {
-            typename std::map<T,int>::iterator it = positions.find(ids[i]);
-            if (it != positions.end()) {
+            int pos = positions.get(ids[i]);
+            if (pos >= 0) {
                 start--;
-                swap_positions(it->second, start, it);
+                swap_positions(pos, start);
             }
         }
         return registered_ids.size() - start;
@@ -237,11 +436,12 @@ public:
         int num_known = move_to_end(ids, length);
         // make enough room to add unknown ids
         int start = registered_ids.size() - num_known;
-        registered_ids.resize(start + length);
+        std::vector<T>& list = registered_ids.own();
+        list.resize(start + length);
         // overwrite the last `length` elements with the given `ids`
         for (int i = 0; i < length; i++) {
-            registered_ids[start + i] = ids[i];
-            positions[ids[i]] = start + i;
+            list[start + i] = ids[i];
+            positions.set(ids[i], start + i, registered_ids.size());
             if (ids[i] > idpool<T>::max_seen) {
                 idpool<T>::max_seen = ids[i];
             }
@@ -259,12 +459,14 @@ public:
             ids[i] = ++idpool<T>::max_seen;
         }
         // make enough room to add all ids
-        int size = registered_ids.size();
-        registered_ids.reserve(size + length);
+        std::vector<T>& list = registered_ids.own();
+        int size = list.size();
+        list.reserve(size + length);
         // append ids to the end
         for (int i = 0; i < length; i++) {
-            registered_ids.push_back(ids[i]);
-            positions[ids[i]] = size++;
+            list.push_back(ids[i]);
+            positions.set(ids[i], size, registered_ids.size());
+            size++;
         }
     }
 
@@ -286,7 +488,7 @@ public:
         for (int i = start; i < start + length; i++) {
             positions.erase(registered_ids[i]);
         }
-        registered_ids.resize(start);
+        registered_ids.own().resize(start);
     }
 };
 
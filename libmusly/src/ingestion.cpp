@@ -0,0 +1,208 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "minilog.h"
+#include "parallel.h"
+#include "ingestion.h"
+
+namespace musly {
+
+namespace {
+
+/** A file on its way through the pipeline.
+ */
+struct job {
+    /** The index of the file.
+     */
+    int index;
+
+    /** The signal buffer holding the decoded excerpt, or -1.
+     */
+    int pcm;
+
+    /** The sample rate of the decoded excerpt.
+     */
+    int sample_rate;
+
+    /** The track buffer holding the features, or -1.
+     */
+    int track;
+
+    /** The result so far, 0 while all stages succeeded.
+     */
+    int result;
+};
+
+} /* anonymous namespace */
+
+ingestion::ingestion(
+        method& m,
+        decoder& d,
+        const serialize_function& serialize,
+        int binsize) :
+        m(m),
+        d(d),
+        serialize(serialize),
+        binsize(binsize),
+        decode_threads(1),
+        analyze_threads(std::max(1u, std::thread::hardware_concurrency())),
+        serialize_threads(1)
+{
+}
+
+int
+ingestion::set_threads(
+        int decode_threads,
+        int analyze_threads,
+        int serialize_threads)
+{
+    if ((decode_threads < 0) || (analyze_threads < 0) ||
+            (serialize_threads < 0)) {
+        return -1;
+    }
+    this->decode_threads = (decode_threads > 0) ? decode_threads : 1;
+    this->analyze_threads = (analyze_threads > 0) ? analyze_threads :
+            std::max(1u, std::thread::hardware_concurrency());
+    this->serialize_threads = (serialize_threads > 0) ? serialize_threads : 1;
+    return 0;
+}
+
+int
+ingestion::run(
+        const std::vector<std::string>& files,
+        float excerpt_length,
+        float excerpt_start,
+        const result_function& done)
+{
+    const int num_files = files.size();
+
+    // Enough signal buffers for each decoding and analysis thread to hold
+    // one, and for as many decoded signals to wait for the analysis, so
+    // that decoding runs ahead; likewise for the tracks.
+    const int num_pcm = decode_threads + 2*analyze_threads;
+    const int num_tracks = analyze_threads + 2*serialize_threads;
+    std::vector<std::vector<float> > pcm(num_pcm);
+    std::vector<std::vector<float> > tracks(num_tracks,
+            std::vector<float>(m.track_getsize()));
+    bounded_queue<int> free_pcm(num_pcm);
+    bounded_queue<int> free_tracks(num_tracks);
+    for (int i = 0; i < num_pcm; i++) {
+        free_pcm.push(i);
+    }
+    for (int i = 0; i < num_tracks; i++) {
+        free_tracks.push(i);
+    }
+    bounded_queue<job> decoded(num_pcm);
+    bounded_queue<job> analyzed(num_tracks);
+
+    std::atomic<int> next_file(0);
+    std::atomic<int> decoding(decode_threads);
+    std::atomic<int> analyzing(analyze_threads);
+    std::atomic<bool> stopped(false);
+    std::mutex done_lock;
+    int failed = 0;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < decode_threads; t++) {
+        threads.push_back(std::thread([&]() {
+            for (int i = next_file++; (i < num_files) && !stopped;
+                    i = next_file++) {
+                job j = {i, -1, 0, -1, -1};
+                free_pcm.pop(j.pcm);
+                if (d.decodeto_mono_float(files[i], excerpt_length,
+                        excerpt_start, pcm[j.pcm], j.sample_rate) > 0) {
+                    j.result = 0;
+                } else {
+                    free_pcm.push(j.pcm);
+                    j.pcm = -1;
+                }
+                decoded.push(j);
+            }
+            if (--decoding == 0) {
+                decoded.close();
+            }
+        }));
+    }
+    for (int t = 0; t < analyze_threads; t++) {
+        threads.push_back(std::thread([&]() {
+            std::unique_ptr<method::analysis_context> context(
+                    m.analysis_context_alloc());
+            job j;
+            while (decoded.pop(j)) {
+                if (stopped) {
+                    if (j.pcm >= 0) {
+                        free_pcm.push(j.pcm);
+                    }
+                    continue;
+                }
+                if (j.result == 0) {
+                    free_tracks.pop(j.track);
+                    std::vector<float>& signal = pcm[j.pcm];
+                    j.result = m.analyze_track_rate(signal.data(),
+                            signal.size(), j.sample_rate,
+                            tracks[j.track].data(), context.get());
+                    free_pcm.push(j.pcm);
+                    j.pcm = -1;
+                    if (j.result != 0) {
+                        free_tracks.push(j.track);
+                        j.track = -1;
+                    }
+                }
+                analyzed.push(j);
+            }
+            if (--analyzing == 0) {
+                analyzed.close();
+            }
+        }));
+    }
+    for (int t = 0; t < serialize_threads; t++) {
+        threads.push_back(std::thread([&]() {
+            std::vector<unsigned char> bin(binsize);
+            job j;
+            while (analyzed.pop(j)) {
+                musly_track* track = NULL;
+                unsigned char* serialized = NULL;
+                if (j.result == 0) {
+                    track = tracks[j.track].data();
+                    serialize(track, bin.data());
+                    serialized = bin.data();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(done_lock);
+                    if (j.result != 0) {
+                        MINILOG(logDEBUG) << "ingestion: " << files[j.index]
+                                << " failed: " << j.result;
+                        failed++;
+                    }
+                    if (!stopped && (done(j.index, j.result, track,
+                            serialized) != 0)) {
+                        stopped = true;
+                    }
+                }
+                if (j.track >= 0) {
+                    free_tracks.push(j.track);
+                }
+            }
+        }));
+    }
+    for (int t = 0; t < (int)threads.size(); t++) {
+        threads[t].join();
+    }
+    return stopped ? -1 : failed;
+}
+
+} /* namespace musly */
@@ -0,0 +1,102 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_INGESTION_H_
+#define MUSLY_INGESTION_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "musly/musly_types.h"
+#include "decoder.h"
+#include "method.h"
+
+namespace musly {
+
+/** Decodes, analyzes and serializes a list of audio files in a pipeline of
+ * three stages, each running on threads of its own, so that reading and
+ * decoding files overlaps with the analysis.
+ *
+ * The stages pass their results on through bounded queues. The decoded
+ * signals and the analyzed tracks are kept in pools of buffers allocated
+ * once per run, whose number bounds the files in flight; a decoding thread
+ * waits for a free signal buffer and an analysis thread for a free track.
+ * Once the signal buffers have grown to the longest excerpt, the pipeline
+ * does not allocate.
+ */
+class ingestion {
+public:
+    /** Called for each file as soon as it is done, never concurrently.
+     * \param index The index of the file in the list.
+     * \param result 0 on success, -1 if the file could not be decoded, or
+     * the nonzero return value of method::analyze_track_rate().
+     * \param track The features, valid during the call only, or NULL on
+     * failure.
+     * \param bin The serialized features, valid during the call only, or
+     * NULL on failure.
+     * \returns 0 to continue, nonzero to stop the pipeline.
+     */
+    typedef std::function<int(int index, int result, musly_track* track,
+            const unsigned char* bin)> result_function;
+
+    /** Writes the serialized \p track to \p bin.
+     */
+    typedef std::function<void(musly_track* track, unsigned char* bin)>
+            serialize_function;
+
+    /** Set up the pipeline for \p m and \p d. Serialized tracks take
+     * \p binsize bytes.
+     */
+    ingestion(
+            method& m,
+            decoder& d,
+            const serialize_function& serialize,
+            int binsize);
+
+    /** Set the number of threads of each stage. Values of 0 select one
+     * decoding thread, one analysis thread per hardware thread, and one
+     * serialization thread.
+     * \returns 0 on success, -1 if a value is negative.
+     */
+    int
+    set_threads(
+            int decode_threads,
+            int analyze_threads,
+            int serialize_threads);
+
+    /** Process \p files, decoding the excerpt given by \p excerpt_length and
+     * \p excerpt_start of each as decoder::decodeto_mono_float()
+     * does, and pass the results to \p done in completion order. If
+     * \p done returns nonzero, no further files are started and the ones in
+     * flight are discarded.
+     * \returns the number of files that failed, or -1 if stopped by
+     * \p done.
+     */
+    int
+    run(
+            const std::vector<std::string>& files,
+            float excerpt_length,
+            float excerpt_start,
+            const result_function& done);
+
+private:
+    method& m;
+    decoder& d;
+    serialize_function serialize;
+    int binsize;
+    int decode_threads;
+    int analyze_threads;
+    int serialize_threads;
+};
+
+} /* namespace musly */
+#endif /* MUSLY_INGESTION_H_ */
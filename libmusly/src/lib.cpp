@@ -10,14 +10,10 @@
  * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
-#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
-#include <winsock2.h>
-#else
-#include <arpa/inet.h>
-#endif
 #include <algorithm>
 #include <vector>
 #include <sstream>
+#include <climits>
 #include <cstdio>
 #include <cstring>
 #include <cstdint>
@@ -28,6 +24,11 @@
 #include "plugins.h"
 #include "decoder.h"
 #include "method.h"
+#include "mappedfile.h"
+#include "mappedjukebox.h"
+#include "byteorder.h"
+#include "parallel.h"
+#include "ingestion.h"
 #include "version.h"
 
 #ifdef MUSLY_STATIC
@@ -47,6 +48,9 @@ MUSLY_METHOD_REGSTATIC(timbre, 1);
 #include "decoders/none.h"
 MUSLY_DECODER_REGSTATIC(none, 0);
 
+#include "decoders/wav.h"
+MUSLY_DECODER_REGSTATIC(wav, -1);
+
 #if MUSLY_DECODER_LIBAV
 #include "decoders/libav.h"
 MUSLY_DECODER_REGSTATIC(libav, 1);
@@ -86,6 +90,30 @@ struct _musly_jukebox
     /** Decoder name as null terminated string
      */
     char* decoder_name;
+
+    /** The file the jukebox was restored from by musly_jukebox_frommmap(),
+     * which the method uses in place, or NULL.
+     */
+    musly::mapped_jukebox* mapping;
+};
+
+struct _musly_analyzer
+{
+    /** The jukebox whose method and decoder are used.
+     */
+    musly_jukebox* jukebox;
+
+    /** The analysis state owned by this analyzer. Hides a C++
+     * musly::method::analysis_context object.
+     */
+    musly::method::analysis_context* context;
+};
+
+struct _musly_mappedfile
+{
+    /** The mapping of the file, unmapped when this object is deleted.
+     */
+    musly::mapped_file mapping;
 };
 
 
@@ -105,6 +133,13 @@ musly_debug(
             std::min(std::max(0, level), (int)(minilog_level_max)-1));
 }
 
+int
+musly_set_threads(
+        int num_threads)
+{
+    return musly::threadpool::get().set_threads(num_threads);
+}
+
 const char*
 musly_jukebox_listmethods()
 {
@@ -201,6 +236,7 @@ musly_jukebox_poweron(
         mj->decoder = nullptr;
         mj->decoder_name = nullptr;
     }
+    mj->mapping = nullptr;
 
 
     return mj;
@@ -228,9 +264,39 @@ musly_jukebox_poweroff(
         delete[] jukebox->decoder_name;
     }
 
+    // the method used the file in place up to now
+    if (jukebox->mapping) {
+        delete jukebox->mapping;
+    }
+
     delete jukebox;
 }
 
+int
+musly_jukebox_setdecoderoptions(
+        musly_jukebox* jukebox,
+        const musly_decoder_options* options)
+{
+    if (!jukebox || !jukebox->decoder) {
+        return -1;
+    }
+    const musly_decoder_options defaults = {};
+    jukebox->decoder->set_options(options ? *options : defaults);
+    return 0;
+}
+
+int
+musly_jukebox_getdecoderoptions(
+        musly_jukebox* jukebox,
+        musly_decoder_options* options)
+{
+    if (!jukebox || !jukebox->decoder || !options) {
+        return -1;
+    }
+    *options = jukebox->decoder->get_options();
+    return 0;
+}
+
 
 int
 musly_jukebox_setmusicstyle(
@@ -334,6 +400,96 @@ musly_jukebox_similarity(
     }
 }
 
+int
+musly_jukebox_similarity_byid(
+        musly_jukebox* jukebox,
+        musly_trackid seed_trackid,
+        musly_trackid* trackids,
+        int num_tracks,
+        float* similarities)
+{
+    if (jukebox && jukebox->method) {
+        musly::method* m = reinterpret_cast<musly::method*>(jukebox->method);
+        return m->similarity_byid(
+                seed_trackid, trackids,
+                num_tracks, similarities);
+    } else {
+        return -1;
+    }
+}
+
+int
+musly_jukebox_similarity_batch(
+        musly_jukebox* jukebox,
+        musly_trackid* seed_trackids,
+        int num_seeds,
+        musly_trackid* trackids,
+        int num_tracks,
+        float* similarities)
+{
+    if (jukebox && jukebox->method) {
+        musly::method* m = reinterpret_cast<musly::method*>(jukebox->method);
+        return m->similarity_batch(
+                seed_trackids, num_seeds,
+                trackids, num_tracks, similarities);
+    } else {
+        return -1;
+    }
+}
+
+int
+musly_jukebox_similarity_allpairs(
+        musly_jukebox* jukebox,
+        musly_trackid* trackids,
+        int num_tracks,
+        int block_rows,
+        musly_similarity_sink sink,
+        void* user_data)
+{
+    if (jukebox && jukebox->method) {
+        musly::method* m = reinterpret_cast<musly::method*>(jukebox->method);
+        return m->similarity_allpairs(
+                trackids, num_tracks, block_rows, sink, user_data);
+    } else {
+        return -1;
+    }
+}
+
+int
+musly_jukebox_knn(
+        musly_jukebox* jukebox,
+        musly_trackid seed_trackid,
+        musly_trackid* trackids,
+        int num_tracks,
+        float* knn_similarities,
+        musly_trackid* knn_trackids,
+        int k)
+{
+    if (jukebox && jukebox->method) {
+        musly::method* m = reinterpret_cast<musly::method*>(jukebox->method);
+        return m->knn(
+                seed_trackid, trackids, num_tracks,
+                knn_similarities, knn_trackids, k);
+    } else {
+        return -1;
+    }
+}
+
+int
+musly_jukebox_storetracks(
+        musly_jukebox* jukebox,
+        musly_track** tracks,
+        musly_trackid* trackids,
+        int num_tracks)
+{
+    if (jukebox && jukebox->method) {
+        musly::method* m = reinterpret_cast<musly::method*>(jukebox->method);
+        return m->store_tracks(tracks, trackids, num_tracks);
+    } else {
+        return -1;
+    }
+}
+
 int
 musly_jukebox_guessneighbors(
         musly_jukebox* jukebox,
@@ -362,6 +518,33 @@ musly_jukebox_guessneighbors_filtered(
     }
 }
 
+int
+musly_jukebox_setoption(
+        musly_jukebox* jukebox,
+        const char* name,
+        int value)
+{
+    if (jukebox && jukebox->method && name) {
+        musly::method* m = reinterpret_cast<musly::method*>(jukebox->method);
+        return m->set_option(name, value);
+    } else {
+        return -1;
+    }
+}
+
+int
+musly_jukebox_getoption(
+        musly_jukebox* jukebox,
+        const char* name)
+{
+    if (jukebox && jukebox->method && name) {
+        musly::method* m = reinterpret_cast<musly::method*>(jukebox->method);
+        return m->get_option(name);
+    } else {
+        return -1;
+    }
+}
+
 int
 musly_jukebox_binsize(
         musly_jukebox* jukebox,
@@ -430,7 +613,9 @@ musly_jukebox_frombin(
     if (jukebox && jukebox->method && ((num_tracks >= 0) || header)) {
         musly::method* m = reinterpret_cast<musly::method*>(jukebox->method);
         if (header) {
-            int expected_tracks = m->deserialize_metadata(buffer);
+            // the caller vouches for a complete header of unknown size
+            int size_head = INT_MAX;
+            int expected_tracks = m->deserialize_metadata(buffer, size_head);
             if (expected_tracks < 0) {
                 return -1;
             }
@@ -440,7 +625,7 @@ musly_jukebox_frombin(
             else if (num_tracks < 0) {
                 num_tracks = expected_tracks;
             }
-            buffer += musly_jukebox_binsize(jukebox, 1, 0);
+            buffer += size_head;
         }
         if (num_tracks) {
             num_tracks = m->deserialize_trackdata(buffer, num_tracks);
@@ -486,14 +671,16 @@ musly_jukebox_tostream(
     written += sizeof(intsize) + sizeof(byteorder);
 
     // write general jukebox information
+    // (the decoder name is empty if the jukebox was created without decoder)
+    const char* decoder_name = musly_jukebox_decodername(jukebox);
     if (fputs(jukebox->method_name, stream) == EOF ||
             fputc('\0', stream) == EOF ||
-            fputs(jukebox->decoder_name, stream) == EOF ||
+            fputs(decoder_name, stream) == EOF ||
             fputc('\0', stream) == EOF) {
         return -1;
     }
     written += strlen(jukebox->method_name) + 1;
-    written += strlen(jukebox->decoder_name) + 1;
+    written += strlen(decoder_name) + 1;
 
     unsigned char* buffer;
     int bcount;
@@ -575,7 +762,8 @@ musly_jukebox_fromstream(
     }
 
     // create empty jukebox
-    musly_jukebox* jukebox = musly_jukebox_poweron(method.c_str(), decoder.c_str());
+    musly_jukebox* jukebox = musly_jukebox_poweron(method.c_str(),
+            decoder.empty() ? NULL : decoder.c_str());
     if (!jukebox) {
         return NULL;
     }
@@ -584,14 +772,18 @@ musly_jukebox_fromstream(
 
     // read jukebox-specific header
     int size_head;
-    if (fread(&size_head, sizeof(size_head), 1, stream) != 1) {
+    if ((fread(&size_head, sizeof(size_head), 1, stream) != 1) ||
+            (size_head < 0)) {
         musly_jukebox_poweroff(jukebox);
         return NULL;
     }
     buffer = new unsigned char[size_head];
+    int size_read = size_head;
     int expected_tracks;
     if ((int)fread(buffer, 1, size_head, stream) != size_head ||
-            (expected_tracks = musly_jukebox_frombin(jukebox, buffer, 1, 0)) < 0) {
+            (expected_tracks = jukebox->method->deserialize_metadata(buffer,
+                    size_read)) < 0 ||
+            (size_read != size_head)) {
         musly_jukebox_poweroff(jukebox);
         delete[] buffer;
         return NULL;
@@ -622,6 +814,159 @@ musly_jukebox_fromstream(
     return jukebox;
 }
 
+namespace {
+
+/** The header of a journal record, see musly_jukebox_journal_addtracks().
+ * The ids of the tracks follow, then for added tracks their state as
+ * written by musly_jukebox_tobin().
+ */
+struct journal_record {
+    uint32_t magic;
+    uint32_t kind;
+    int32_t num_tracks;
+    uint32_t size;
+};
+
+const uint32_t journal_magic = 0x4c4e524a;  // "JRNL" on little-endian
+const uint32_t journal_added = 1;
+const uint32_t journal_removed = 2;
+
+int
+write_journal_record(
+        FILE* stream,
+        uint32_t kind,
+        const musly_trackid* trackids,
+        int num_tracks,
+        const std::vector<unsigned char>& state) {
+    const size_t size_ids = num_tracks * sizeof(musly_trackid);
+    journal_record record = {journal_magic, kind, num_tracks,
+            (uint32_t)(size_ids + state.size())};
+    if ((fwrite(&record, sizeof(record), 1, stream) != 1) ||
+            (size_ids &&
+                    (fwrite(trackids, 1, size_ids, stream) != size_ids)) ||
+            (!state.empty() &&
+                    (fwrite(state.data(), 1, state.size(), stream) !=
+                    state.size())) ||
+            (fflush(stream) != 0)) {
+        return -1;
+    }
+    return sizeof(record) + record.size;
+}
+
+} /* anonymous namespace */
+
+int
+musly_jukebox_journal_addtracks(
+        musly_jukebox* jukebox,
+        FILE* stream,
+        const musly_trackid* trackids,
+        int num_tracks) {
+    if (!jukebox || !jukebox->method || !stream || (num_tracks < 0) ||
+            (num_tracks && !trackids)) {
+        return -1;
+    }
+    musly::method* m = jukebox->method;
+    const int size_track = musly_jukebox_binsize(jukebox, 0, 1);
+    if (size_track <= 0) {
+        return -1;
+    }
+
+    // a track given twice could not be replayed
+    std::vector<musly_trackid> sorted(trackids, trackids + num_tracks);
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+        return -1;
+    }
+
+    std::vector<int> positions(num_tracks);
+    m->positions_of(trackids, num_tracks, positions.data());
+    std::vector<unsigned char> state((size_t)num_tracks * size_track);
+    for (int i = 0; i < num_tracks; i++) {
+        const int pos = positions[i];
+        if ((pos < 0) || (m->serialize_trackdata(
+                &state[(size_t)i * size_track], 1, pos) != size_track)) {
+            return -1;
+        }
+    }
+    return write_journal_record(stream, journal_added, trackids, num_tracks,
+            state);
+}
+
+int
+musly_jukebox_journal_removetracks(
+        musly_jukebox* jukebox,
+        FILE* stream,
+        const musly_trackid* trackids,
+        int num_tracks) {
+    if (!jukebox || !jukebox->method || !stream || (num_tracks < 0) ||
+            (num_tracks && !trackids)) {
+        return -1;
+    }
+    return write_journal_record(stream, journal_removed, trackids,
+            num_tracks, std::vector<unsigned char>());
+}
+
+int
+musly_jukebox_journal_replay(
+        musly_jukebox* jukebox,
+        FILE* stream) {
+    if (!jukebox || !jukebox->method || !stream) {
+        return -1;
+    }
+    const int size_track = musly_jukebox_binsize(jukebox, 0, 1);
+    if (size_track <= 0) {
+        return -1;
+    }
+
+    int replayed = 0;
+    journal_record record;
+    std::vector<unsigned char> buffer;
+    size_t got;
+    while ((got = fread(&record, 1, sizeof(record), stream)) > 0) {
+        // an incomplete or unknown record ends the journal
+        if ((got != sizeof(record)) || (record.magic != journal_magic) ||
+                (record.num_tracks < 0)) {
+            return -1;
+        }
+        const uint64_t size_ids =
+                (uint64_t)record.num_tracks * sizeof(musly_trackid);
+        const uint64_t size_state = (record.kind == journal_added) ?
+                (uint64_t)record.num_tracks * size_track : 0;
+        if (((record.kind != journal_added) &&
+                (record.kind != journal_removed)) ||
+                (record.size != size_ids + size_state)) {
+            return -1;
+        }
+        buffer.resize(record.size);
+        if (fread(buffer.data(), 1, record.size, stream) != record.size) {
+            return -1;
+        }
+
+        // added tracks replace tracks of the same ids, like in
+        // musly_jukebox_addtracks(), so the record is checked before any
+        // track is removed: restoring a track state only fails for ids
+        // given twice
+        musly_trackid* ids = (musly_trackid*)buffer.data();
+        if (record.kind == journal_added) {
+            std::vector<musly_trackid> sorted(ids, ids + record.num_tracks);
+            std::sort(sorted.begin(), sorted.end());
+            if (std::adjacent_find(sorted.begin(), sorted.end()) !=
+                    sorted.end()) {
+                return -1;
+            }
+        }
+        jukebox->method->remove_tracks(ids, record.num_tracks);
+        if ((record.kind == journal_added) && (record.num_tracks > 0) &&
+                (jukebox->method->deserialize_trackdata(
+                        buffer.data() + size_ids, record.num_tracks)
+                        != record.num_tracks)) {
+            return -1;
+        }
+        replayed++;
+    }
+    return replayed;
+}
+
 int
 musly_jukebox_tofile(
         musly_jukebox* jukebox,
@@ -645,6 +990,88 @@ musly_jukebox_fromfile(
     return NULL;
 }
 
+int
+musly_jukebox_tommap(
+        musly_jukebox* jukebox,
+        const char* filename) {
+    if (!jukebox || !jukebox->method || !filename) {
+        return -1;
+    }
+    musly::mapped_jukebox::writer out;
+    if (jukebox->method->serialize_sections(out) < 0) {
+        return -1;
+    }
+    return out.write(filename, jukebox->method_name,
+            jukebox->decoder_name ? jukebox->decoder_name : "",
+            jukebox->method->track_getsize());
+}
+
+musly_jukebox*
+musly_jukebox_frommmap(
+        const char* filename) {
+    if (!filename) {
+        return NULL;
+    }
+    musly::mapped_jukebox* mapping = new musly::mapped_jukebox;
+    if (!mapping->open(filename)) {
+        delete mapping;
+        return NULL;
+    }
+
+    // create empty jukebox
+    const std::string& decoder = mapping->get_decoder();
+    musly_jukebox* jukebox = musly_jukebox_poweron(
+            mapping->get_method().c_str(),
+            decoder.empty() ? NULL : decoder.c_str());
+    if (!jukebox) {
+        delete mapping;
+        return NULL;
+    }
+    jukebox->mapping = mapping;
+
+    // restore its state, using the file in place
+    if ((mapping->get_track_size() != jukebox->method->track_getsize()) ||
+            (jukebox->method->map_sections(*mapping) < 0)) {
+        MINILOG(logERROR) << filename << " does not match the method, or "
+                << "is damaged.";
+        musly_jukebox_poweroff(jukebox);
+        return NULL;
+    }
+    return jukebox;
+}
+
+musly_mappedfile*
+musly_mappedfile_open(
+        const char* filename) {
+    if (!filename) {
+        return NULL;
+    }
+    musly_mappedfile* file = new musly_mappedfile;
+    if (!file->mapping.open(filename)) {
+        delete file;
+        return NULL;
+    }
+    return file;
+}
+
+const unsigned char*
+musly_mappedfile_data(
+        const musly_mappedfile* file) {
+    return file ? file->mapping.data() : NULL;
+}
+
+size_t
+musly_mappedfile_size(
+        const musly_mappedfile* file) {
+    return file ? file->mapping.size() : 0;
+}
+
+void
+musly_mappedfile_close(
+        musly_mappedfile* file) {
+    delete file;
+}
+
 musly_track*
 musly_track_alloc(
         musly_jukebox* jukebox)
@@ -697,16 +1124,8 @@ musly_track_tobin(
         int len = m->track_getsize();
         int sz = len*sizeof(float);
 
-        // serialize to uint32 and convert to network byte order
-        union v {
-            float f;
-            uint32_t i;
-        } val;
-        uint32_t* raw_uint32 = reinterpret_cast<uint32_t*>(to_buffer);
-        for (int i = 0; i < len; i++) {
-            val.f = from_track[i];
-            raw_uint32[i] = htonl(val.i);
-        }
+        // serialize to uint32 in network byte order
+        musly::copy_network_order(from_track, to_buffer, len);
 
         return sz;
 
@@ -728,17 +1147,8 @@ musly_track_frombin(
         int len = m->track_getsize();
         int sz = len*sizeof(float);
 
-        // deserialize from uint32 and convert from network byte order to
-        // host byte order.
-        union v {
-            float f;
-            uint32_t i;
-        } val;
-        uint32_t* raw_uint32 = reinterpret_cast<uint32_t*>(from_buffer);
-        for (int i = 0; i < len; i++) {
-            val.i = ntohl(raw_uint32[i]);
-            to_track[i] = val.f;
-        }
+        // deserialize from uint32 in network byte order
+        musly::copy_network_order(from_buffer, to_track, len);
 
         return sz;
 
@@ -747,6 +1157,60 @@ musly_track_frombin(
     }
 }
 
+int
+musly_tracks_tobin_batch(
+        musly_jukebox* jukebox,
+        musly_track** from_tracks,
+        int num_tracks,
+        unsigned char* to_buffer,
+        int native)
+{
+    if (!jukebox || !jukebox->method || (num_tracks < 0) ||
+            (num_tracks && (!from_tracks || !to_buffer))) {
+        return -1;
+    }
+    const size_t len = jukebox->method->track_getsize();
+    for (int i = 0; i < num_tracks; i++) {
+        if (!from_tracks[i]) {
+            return -1;
+        }
+        unsigned char* to = to_buffer + i * len * sizeof(float);
+        if (native) {
+            std::memcpy(to, from_tracks[i], len * sizeof(float));
+        } else {
+            musly::copy_network_order(from_tracks[i], to, len);
+        }
+    }
+    return num_tracks;
+}
+
+int
+musly_tracks_frombin_batch(
+        musly_jukebox* jukebox,
+        unsigned char* from_buffer,
+        int num_tracks,
+        musly_track** to_tracks,
+        int native)
+{
+    if (!jukebox || !jukebox->method || (num_tracks < 0) ||
+            (num_tracks && (!from_buffer || !to_tracks))) {
+        return -1;
+    }
+    const size_t len = jukebox->method->track_getsize();
+    for (int i = 0; i < num_tracks; i++) {
+        if (!to_tracks[i]) {
+            return -1;
+        }
+        const unsigned char* from = from_buffer + i * len * sizeof(float);
+        if (native) {
+            std::memcpy(to_tracks[i], from, len * sizeof(float));
+        } else {
+            musly::copy_network_order(from, to_tracks[i], len);
+        }
+    }
+    return num_tracks;
+}
+
 const char*
 musly_track_tostr(musly_jukebox* jukebox,
         musly_track* from_track)
@@ -767,12 +1231,85 @@ musly_track_analyze_pcm(
         musly_track* track)
 {
     if (jukebox && jukebox->method) {
-        return jukebox->method->analyze_track(mono_22khz_pcm, length_pcm, track);
+        // use a temporary analysis context, so concurrent calls do not
+        // share any state
+        musly::method::analysis_context* context =
+                jukebox->method->analysis_context_alloc();
+        int ret = jukebox->method->analyze_track(mono_22khz_pcm, length_pcm,
+                track, context);
+        delete context;
+        return ret;
     } else {
         return -1;
     }
 }
 
+int
+musly_track_analyze_pcm_rate(
+        musly_jukebox* jukebox,
+        float* mono_pcm,
+        int length_pcm,
+        int sample_rate,
+        musly_track* track)
+{
+    if (!jukebox || !jukebox->method || !mono_pcm || !track) {
+        return -1;
+    }
+
+    musly::method::analysis_context* context =
+            jukebox->method->analysis_context_alloc();
+    int ret = jukebox->method->analyze_track_rate(mono_pcm, length_pcm,
+            sample_rate, track, context);
+    delete context;
+    return ret;
+}
+
+int
+musly_track_analyze_pcm_batch(
+        musly_jukebox* jukebox,
+        float** mono_22khz_pcm,
+        int* lengths_pcm,
+        musly_track** tracks,
+        int num_tracks,
+        int* results)
+{
+    if (!jukebox || !jukebox->method || (num_tracks < 0) ||
+            ((num_tracks > 0) && (!mono_22khz_pcm || !lengths_pcm || !tracks))) {
+        return -1;
+    }
+
+    // one analysis context per thread, allocated when the thread starts
+    // analyzing
+    musly::method* m = jukebox->method;
+    musly::threadpool& pool = musly::threadpool::get();
+    std::vector<musly::method::analysis_context*> contexts(
+            pool.get_threads(), NULL);
+    std::vector<int> ret(num_tracks);
+    pool.run(num_tracks, [&](int i, int worker) {
+        if (!mono_22khz_pcm[i] || !tracks[i] || (lengths_pcm[i] < 0)) {
+            ret[i] = -1;
+            return;
+        }
+        if (!contexts[worker]) {
+            contexts[worker] = m->analysis_context_alloc();
+        }
+        ret[i] = m->analyze_track(mono_22khz_pcm[i], lengths_pcm[i],
+                tracks[i], contexts[worker]);
+    }, contexts.size());
+    for (int w = 0; w < (int)contexts.size(); w++) {
+        delete contexts[w];
+    }
+
+    int failed = 0;
+    for (int i = 0; i < num_tracks; i++) {
+        if (results) {
+            results[i] = ret[i];
+        }
+        failed += (ret[i] != 0);
+    }
+    return failed;
+}
+
 int
 musly_track_analyze_audiofile(
         musly_jukebox* jukebox,
@@ -784,14 +1321,16 @@ musly_track_analyze_audiofile(
     if (jukebox && jukebox->decoder) {
 
         // decode the specified excerpt
-        std::vector<float> pcm =
-                jukebox->decoder->decodeto_22050hz_mono_float(audiofile, excerpt_length, excerpt_start);
-        if (pcm.size() == 0) {
+        std::vector<float> pcm;
+        int sample_rate;
+        if (jukebox->decoder->decodeto_mono_float(audiofile, excerpt_length,
+                excerpt_start, pcm, sample_rate) == 0) {
             return -1;
         }
 
         // pass it on to build the similarity model
-        return musly_track_analyze_pcm(jukebox, pcm.data(), pcm.size(), track);
+        return musly_track_analyze_pcm_rate(jukebox, pcm.data(), pcm.size(),
+                sample_rate, track);
 
     } else {
         return -1;
@@ -799,6 +1338,221 @@ musly_track_analyze_audiofile(
     return 0;
 }
 
+int
+musly_track_analyze_audiobuffer(
+        musly_jukebox* jukebox,
+        const unsigned char* buffer,
+        size_t size,
+        float excerpt_length,
+        float excerpt_start,
+        musly_track* track)
+{
+    if (!jukebox || !jukebox->decoder || !buffer) {
+        return -1;
+    }
+
+    // decode the specified excerpt straight from memory
+    std::vector<float> pcm;
+    int sample_rate;
+    if (jukebox->decoder->decodeto_mono_float(buffer, size,
+            excerpt_length, excerpt_start, pcm, sample_rate) == 0) {
+        return -1;
+    }
+
+    // pass it on to build the similarity model
+    return musly_track_analyze_pcm_rate(jukebox, pcm.data(), pcm.size(),
+            sample_rate, track);
+}
+
+int
+musly_track_analyze_audiofiles(
+        musly_jukebox* jukebox,
+        const char** audiofiles,
+        int num_files,
+        float excerpt_length,
+        float excerpt_start,
+        int decode_threads,
+        int analyze_threads,
+        int serialize_threads,
+        musly_audiofile_sink sink,
+        void* user_data)
+{
+    if (!jukebox || !jukebox->method || !jukebox->decoder || !sink ||
+            (num_files < 0) || (!audiofiles && (num_files > 0))) {
+        return -1;
+    }
+    std::vector<std::string> files(num_files);
+    for (int i = 0; i < num_files; i++) {
+        if (!audiofiles[i]) {
+            return -1;
+        }
+        files[i] = audiofiles[i];
+    }
+
+    musly::ingestion pipeline(*jukebox->method, *jukebox->decoder,
+            [jukebox](musly_track* track, unsigned char* bin) {
+                musly_track_tobin(jukebox, track, bin);
+            }, musly_track_binsize(jukebox));
+    if (pipeline.set_threads(decode_threads, analyze_threads,
+            serialize_threads) != 0) {
+        return -1;
+    }
+    return pipeline.run(files, excerpt_length, excerpt_start,
+            [sink, user_data](int index, int result, musly_track* track,
+                    const unsigned char* bin) {
+                return sink(user_data, index, result, track, bin);
+            });
+}
+
+musly_analyzer*
+musly_analyzer_create(
+        musly_jukebox* jukebox)
+{
+    if (!jukebox || !jukebox->method) {
+        return NULL;
+    }
+
+    musly_analyzer* analyzer = new struct _musly_analyzer;
+    analyzer->jukebox = jukebox;
+    analyzer->context = jukebox->method->analysis_context_alloc();
+    return analyzer;
+}
+
+void
+musly_analyzer_free(
+        musly_analyzer* analyzer)
+{
+    if (!analyzer) {
+        return;
+    }
+
+    delete analyzer->context;
+    delete analyzer;
+}
+
+int
+musly_analyzer_analyze_pcm(
+        musly_analyzer* analyzer,
+        float* mono_22khz_pcm,
+        int length_pcm,
+        musly_track* track)
+{
+    if (!analyzer || !mono_22khz_pcm || !track) {
+        return -1;
+    }
+
+    return analyzer->jukebox->method->analyze_track(mono_22khz_pcm,
+            length_pcm, track, analyzer->context);
+}
+
+int
+musly_analyzer_analyze_pcm_rate(
+        musly_analyzer* analyzer,
+        float* mono_pcm,
+        int length_pcm,
+        int sample_rate,
+        musly_track* track)
+{
+    if (!analyzer || !mono_pcm || !track) {
+        return -1;
+    }
+
+    return analyzer->jukebox->method->analyze_track_rate(mono_pcm,
+            length_pcm, sample_rate, track, analyzer->context);
+}
+
+int
+musly_analyzer_analyze_audiofile(
+        musly_analyzer* analyzer,
+        const char* audiofile,
+        float excerpt_length,
+        float excerpt_start,
+        musly_track* track)
+{
+    if (!analyzer || !analyzer->jukebox->decoder) {
+        return -1;
+    }
+
+    // decode the specified excerpt
+    std::vector<float> pcm;
+    int sample_rate;
+    if (analyzer->jukebox->decoder->decodeto_mono_float(audiofile,
+            excerpt_length, excerpt_start, pcm, sample_rate) == 0) {
+        return -1;
+    }
+
+    // pass it on to build the similarity model
+    return musly_analyzer_analyze_pcm_rate(analyzer, pcm.data(), pcm.size(),
+            sample_rate, track);
+}
+
+int
+musly_analyzer_analyze_audiobuffer(
+        musly_analyzer* analyzer,
+        const unsigned char* buffer,
+        size_t size,
+        float excerpt_length,
+        float excerpt_start,
+        musly_track* track)
+{
+    if (!analyzer || !analyzer->jukebox->decoder || !buffer) {
+        return -1;
+    }
+
+    // decode the specified excerpt straight from memory
+    std::vector<float> pcm;
+    int sample_rate;
+    if (analyzer->jukebox->decoder->decodeto_mono_float(buffer, size,
+            excerpt_length, excerpt_start, pcm, sample_rate) == 0) {
+        return -1;
+    }
+
+    // pass it on to build the similarity model
+    return musly_analyzer_analyze_pcm_rate(analyzer, pcm.data(), pcm.size(),
+            sample_rate, track);
+}
+
+int
+musly_analyzer_begin(
+        musly_analyzer* analyzer,
+        int length_pcm,
+        float peak)
+{
+    if (!analyzer) {
+        return -1;
+    }
+
+    return analyzer->jukebox->method->analyze_begin(length_pcm, peak,
+            analyzer->context);
+}
+
+int
+musly_analyzer_feed(
+        musly_analyzer* analyzer,
+        const float* mono_22khz_pcm,
+        int length_pcm)
+{
+    if (!analyzer) {
+        return -1;
+    }
+
+    return analyzer->jukebox->method->analyze_feed(mono_22khz_pcm,
+            length_pcm, analyzer->context);
+}
+
+int
+musly_analyzer_finish(
+        musly_analyzer* analyzer,
+        musly_track* track)
+{
+    if (!analyzer || !track) {
+        return -1;
+    }
+
+    return analyzer->jukebox->method->analyze_finish(track,
+            analyzer->context);
+}
+
 typedef std::pair<float, musly_trackid> knn;
 struct knn_comp {
     bool operator()(knn const& lhs, knn const& rhs) {
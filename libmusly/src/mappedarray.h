@@ -0,0 +1,101 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_MAPPEDARRAY_H_
+#define MUSLY_MAPPEDARRAY_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace musly {
+
+/** An array that is either a vector of its own, or a view of memory owned
+ * by someone else, such as a section of a memory-mapped jukebox file (see
+ * mapped_jukebox). A view is read in place and copied into a vector of its
+ * own before the first change, so a jukebox restored from a file starts
+ * without copying anything, and only pays for the copy once it changes.
+ *
+ * Reading goes through the const accessors, changing through own(); the
+ * pointer returned by data() is invalidated by own().
+ */
+template <typename T>
+class mapped_array {
+public:
+    mapped_array() : view(NULL), length(0) {}
+
+    /** Make the array a view of the \p size elements at \p data, which must
+     * stay valid until the array changes or is destroyed.
+     */
+    void
+    map(const T* data, size_t size) {
+        std::vector<T>().swap(owned);
+        view = data;
+        length = size;
+    }
+
+    /** Return whether the array is a view of memory it does not own.
+     */
+    inline bool
+    is_mapped() const {
+        return view != NULL;
+    }
+
+    inline size_t
+    size() const {
+        return view ? length : owned.size();
+    }
+
+    inline bool
+    empty() const {
+        return size() == 0;
+    }
+
+    inline const T*
+    data() const {
+        return view ? view : owned.data();
+    }
+
+    inline const T&
+    operator[](size_t index) const {
+        return data()[index];
+    }
+
+    inline const T*
+    begin() const {
+        return data();
+    }
+
+    inline const T*
+    end() const {
+        return data() + size();
+    }
+
+    /** Return the vector to change the array with, copying the elements
+     * into it first if the array is a view.
+     */
+    std::vector<T>&
+    own() {
+        if (view) {
+            owned.assign(view, view + length);
+            view = NULL;
+            length = 0;
+        }
+        return owned;
+    }
+
+private:
+    std::vector<T> owned;
+    const T* view;
+    size_t length;
+};
+
+} /* namespace musly */
+#endif /* MUSLY_MAPPEDARRAY_H_ */
@@ -0,0 +1,147 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.h"
+
+namespace musly {
+
+mapped_file::mapped_file() :
+        contents(NULL),
+        length(0)
+#ifdef _WIN32
+        , mapping(NULL)
+#endif
+{
+}
+
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool
+mapped_file::open(
+        const std::string& filename)
+{
+    close();
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        CloseHandle(file);
+        return false;
+    }
+    length = (size_t)file_size.QuadPart;
+    if (length == 0) {
+        // empty files cannot be mapped
+        CloseHandle(file);
+        return true;
+    }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) {
+        length = 0;
+        return false;
+    }
+    contents = static_cast<const unsigned char*>(
+            MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!contents) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void
+mapped_file::close()
+{
+    if (contents) {
+        UnmapViewOfFile(contents);
+    }
+    if (mapping) {
+        CloseHandle(mapping);
+    }
+    contents = NULL;
+    mapping = NULL;
+    length = 0;
+}
+
+#else
+
+bool
+mapped_file::open(
+        const std::string& filename)
+{
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+    length = (size_t)st.st_size;
+    if (length == 0) {
+        // empty files cannot be mapped
+        ::close(fd);
+        return true;
+    }
+    void* p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        length = 0;
+        return false;
+    }
+    contents = static_cast<const unsigned char*>(p);
+    return true;
+}
+
+void
+mapped_file::close()
+{
+    if (contents) {
+        munmap(const_cast<unsigned char*>(contents), length);
+    }
+    contents = NULL;
+    length = 0;
+}
+
+#endif
+
+const unsigned char*
+mapped_file::data() const
+{
+    return contents;
+}
+
+size_t
+mapped_file::size() const
+{
+    return length;
+}
+
+} /* namespace musly */
@@ -0,0 +1,64 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_MAPPEDFILE_H_
+#define MUSLY_MAPPEDFILE_H_
+
+#include <cstddef>
+#include <string>
+
+namespace musly {
+
+/** A file mapped read-only into memory, so it can be read in place, paged
+ * in by the operating system as it is accessed, instead of being copied
+ * into buffers of our own.
+ */
+class mapped_file {
+public:
+    mapped_file();
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    /** Map \p filename, unmapping a file mapped before.
+     * \returns true on success.
+     */
+    bool
+    open(
+            const std::string& filename);
+
+    /** Unmap the file.
+     */
+    void
+    close();
+
+    /** Return the contents of the file, or NULL if none is mapped or it is
+     * empty.
+     */
+    const unsigned char*
+    data() const;
+
+    /** Return the size of the file in bytes.
+     */
+    size_t
+    size() const;
+
+private:
+    const unsigned char* contents;
+    size_t length;
+#ifdef _WIN32
+    void* mapping;
+#endif
+};
+
+} /* namespace musly */
+#endif /* MUSLY_MAPPEDFILE_H_ */
@@ -0,0 +1,245 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <cstdio>
+#include <cstring>
+
+#include "minilog.h"
+#include "mappedjukebox.h"
+
+namespace musly {
+
+namespace {
+
+const char magic[8] = {'M', 'U', 'S', 'L', 'Y', 'J', 'B', 'X'};
+const uint32_t byteorder = 0x01020304;
+const int name_size = 32;
+const size_t header_size = 96;
+const size_t entry_size = 24;
+
+bool
+little_endian()
+{
+    unsigned char first;
+    std::memcpy(&first, &byteorder, 1);
+    return first == 0x04;
+}
+
+uint64_t
+aligned(
+        uint64_t offset)
+{
+    return (offset + mapped_jukebox::alignment - 1)
+            / mapped_jukebox::alignment * mapped_jukebox::alignment;
+}
+
+/** Move \p from over \p to. A mapping of the file replaced stays valid.
+ */
+bool
+replace_file(
+        const std::string& from,
+        const std::string& to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING)
+            != 0;
+#else
+    return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+} /* anonymous namespace */
+
+void
+mapped_jukebox::writer::add(
+        uint32_t tag,
+        const void* data,
+        uint64_t size)
+{
+    section s = {tag, data, size, -1};
+    sections.push_back(s);
+}
+
+void
+mapped_jukebox::writer::add_copy(
+        uint32_t tag,
+        const void* data,
+        uint64_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    copies.push_back(std::vector<unsigned char>(bytes, bytes + size));
+    section s = {tag, NULL, size, (int)copies.size() - 1};
+    sections.push_back(s);
+}
+
+int
+mapped_jukebox::writer::write(
+        const std::string& filename,
+        const std::string& method,
+        const std::string& decoder,
+        int track_size) const
+{
+    if (!little_endian()) {
+        MINILOG(logERROR) << "Mapped jukebox files need a little-endian "
+                << "machine.";
+        return -1;
+    }
+    if ((method.size() >= name_size) || (decoder.size() >= name_size)) {
+        return -1;
+    }
+
+    // the header and the table of sections, then the sections
+    std::vector<unsigned char> head(header_size + sections.size()*entry_size);
+    unsigned char* p = head.data();
+    const uint32_t version = format_version;
+    const uint32_t size = track_size;
+    const uint32_t count = (uint32_t)sections.size();
+    std::memcpy(p, magic, sizeof(magic));
+    std::memcpy(p + 8, &version, 4);
+    std::memcpy(p + 12, &byteorder, 4);
+    std::memcpy(p + 16, &size, 4);
+    std::memcpy(p + 20, &count, 4);
+    std::memcpy(p + 24, method.c_str(), method.size());
+    std::memcpy(p + 24 + name_size, decoder.c_str(), decoder.size());
+
+    uint64_t offset = aligned(head.size());
+    for (size_t i = 0; i < sections.size(); i++) {
+        unsigned char* entry = p + header_size + i*entry_size;
+        std::memcpy(entry, &sections[i].tag, 4);
+        std::memcpy(entry + 8, &offset, 8);
+        std::memcpy(entry + 16, &sections[i].size, 8);
+        offset = aligned(offset + sections[i].size);
+    }
+
+    // Write to a file next to the target and move it over the target only
+    // when complete. Jukeboxes mapping the target, even the one written,
+    // keep reading the file they mapped.
+    const std::string temp_filename = filename + ".tmp";
+    FILE* f = fopen(temp_filename.c_str(), "wb");
+    if (!f) {
+        MINILOG(logERROR) << "Could not write the jukebox to " << filename;
+        return -1;
+    }
+    const unsigned char padding[alignment] = {0};
+    bool ok = fwrite(head.data(), 1, head.size(), f) == head.size();
+    uint64_t written = head.size();
+    for (size_t i = 0; ok && (i < sections.size()); i++) {
+        const size_t pad = (size_t)(aligned(written) - written);
+        ok = fwrite(padding, 1, pad, f) == pad;
+        const section& s = sections[i];
+        const void* data = (s.copy < 0) ? s.data : copies[s.copy].data();
+        ok = ok && ((s.size == 0) ||
+                (fwrite(data, 1, (size_t)s.size, f) == s.size));
+        written = aligned(written) + s.size;
+    }
+    ok = (fclose(f) == 0) && ok;
+    ok = ok && replace_file(temp_filename, filename);
+    if (!ok) {
+        std::remove(temp_filename.c_str());
+        MINILOG(logERROR) << "Could not write the jukebox to " << filename;
+        return -1;
+    }
+    return 0;
+}
+
+mapped_jukebox::mapped_jukebox() :
+        track_size(0)
+{
+}
+
+bool
+mapped_jukebox::open(
+        const std::string& filename)
+{
+    sections.clear();
+    if (!little_endian() || !file.open(filename)) {
+        return false;
+    }
+    const unsigned char* p = file.data();
+    const size_t length = file.size();
+    uint32_t version, order, size, count;
+    if ((length < header_size) || (std::memcmp(p, magic, sizeof(magic)) != 0)) {
+        MINILOG(logERROR) << filename << " is not a mapped jukebox file.";
+        file.close();
+        return false;
+    }
+    std::memcpy(&version, p + 8, 4);
+    std::memcpy(&order, p + 12, 4);
+    std::memcpy(&size, p + 16, 4);
+    std::memcpy(&count, p + 20, 4);
+    if ((version != format_version) || (order != byteorder) ||
+            (count > (length - header_size) / entry_size) ||
+            (p[24 + name_size - 1] != 0) ||
+            (p[24 + 2*name_size - 1] != 0)) {
+        MINILOG(logERROR) << filename << " has an unsupported version or "
+                << "byte order, or is damaged.";
+        file.close();
+        return false;
+    }
+    method = reinterpret_cast<const char*>(p + 24);
+    decoder = reinterpret_cast<const char*>(p + 24 + name_size);
+    track_size = (int)size;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const unsigned char* entry = p + header_size + i*entry_size;
+        section s;
+        std::memcpy(&s.tag, entry, 4);
+        std::memcpy(&s.offset, entry + 8, 8);
+        std::memcpy(&s.size, entry + 16, 8);
+        if ((s.offset % alignment != 0) || (s.offset > length) ||
+                (s.size > length - s.offset)) {
+            MINILOG(logERROR) << filename << " is truncated or damaged.";
+            sections.clear();
+            file.close();
+            return false;
+        }
+        sections.push_back(s);
+    }
+    return true;
+}
+
+const std::string&
+mapped_jukebox::get_method() const
+{
+    return method;
+}
+
+const std::string&
+mapped_jukebox::get_decoder() const
+{
+    return decoder;
+}
+
+int
+mapped_jukebox::get_track_size() const
+{
+    return track_size;
+}
+
+const unsigned char*
+mapped_jukebox::find(
+        uint32_t tag,
+        uint64_t& size) const
+{
+    for (size_t i = 0; i < sections.size(); i++) {
+        if (sections[i].tag == tag) {
+            size = sections[i].size;
+            return file.data() + sections[i].offset;
+        }
+    }
+    size = 0;
+    return NULL;
+}
+
+} /* namespace musly */
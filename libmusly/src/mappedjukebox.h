@@ -0,0 +1,155 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_MAPPEDJUKEBOX_H_
+#define MUSLY_MAPPEDJUKEBOX_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "mappedfile.h"
+
+namespace musly {
+
+/** A jukebox file laid out to be memory-mapped and used in place.
+ *
+ * The file starts with a header of 96 bytes, all numbers little-endian:
+ *  - the magic bytes "MUSLYJBX",
+ *  - the format version (uint32),
+ *  - 0x01020304 (uint32), to tell the byte order,
+ *  - the size of a musly_track in floats (uint32),
+ *  - the number of sections (uint32),
+ *  - the method and the decoder name, NUL-padded to 32 bytes each,
+ *  - 8 reserved bytes.
+ *
+ * A table of the sections follows, 24 bytes each: a tag (uint32), 4
+ * reserved bytes, and the offset and size in bytes of the section (uint64
+ * each). Each section starts at a multiple of 64 bytes from the start of
+ * the file, so arrays of floats and ints in it can be used in place, with
+ * the alignment the columns of a trackstore need.
+ *
+ * The contents and tags of the sections are up to the methods, see
+ * method::serialize_sections(). As the sections are written and used as
+ * they are in memory, only little-endian machines can write and map the
+ * files.
+ */
+class mapped_jukebox {
+public:
+    /** The version of the file format.
+     */
+    static const uint32_t format_version = 1;
+
+    /** The alignment of sections in bytes.
+     */
+    static const int alignment = 64;
+
+    /** Return the tag of four characters \p a to \p d.
+     */
+    static constexpr uint32_t
+    tag(
+            char a,
+            char b,
+            char c,
+            char d) {
+        return (uint32_t)(unsigned char)a | ((uint32_t)(unsigned char)b << 8)
+                | ((uint32_t)(unsigned char)c << 16)
+                | ((uint32_t)(unsigned char)d << 24);
+    }
+
+    /** Collects the sections of a jukebox file, then writes it.
+     */
+    class writer {
+    public:
+        /** Add a section of \p size bytes at \p data, which must stay
+         * valid until the file is written.
+         */
+        void
+        add(
+                uint32_t tag,
+                const void* data,
+                uint64_t size);
+
+        /** Add a section of a copy of the \p size bytes at \p data.
+         */
+        void
+        add_copy(
+                uint32_t tag,
+                const void* data,
+                uint64_t size);
+
+        /** Write the sections to \p filename, with the given method and
+         * decoder name and size of a musly_track in floats. The file is
+         * written next to \p filename and then renamed to it, so mappings
+         * of a file replaced stay valid.
+         * \returns 0 on success, -1 on failure.
+         */
+        int
+        write(
+                const std::string& filename,
+                const std::string& method,
+                const std::string& decoder,
+                int track_size) const;
+
+    private:
+        struct section {
+            uint32_t tag;
+            const void* data;
+            uint64_t size;
+            int copy;
+        };
+        std::vector<section> sections;
+        std::vector<std::vector<unsigned char> > copies;
+    };
+
+    mapped_jukebox();
+
+    /** Map \p filename and check its header and table of sections.
+     * \returns true on success.
+     */
+    bool
+    open(
+            const std::string& filename);
+
+    const std::string&
+    get_method() const;
+
+    const std::string&
+    get_decoder() const;
+
+    /** Return the size of a musly_track in floats.
+     */
+    int
+    get_track_size() const;
+
+    /** Return the section tagged \p tag and its \p size in bytes, or NULL
+     * if there is none. The section is valid as long as the file is open.
+     */
+    const unsigned char*
+    find(
+            uint32_t tag,
+            uint64_t& size) const;
+
+private:
+    struct section {
+        uint32_t tag;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    mapped_file file;
+    std::string method;
+    std::string decoder;
+    int track_size;
+    std::vector<section> sections;
+};
+
+} /* namespace musly */
+#endif /* MUSLY_MAPPEDJUKEBOX_H_ */
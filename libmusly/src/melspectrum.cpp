@@ -18,19 +18,23 @@ namespace musly {
 melspectrum::melspectrum(
         int powerspectrum_bins,
         int mel_bins,
-        int sample_rate) :
+        int sample_rate,
+        int filter_rate) :
                 filterbank(mel_bins, powerspectrum_bins)
 {
     // our mel filters start at a minimum frequency of 20hz
     float min_freq = 20;
+    if (filter_rate <= 0) {
+        filter_rate = sample_rate;
+    }
 
     // determine the frequency of each powerspectrum bin
     Eigen::VectorXf ps_freq = Eigen::VectorXf::LinSpaced(powerspectrum_bins,
             0.0f, sample_rate/2.0f);
 
     // determine the best mel bin for each frequency
-    Eigen::VectorXf freq = Eigen::VectorXf::LinSpaced(sample_rate/2-min_freq,
-            min_freq, sample_rate/2);
+    Eigen::VectorXf freq = Eigen::VectorXf::LinSpaced(filter_rate/2-min_freq,
+            min_freq, filter_rate/2);
     Eigen::VectorXf mel = ((freq/700.0f).array() + 1.0f).log() * 1127.01048f;
     Eigen::VectorXf mel_idx = Eigen::VectorXf::LinSpaced(mel_bins+2,
             1.0f, mel.maxCoeff());
@@ -69,6 +73,31 @@ melspectrum::melspectrum(
         }
     }
 
+    // copy each filter into a dense band, the filters are contiguous
+    band_first.assign(mel_bins, 0);
+    std::vector<int> band_last(mel_bins, -1);
+    for (int j = 0; j < filterbank.outerSize(); j++) {
+        for (Eigen::SparseMatrix<float>::InnerIterator it(filterbank, j); it;
+                ++it) {
+            if (band_last[it.row()] < 0) {
+                band_first[it.row()] = j;
+            }
+            band_last[it.row()] = j;
+        }
+    }
+    band_offset.assign(mel_bins + 1, 0);
+    for (int i = 0; i < mel_bins; i++) {
+        band_offset[i+1] = band_offset[i] + (band_last[i] - band_first[i] + 1);
+    }
+    band_weights.assign(band_offset[mel_bins], 0.0f);
+    for (int j = 0; j < filterbank.outerSize(); j++) {
+        for (Eigen::SparseMatrix<float>::InnerIterator it(filterbank, j); it;
+                ++it) {
+            band_weights[band_offset[it.row()] + j - band_first[it.row()]] =
+                    it.value();
+        }
+    }
+
     MINILOG(logTRACE) << "Mel filterbank: " << filterbank;
 }
 
@@ -77,7 +106,7 @@ melspectrum::~melspectrum()
 }
 
 Eigen::MatrixXf
-melspectrum::from_powerspectrum(const Eigen::MatrixXf& ps)
+melspectrum::from_powerspectrum(const Eigen::MatrixXf& ps) const
 {
     MINILOG(logTRACE) << "Mel filtering specturm. size=" << ps.rows()
             << "x" << ps.cols();
@@ -93,5 +122,22 @@ melspectrum::from_powerspectrum(const Eigen::MatrixXf& ps)
     return mels;
 }
 
+void
+melspectrum::from_frame(
+        const float* ps,
+        float* mel) const
+{
+    for (int i = 0; i < (int)band_first.size(); i++) {
+        const float* w = &band_weights[band_offset[i]];
+        const float* p = ps + band_first[i];
+        const int size = band_offset[i+1] - band_offset[i];
+        float sum = 0;
+        for (int j = 0; j < size; j++) {
+            sum += w[j] * p[j];
+        }
+        mel[i] = sum;
+    }
+}
+
 
 } /* namespace musly */
@@ -24,6 +24,15 @@ private:
      */
     Eigen::SparseMatrix<float> filterbank;
 
+    /** The filterbank as dense bands for from_frame(): the filter of mel
+     * bin i has the weights band_weights[band_offset[i]] up to
+     * band_weights[band_offset[i+1]] for the powerspectrum bins starting
+     * at band_first[i].
+     */
+    std::vector<int> band_first;
+    std::vector<int> band_offset;
+    std::vector<float> band_weights;
+
 public:
     /** Initializes the Mel filterbanks. The Mel filterbanks are computed using
      * the sample rate and number of bins in the powerspectum.
@@ -31,11 +40,15 @@ public:
      * \param mel_bins The number of mel filters or bins to compute from the
      * powerspectrum.
      * \param sample_rate The original sample rate of the PCM signal.
+     * \param filter_rate The sample rate whose frequency range the filters
+     * span, up to its Nyquist frequency, or 0 for \p sample_rate. Signals
+     * of other rates are thus filtered like signals of this one.
      */
     melspectrum(
             int powerspectrum_bins,
             int mel_bins,
-            int sample_rate);
+            int sample_rate,
+            int filter_rate = 0);
 
     /** Currently empty destructor
      */
@@ -47,7 +60,17 @@ public:
      * \returns The Mel spectrum as a matrix (frequency, time). Column major.
      */
     Eigen::MatrixXf from_powerspectrum(
-            const Eigen::MatrixXf& ps);
+            const Eigen::MatrixXf& ps) const;
+
+    /** Computes the Mel spectrum of a single frame, like
+     * from_powerspectrum() does for each column.
+     * \param ps The powerspectrum bins of the frame.
+     * \param mel The output array of Mel bins.
+     */
+    void
+    from_frame(
+            const float* ps,
+            float* mel) const;
 };
 
 } /* namespace musly */
@@ -11,6 +11,8 @@
  */
 
 #include <cstdio>
+#include <map>
+#include <vector>
 #include "method.h"
 
 namespace musly {
@@ -24,6 +26,56 @@ method::~method()
 {
 }
 
+method::analysis_context::~analysis_context()
+{
+}
+
+method::analysis_context*
+method::analysis_context_alloc() const
+{
+    return new analysis_context();
+}
+
+int
+method::analyze_track_rate(
+        float* pcm,
+        int length,
+        int sample_rate,
+        musly_track* track,
+        analysis_context* context) const
+{
+    if (sample_rate != 22050) {
+        return -1;
+    }
+    return analyze_track(pcm, length, track, context);
+}
+
+int
+method::analyze_begin(
+        int length,
+        float peak,
+        analysis_context* context) const
+{
+    return -1;
+}
+
+int
+method::analyze_feed(
+        const float* pcm,
+        int length,
+        analysis_context* context) const
+{
+    return -1;
+}
+
+int
+method::analyze_finish(
+        musly_track* track,
+        analysis_context* context) const
+{
+    return -1;
+}
+
 
 int
 method::track_addfield_floats(
@@ -85,6 +137,64 @@ method::set_musicstyle(
     return 0;
 }
 
+int
+method::similarity_byid(
+        musly_trackid seed_trackid,
+        musly_trackid* trackids,
+        int length,
+        float* similarities)
+{
+    // default: tracks are not retained
+    return -1;
+}
+
+int
+method::similarity_batch(
+        musly_trackid* seed_trackids,
+        int num_seeds,
+        musly_trackid* trackids,
+        int length,
+        float* similarities)
+{
+    // default: tracks are not retained
+    return -1;
+}
+
+int
+method::similarity_allpairs(
+        musly_trackid* trackids,
+        int length,
+        int block_rows,
+        musly_similarity_sink sink,
+        void* user_data)
+{
+    // default: tracks are not retained
+    return -1;
+}
+
+int
+method::knn(
+        musly_trackid seed_trackid,
+        musly_trackid* trackids,
+        int length,
+        float* knn_similarities,
+        musly_trackid* knn_trackids,
+        int k)
+{
+    // default: tracks are not retained
+    return -1;
+}
+
+int
+method::store_tracks(
+        musly_track** tracks,
+        musly_trackid* trackids,
+        int length)
+{
+    // default: tracks are not retained
+    return -1;
+}
+
 int
 method::guess_neighbors(
         musly_trackid seed,
@@ -97,6 +207,47 @@ method::guess_neighbors(
     return -1;
 }
 
+int
+method::set_option(
+        const char* name,
+        int value)
+{
+    // no options
+    return -1;
+}
+
+int
+method::get_option(
+        const char* name)
+{
+    // no options
+    return -1;
+}
+
+void
+method::positions_of(
+        const musly_trackid* trackids,
+        int length,
+        int* positions)
+{
+    // find the positions in a single pass over all tracks
+    std::map<musly_trackid, int> wanted;
+    for (int i = 0; i < length; i++) {
+        wanted[trackids[i]] = -1;
+    }
+    std::vector<musly_trackid> all(get_trackcount());
+    get_trackids(all.data());
+    for (int pos = 0; pos < (int)all.size(); pos++) {
+        std::map<musly_trackid, int>::iterator it = wanted.find(all[pos]);
+        if (it != wanted.end()) {
+            it->second = pos;
+        }
+    }
+    for (int i = 0; i < length; i++) {
+        positions[i] = wanted[trackids[i]];
+    }
+}
+
 int
 method::serialize_metadata(
         unsigned char* buffer) {
@@ -108,7 +259,12 @@ method::serialize_metadata(
 
 int
 method::deserialize_metadata(
-        unsigned char* buffer) {
+        unsigned char* buffer,
+        int& size) {
+    if (size < (int)sizeof(int)) {
+        return -1;
+    }
+    size = sizeof(int);
     int expected_tracks = *(int*)(buffer);
     return expected_tracks;
 }
@@ -130,5 +286,19 @@ method::deserialize_trackdata(
     return -1;
 }
 
+int
+method::serialize_sections(
+        mapped_jukebox::writer& out) {
+    // default: not implemented
+    return -1;
+}
+
+int
+method::map_sections(
+        const mapped_jukebox& in) {
+    // default: not implemented
+    return -1;
+}
+
 
 } /* namespace musly */
@@ -16,6 +16,7 @@
 #include <string>
 #include <vector>
 #include "plugins.h"
+#include "mappedjukebox.h"
 #include "musly/musly_types.h"
 
 namespace musly {
@@ -69,6 +70,15 @@ protected:
             int num_floats);
 
 public:
+    /** The per-thread state of analyze_track(), such as FFT plans and
+     * scratch buffers. Methods needing any derive their own context from
+     * this class and allocate it in analysis_context_alloc().
+     */
+    class analysis_context {
+    public:
+        virtual ~analysis_context();
+    };
+
     method();
     virtual ~method();
 
@@ -102,14 +112,81 @@ public:
     track_tostr(
             musly_track* track);
 
-    /**
+    /** Allocate a context for analyze_track(). The default implementation
+     * returns an empty one. Free it with delete.
+     */
+    virtual analysis_context*
+    analysis_context_alloc() const;
+
+    /** Compute the features of a track from a mono 22050 Hz PCM signal.
+     * All state the analysis modifies lives in \p context, so calls with
+     * distinct contexts may run concurrently on the same method.
      *
+     * \param pcm The PCM signal.
+     * \param length The number of samples in \p pcm.
+     * \param track The musly_track to write the features to.
+     * \param context A context from analysis_context_alloc() of this method.
+     * \returns 0 on success, a positive value if the features could not be
+     * estimated.
      */
     virtual int
     analyze_track(
             float* pcm,
             int length,
-            musly_track* track) = 0;
+            musly_track* track,
+            analysis_context* context) const = 0;
+
+    /** Compute the features of a track like analyze_track(), from a mono
+     * PCM signal of \p sample_rate Hz. Methods supporting this analyze the
+     * signal at its own rate with windows and filters equivalent to the
+     * ones at 22050 Hz, which is cheaper than resampling it first. The
+     * default implementation supports 22050 Hz only.
+     *
+     * \returns like analyze_track(), or -1 if the sample rate is not
+     * supported.
+     */
+    virtual int
+    analyze_track_rate(
+            float* pcm,
+            int length,
+            int sample_rate,
+            musly_track* track,
+            analysis_context* context) const;
+
+    /** Start computing the features of a track from a mono 22050 Hz PCM
+     * signal that is fed chunk by chunk with analyze_feed(), instead of
+     * passed at once. Methods supporting this keep the state of the
+     * analysis in \p context. The default implementation fails.
+     *
+     * \param length The number of samples that will be fed, or 0 if
+     * unknown.
+     * \param peak The peak amplitude of the signal, or 0 if unknown.
+     * \param context A context from analysis_context_alloc() of this method.
+     * \returns 0 on success, -1 on failure.
+     */
+    virtual int
+    analyze_begin(
+            int length,
+            float peak,
+            analysis_context* context) const;
+
+    /** Feed the next \p length samples of the signal to an analysis
+     * started with analyze_begin(). Returns 0 on success, -1 on failure.
+     */
+    virtual int
+    analyze_feed(
+            const float* pcm,
+            int length,
+            analysis_context* context) const;
+
+    /** Finish an analysis started with analyze_begin() and write the
+     * features to \p track. Returns 0 on success, a positive value if the
+     * features could not be estimated, -1 on failure.
+     */
+    virtual int
+    analyze_finish(
+            musly_track* track,
+            analysis_context* context) const;
 
     /**
      *
@@ -123,6 +200,111 @@ public:
             int length,
             float* similarities) = 0;
 
+    /**
+     * Computes the similarity between a registered seed track and other
+     * registered tracks, using the features retained by add_tracks() or
+     * store_tracks().
+     *
+     * \param seed_trackid The id of the seed track.
+     * \param trackids The ids of the tracks to compare to, or
+     * <tt>NULL</tt> to compare to all registered tracks in the order of
+     * get_trackids().
+     * \param length The length of \p trackids and \p similarities.
+     * \param similarities The output array.
+     * \returns 0 on success, or -1 if the method does not retain track
+     * features, or a track is unknown or has no features stored.
+     */
+    virtual int
+    similarity_byid(
+            musly_trackid seed_trackid,
+            musly_trackid* trackids,
+            int length,
+            float* similarities);
+
+    /**
+     * Computes the similarities between several registered seed tracks and
+     * other registered tracks, using the features retained by add_tracks()
+     * or store_tracks(). Row \p i of the result holds the same values as
+     * similarity_byid() for the \p i th seed.
+     *
+     * \param seed_trackids The ids of the seed tracks.
+     * \param num_seeds The length of \p seed_trackids.
+     * \param trackids The ids of the tracks to compare to, or <tt>NULL</tt>
+     * to compare to all registered tracks in the order of get_trackids().
+     * \param length The length of \p trackids.
+     * \param similarities The output array of \p num_seeds rows of
+     * \p length similarities each.
+     * \returns 0 on success, or -1 on an error.
+     */
+    virtual int
+    similarity_batch(
+            musly_trackid* seed_trackids,
+            int num_seeds,
+            musly_trackid* trackids,
+            int length,
+            float* similarities);
+
+    /**
+     * Computes the similarities between all pairs of the given registered
+     * tracks, using the features retained by add_tracks() or
+     * store_tracks(). Each unordered pair is computed only once; the upper
+     * triangle of the matrix is passed to \p sink in blocks of
+     * \p block_rows rows (see musly_similarity_sink).
+     *
+     * \param trackids The ids of the tracks, or <tt>NULL</tt> for all
+     * registered tracks in the order of get_trackids().
+     * \param length The length of \p trackids.
+     * \param block_rows The number of rows to pass to \p sink at once.
+     * \param sink The callback receiving the rows.
+     * \param user_data Passed on to \p sink.
+     * \returns 0 on success, or -1 on an error or if \p sink aborted.
+     */
+    virtual int
+    similarity_allpairs(
+            musly_trackid* trackids,
+            int length,
+            int block_rows,
+            musly_similarity_sink sink,
+            void* user_data);
+
+    /**
+     * Finds the \p k registered tracks most similar to a registered seed
+     * track, using the features retained by add_tracks() or store_tracks().
+     * Gives the same result as similarity_byid() followed by musly_findmin(),
+     * without materializing all \p length similarities.
+     *
+     * \param seed_trackid The id of the seed track.
+     * \param trackids The ids of the candidate tracks, or <tt>NULL</tt> to
+     * consider all registered tracks.
+     * \param length The length of \p trackids.
+     * \param knn_similarities The output array for the \p k smallest
+     * similarities, in ascending order.
+     * \param knn_trackids The output array for the corresponding track ids.
+     * \param k The number of neighbors to find.
+     * \returns the number of neighbors written, or -1 on an error.
+     */
+    virtual int
+    knn(
+            musly_trackid seed_trackid,
+            musly_trackid* trackids,
+            int length,
+            float* knn_similarities,
+            musly_trackid* knn_trackids,
+            int k);
+
+    /**
+     * Stores the features of already registered tracks for use with
+     * similarity_byid(), without changing any other jukebox state.
+     *
+     * \returns the number of tracks stored, or -1 if the method does not
+     * retain track features.
+     */
+    virtual int
+    store_tracks(
+            musly_track** tracks,
+            musly_trackid* trackids,
+            int length);
+
     /**
      *
      */
@@ -134,6 +316,25 @@ public:
             musly_trackid* limit_to,
             int num_limit_to);
 
+    /**
+     * Sets a method-specific option.
+     *
+     * \returns 0 on success, or -1 if the option is unknown or the value
+     * cannot be set.
+     */
+    virtual int
+    set_option(
+            const char* name,
+            int value);
+
+    /**
+     * Returns the value of a method-specific option, or -1 if the option
+     * is unknown.
+     */
+    virtual int
+    get_option(
+            const char* name);
+
     /**
      *
      */
@@ -179,6 +380,20 @@ public:
     get_trackids(
             musly_trackid* trackids) = 0;
 
+    /**
+     * Looks up the positions of registered tracks in the order of
+     * get_trackids(), which serialize_trackdata() skips tracks by.
+     *
+     * \param trackids The ids of the tracks to look up.
+     * \param length The length of \p trackids and \p positions.
+     * \param positions The output array, -1 for unknown tracks.
+     */
+    virtual void
+    positions_of(
+            const musly_trackid* trackids,
+            int length,
+            int* positions);
+
     /**
      * Writes metadata about the jukebox state into a binary buffer.
      *
@@ -218,16 +433,21 @@ public:
      * Initiates restoring the jukebox state from a binary buffer.
      *
      * \param buffer The buffer to read from.
+     * \param size The number of bytes available in \p buffer. Set to the
+     * number of bytes read on success.
      * \returns The total number of track states expected to be restored via
-     * deserialize_trackdata() for this jukebox, or -1 in case of an error.
+     * deserialize_trackdata() for this jukebox, or -1 in case of an error,
+     * including a buffer that ends too early.
      *
      * \note The number of bytes read is the same that was written by
      * serialize_metadata(). It depends on the internal state of the jukebox
-     * that was serialized.
+     * that was serialized, and on the version of the format it was written
+     * with.
      */
     virtual int
     deserialize_metadata(
-            unsigned char* buffer);
+            unsigned char* buffer,
+            int& size);
 
     /**
      * Restores the jukebox state for registered tracks from a binary buffer.
@@ -243,6 +463,31 @@ public:
             unsigned char* buffer,
             int num_tracks);
 
+    /**
+     * Adds the jukebox state, including the features of the tracks if they
+     * are stored, as sections of a mapped jukebox file.
+     *
+     * \param out The writer to add the sections to. Sections added without
+     * a copy must stay valid until the file is written.
+     * \returns 0 on success, or -1 in case of an error or if the method does
+     * not support mapped jukebox files.
+     */
+    virtual int
+    serialize_sections(
+            mapped_jukebox::writer& out);
+
+    /**
+     * Restores the jukebox state from the sections of a mapped jukebox file
+     * written by serialize_sections(), using them in place where possible.
+     *
+     * \param in The file to restore from, which must stay open as long as
+     * the jukebox is used.
+     * \returns 0 on success, or -1 in case of an error.
+     */
+    virtual int
+    map_sections(
+            const mapped_jukebox& in);
+
 };
 
 /** A macro to facilitating registering a method class with musly. This macro
@@ -10,10 +10,10 @@
  * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
+#include <vector>
 #include <Eigen/Core>
 
 #include "minilog.h"
-#include "windowfunction.h"
 #include "mandelellis.h"
 
 
@@ -31,13 +31,11 @@ mandelellis::mandelellis() :
         window_size(1024),
         hop(0.5f),
         max_pcmlength(60*sample_rate),
-        ps_bins(window_size/2+1),
         mel_bins(36),
         mfcc_bins(20),
 
         // spectra and filters
-        ps(windowfunction::hann(window_size), hop),
-        mel(ps_bins, mel_bins, sample_rate),
+        bank(sample_rate, window_size, hop, mel_bins),
         mfccs(mel_bins, mfcc_bins),
         gs(mfcc_bins)
 {
@@ -70,40 +68,44 @@ mandelellis::about()
         "is computed with the symmetrized Kullback-Leibler divergence";
 }
 
+method::analysis_context*
+mandelellis::analysis_context_alloc() const
+{
+    return new mfccstream(bank, mfccs, mel_bins, mfcc_bins, max_pcmlength);
+}
+
 int
 mandelellis::analyze_track(
         float* pcm,
         int length,
-        musly_track* track)
+        musly_track* track,
+        analysis_context* context) const
 {
-    MINILOG(logTRACE) << "ME analysis started. samples=" << length;
-
-    // select the central max_pcmlength (usually 60s) of the piece
-    int start = 0;
-    if (length > max_pcmlength) {
-        start = (length - max_pcmlength) / 2;
-        length = max_pcmlength;
-    }
-
-    // PCM --> powerspectrum
-    Eigen::Map<Eigen::VectorXf> pcm_vector(pcm+start, length);
-    Eigen::MatrixXf power_spectrum = ps.from_pcm(pcm_vector);
-
-    // powerspectrum -> Mel
-    Eigen::MatrixXf mel_spectrum = mel.from_powerspectrum(power_spectrum);
+    return analyze_track_rate(pcm, length, sample_rate, track, context);
+}
 
-    // Mel -> MFCC representation
-    Eigen::MatrixXf mfcc_representation =
-            mfccs.from_melspectrum(mel_spectrum);
+int
+mandelellis::analyze_track_rate(
+        float* pcm,
+        int length,
+        int signal_rate,
+        musly_track* track,
+        analysis_context* context) const
+{
+    MINILOG(logTRACE) << "ME analysis started. samples=" << length
+            << ", sample rate=" << signal_rate;
 
-    // estimate the Gaussian from the MFCC representation
+    // PCM --> powerspectrum --> Mel --> MFCC --> Gaussian, frame by frame,
+    // for the central max_pcmlength (usually 60s) of the piece
     gaussian g = {0, 0, 0, 0};
     g.mu = &track[track_mu];
     g.covar = &track[track_covar];
     g.covar_inverse = &track[track_covar_inverse];
-    if (gs.estimate_gaussian(mfcc_representation, g) == false) {
+    int ret = static_cast<mfccstream*>(context)->analyze(pcm, length,
+            signal_rate, gs, g);
+    if (ret != 0) {
         MINILOG(logTRACE) << "ME Gaussian model estimation failed.";
-        return 2;
+        return ret;
     }
 
     MINILOG(logTRACE) << "ME analysis finished!";
@@ -111,6 +113,40 @@ mandelellis::analyze_track(
     return 0;
 }
 
+int
+mandelellis::analyze_begin(
+        int length,
+        float peak,
+        analysis_context* context) const
+{
+    MINILOG(logTRACE) << "ME streaming analysis started. samples=" << length;
+    return static_cast<mfccstream*>(context)->begin(length, peak,
+            sample_rate);
+}
+
+int
+mandelellis::analyze_feed(
+        const float* pcm,
+        int length,
+        analysis_context* context) const
+{
+    return static_cast<mfccstream*>(context)->feed(pcm, length);
+}
+
+int
+mandelellis::analyze_finish(
+        musly_track* track,
+        analysis_context* context) const
+{
+    gaussian g = {0, 0, 0, 0};
+    g.mu = &track[track_mu];
+    g.covar = &track[track_covar];
+    g.covar_inverse = &track[track_covar_inverse];
+    int ret = static_cast<mfccstream*>(context)->finish(gs, g);
+    MINILOG(logTRACE) << "ME streaming analysis finished. ret=" << ret;
+    return ret;
+}
+
 
 int
 mandelellis::similarity(
@@ -210,7 +246,13 @@ mandelellis::serialize_metadata(
 
 int
 mandelellis::deserialize_metadata(
-        unsigned char* buffer) {
+        unsigned char* buffer,
+        int& size) {
+    if (size < (int)(sizeof(int) + sizeof(musly_trackid))) {
+        return -1;
+    }
+    size = sizeof(int) + sizeof(musly_trackid);
+
     // number of registered tracks
     int expected_tracks = *(int*)(buffer);
     buffer += sizeof(int);
@@ -255,5 +297,52 @@ mandelellis::deserialize_trackdata(
     return num_tracks;
 }
 
+namespace {
+
+const uint32_t section_meta = mapped_jukebox::tag('m', 'e', 't', 'a');
+const uint32_t section_ids = mapped_jukebox::tag('i', 'd', 's', ' ');
+
+} /* anonymous namespace */
+
+int
+mandelellis::serialize_sections(
+        mapped_jukebox::writer& out) {
+    // number of registered tracks and largest seen track id
+    const int meta[2] = {idpool.get_size(), idpool.get_max_seen()};
+    out.add_copy(section_meta, meta, sizeof(meta));
+
+    std::vector<musly_trackid> ids(idpool.get_size());
+    idpool.export_ids(0, ids.size(), ids.data());
+    out.add_copy(section_ids, ids.data(), ids.size() * sizeof(musly_trackid));
+    return 0;
+}
+
+int
+mandelellis::map_sections(
+        const mapped_jukebox& in) {
+    uint64_t size;
+    const int* meta = (const int*)in.find(section_meta, size);
+    if (!meta || (size != 2 * sizeof(int)) || (meta[0] < 0) ||
+            (idpool.get_size() > 0)) {
+        return -1;
+    }
+    const musly_trackid* ids = (const musly_trackid*)in.find(section_ids,
+            size);
+    if (!ids || (size != (uint64_t)meta[0] * sizeof(musly_trackid))) {
+        return -1;
+    }
+
+    // the ids are kept in a set, so they are copied
+    musly_trackid max_seen = meta[1];
+    idpool.add_ids(&max_seen, 1);
+    idpool.remove_ids(&max_seen, 1);
+    std::vector<musly_trackid> list(ids, ids + meta[0]);
+    if ((idpool.add_ids(list.data(), list.size()) != meta[0]) ||
+            (idpool.get_max_seen() != max_seen)) {
+        return -1;
+    }
+    return 0;
+}
+
 } /* namespace methods */
 } /* namespace musly */
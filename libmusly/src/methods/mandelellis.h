@@ -14,10 +14,9 @@
 #define MUSLY_METHODS_MANDELELLIS_H_
 
 #include "method.h"
-#include "powerspectrum.h"
-#include "melspectrum.h"
 #include "mfcc.h"
 #include "gaussianstatistics.h"
+#include "mfccstream.h"
 #include "idpool.h"
 
 namespace musly {
@@ -35,7 +34,6 @@ private:
     const int window_size;
     const float hop;
     const int max_pcmlength;
-    const int ps_bins;
     const int mel_bins;
     const int mfcc_bins;
 
@@ -43,8 +41,7 @@ private:
     int track_covar;
     int track_covar_inverse;
 
-    powerspectrum ps;
-    melspectrum mel;
+    spectrumbank bank;
     mfcc mfccs;
     gaussian_statistics gs;
     unordered_idpool<musly_trackid> idpool;
@@ -65,11 +62,40 @@ public:
     virtual const char*
     about();
 
+    virtual analysis_context*
+    analysis_context_alloc() const;
+
     virtual int
     analyze_track(
             float* pcm,
             int length,
-            musly_track* track);
+            musly_track* track,
+            analysis_context* context) const;
+
+    virtual int
+    analyze_track_rate(
+            float* pcm,
+            int length,
+            int sample_rate,
+            musly_track* track,
+            analysis_context* context) const;
+
+    virtual int
+    analyze_begin(
+            int length,
+            float peak,
+            analysis_context* context) const;
+
+    virtual int
+    analyze_feed(
+            const float* pcm,
+            int length,
+            analysis_context* context) const;
+
+    virtual int
+    analyze_finish(
+            musly_track* track,
+            analysis_context* context) const;
 
     virtual int
     similarity(
@@ -108,7 +134,8 @@ public:
 
     virtual int
     deserialize_metadata(
-            unsigned char* buffer);
+            unsigned char* buffer,
+            int& size);
 
     virtual int
     serialize_trackdata(
@@ -121,6 +148,14 @@ public:
             unsigned char* buffer,
             int num_tracks);
 
+    virtual int
+    serialize_sections(
+            mapped_jukebox::writer& out);
+
+    virtual int
+    map_sections(
+            const mapped_jukebox& in);
+
 };
 
 } /* namespace methods */
@@ -11,10 +11,15 @@
  */
 
 #include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <vector>
 #include <Eigen/Core>
 
 #include "minilog.h"
-#include "windowfunction.h"
+#include "parallel.h"
 #include "timbre.h"
 
 
@@ -25,6 +30,204 @@ namespace methods {
  */
 MUSLY_METHOD_REGIMPL(timbre, 1);
 
+namespace {
+
+// Tracks with nearly singular covariances are not trusted to obey the
+// triangle inequality: their divergences are dominated by rounding errors.
+// The threshold is well above the logdet_error() of well-conditioned
+// covariances, and well below the one of covariances estimated from
+// silence or pure tones.
+const float max_logdet_error = 0.1f;
+
+// Distances are computed in single precision, so lower bounds from the
+// triangle inequality may be off by a few rounding errors.
+inline float
+with_slack(
+        float radius)
+{
+    return radius + 1e-3f * (1.0f + radius);
+}
+
+// The sections of a mapped jukebox file, see timbre::serialize_sections()
+const uint32_t section_meta = mapped_jukebox::tag('m', 'e', 't', 'a');
+const uint32_t section_normtracks = mapped_jukebox::tag('n', 't', 'r', 'k');
+const uint32_t section_norm_mu = mapped_jukebox::tag('n', 'm', 'u', ' ');
+const uint32_t section_norm_std = mapped_jukebox::tag('n', 's', 't', 'd');
+const uint32_t section_ids = mapped_jukebox::tag('i', 'd', 's', ' ');
+const uint32_t section_pivots = mapped_jukebox::tag('p', 'i', 'v', 't');
+const uint32_t section_index = mapped_jukebox::tag('h', 'n', 's', 'w');
+const uint32_t section_present = mapped_jukebox::tag('p', 'r', 's', 'n');
+
+// The jukebox metadata of musly 2.0.0, format 0, starts with the number of
+// tracks. Later formats start with their version, negated, followed by the
+// fields of format 0 and the ones they add.
+const int metadata_version = 1;
+
+// Copy a value from the metadata at buffer, which has size bytes left, and
+// advance past it. Returns false if the metadata ends before.
+template <typename T>
+bool
+read_metadata(
+        unsigned char*& buffer,
+        int& size,
+        T& value)
+{
+    if (size < (int)sizeof(T)) {
+        return false;
+    }
+    std::memcpy(&value, buffer, sizeof(T));
+    buffer += sizeof(T);
+    size -= sizeof(T);
+    return true;
+}
+
+/** The section of column \p column of the trackstore
+ */
+inline uint32_t
+section_column(
+        int column)
+{
+    return mapped_jukebox::tag('c', 'o', 'l', (char)('0' + column));
+}
+
+/** Collects the tracks of the smallest raw Jensen-Shannon divergence to a
+ * seed from a vptree, excluding the seed itself and optionally restricted
+ * to some idpool positions.
+ */
+class nearest_visitor : public vptree_visitor {
+public:
+    typedef std::pair<float, musly_trackid> neighbor;
+
+    nearest_visitor(
+            musly_trackid seed,
+            int k,
+            ordered_idpool<musly_trackid>& idpool,
+            const std::vector<char>* allowed) :
+            seed(seed),
+            k(k),
+            idpool(idpool),
+            allowed(allowed)
+    {
+        heap.reserve(k);
+    }
+
+    virtual bool
+    accepts(
+            musly_trackid id) {
+        if (id == seed) {
+            return false;
+        }
+        return !allowed || (*allowed)[idpool.position_of(id)];
+    }
+
+    virtual float
+    radius() {
+        return ((int)heap.size() < k) ? FLT_MAX : heap.front().first;
+    }
+
+    virtual void
+    visit(
+            const musly_trackid* ids,
+            const float* distances,
+            int length) {
+        for (int i = 0; i < length; i++) {
+            if ((distances[i] < 0) || (distances[i] == FLT_MAX)) {
+                continue;
+            }
+            neighbor n(distances[i], ids[i]);
+            if ((int)heap.size() < k) {
+                heap.push_back(n);
+                std::push_heap(heap.begin(), heap.end());
+            } else if (n < heap.front()) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.back() = n;
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+    }
+
+    std::vector<neighbor> heap;
+
+private:
+    musly_trackid seed;
+    int k;
+    ordered_idpool<musly_trackid>& idpool;
+    const std::vector<char>* allowed;
+};
+
+/** Collects the tracks of the smallest mutual proximity normalized
+ * similarity to a seed from a vptree, like timbre::knn() does for a list
+ * of tracks, optionally restricted to some idpool positions.
+ */
+class proximity_visitor : public vptree_visitor {
+public:
+    proximity_visitor(
+            int seed_position,
+            int k,
+            mutualproximity& mp,
+            ordered_idpool<musly_trackid>& idpool,
+            const std::vector<char>* allowed) :
+            failed(false),
+            seed_position(seed_position),
+            k(k),
+            mp(mp),
+            idpool(idpool),
+            allowed(allowed),
+            radius_worst(-1),
+            radius_cached(FLT_MAX)
+    {
+        heap.reserve(k);
+    }
+
+    virtual bool
+    accepts(
+            musly_trackid id) {
+        return !allowed || (*allowed)[idpool.position_of(id)];
+    }
+
+    virtual float
+    radius() {
+        // the bound only changes with the worst result
+        if (((int)heap.size() == k) && (heap.front().first != radius_worst)) {
+            radius_worst = heap.front().first;
+            radius_cached = mp.topk_radius(seed_position, heap, k);
+        }
+        return radius_cached;
+    }
+
+    virtual void
+    visit(
+            const musly_trackid* ids,
+            const float* distances,
+            int length) {
+        positions.resize(length);
+        other_ids.assign(ids, ids + length);
+        for (int i = 0; i < length; i++) {
+            positions[i] = idpool.position_of(ids[i]);
+        }
+        if (mp.normalize_topk(seed_position, positions.data(),
+                other_ids.data(), length, distances, heap, k) != 0) {
+            failed = true;
+        }
+    }
+
+    std::vector<mutualproximity::neighbor> heap;
+    bool failed;
+
+private:
+    int seed_position;
+    int k;
+    mutualproximity& mp;
+    ordered_idpool<musly_trackid>& idpool;
+    const std::vector<char>* allowed;
+    std::vector<int> positions;
+    std::vector<musly_trackid> other_ids;
+    float radius_worst;
+    float radius_cached;
+};
+
+} /* anonymous namespace */
+
 
 
 timbre::timbre() :
@@ -34,16 +237,28 @@ timbre::timbre() :
         window_size(1024),
         hop(0.5f),
         max_pcmlength(60*sample_rate),
-        ps_bins(window_size/2+1),
         mel_bins(36),
         mfcc_bins(25),
 
+        // covariances stored as they are
+        store_encoding(covar_float32),
+        covar_rerank(0),
+
         // spectra and filters
-        ps(windowfunction::hann(window_size), hop),
-        mel(ps_bins, mel_bins, sample_rate),
+        bank(sample_rate, window_size, hop, mel_bins),
         mfccs(mel_bins, mfcc_bins),
         gs(mfcc_bins),
-        mp(this)
+        mp(this),
+        index(this),
+        mapped_index(NULL),
+        mapped_index_size(0),
+        pivot_count(0),
+        exact_metric(this),
+        exact_index(&exact_metric),
+        exact(false),
+        exact_stale(true),
+        exact_distances(0),
+        exact_candidates(0)
 {
     // Configure the musly_track features and save the musly_track offsets
 
@@ -54,6 +269,9 @@ timbre::timbre() :
     // add the log(det(covar)) of the covariance for performance reasons
     track_logdet = track_addfield_floats("gaussian.covar_logdet", 1);
 
+    // Keep the features of registered tracks in a column per feature
+    init_store();
+
     // React on changes to the trackid mapping in the ordered_idpool
     idpool.set_observer(this);
 }
@@ -79,40 +297,44 @@ timbre::about()
         "Conference, ISMIR, 2011.";
 }
 
+method::analysis_context*
+timbre::analysis_context_alloc() const
+{
+    return new mfccstream(bank, mfccs, mel_bins, mfcc_bins, max_pcmlength);
+}
+
 int
 timbre::analyze_track(
         float* pcm,
         int length,
-        musly_track* track)
+        musly_track* track,
+        analysis_context* context) const
 {
-    MINILOG(logTRACE) << "T analysis started. samples=" << length;
-
-    // select the central max_pcmlength (usually 60s) of the piece
-    int start = 0;
-    if (length > max_pcmlength) {
-        start = (length - max_pcmlength) / 2;
-        length = max_pcmlength;
-    }
-
-    // PCM --> powerspectrum
-    Eigen::Map<Eigen::VectorXf> pcm_vector(pcm+start, length);
-    Eigen::MatrixXf power_spectrum = ps.from_pcm(pcm_vector);
-
-    // powerspectrum -> Mel
-    Eigen::MatrixXf mel_spectrum = mel.from_powerspectrum(power_spectrum);
+    return analyze_track_rate(pcm, length, sample_rate, track, context);
+}
 
-    // Mel -> MFCC representation
-    Eigen::MatrixXf mfcc_representation =
-            mfccs.from_melspectrum(mel_spectrum);
+int
+timbre::analyze_track_rate(
+        float* pcm,
+        int length,
+        int signal_rate,
+        musly_track* track,
+        analysis_context* context) const
+{
+    MINILOG(logTRACE) << "T analysis started. samples=" << length
+            << ", sample rate=" << signal_rate;
 
-    // estimate the Gaussian from the MFCC representation
+    // PCM --> powerspectrum --> Mel --> MFCC --> Gaussian, frame by frame,
+    // for the central max_pcmlength (usually 60s) of the piece
     gaussian g = {0, 0, 0, 0};
     g.mu = &track[track_mu];
     g.covar = &track[track_covar];
     g.covar_logdet = &track[track_logdet];
-    if (gs.estimate_gaussian(mfcc_representation, g) == false) {
+    int ret = static_cast<mfccstream*>(context)->analyze(pcm, length,
+            signal_rate, gs, g);
+    if (ret != 0) {
         MINILOG(logTRACE) << "T Gaussian model estimation failed.";
-        return 2;
+        return ret;
     }
 
     MINILOG(logTRACE) << "T analysis finished!";
@@ -120,6 +342,40 @@ timbre::analyze_track(
     return 0;
 }
 
+int
+timbre::analyze_begin(
+        int length,
+        float peak,
+        analysis_context* context) const
+{
+    MINILOG(logTRACE) << "T streaming analysis started. samples=" << length;
+    return static_cast<mfccstream*>(context)->begin(length, peak,
+            sample_rate);
+}
+
+int
+timbre::analyze_feed(
+        const float* pcm,
+        int length,
+        analysis_context* context) const
+{
+    return static_cast<mfccstream*>(context)->feed(pcm, length);
+}
+
+int
+timbre::analyze_finish(
+        musly_track* track,
+        analysis_context* context) const
+{
+    gaussian g = {0, 0, 0, 0};
+    g.mu = &track[track_mu];
+    g.covar = &track[track_covar];
+    g.covar_logdet = &track[track_logdet];
+    int ret = static_cast<mfccstream*>(context)->finish(gs, g);
+    MINILOG(logTRACE) << "T streaming analysis finished. ret=" << ret;
+    return ret;
+}
+
 
 void
 timbre::similarity_raw(
@@ -134,25 +390,18 @@ timbre::similarity_raw(
     g0.covar = &track[track_covar];
     g0.covar_logdet = &track[track_logdet];
 
-    // create the temporary buffer required for the Jensen-Shannon divergence
-    musly_track* tmp_t = track_alloc();
-    gaussian tmp;
-    tmp.mu = &tmp_t[track_mu];
-    tmp.covar = &tmp_t[track_covar];
-    tmp.covar_logdet = &tmp_t[track_logdet];
-
-    // iterate over all musly_tracks to compute the Jensen-Shannon divergence
+    // map the other musly_tracks to gaussian structures
+    std::vector<gaussian> gs1(length);
     for (int i = 0; i < length; i++) {
-        gaussian gi;
         musly_track* track1 = tracks[i];
-        gi.mu = &track1[track_mu];
-        gi.covar = &track1[track_covar];
-        gi.covar_logdet = &track1[track_logdet];
-
-        similarities[i] = gs.jensenshannon(g0, gi, tmp);
+        gs1[i].mu = &track1[track_mu];
+        gs1[i].covar = &track1[track_covar];
+        gs1[i].covar_inverse = 0;
+        gs1[i].covar_logdet = &track1[track_logdet];
     }
 
-    delete[] tmp_t;
+    // compute the Jensen-Shannon divergence to all of them at once
+    gs.jensenshannon_batch(g0, gs1.data(), length, similarities);
 }
 
 
@@ -173,18 +422,823 @@ timbre::similarity(
     // compute raw similarities
     similarity_raw(track, tracks, length, similarities);
 
-    // normalize with mp
-    // - lookup positions of trackids in the ordered_idpool
+    // normalize with mp, looking up the positions of trackids in the
+    // ordered_idpool block by block
     int seed_position = idpool.position_of(seed_trackid);
-    int* other_positions = new int[length];
+    const int block = 256;
+    int positions[block];
+    for (int start = 0; start < length; start += block) {
+        const int count = std::min(block, length - start);
+        idpool.positions_of(trackids + start, count, positions, start);
+        if (mp.normalize(seed_position, positions, count,
+                similarities + start) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void
+timbre::init_store()
+{
+    store = trackstore();
+    store_mu = store.add_column(track_mu, gs.get_dim());
+    store_covar = store.add_column(track_covar, gs.get_covarelems(),
+            store_encoding);
+    store_logdet = store.add_column(track_logdet, 1);
+
+    // the float32 covariances for re-ranking go last, so get_track() ends
+    // up with them rather than the decoded ones
+    store_covar_exact = -1;
+    if ((store_encoding != covar_float32) && (covar_rerank > 0)) {
+        store_covar_exact = store.add_column(track_covar,
+                gs.get_covarelems());
+    }
+}
+
+gaussian
+timbre::stored_gaussian(
+        int position)
+{
+    gaussian g;
+    g.mu = store.at(store_mu, position);
+    g.covar = store.at(store_covar, position);
+    g.covar_inverse = 0;
+    g.covar_logdet = store.at(store_logdet, position);
+    return g;
+}
+
+gaussian
+timbre::exact_gaussian(
+        int position)
+{
+    gaussian g = stored_gaussian(position);
+    if (store_covar_exact >= 0) {
+        g.covar = store.at(store_covar_exact, position);
+    }
+    return g;
+}
+
+int
+timbre::similarity_byid(
+        musly_trackid seed_trackid,
+        musly_trackid* trackids,
+        int length,
+        float* similarities)
+{
+    if ((length <= 0) || !similarities) {
+        return -1;
+    }
+    if (!trackids && (length != idpool.get_size())) {
+        return -1;
+    }
+
+    int seed_position = idpool.position_of(seed_trackid);
+    if ((seed_position < 0) || !store.is_present(seed_position)) {
+        return -1;
+    }
+
+    // lookup positions of trackids in the ordered_idpool, which are the
+    // rows of their features in the track store
+    std::vector<int> positions(length);
+    std::vector<gaussian> gs1(length);
+    if (trackids) {
+        idpool.positions_of(trackids, length, positions.data());
+    }
     for (int i = 0; i < length; i++) {
-        other_positions[i] = idpool.position_of(trackids[i]);
+        int pos = trackids ? positions[i] : i;
+        if ((pos < 0) || !store.is_present(pos)) {
+            return -1;
+        }
+        positions[i] = pos;
+        gs1[i] = stored_gaussian(pos);
+    }
+
+    // compute raw similarities and normalize with mp
+    gs.jensenshannon_batch(stored_gaussian(seed_position), gs1.data(),
+            length, similarities, store_encoding);
+    if (!trackids) {
+        return mp.normalize_range(seed_position, 0, length, similarities);
+    }
+    return mp.normalize(seed_position, positions.data(), length, similarities);
+}
+
+int
+timbre::similarity_batch(
+        musly_trackid* seed_trackids,
+        int num_seeds,
+        musly_trackid* trackids,
+        int length,
+        float* similarities)
+{
+    if ((num_seeds <= 0) || (length <= 0) || !seed_trackids || !similarities) {
+        return -1;
+    }
+    if (!trackids && (length != idpool.get_size())) {
+        return -1;
+    }
+
+    // lookup positions of seeds and tracks
+    std::vector<int> seed_positions(num_seeds);
+    std::vector<gaussian> gs0(num_seeds);
+    for (int i = 0; i < num_seeds; i++) {
+        int pos = idpool.position_of(seed_trackids[i]);
+        if ((pos < 0) || !store.is_present(pos)) {
+            return -1;
+        }
+        seed_positions[i] = pos;
+        gs0[i] = stored_gaussian(pos);
+    }
+    std::vector<int> positions(length);
+    std::vector<gaussian> gs1(length);
+    if (trackids) {
+        idpool.positions_of(trackids, length, positions.data());
+    }
+    for (int i = 0; i < length; i++) {
+        int pos = trackids ? positions[i] : i;
+        if ((pos < 0) || !store.is_present(pos)) {
+            return -1;
+        }
+        positions[i] = pos;
+        gs1[i] = stored_gaussian(pos);
+    }
+
+    // Split the seeds x tracks matrix into tiles such that the features of a
+    // tile's tracks (about 1.5 KiB each) stay in the L2 cache while all of
+    // the tile's seeds are compared to them. Tiles are computed in parallel.
+    const int seed_tile = 32;
+    const int track_tile = 8 * gaussian_statistics::jsd_lanes;
+    const int seed_tiles = (num_seeds + seed_tile - 1) / seed_tile;
+    const int track_tiles = (length + track_tile - 1) / track_tile;
+    std::atomic<bool> failed(false);
+    parallel_for(seed_tiles * track_tiles, [&](int tile) {
+        const int seed_start = (tile / track_tiles) * seed_tile;
+        const int seed_end = std::min(num_seeds, seed_start + seed_tile);
+        const int start = (tile % track_tiles) * track_tile;
+        const int count = std::min(track_tile, length - start);
+        for (int s = seed_start; s < seed_end; s++) {
+            float* sim = similarities + (size_t)s * length + start;
+            gs.jensenshannon_batch(gs0[s], &gs1[start], count, sim,
+                    store_encoding);
+            const int ret = trackids
+                    ? mp.normalize(seed_positions[s], &positions[start], count,
+                            sim)
+                    : mp.normalize_range(seed_positions[s], start, count, sim);
+            if (ret < 0) {
+                failed = true;
+            }
+        }
+    });
+    return failed ? -1 : 0;
+}
+
+int
+timbre::similarity_allpairs(
+        musly_trackid* trackids,
+        int length,
+        int block_rows,
+        musly_similarity_sink sink,
+        void* user_data)
+{
+    if ((length <= 0) || (block_rows <= 0) || !sink) {
+        return -1;
+    }
+    if (!trackids && (length != idpool.get_size())) {
+        return -1;
+    }
+
+    // lookup positions of tracks
+    std::vector<int> positions(length);
+    std::vector<gaussian> gs1(length);
+    if (trackids) {
+        idpool.positions_of(trackids, length, positions.data());
+    }
+    for (int i = 0; i < length; i++) {
+        int pos = trackids ? positions[i] : i;
+        if ((pos < 0) || !store.is_present(pos)) {
+            return -1;
+        }
+        positions[i] = pos;
+        gs1[i] = stored_gaussian(pos);
+    }
+
+    // Both the JSD and mp are symmetric, so we only compute the pairs (i, j)
+    // with i < j, by rows of the upper triangle. Each block of rows is split
+    // into column tiles computed in parallel, as in similarity_batch().
+    const int track_tile = 8 * gaussian_statistics::jsd_lanes;
+    std::vector<float> sim;
+    std::vector<size_t> row_offsets(block_rows + 1);
+    std::atomic<bool> failed(false);
+    for (int first = 0; first < length; first += block_rows) {
+        const int rows = std::min(block_rows, length - first);
+        row_offsets[0] = 0;
+        for (int r = 0; r < rows; r++) {
+            row_offsets[r + 1] = row_offsets[r] + (length - 1 - (first + r));
+        }
+        sim.resize(std::max<size_t>(row_offsets[rows], 1));
+
+        const int tiles_start = first + 1;
+        const int tiles = (length - tiles_start + track_tile - 1) / track_tile;
+        parallel_for(tiles, [&](int tile) {
+            const int start = tiles_start + tile * track_tile;
+            const int end = std::min(length, start + track_tile);
+            for (int r = 0; r < rows; r++) {
+                const int i = first + r;
+                const int j = std::max(start, i + 1);
+                if (j >= end) {
+                    break;  // the tile is left of the diagonal from here on
+                }
+                float* row = &sim[row_offsets[r] + (j - (i + 1))];
+                gs.jensenshannon_batch(gs1[i], &gs1[j], end - j, row,
+                        store_encoding);
+                const int ret = trackids
+                        ? mp.normalize(positions[i], &positions[j], end - j,
+                                row)
+                        : mp.normalize_range(positions[i], j, end - j, row);
+                if (ret < 0) {
+                    failed = true;
+                }
+            }
+        });
+
+        if (failed || sink(user_data, first, rows, sim.data()) != 0) {
+            return -1;
+        }
     }
-    // - call mp.normalize with these positions
-    int res = mp.normalize(seed_position, other_positions, length, similarities);
-    delete[] other_positions;
+    return 0;
+}
 
-    return res;
+int
+timbre::knn(
+        musly_trackid seed_trackid,
+        musly_trackid* trackids,
+        int length,
+        float* knn_similarities,
+        musly_trackid* knn_trackids,
+        int k)
+{
+    if ((length < 0) || (k < 0) || !knn_similarities || !knn_trackids) {
+        return -1;
+    }
+    if (!trackids && (length != idpool.get_size())) {
+        return -1;
+    }
+
+    int seed_position = idpool.position_of(seed_trackid);
+    if ((seed_position < 0) || !store.is_present(seed_position)) {
+        return -1;
+    }
+
+    // with compactly stored covariances, find some more candidates than
+    // asked for, to re-rank them with the float32 ones
+    const int wanted = k;
+    if ((k > 0) && (store_covar_exact >= 0)) {
+        k += std::min(covar_rerank, INT_MAX - k);
+    }
+
+    if ((k > 0) && (length > 0) && store.all_present() && exact_ready()) {
+        // let the exact index skip tracks that cannot enter the top k
+        std::vector<char> allowed;
+        if (trackids) {
+            allowed.resize(idpool.get_size(), 0);
+            for (int i = 0; i < length; i++) {
+                int pos = idpool.position_of(trackids[i]);
+                if (pos < 0) {
+                    return -1;
+                }
+                allowed[pos] = 1;
+            }
+        }
+        proximity_visitor v(seed_position, k, mp, idpool,
+                trackids ? &allowed : NULL);
+        exact_distances += exact_index.search(seed_trackid, v);
+        exact_candidates += length;
+        if (v.failed) {
+            return -1;
+        }
+        return knn_results(seed_position, v.heap, wanted, knn_similarities,
+                knn_trackids);
+    }
+
+    gaussian g0 = stored_gaussian(seed_position);
+
+    // process candidates in blocks small enough for the raw similarities,
+    // positions and ids to stay in the L1 cache between the JSD and the mp
+    // pass; only the heap of the k best results is kept across blocks
+    const int block = 16 * gaussian_statistics::jsd_lanes;
+    std::vector<int> positions(block);
+    std::vector<int> lookup(block);
+    std::vector<musly_trackid> ids(block);
+    std::vector<gaussian> gs1(block);
+    std::vector<float> sim(block);
+    std::vector<mutualproximity::neighbor> heap;
+    heap.reserve(k);
+    for (int start = 0; (start < length) && (k > 0); start += block) {
+        // candidates farther away than this cannot enter the heap
+        float radius = FLT_MAX;
+        if (pivots.get_pivots() > 0) {
+            radius = mp.topk_radius(seed_position, heap, k);
+        }
+        const int end = std::min(start + block, length);
+        if (trackids) {
+            idpool.positions_of(trackids + start, end - start,
+                    lookup.data(), start);
+        }
+        int count = 0;
+        for (int i = start; i < end; i++) {
+            int pos;
+            if (trackids) {
+                ids[count] = trackids[i];
+                pos = lookup[i - start];
+            } else {
+                pos = i;
+                ids[count] = idpool[pos];
+            }
+            if ((pos < 0) || !store.is_present(pos)) {
+                return -1;
+            }
+            if ((radius != FLT_MAX) && (pivots.lower_bound(seed_position,
+                    pos) > with_slack(radius))) {
+                continue;
+            }
+            positions[count] = pos;
+            gs1[count] = stored_gaussian(pos);
+            count++;
+        }
+        gs.jensenshannon_batch(g0, gs1.data(), count, sim.data(),
+                store_encoding);
+        if (mp.normalize_topk(seed_position, positions.data(), ids.data(),
+                count, sim.data(), heap, k) != 0) {
+            return -1;
+        }
+    }
+
+    return knn_results(seed_position, heap, wanted, knn_similarities,
+            knn_trackids);
+}
+
+int
+timbre::knn_results(
+        int seed_position,
+        std::vector<mutualproximity::neighbor>& heap,
+        int k,
+        float* knn_similarities,
+        musly_trackid* knn_trackids)
+{
+    if (store_covar_exact >= 0) {
+        // recompute the similarities of the candidates with the float32
+        // covariances and keep the k best
+        const int length = heap.size();
+        std::vector<int> positions(length);
+        std::vector<gaussian> gs1(length);
+        std::vector<float> sim(length);
+        for (int i = 0; i < length; i++) {
+            positions[i] = idpool.position_of(heap[i].second);
+            gs1[i] = exact_gaussian(positions[i]);
+        }
+        gs.jensenshannon_batch(exact_gaussian(seed_position), gs1.data(),
+                length, sim.data());
+        if (mp.normalize(seed_position, positions.data(), length,
+                sim.data()) != 0) {
+            return -1;
+        }
+        for (int i = 0; i < length; i++) {
+            heap[i].first = sim[i];
+        }
+        std::sort(heap.begin(), heap.end(), mutualproximity::neighbor_less);
+        heap.resize(std::min(k, length));
+        std::make_heap(heap.begin(), heap.end(),
+                mutualproximity::neighbor_less);
+    }
+
+    std::sort_heap(heap.begin(), heap.end(), mutualproximity::neighbor_less);
+    for (int i = 0; i < (int)heap.size(); i++) {
+        knn_similarities[i] = heap[i].first;
+        knn_trackids[i] = heap[i].second;
+    }
+    return heap.size();
+}
+
+int
+timbre::store_tracks(
+        musly_track** tracks,
+        musly_trackid* trackids,
+        int length)
+{
+    int stored = 0;
+    for (int i = 0; i < length; i++) {
+        int pos = idpool.position_of(trackids[i]);
+        if (pos >= 0) {
+            store.set_track(pos, tracks[i]);
+            stored++;
+        }
+    }
+    exact_stale = true;
+
+    // index tracks that were registered after the index was serialized
+    index_ready();
+    for (int i = 0; i < length; i++) {
+        if ((idpool.position_of(trackids[i]) >= 0) &&
+                !index.contains(trackids[i])) {
+            index.insert(trackids[i]);
+        }
+    }
+    return stored;
+}
+
+void
+timbre::raw_distances(
+        musly_trackid from,
+        const musly_trackid* to,
+        int length,
+        float* distances)
+{
+    int from_pos = idpool.position_of(from);
+    if ((from_pos < 0) || !store.is_present(from_pos)) {
+        std::fill(distances, distances + length, FLT_MAX);
+        return;
+    }
+    gaussian g0 = stored_gaussian(from_pos);
+
+    // tracks without features are compared to the seed itself, and
+    // reported as infinitely far away
+    std::vector<gaussian> gs1(length);
+    std::vector<char> missing(length, 0);
+    for (int i = 0; i < length; i++) {
+        int pos = idpool.position_of(to[i]);
+        if ((pos < 0) || !store.is_present(pos)) {
+            missing[i] = 1;
+            gs1[i] = g0;
+        } else {
+            gs1[i] = stored_gaussian(pos);
+        }
+    }
+    gs.jensenshannon_batch(g0, gs1.data(), length, distances,
+            store_encoding);
+    for (int i = 0; i < length; i++) {
+        if (missing[i]) {
+            distances[i] = FLT_MAX;
+        }
+    }
+}
+
+void
+timbre::distances(
+        musly_trackid from,
+        const musly_trackid* to,
+        int length,
+        float* distances)
+{
+    // failed comparisons are negative
+    raw_distances(from, to, length, distances);
+    for (int i = 0; i < length; i++) {
+        if (distances[i] < 0) {
+            distances[i] = FLT_MAX;
+        }
+    }
+}
+
+bool
+timbre::exact_ready()
+{
+    if (!exact) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(exact_lock);
+    if (exact_stale) {
+        // tracks with nearly singular covariances are kept out of the tree
+        std::vector<musly_trackid> indexed;
+        std::vector<musly_trackid> unindexed;
+        for (int pos = 0; pos < idpool.get_size(); pos++) {
+            if (!store.is_present(pos)) {
+                continue;
+            }
+            if (gs.logdet_error(stored_gaussian(pos), store_encoding)
+                    <= max_logdet_error) {
+                indexed.push_back(idpool[pos]);
+            } else {
+                unindexed.push_back(idpool[pos]);
+            }
+        }
+        exact_index.build(indexed.data(), indexed.size(),
+                unindexed.data(), unindexed.size());
+        exact_stale = false;
+    }
+    return true;
+}
+
+void
+timbre::index_ready()
+{
+    std::lock_guard<std::mutex> lock(index_lock);
+    if (mapped_index) {
+        if (index.deserialize(mapped_index, mapped_index_size) < 0) {
+            MINILOG(logERROR) << "The neighbor search index of the mapped "
+                    << "jukebox is damaged, starting with an empty one.";
+            const int empty[5] = {index.get_m(), index.get_ef_construction(),
+                    index.get_ef_search(), 0, -1};
+            index.deserialize((const unsigned char*)empty, sizeof(empty));
+        }
+        mapped_index = NULL;
+    }
+}
+
+void
+timbre::select_pivots()
+{
+    // use the first music style tracks with well-conditioned covariances
+    std::vector<musly_track*>& normtracks = *mp.get_normtracks();
+    pivot_tracks.clear();
+    for (int i = 0; (i < (int)normtracks.size()) &&
+            ((int)pivot_tracks.size() < pivot_count); i++) {
+        gaussian g;
+        g.mu = &normtracks[i][track_mu];
+        g.covar = &normtracks[i][track_covar];
+        g.covar_inverse = 0;
+        g.covar_logdet = &normtracks[i][track_logdet];
+        if (gs.logdet_error(g) <= max_logdet_error) {
+            pivot_tracks.push_back(i);
+        }
+    }
+
+    // quantize up to half again the largest distance of a pivot to the
+    // music style, which stands in for the collection
+    float largest = 0;
+    std::vector<float> sim(normtracks.size());
+    for (int p = 0; p < (int)pivot_tracks.size(); p++) {
+        similarity_raw(normtracks[pivot_tracks[p]], normtracks.data(),
+                normtracks.size(), sim.data());
+        for (int i = 0; i < (int)sim.size(); i++) {
+            if ((sim[i] > largest) && (sim[i] != FLT_MAX)) {
+                largest = sim[i];
+            }
+        }
+    }
+    float step = (largest > 0) ? 1.5f * largest / pivottable::levels : 1;
+    pivots.reset(pivot_tracks.size(), step);
+    pivots.resize(idpool.get_size());
+}
+
+int
+timbre::pivot_bytes()
+{
+    // keep the floats of the next track aligned
+    return (pivots.get_pivots() + 3) / 4 * 4;
+}
+
+int
+timbre::guess_neighbors(
+        musly_trackid seed,
+        musly_trackid* neighbors,
+        int length,
+        musly_trackid* limit_to,
+        int num_limit_to)
+{
+    if (length < 0) {
+        return -1;
+    }
+    int seed_pos = idpool.position_of(seed);
+    if ((seed_pos < 0) || !store.is_present(seed_pos)) {
+        return -1;
+    }
+
+    if (exact_ready()) {
+        // find the exact nearest neighbors, among the given tracks if any
+        std::vector<char> allowed;
+        int candidates = exact_index.get_size() - 1;
+        if (num_limit_to > 0) {
+            allowed.resize(idpool.get_size(), 0);
+            candidates = 0;
+            for (int i = 0; i < num_limit_to; i++) {
+                int pos = idpool.position_of(limit_to[i]);
+                if (pos >= 0) {
+                    allowed[pos] = 1;
+                }
+                candidates += (limit_to[i] != seed);
+            }
+        }
+        nearest_visitor v(seed, length, idpool,
+                (num_limit_to > 0) ? &allowed : NULL);
+        exact_distances += exact_index.search(seed, v);
+        exact_candidates += candidates;
+        std::sort_heap(v.heap.begin(), v.heap.end());
+        for (int i = 0; i < (int)v.heap.size(); i++) {
+            neighbors[i] = v.heap[i].second;
+        }
+        return v.heap.size();
+    }
+
+    if (num_limit_to <= 0) {
+        index_ready();
+        if ((index.get_m() == 0) || (index.get_size() == 0)) {
+            return -1;
+        }
+        return index.search(seed, length, neighbors);
+    }
+
+    // for filtered searches, rank the given tracks by their raw similarity
+    std::vector<musly_trackid> ids;
+    ids.reserve(num_limit_to);
+    for (int i = 0; i < num_limit_to; i++) {
+        if (limit_to[i] != seed) {
+            ids.push_back(limit_to[i]);
+        }
+    }
+    if (pivots.get_pivots() > 0) {
+        // Compare the tracks of the smallest lower bounds first, to find
+        // close neighbors early. Then compare the others in their given
+        // order, which keeps memory accesses sequential, skipping the ones
+        // that cannot be closer than the current neighbors.
+        std::vector<std::pair<float, int> > bounded;
+        bounded.reserve(ids.size());
+        for (int i = 0; i < (int)ids.size(); i++) {
+            int pos = idpool.position_of(ids[i]);
+            if ((pos >= 0) && store.is_present(pos)) {
+                bounded.push_back(std::make_pair(
+                        pivots.lower_bound(seed_pos, pos), pos));
+            }
+        }
+        const int block = 4 * gaussian_statistics::jsd_lanes;
+        int first = std::min((int)bounded.size(), std::max(length, block));
+        float threshold = 0;
+        if (first > 0) {
+            std::vector<float> order(bounded.size());
+            for (int i = 0; i < (int)bounded.size(); i++) {
+                order[i] = bounded[i].first;
+            }
+            std::nth_element(order.begin(), order.begin() + first - 1,
+                    order.end());
+            threshold = order[first - 1];
+        }
+        gaussian g0 = stored_gaussian(seed_pos);
+        std::vector<gaussian> gs1;
+        std::vector<int> positions;
+        float d[block];
+        std::vector<std::pair<float, musly_trackid> > heap;
+        for (int pass = 0; pass < 2; pass++) {
+            for (int i = 0; i <= (int)bounded.size(); i++) {
+                if (i < (int)bounded.size()) {
+                    float bound = bounded[i].first;
+                    if ((pass == 0) != (bound <= threshold)) {
+                        continue;
+                    }
+                    if ((pass == 1) && ((int)heap.size() == length) &&
+                            ((length == 0) ||
+                            (bound > with_slack(heap.front().first)))) {
+                        continue;
+                    }
+                    positions.push_back(bounded[i].second);
+                    gs1.push_back(stored_gaussian(bounded[i].second));
+                    if ((int)gs1.size() < block) {
+                        continue;
+                    }
+                }
+                gs.jensenshannon_batch(g0, gs1.data(), gs1.size(), d,
+                        store_encoding);
+                for (int j = 0; j < (int)gs1.size(); j++) {
+                    if ((d[j] < 0) || (d[j] == FLT_MAX)) {
+                        continue;
+                    }
+                    std::pair<float, musly_trackid> n(d[j],
+                            idpool[positions[j]]);
+                    if ((int)heap.size() < length) {
+                        heap.push_back(n);
+                        std::push_heap(heap.begin(), heap.end());
+                    } else if ((length > 0) && (n < heap.front())) {
+                        std::pop_heap(heap.begin(), heap.end());
+                        heap.back() = n;
+                        std::push_heap(heap.begin(), heap.end());
+                    }
+                }
+                gs1.clear();
+                positions.clear();
+            }
+        }
+        std::sort_heap(heap.begin(), heap.end());
+        for (int i = 0; i < (int)heap.size(); i++) {
+            neighbors[i] = heap[i].second;
+        }
+        return heap.size();
+    }
+    std::vector<float> d(ids.size());
+    distances(seed, ids.data(), ids.size(), d.data());
+    std::vector<std::pair<float, musly_trackid> > ranked;
+    ranked.reserve(ids.size());
+    for (int i = 0; i < (int)ids.size(); i++) {
+        if (d[i] != FLT_MAX) {
+            ranked.push_back(std::make_pair(d[i], ids[i]));
+        }
+    }
+    length = std::min(length, (int)ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + length, ranked.end());
+    for (int i = 0; i < length; i++) {
+        neighbors[i] = ranked[i].second;
+    }
+    return length;
+}
+
+int
+timbre::set_option(
+        const char* name,
+        int value)
+{
+    std::string option(name);
+    if (option.compare(0, 5, "hnsw.") == 0) {
+        index_ready();
+    }
+    if (option == "hnsw.m") {
+        return index.set_m(value);
+    }
+    else if (option == "hnsw.ef_construction") {
+        return index.set_ef_construction(value);
+    }
+    else if (option == "hnsw.ef_search") {
+        return index.set_ef_search(value);
+    }
+    else if (option == "pivots.count") {
+        if ((value < 0) || (idpool.get_size() > 0)) {
+            return -1;
+        }
+        pivot_count = value;
+        select_pivots();
+        return 0;
+    }
+    else if (option == "vptree.enabled") {
+        if ((value != 0) && (value != 1)) {
+            return -1;
+        }
+        exact = (value == 1);
+        if (!exact) {
+            exact_index.clear();
+            exact_stale = true;
+        }
+        return 0;
+    }
+    else if ((option == "vptree.distances") ||
+            (option == "vptree.candidates")) {
+        if (value != 0) {
+            return -1;
+        }
+        exact_distances = 0;
+        exact_candidates = 0;
+        return 0;
+    }
+    else if (option == "covar.encoding") {
+        if ((value < covar_float32) || (value > covar_int8) ||
+                (idpool.get_size() > 0)) {
+            return -1;
+        }
+        store_encoding = (covar_encoding)value;
+        init_store();
+        return 0;
+    }
+    else if (option == "covar.rerank") {
+        if ((value < 0) || (idpool.get_size() > 0)) {
+            return -1;
+        }
+        covar_rerank = value;
+        init_store();
+        return 0;
+    }
+    return -1;
+}
+
+int
+timbre::get_option(
+        const char* name)
+{
+    std::string option(name);
+    if (option.compare(0, 5, "hnsw.") == 0) {
+        index_ready();
+    }
+    if (option == "hnsw.m") {
+        return index.get_m();
+    }
+    else if (option == "hnsw.ef_construction") {
+        return index.get_ef_construction();
+    }
+    else if (option == "hnsw.ef_search") {
+        return index.get_ef_search();
+    }
+    else if (option == "pivots.count") {
+        return pivot_count;
+    }
+    else if (option == "vptree.enabled") {
+        return exact ? 1 : 0;
+    }
+    else if (option == "vptree.distances") {
+        return std::min<long long>(exact_distances, INT_MAX);
+    }
+    else if (option == "vptree.candidates") {
+        return std::min<long long>(exact_candidates, INT_MAX);
+    }
+    else if (option == "covar.encoding") {
+        return store_encoding;
+    }
+    else if (option == "covar.rerank") {
+        return covar_rerank;
+    }
+    return -1;
 }
 
 int
@@ -195,7 +1249,9 @@ timbre::set_musicstyle(
     MINILOG(logTRACE) << "T initializing mutual proximity!";
 
     // save the mp normalization tracks
-    return mp.set_normtracks(tracks, length);
+    int ret = mp.set_normtracks(tracks, length);
+    select_pivots();
+    return ret;
 }
 
 int
@@ -216,14 +1272,39 @@ timbre::add_tracks(
         num_new = idpool.add_ids(trackids, length);
     }
 
+    exact_stale = true;
+    index_ready();
     Eigen::VectorXf sim(mp.get_normtracks()->size());
     mp.append_normfacts(num_new);
+    store.resize(idpool.get_size());
+    pivots.resize(idpool.get_size());
+    std::vector<float> pivot_sim(pivots.get_pivots());
     int pos = idpool.get_size() - length;
     for (int i = 0; i < length; i++) {
+        store.set_track(pos + i, tracks[i]);
+
         similarity_raw(tracks[i], mp.get_normtracks()->data(),
                 mp.get_normtracks()->size(), sim.data());
 
         mp.set_normfacts(pos + i, sim);
+
+        // keep the distances to the pivots among them
+        if ((pivots.get_pivots() > 0) &&
+                (gs.logdet_error(stored_gaussian(pos + i), store_encoding)
+                <= max_logdet_error)) {
+            for (int p = 0; p < pivots.get_pivots(); p++) {
+                pivot_sim[p] = sim[pivot_tracks[p]];
+            }
+            pivots.set_row(pos + i, pivot_sim.data());
+        } else {
+            pivots.clear_row(pos + i);
+        }
+
+        // (re-)insert the track into the neighbor search index
+        if (index.contains(trackids[i])) {
+            index.remove(&trackids[i], 1);
+        }
+        index.insert(trackids[i]);
     }
     return 0;
 }
@@ -232,9 +1313,14 @@ void
 timbre::remove_tracks(
         musly_trackid* trackids,
         int length) {
+    index_ready();
+    index.remove(trackids, length);
+    exact_stale = true;
     length = idpool.move_to_end(trackids, length);
     mp.trim_normfacts(length);
     idpool.remove_last(length);
+    store.resize(idpool.get_size());
+    pivots.resize(idpool.get_size());
 }
 
 int
@@ -254,18 +1340,33 @@ timbre::get_trackids(
     return idpool.get_size();
 }
 
+void
+timbre::positions_of(
+        const musly_trackid* trackids,
+        int length,
+        int* positions) {
+    idpool.positions_of(trackids, length, positions);
+}
+
 void
 timbre::swapped_positions(
         int pos_a,
         int pos_b) {
-    // positions in idpool have changed; update mp index accordingly
+    // positions in idpool have changed; update mp index and the track
+    // store accordingly
     mp.swap_normfacts(pos_a, pos_b);
+    store.swap_rows(pos_a, pos_b);
+    pivots.swap_rows(pos_a, pos_b);
 }
 
 int
 timbre::serialize_metadata(
         unsigned char* buffer) {
     if (buffer) {
+        // format version
+        *(int*)(buffer) = -metadata_version;
+        buffer += sizeof(int);
+
         // number of registered tracks
         *(int*)(buffer) = idpool.get_size();
         buffer += sizeof(int);
@@ -282,36 +1383,134 @@ timbre::serialize_metadata(
             std::copy(mptracks[i], mptracks[i] + track_getsize(), (musly_track*)buffer);
             buffer += track_getsize() * sizeof(musly_track);
         }
+
+        // pivots among them and their quantization step
+        *(int*)(buffer) = pivot_count;
+        buffer += sizeof(int);
+        *(int*)(buffer) = pivot_tracks.size();
+        buffer += sizeof(int);
+        std::copy(pivot_tracks.begin(), pivot_tracks.end(), (int*)buffer);
+        buffer += pivot_tracks.size() * sizeof(int);
+        *(float*)(buffer) = pivots.get_step();
+        buffer += sizeof(float);
+
+        // how the covariances are stored
+        *(int*)(buffer) = store_encoding;
+        buffer += sizeof(int);
+        *(int*)(buffer) = covar_rerank;
+        buffer += sizeof(int);
     }
-    return sizeof(int) + sizeof(musly_trackid) + sizeof(int)
-            + mp.get_normtracks()->size() * track_getsize() * sizeof(musly_track);
+    int size = 2 * sizeof(int) + sizeof(musly_trackid) + sizeof(int)
+            + mp.get_normtracks()->size() * track_getsize() * sizeof(musly_track)
+            + 2 * sizeof(int) + pivot_tracks.size() * sizeof(int)
+            + sizeof(float) + 2 * sizeof(int);
+
+    // neighbor search index
+    index_ready();
+    return size + index.serialize(buffer);
 }
 
 int
 timbre::deserialize_metadata(
-        unsigned char* buffer) {
-    // number of registered tracks
-    int expected_tracks = *(int*)(buffer);
-    buffer += sizeof(int);
+        unsigned char* buffer,
+        int& size) {
+    int left = size;
+
+    // format version, or the number of registered tracks of format 0
+    int version;
+    int expected_tracks;
+    if (!read_metadata(buffer, left, version)) {
+        return -1;
+    }
+    if (version >= 0) {
+        expected_tracks = version;
+        version = 0;
+    } else if ((-version > metadata_version) ||
+            !read_metadata(buffer, left, expected_tracks) ||
+            (expected_tracks < 0)) {
+        return -1;
+    } else {
+        version = -version;
+    }
 
     // largest seen track id
-    musly_trackid max_seen = *(musly_trackid*)(buffer);
-    buffer += sizeof(musly_trackid);
+    musly_trackid max_seen;
+    if (!read_metadata(buffer, left, max_seen)) {
+        return -1;
+    }
     idpool.add_ids(&max_seen, 1);
     idpool.remove_ids(&max_seen, 1);
 
     // mutual proximity tracks
-    int num_mptracks = *(int*)(buffer);
-    buffer += sizeof(int);
-    musly_track** mptracks = new musly_track*[num_mptracks];
+    const int mptrack_size = track_getsize() * sizeof(musly_track);
+    int num_mptracks;
+    if (!read_metadata(buffer, left, num_mptracks) || (num_mptracks < 0) ||
+            (num_mptracks > left / mptrack_size)) {
+        return -1;
+    }
+    std::vector<musly_track*> mptracks(num_mptracks);
     for (int i = 0; i < num_mptracks; i++) {
         mptracks[i] = (musly_track*)buffer;
-        buffer += track_getsize() * sizeof(musly_track);
+        buffer += mptrack_size;
     }
-    mp.set_normtracks(mptracks, num_mptracks);
-    delete[] mptracks;
+    left -= num_mptracks * mptrack_size;
+    mp.set_normtracks(mptracks.data(), num_mptracks);
     mp.append_normfacts(expected_tracks);
 
+    // format 0 ends here, with no pivots, float covariances and an index
+    // that is built anew
+    if (version == 0) {
+        pivot_count = 0;
+        pivot_tracks.clear();
+        pivots.reset(0, 1);
+        store_encoding = covar_float32;
+        covar_rerank = 0;
+        init_store();
+        size -= left;
+        return expected_tracks;
+    }
+
+    // pivots among them and their quantization step
+    int num_pivots;
+    if (!read_metadata(buffer, left, pivot_count) ||
+            !read_metadata(buffer, left, num_pivots) ||
+            (pivot_count < 0) || (num_pivots < 0) ||
+            (num_pivots > pivot_count) || (num_pivots > num_mptracks)) {
+        return -1;
+    }
+    pivot_tracks.resize(num_pivots);
+    for (int p = 0; p < num_pivots; p++) {
+        if (!read_metadata(buffer, left, pivot_tracks[p]) ||
+                (pivot_tracks[p] < 0) || (pivot_tracks[p] >= num_mptracks)) {
+            return -1;
+        }
+    }
+    float step;
+    if (!read_metadata(buffer, left, step)) {
+        return -1;
+    }
+    pivots.reset(num_pivots, step);
+
+    // how the covariances are stored
+    int encoding;
+    int rerank;
+    if (!read_metadata(buffer, left, encoding) ||
+            !read_metadata(buffer, left, rerank) ||
+            (encoding < covar_float32) || (encoding > covar_int8) ||
+            (rerank < 0)) {
+        return -1;
+    }
+    store_encoding = (covar_encoding)encoding;
+    covar_rerank = rerank;
+    init_store();
+
+    // neighbor search index
+    const int index_size = index.deserialize(buffer, left);
+    if (index_size < 0) {
+        return -1;
+    }
+    size -= left - index_size;
+
     return expected_tracks;
 }
 
@@ -334,9 +1533,14 @@ timbre::serialize_trackdata(
                     (float*)(buffer),
                     (float*)(buffer + sizeof(float)));
             buffer += 2 * sizeof(float);
+            std::fill(buffer, buffer + pivot_bytes(), 0);
+            std::copy(pivots.codes(i), pivots.codes(i) + pivots.get_pivots(),
+                    buffer);
+            buffer += pivot_bytes();
         }
     }
-    return num_tracks * (sizeof(musly_trackid) + 2 * sizeof(float));
+    return num_tracks * (sizeof(musly_trackid) + 2 * sizeof(float)
+            + pivot_bytes());
 }
 
 int
@@ -346,17 +1550,172 @@ timbre::deserialize_trackdata(
     if (num_tracks < 0) {
         return -1;
     }
+    exact_stale = true;
     int had_tracks = idpool.get_size();
     for (int i = 0; i < num_tracks; i++) {
         idpool.add_ids((musly_trackid*)buffer, 1);
+        store.resize(idpool.get_size());
+        pivots.resize(idpool.get_size());
         buffer += sizeof(musly_trackid);
         mp.set_normfacts(had_tracks + i,
                 *(float*)(buffer),
                 *(float*)(buffer + sizeof(float)));
         buffer += 2 * sizeof(float);
+        pivots.set_codes(had_tracks + i, buffer);
+        buffer += pivot_bytes();
     }
     return num_tracks;
 }
 
+int
+timbre::serialize_sections(
+        mapped_jukebox::writer& out) {
+    const int num_tracks = idpool.get_size();
+    std::vector<musly_track*> &mptracks = *mp.get_normtracks();
+
+    // the counts, the quantization step of the pivots, how the covariances
+    // are stored and the pivots among the mutual proximity tracks
+    std::vector<int> meta;
+    meta.push_back(num_tracks);
+    meta.push_back(idpool.get_max_seen());
+    meta.push_back(mptracks.size());
+    meta.push_back(pivot_count);
+    meta.push_back(pivot_tracks.size());
+    float step = pivots.get_step();
+    meta.push_back(0);
+    std::memcpy(&meta.back(), &step, sizeof(float));
+    meta.push_back(store_encoding);
+    meta.push_back(covar_rerank);
+    meta.insert(meta.end(), pivot_tracks.begin(), pivot_tracks.end());
+    out.add_copy(section_meta, meta.data(), meta.size() * sizeof(int));
+
+    // mutual proximity tracks
+    std::vector<musly_track> normtracks;
+    for (int i = 0; i < (int)mptracks.size(); i++) {
+        normtracks.insert(normtracks.end(), mptracks[i],
+                mptracks[i] + track_getsize());
+    }
+    out.add_copy(section_normtracks, normtracks.data(),
+            normtracks.size() * sizeof(musly_track));
+
+    // the columns by position: ids, normfacts, pivot codes and features
+    const uint64_t floats = (uint64_t)num_tracks * sizeof(float);
+    out.add(section_ids, idpool.idlist().data(),
+            (uint64_t)num_tracks * sizeof(musly_trackid));
+    out.add(section_norm_mu, mp.get_norm_mu(), floats);
+    out.add(section_norm_std, mp.get_norm_std(), floats);
+    out.add(section_pivots, pivots.codes(0),
+            (uint64_t)num_tracks * pivots.get_pivots());
+    out.add(section_present, store.present_data(), num_tracks);
+    for (int c = 0; c < store.get_columns(); c++) {
+        out.add(section_column(c), store.column_data(c),
+                floats * store.get_stride(c));
+    }
+
+    // neighbor search index
+    index_ready();
+    std::vector<unsigned char> graph(index.serialize(NULL));
+    index.serialize(graph.data());
+    out.add_copy(section_index, graph.data(), graph.size());
+    return 0;
+}
+
+int
+timbre::map_sections(
+        const mapped_jukebox& in) {
+    uint64_t size;
+    const int* meta = (const int*)in.find(section_meta, size);
+    if (!meta || (size < 8 * sizeof(int)) || (idpool.get_size() > 0)) {
+        return -1;
+    }
+    const int num_tracks = meta[0];
+    const musly_trackid max_seen = meta[1];
+    const int num_mptracks = meta[2];
+    const int num_pivots = meta[4];
+    float step;
+    std::memcpy(&step, meta + 5, sizeof(float));
+    if ((num_tracks < 0) || (num_mptracks < 0) || (meta[3] < 0) ||
+            (num_pivots < 0) || (num_pivots > meta[3]) ||
+            (num_pivots > num_mptracks) ||
+            (meta[6] < covar_float32) || (meta[6] > covar_int8) ||
+            (meta[7] < 0) ||
+            (size != (8 + (uint64_t)num_pivots) * sizeof(int))) {
+        return -1;
+    }
+    for (int p = 0; p < num_pivots; p++) {
+        if ((meta[8 + p] < 0) || (meta[8 + p] >= num_mptracks)) {
+            return -1;
+        }
+    }
+
+    // the columns of the store depend on how the covariances are stored
+    store_encoding = (covar_encoding)meta[6];
+    covar_rerank = meta[7];
+    init_store();
+
+    // all sections must be there, and of the size the counts imply
+    const uint64_t floats = (uint64_t)num_tracks * sizeof(float);
+    const unsigned char* normtracks = in.find(section_normtracks, size);
+    if (!normtracks || (size != (uint64_t)num_mptracks * track_getsize()
+            * sizeof(musly_track))) {
+        return -1;
+    }
+    const unsigned char* ids = in.find(section_ids, size);
+    if (!ids || (size != (uint64_t)num_tracks * sizeof(musly_trackid))) {
+        return -1;
+    }
+    const unsigned char* norm_mu = in.find(section_norm_mu, size);
+    if (!norm_mu || (size != floats)) {
+        return -1;
+    }
+    const unsigned char* norm_std = in.find(section_norm_std, size);
+    if (!norm_std || (size != floats)) {
+        return -1;
+    }
+    const unsigned char* codes = in.find(section_pivots, size);
+    if (!codes || (size != (uint64_t)num_tracks * num_pivots)) {
+        return -1;
+    }
+    const unsigned char* present = in.find(section_present, size);
+    if (!present || (size != (uint64_t)num_tracks)) {
+        return -1;
+    }
+    std::vector<const float*> columns(store.get_columns());
+    for (int c = 0; c < store.get_columns(); c++) {
+        columns[c] = (const float*)in.find(section_column(c), size);
+        if (!columns[c] || (size != floats * store.get_stride(c))) {
+            return -1;
+        }
+    }
+    const unsigned char* graph = in.find(section_index, size);
+    if (!graph || (size < 5 * sizeof(int)) || (size > INT_MAX)) {
+        return -1;
+    }
+
+    if (!idpool.map((const musly_trackid*)ids, num_tracks, max_seen)) {
+        return -1;
+    }
+    std::vector<musly_track*> mptracks(num_mptracks);
+    for (int i = 0; i < num_mptracks; i++) {
+        mptracks[i] = (musly_track*)normtracks
+                + (size_t)i * track_getsize();
+    }
+    mp.set_normtracks(mptracks.data(), num_mptracks);
+    mp.map_normfacts((const float*)norm_mu, (const float*)norm_std,
+            num_tracks);
+    pivot_count = meta[3];
+    pivot_tracks.assign(meta + 8, meta + 8 + num_pivots);
+    pivots.reset(num_pivots, step);
+    pivots.map(num_tracks, codes);
+    store.map(num_tracks, columns.data(), present);
+    exact_stale = true;
+
+    // the neighbor search index is restored when first needed, as it takes
+    // longer than all the rest
+    mapped_index = graph;
+    mapped_index_size = size;
+    return 0;
+}
+
 } /* namespace methods */
 } /* namespace musly */
@@ -14,18 +14,24 @@
 #define MUSLY_METHODS_TIMBRE_H_
 
 #include "method.h"
-#include "powerspectrum.h"
-#include "melspectrum.h"
 #include "mfcc.h"
 #include "gaussianstatistics.h"
+#include "mfccstream.h"
 #include "mutualproximity.h"
 #include "idpool.h"
+#include "trackstore.h"
+#include "hnsw.h"
+#include "vptree.h"
+#include "pivottable.h"
+#include <atomic>
+#include <mutex>
 
 namespace musly {
 namespace methods {
 
 class timbre :
-        public musly::method, musly::ordered_idpool_observer
+        public musly::method, musly::ordered_idpool_observer,
+        musly::track_metric
 
 {
 MUSLY_METHOD_REGCLASS(timbre);
@@ -36,7 +42,6 @@ private:
     const int window_size;
     const float hop;
     const int max_pcmlength;
-    const int ps_bins;
     const int mel_bins;
     const int mfcc_bins;
 
@@ -44,12 +49,101 @@ private:
     int track_covar;
     int track_logdet;
 
-    powerspectrum ps;
-    melspectrum mel;
+    int store_mu;
+    int store_covar;
+    int store_logdet;
+
+    /** how the covariances are stored, and the number of extra candidates
+     * knn() re-ranks with the float32 covariances kept in column
+     * store_covar_exact for it, or -1 */
+    covar_encoding store_encoding;
+    int covar_rerank;
+    int store_covar_exact;
+
+    spectrumbank bank;
     mfcc mfccs;
     gaussian_statistics gs;
     mutualproximity mp;
     ordered_idpool<musly_trackid> idpool;
+    trackstore store;
+    hnsw index;
+
+    /** the serialized index of a mapped jukebox file and its size in bytes,
+     * restored when first needed, or NULL */
+    const unsigned char* mapped_index;
+    int mapped_index_size;
+    std::mutex index_lock;
+
+    /** the number of pivots asked for, the music style tracks used as
+     * pivots and the distances of all tracks to them */
+    int pivot_count;
+    std::vector<int> pivot_tracks;
+    pivottable pivots;
+
+    /** Passes on the raw Jensen-Shannon divergences to the exact index,
+     * including the negative ones of failed comparisons, to reproduce a
+     * linear scan exactly.
+     */
+    class raw_metric : public musly::track_metric {
+    public:
+        raw_metric(timbre* t) : t(t) {};
+        virtual void
+        distances(
+                musly_trackid from,
+                const musly_trackid* to,
+                int length,
+                float* distances) {
+            t->raw_distances(from, to, length, distances);
+        }
+    private:
+        timbre* t;
+    };
+
+    raw_metric exact_metric;
+    vptree exact_index;
+    bool exact;
+    bool exact_stale;
+    std::mutex exact_lock;
+    std::atomic<long long> exact_distances;
+    std::atomic<long long> exact_candidates;
+
+    void
+    init_store();
+
+    gaussian
+    stored_gaussian(
+            int position);
+
+    gaussian
+    exact_gaussian(
+            int position);
+
+    void
+    raw_distances(
+            musly_trackid from,
+            const musly_trackid* to,
+            int length,
+            float* distances);
+
+    bool
+    exact_ready();
+
+    void
+    index_ready();
+
+    void
+    select_pivots();
+
+    int
+    pivot_bytes();
+
+    int
+    knn_results(
+            int seed_position,
+            std::vector<mutualproximity::neighbor>& heap,
+            int k,
+            float* knn_similarities,
+            musly_trackid* knn_trackids);
 
     void
     similarity_raw(
@@ -67,11 +161,40 @@ public:
     virtual const char*
     about();
 
+    virtual analysis_context*
+    analysis_context_alloc() const;
+
     virtual int
     analyze_track(
             float* pcm,
             int length,
-            musly_track* track);
+            musly_track* track,
+            analysis_context* context) const;
+
+    virtual int
+    analyze_track_rate(
+            float* pcm,
+            int length,
+            int sample_rate,
+            musly_track* track,
+            analysis_context* context) const;
+
+    virtual int
+    analyze_begin(
+            int length,
+            float peak,
+            analysis_context* context) const;
+
+    virtual int
+    analyze_feed(
+            const float* pcm,
+            int length,
+            analysis_context* context) const;
+
+    virtual int
+    analyze_finish(
+            musly_track* track,
+            analysis_context* context) const;
 
     virtual int
     similarity(
@@ -82,6 +205,61 @@ public:
             int length,
             float* similarities);
 
+    virtual int
+    similarity_byid(
+            musly_trackid seed_trackid,
+            musly_trackid* trackids,
+            int length,
+            float* similarities);
+
+    virtual int
+    similarity_batch(
+            musly_trackid* seed_trackids,
+            int num_seeds,
+            musly_trackid* trackids,
+            int length,
+            float* similarities);
+
+    virtual int
+    similarity_allpairs(
+            musly_trackid* trackids,
+            int length,
+            int block_rows,
+            musly_similarity_sink sink,
+            void* user_data);
+
+    virtual int
+    knn(
+            musly_trackid seed_trackid,
+            musly_trackid* trackids,
+            int length,
+            float* knn_similarities,
+            musly_trackid* knn_trackids,
+            int k);
+
+    virtual int
+    store_tracks(
+            musly_track** tracks,
+            musly_trackid* trackids,
+            int length);
+
+    virtual int
+    guess_neighbors(
+            musly_trackid seed,
+            musly_trackid* neighbors,
+            int length,
+            musly_trackid* limit_to,
+            int num_limit_to);
+
+    virtual int
+    set_option(
+            const char* name,
+            int value);
+
+    virtual int
+    get_option(
+            const char* name);
+
     virtual int
     set_musicstyle(
             musly_track** tracks,
@@ -109,6 +287,19 @@ public:
     get_trackids(
             musly_trackid* trackids);
 
+    virtual void
+    positions_of(
+            const musly_trackid* trackids,
+            int length,
+            int* positions);
+
+    virtual void
+    distances(
+            musly_trackid from,
+            const musly_trackid* to,
+            int length,
+            float* distances);
+
     virtual void
     swapped_positions(
             int pos_a,
@@ -120,7 +311,8 @@ public:
 
     virtual int
     deserialize_metadata(
-            unsigned char* buffer);
+            unsigned char* buffer,
+            int& size);
 
     virtual int
     serialize_trackdata(
@@ -133,6 +325,14 @@ public:
             unsigned char* buffer,
             int num_tracks);
 
+    virtual int
+    serialize_sections(
+            mapped_jukebox::writer& out);
+
+    virtual int
+    map_sections(
+            const mapped_jukebox& in);
+
 };
 
 } /* namespace methods */
@@ -9,17 +9,20 @@
  * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
+#include <cmath>
+
 #include "minilog.h"
 #include "mfcc.h"
 
 namespace musly {
 
 mfcc::mfcc(int mel_bins, int mfcc_bins) :
-        dct(mel_bins, mfcc_bins)
+        dct(mel_bins, mfcc_bins),
+        mel_bins(mel_bins)
 {
 }
 
-Eigen::MatrixXf mfcc::from_melspectrum(const Eigen::MatrixXf& mel)
+Eigen::MatrixXf mfcc::from_melspectrum(const Eigen::MatrixXf& mel) const
 {
     MINILOG(logTRACE) << "Computing MFCCs.";
 
@@ -30,4 +33,12 @@ Eigen::MatrixXf mfcc::from_melspectrum(const Eigen::MatrixXf& mel)
     return mfcc_coeffs;
 }
 
+void mfcc::from_melframe(float* mel, float* mfcc_coeffs) const
+{
+    for (int i = 0; i < mel_bins; i++) {
+        mel[i] = std::log(1.0f + mel[i]);
+    }
+    dct.compress_frame(mel, mfcc_coeffs);
+}
+
 } /* namespace musly */
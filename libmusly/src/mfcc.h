@@ -26,6 +26,10 @@ private:
      */
     discretecosinetransform dct;
 
+    /** The number of input MEL bins.
+     */
+    int mel_bins;
+
 public:
     /** Preinitialize the MFCC class by specifying the number of input MEL
      * bins and output MFCC bins.
@@ -38,7 +42,15 @@ public:
      * \param mel The MEL spectrum computed with melspecturm
      * \returns The DCT compressed MFCC representation of the input specturm.
      */
-    Eigen::MatrixXf from_melspectrum(const Eigen::MatrixXf& mel);
+    Eigen::MatrixXf from_melspectrum(const Eigen::MatrixXf& mel) const;
+
+    /** Compute the MFCCs of a single frame, like from_melspectrum() does for
+     * each column.
+     * \param mel The MEL spectrum of the frame. It is log-compressed in
+     * place.
+     * \param mfcc_coeffs The output array of MFCCs.
+     */
+    void from_melframe(float* mel, float* mfcc_coeffs) const;
 };
 
 } /* namespace musly */
@@ -0,0 +1,285 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *                2014, Jan Schlueter <jan.schlueter@ofai.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "minilog.h"
+#include "mfccstream.h"
+
+namespace musly {
+
+mfccstream::mfccstream(
+        const spectrumbank& bank,
+        const mfcc& mfccs,
+        int mel_bins,
+        int mfcc_bins,
+        int max_length) :
+        bank(bank),
+        mfccs(mfccs),
+        mel_bins(mel_bins),
+        mfcc_bins(mfcc_bins),
+        max_length(max_length),
+        current(NULL),
+        started(false),
+        skip(0),
+        remaining(0),
+        peak_known(false),
+        scale_peak(1),
+        peak(0),
+        frame_mel(mel_bins),
+        frame_mfcc(mfcc_bins),
+        frame_x(mfcc_bins),
+        frames(0),
+        shift(mfcc_bins),
+        sum(mfcc_bins),
+        sum_sq(mfcc_bins*(mfcc_bins+1)/2)
+{
+    select_rate(bank.get_reference_rate());
+}
+
+bool
+mfccstream::select_rate(
+        int sample_rate)
+{
+    if (current && (current->sample_rate == sample_rate)) {
+        return true;
+    }
+    const spectrumbank::rate* r = bank.get(sample_rate);
+    if (!r) {
+        return false;
+    }
+    const int win_size = r->ps.get_winsize();
+    if (!current || (current->ps.get_winsize() != win_size)) {
+        fft.reset(new powerspectrum::workspace(win_size));
+        frame_ps.resize(win_size/2 + 1);
+        pending.reserve(win_size);
+    }
+    current = r;
+    return true;
+}
+
+int
+mfccstream::max_samples() const
+{
+    return (int)((int64_t)max_length * current->sample_rate /
+            bank.get_reference_rate());
+}
+
+int
+mfccstream::begin(
+        int length,
+        float peak,
+        int sample_rate)
+{
+    if ((length < 0) || !(peak >= 0) || !select_rate(sample_rate)) {
+        return -1;
+    }
+
+    // select the central max_length samples, as for whole signals
+    const int max_length = max_samples();
+    skip = (length > max_length) ? (length - max_length) / 2 : 0;
+    remaining = (length > 0) ? std::min(length, max_length) : max_length;
+
+    peak_known = (peak > 0);
+    scale_peak = peak_known ? peak : 1.0f;
+    this->peak = 0;
+    pending.clear();
+    deferred.clear();
+    frames = 0;
+    started = true;
+    return 0;
+}
+
+int
+mfccstream::feed(
+        const float* pcm,
+        int length)
+{
+    if (!started || (length < 0) || (!pcm && (length > 0))) {
+        return -1;
+    }
+
+    // keep the samples of the excerpt only
+    int skipped = std::min(length, skip);
+    pcm += skipped;
+    length -= skipped;
+    skip -= skipped;
+    length = std::min(length, remaining);
+    remaining -= length;
+
+    for (int i = 0; i < length; i++) {
+        peak = std::max(peak, std::fabs(pcm[i]));
+    }
+
+    // complete the frames starting in the pending samples
+    const int win_size = current->ps.get_winsize();
+    const int hop_size = current->ps.get_hopsize();
+    int appended = 0;
+    while (!pending.empty()) {
+        int count = std::min(length, win_size - (int)pending.size());
+        pending.insert(pending.end(), pcm, pcm + count);
+        pcm += count;
+        length -= count;
+        appended += count;
+        if ((int)pending.size() < win_size) {
+            return 0;
+        }
+        analyze_frames(pending.data(), 1);
+        pending.erase(pending.begin(), pending.begin() + hop_size);
+        if ((int)pending.size() <= appended) {
+            // the next frame starts within the given samples
+            pcm -= pending.size();
+            length += pending.size();
+            pending.clear();
+        }
+    }
+
+    // analyze the frames within the given samples in place, and keep the
+    // samples of the next one
+    int count = (length >= win_size) ?
+            (length - (win_size - hop_size)) / hop_size : 0;
+    analyze_frames(pcm, count);
+    pending.assign(pcm + count*hop_size, pcm + length);
+    return 0;
+}
+
+void
+mfccstream::analyze_frames(
+        const float* pcm,
+        int count)
+{
+    const int hop_size = current->ps.get_hopsize();
+    const float pcm_scale = powerspectrum::get_scale(scale_peak) *
+            current->scale;
+    for (int i = 0; i < count; i++) {
+        current->ps.from_frame(pcm + i*hop_size, pcm_scale, *fft,
+                frame_ps.data());
+        current->mel.from_frame(frame_ps.data(), frame_mel.data());
+        if (peak_known) {
+            add_frame(frame_mel.data());
+        } else {
+            deferred.insert(deferred.end(), frame_mel.begin(),
+                    frame_mel.end());
+        }
+    }
+}
+
+void
+mfccstream::add_frame(
+        float* mel_frame)
+{
+    mfccs.from_melframe(mel_frame, frame_mfcc.data());
+
+    if (frames == 0) {
+        std::copy(frame_mfcc.begin(), frame_mfcc.end(), shift.begin());
+        std::fill(sum.begin(), sum.end(), 0.0);
+        std::fill(sum_sq.begin(), sum_sq.end(), 0.0);
+    }
+    double* x = frame_x.data();
+    for (int i = 0; i < mfcc_bins; i++) {
+        x[i] = frame_mfcc[i] - shift[i];
+        sum[i] += x[i];
+    }
+    double* row = sum_sq.data();
+    for (int i = 0; i < mfcc_bins; i++) {
+        for (int j = 0; j <= i; j++) {
+            row[j] += x[i] * x[j];
+        }
+        row += i + 1;
+    }
+    frames++;
+}
+
+int
+mfccstream::finish(
+        const gaussian_statistics& gs,
+        gaussian& g)
+{
+    if (!started) {
+        return -1;
+    }
+    started = false;
+    pending.clear();
+
+    // The deferred mel spectra were computed for a peak of 1. As the mel
+    // spectrum is linear in the power spectrum, scaling them by the squared
+    // ratio to the actual peak gives the ones for the actual peak.
+    if (!deferred.empty()) {
+        const float factor = (peak > 0) ? 1.0f / (peak*peak) : 1.0f;
+        for (size_t start = 0; start < deferred.size(); start += mel_bins) {
+            for (int i = 0; i < mel_bins; i++) {
+                frame_mel[i] = deferred[start + i] * factor;
+            }
+            add_frame(frame_mel.data());
+        }
+        deferred.clear();
+    }
+
+    if (frames <= mfcc_bins) {
+        MINILOG(logTRACE) << "could not estimate Gaussian. "
+                << "Too few frames=" << frames;
+        return 2;
+    }
+
+    Eigen::VectorXf mu(mfcc_bins);
+    Eigen::MatrixXf covar(mfcc_bins, mfcc_bins);
+    const double* row = sum_sq.data();
+    for (int i = 0; i < mfcc_bins; i++) {
+        mu(i) = shift[i] + sum[i] / frames;
+        for (int j = 0; j <= i; j++) {
+            double c = (row[j] - sum[i] * sum[j] / frames) / (frames - 1.0);
+            covar(i, j) = c;
+            covar(j, i) = c;
+        }
+        row += i + 1;
+    }
+    return gs.estimate_gaussian(mu, covar, g) ? 0 : 2;
+}
+
+int
+mfccstream::analyze(
+        const float* pcm,
+        int length,
+        int sample_rate,
+        const gaussian_statistics& gs,
+        gaussian& g)
+{
+    if (!select_rate(sample_rate)) {
+        return -1;
+    }
+
+    // the peak of the central excerpt begin() selects
+    const int max_length = max_samples();
+    int start = 0;
+    int excerpt = length;
+    if (length > max_length) {
+        start = (length - max_length) / 2;
+        excerpt = max_length;
+    }
+    float excerpt_peak = 0;
+    for (int i = start; i < start + excerpt; i++) {
+        excerpt_peak = std::max(excerpt_peak, std::fabs(pcm[i]));
+    }
+
+    int ret = begin(length, excerpt_peak, sample_rate);
+    if (ret == 0) {
+        ret = feed(pcm, length);
+    }
+    if (ret == 0) {
+        ret = finish(gs, g);
+    }
+    return ret;
+}
+
+} /* namespace musly */
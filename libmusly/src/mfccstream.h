@@ -0,0 +1,192 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *                2014, Jan Schlueter <jan.schlueter@ofai.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_MFCCSTREAM_H_
+#define MUSLY_MFCCSTREAM_H_
+
+#include <memory>
+#include <vector>
+#include <Eigen/Core>
+#include "method.h"
+#include "spectrumbank.h"
+#include "mfcc.h"
+#include "gaussianstatistics.h"
+
+namespace musly {
+
+/** The analysis context of the methods modelling a track by a single
+ * Gaussian of its MFCCs. It carries each frame of a signal through window,
+ * FFT, power, mel filters, logarithm and DCT into running first and second
+ * moments of the MFCCs, all in buffers of a frame's size that are reused
+ * from one frame and one track to the next. The signal can be passed at
+ * once or chunk by chunk, keeping the samples of an incomplete frame. If the
+ * peak of the signal is known in advance, the memory use thus depends on the
+ * window size only, not on the length of the signal. Otherwise, the mel
+ * spectra of the frames are kept until the peak is known, which takes about
+ * a fourteenth of the memory of the signal.
+ *
+ * Signals of sample rates other than the reference rate of the methods are
+ * analyzed with the window and filters of their rate from a spectrumbank.
+ */
+class mfccstream : public method::analysis_context {
+private:
+    const spectrumbank& bank;
+    const mfcc& mfccs;
+    const int mel_bins;
+    const int mfcc_bins;
+
+    /** The number of samples the methods analyze at most, at the reference
+     * rate.
+     */
+    const int max_length;
+
+    /** The window and filters of the sample rate of the signal.
+     */
+    const spectrumbank::rate* current;
+
+    /** The FFT plan and buffers, for the window size of the current rate.
+     */
+    std::unique_ptr<powerspectrum::workspace> fft;
+
+    /** Whether begin() has been called without finish().
+     */
+    bool started;
+
+    /** The number of samples to skip before the excerpt to analyze, and the
+     * number of samples of the excerpt still to come.
+     */
+    int skip;
+    int remaining;
+
+    /** Whether the peak amplitude of the signal is known in advance, the
+     * peak amplitude the signal is scaled for, and the actual peak of the
+     * samples analyzed so far.
+     */
+    bool peak_known;
+    float scale_peak;
+    float peak;
+
+    /** The samples of the next frame, as far as they have been fed.
+     */
+    std::vector<float> pending;
+
+    /** The mel spectra of the frames analyzed so far, frame by frame, if
+     * the peak is not known in advance.
+     */
+    std::vector<float> deferred;
+
+    /** The powerspectrum, mel spectrum and MFCCs of the current frame, and
+     * its MFCCs relative to the first frame.
+     */
+    std::vector<float> frame_ps;
+    std::vector<float> frame_mel;
+    std::vector<float> frame_mfcc;
+    std::vector<double> frame_x;
+
+    /** The number of frames analyzed, and the sum and the sum of outer
+     * products of their MFCCs, relative to the MFCCs of the first frame
+     * to avoid cancellation. The outer products are summed up as a packed
+     * lower triangle, row by row.
+     */
+    int frames;
+    std::vector<double> shift;
+    std::vector<double> sum;
+    std::vector<double> sum_sq;
+
+    /** Analyze \p count frames of the samples \p pcm, and either add their
+     * MFCCs to the moments or defer them.
+     */
+    void
+    analyze_frames(
+            const float* pcm,
+            int count);
+
+    /** Add the MFCCs of the mel spectrum \p mel_frame to the moments. The
+     * mel spectrum is overwritten.
+     */
+    void
+    add_frame(
+            float* mel_frame);
+
+    /** Switch to the window and filters of \p sample_rate.
+     * \returns false if the rate is not supported.
+     */
+    bool
+    select_rate(
+            int sample_rate);
+
+    /** Return the maximum number of samples to analyze at the current
+     * rate.
+     */
+    int
+    max_samples() const;
+
+public:
+    mfccstream(
+            const spectrumbank& bank,
+            const mfcc& mfccs,
+            int mel_bins,
+            int mfcc_bins,
+            int max_length);
+
+    /** Start analyzing a new signal, discarding any previous one.
+     * \param length The number of samples that will be fed, or 0 if
+     * unknown. If larger than the maximum length, only the central excerpt
+     * is analyzed. If unknown, the start of the signal is analyzed.
+     * \param peak The peak amplitude of the (analyzed part of the) signal,
+     * or 0 if unknown. Signals are normalized to their peak before the
+     * analysis. If the peak of a fed signal is unknown, the mel spectra are
+     * deferred until it is known in finish(), as the MFCCs depend on the
+     * scale nonlinearly.
+     * \param sample_rate The sample rate of the signal.
+     * \returns 0 on success, -1 on invalid arguments or an unsupported
+     * sample rate.
+     */
+    int
+    begin(
+            int length,
+            float peak,
+            int sample_rate);
+
+    /** Feed the next \p length samples of the signal.
+     * \returns 0 on success, -1 if not started or on invalid arguments.
+     */
+    int
+    feed(
+            const float* pcm,
+            int length);
+
+    /** Finish the analysis, estimating the Gaussian \p g of the MFCCs.
+     * \returns 0 on success, 2 if the signal was too short to estimate the
+     * Gaussian, -1 if not started.
+     */
+    int
+    finish(
+            const gaussian_statistics& gs,
+            gaussian& g);
+
+    /** Analyze a whole signal of \p length samples of \p sample_rate Hz at
+     * once, using its central excerpt of the maximum length, and estimate
+     * the Gaussian \p g of the MFCCs. Returns like finish(), or -1 for an
+     * unsupported sample rate.
+     */
+    int
+    analyze(
+            const float* pcm,
+            int length,
+            int sample_rate,
+            const gaussian_statistics& gs,
+            gaussian& g);
+};
+
+} /* namespace musly */
+#endif /* MUSLY_MFCCSTREAM_H_ */
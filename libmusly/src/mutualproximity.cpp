@@ -12,12 +12,126 @@
 
 #include <Eigen/Core>
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
 
 #include "musly/musly_types.h"
 #include "mutualproximity.h"
+#include "simd.h"
 
 namespace musly {
 
+namespace {
+
+/** The number of tracks normalize() and normalize_topk() gather the normfacts
+ * of into columns at a time.
+ */
+const int chunk = 256;
+
+/** Return exp(y) for -87 <= y <= 0, without branches, so loops calling it
+ * vectorize. The argument is split into n*ln(2) + r, with |r| <= ln(2)/2,
+ * and exp(r) is approximated by the minimax polynomial of the Cephes
+ * library (relative error below 2e-7).
+ */
+inline float
+exp_nonpositive(
+        float y)
+{
+    // truncation rounds the (negative) argument to the nearest integer
+    int n = static_cast<int>(y * 1.44269504088896341f - 0.5f);
+    float r = y - n * 0.693359375f + n * 2.12194440e-4f;
+    float p = 1.9875691500e-4f;
+    p = p*r + 1.3981999507e-3f;
+    p = p*r + 8.3334519073e-3f;
+    p = p*r + 4.1665795894e-2f;
+    p = p*r + 1.6666665459e-1f;
+    p = p*r + 5.0000001201e-1f;
+    p = p*r*r + r + 1.0f;
+    int bits = (n + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+/** Return the probability of a standard normal variable to exceed \p z,
+ * i.e., 1 - normcdf(z) = erfc(z/sqrt(2))/2, in single precision and without
+ * branches. Uses formula 7.1.26 of Abramowitz & Stegun for erfc, which has
+ * an absolute error below 1.5e-7; together with rounding, the result is
+ * within 2e-7 of the exact value. It is never larger than 1. The result for
+ * a NaN \p z is unspecified.
+ */
+inline float
+upper_tail(
+        float z)
+{
+    const float a1 =  0.254829592f;
+    const float a2 = -0.284496736f;
+    const float a3 =  1.421413741f;
+    const float a4 = -1.453152027f;
+    const float a5 =  1.061405429f;
+    const float p  =  0.3275911f;
+
+    // Limit x to 9, where erfc(x) is below 1e-36 already. The bits of
+    // non-negative floats order like their values, and clamping them as
+    // integers keeps compilers from branching on the limit. For the same
+    // reason, the sign of z is taken from its bits, not from a comparison
+    // (which may trap on NaN).
+    int sign_bits;
+    std::memcpy(&sign_bits, &z, sizeof(sign_bits));
+    float x = std::fabs(z) * 0.70710678118654752f;
+    int bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    bits = std::min(bits, 0x41100000);
+    std::memcpy(&x, &bits, sizeof(x));
+
+    float t = 1.0f / (1.0f + p*x);
+    float h = 0.5f * ((((a5*t + a4)*t + a3)*t + a2)*t + a1)*t *
+            exp_nonpositive(-x*x);
+    // h for positive z, 1 - h for negative ones
+    float base = (sign_bits < 0) ? 1.0f : 0.0f;
+    float sign = (sign_bits < 0) ? -1.0f : 1.0f;
+    return base + sign*h;
+}
+
+/** Normalize the raw similarities \p sim of \p length tracks to a seed with
+ * the normfacts \p seed_mu, \p seed_std. The normfacts of the tracks are
+ * given as columns in the same order as \p sim. Tracks at the position
+ * \p seed_position are the seed itself and get a similarity of 0. NaN
+ * similarities stay NaN.
+ */
+MUSLY_TARGET_CLONES
+void
+normalize_columns(
+        float seed_mu,
+        float seed_std,
+        int seed_position,
+        const int* MUSLY_RESTRICT positions,
+        const float* MUSLY_RESTRICT mu,
+        const float* MUSLY_RESTRICT std,
+        int length,
+        float* MUSLY_RESTRICT sim)
+{
+    for (int i = 0; i < length; i++) {
+        float d = sim[i];
+        float p1 = upper_tail((d - seed_mu) / seed_std);
+        float p2 = upper_tail((d - mu[i]) / std[i]);
+        float s = 1.0f - p1*p2;
+
+        // pass NaN on and zero the seed, blending bits to stay branch free
+        int s_bits;
+        int d_bits;
+        std::memcpy(&s_bits, &s, sizeof(s_bits));
+        std::memcpy(&d_bits, &d, sizeof(d_bits));
+        int nan = -static_cast<int>(d != d);
+        int seed = -static_cast<int>(positions[i] == seed_position);
+        s_bits = ((s_bits & ~nan) | (d_bits & nan)) & ~seed;
+        std::memcpy(&sim[i], &s_bits, sizeof(s_bits));
+    }
+}
+
+} /* anonymous namespace */
+
 mutualproximity::mutualproximity(method* m) :
         m(m)
 {
@@ -66,7 +180,8 @@ mutualproximity::get_normtracks()
 void
 mutualproximity::append_normfacts(
         int count) {
-    norm_facts.resize(norm_facts.size() + count);
+    norm_mu.own().resize(norm_mu.size() + count);
+    norm_std.own().resize(norm_std.size() + count);
 }
 
 void
@@ -88,11 +203,12 @@ mutualproximity::set_normfacts(
         float std) {
     // allocate space if needed
     // (ideally, this has already been taken care of by append_normfacts)
-    if (position >= (int)norm_facts.size()) {
-        norm_facts.resize(position+1);
+    if (position >= (int)norm_mu.size()) {
+        norm_mu.own().resize(position+1);
+        norm_std.own().resize(position+1);
     }
-    norm_facts[position].mu = mu;
-    norm_facts[position].std = std;
+    norm_mu.own()[position] = mu;
+    norm_std.own()[position] = std;
 }
 
 void
@@ -100,46 +216,49 @@ mutualproximity::get_normfacts(
         int position,
         float* mu,
         float* std) {
-    *mu = norm_facts[position].mu;
-    *std = norm_facts[position].std;
+    *mu = norm_mu[position];
+    *std = norm_std[position];
 }
 
 void
 mutualproximity::swap_normfacts(
         int position1,
         int position2) {
-    std::swap(norm_facts[position1], norm_facts[position2]);
+    std::vector<float>& mu = norm_mu.own();
+    std::vector<float>& std = norm_std.own();
+    std::swap(mu[position1], mu[position2]);
+    std::swap(std[position1], std[position2]);
 }
 
 void
 mutualproximity::trim_normfacts(
         int count) {
-    norm_facts.resize(norm_facts.size() - count);
+    norm_mu.own().resize(norm_mu.size() - count);
+    norm_std.own().resize(norm_std.size() - count);
 }
 
-double
-mutualproximity::normcdf(double x)
-{
-    // constants
-    const double a1 =  0.254829592;
-    const double a2 = -0.284496736;
-    const double a3 =  1.421413741;
-    const double a4 = -1.453152027;
-    const double a5 =  1.061405429;
-    const double p  =  0.3275911;
+void
+mutualproximity::map_normfacts(
+        const float* mu,
+        const float* std,
+        int count) {
+    norm_mu.map(mu, count);
+    norm_std.map(std, count);
+}
 
-    // Save the sign of x
-    int sign = 1;
-    if (x < 0) {
-        sign = -1;
-    }
-    x = fabs(x)/M_SQRT2;
+int
+mutualproximity::get_normfacts_count() const {
+    return norm_mu.size();
+}
 
-    // A&S formula 7.1.26
-    double t = 1.0/(1.0 + p*x);
-    double y = 1.0 - (((((a5*t + a4)*t) + a3)*t + a2)*t + a1)*t*exp(-x*x);
+const float*
+mutualproximity::get_norm_mu() const {
+    return norm_mu.data();
+}
 
-    return 0.5*(1.0 + sign*y);
+const float*
+mutualproximity::get_norm_std() const {
+    return norm_std.data();
 }
 
 int
@@ -149,33 +268,163 @@ mutualproximity::normalize(
         int length,
         float* sim)
 {
-    if (seed_position < 0 || seed_position >= (int)norm_facts.size()) {
+    const int size = norm_mu.size();
+    if (seed_position < 0 || seed_position >= size) {
         return -1;
     }
-    float seed_mu = norm_facts[seed_position].mu;
-    float seed_std = norm_facts[seed_position].std;
-    for (int i = 0; i < length; i++) {
-        int pos = other_positions[i];
-        if (pos < 0 || pos >= (int)norm_facts.size()) {
-            return -1;
+
+    // gather the normfacts into columns, chunk by chunk
+    float mu[chunk];
+    float std[chunk];
+    for (int start = 0; start < length; start += chunk) {
+        const int count = std::min(chunk, length - start);
+        const int* positions = other_positions + start;
+        for (int i = 0; i < count; i++) {
+            if (positions[i] < 0 || positions[i] >= size) {
+                return -1;
+            }
+            mu[i] = norm_mu[positions[i]];
+            std[i] = norm_std[positions[i]];
         }
-        if (pos == seed_position) {
-            sim[i] = 0;
-            continue;
+        normalize_columns(norm_mu[seed_position], norm_std[seed_position],
+                seed_position, positions, mu, std, count, sim + start);
+    }
+    return 0;
+}
+
+int
+mutualproximity::normalize_range(
+        int seed_position,
+        int first_position,
+        int length,
+        float* sim)
+{
+    const int size = norm_mu.size();
+    if (seed_position < 0 || seed_position >= size || first_position < 0 ||
+            length < 0 || first_position > size - length) {
+        return -1;
+    }
+
+    // the normfacts are stored by position, so they are columns already
+    int positions[chunk];
+    for (int start = 0; start < length; start += chunk) {
+        const int count = std::min(chunk, length - start);
+        const int first = first_position + start;
+        for (int i = 0; i < count; i++) {
+            positions[i] = first + i;
         }
+        normalize_columns(norm_mu[seed_position], norm_std[seed_position],
+                seed_position, positions, &norm_mu[first], &norm_std[first],
+                count, sim + start);
+    }
+    return 0;
+}
 
-        float d = sim[i];
-        if (std::isnan(d)) {
-           continue;
+bool
+mutualproximity::neighbor_less(
+        const neighbor& lhs,
+        const neighbor& rhs)
+{
+    return lhs.first < rhs.first;
+}
+
+float
+mutualproximity::skip_bound(
+        float worst)
+{
+    // As p2 <= 1 in normalize(), the normalized similarity of a candidate is
+    // at least 1 - p1, which only depends on the standardized raw similarity
+    // z with respect to the seed. Find the smallest z (up to bisection
+    // precision) for which 1 - p1 already reaches `worst`. As upper_tail()
+    // is monotonic, no candidate with a larger z can enter the heap.
+    float lo = -40;
+    float hi = 40;
+    if (1.0f - upper_tail(hi) < worst) {
+        return std::numeric_limits<float>::infinity();
+    }
+    if (1.0f - upper_tail(lo) >= worst) {
+        return -std::numeric_limits<float>::infinity();
+    }
+    for (int i = 0; i < 64; i++) {
+        float mid = lo + (hi - lo) / 2;
+        if ((mid <= lo) || (mid >= hi)) {
+            break;
+        }
+        if (1.0f - upper_tail(mid) >= worst) {
+            hi = mid;
+        } else {
+            lo = mid;
         }
+    }
+    return hi;
+}
 
-        double p1 = 1 - normcdf((d - seed_mu)/seed_std);
-        double p2 = 1 - normcdf((d - norm_facts[pos].mu)/norm_facts[pos].std);
-        sim[i] = 1 - p1*p2;
+float
+mutualproximity::topk_radius(
+        int seed_position,
+        const std::vector<neighbor>& heap,
+        int k)
+{
+    if (((int)heap.size() < k) || (seed_position < 0) ||
+            (seed_position >= (int)norm_mu.size())) {
+        return std::numeric_limits<float>::max();
     }
-    return 0;
+    float bound = skip_bound(heap.front().first);
+    if (bound == std::numeric_limits<float>::infinity()) {
+        return std::numeric_limits<float>::max();
+    }
+    return norm_mu[seed_position] + bound*norm_std[seed_position];
 }
 
+int
+mutualproximity::normalize_topk(
+        int seed_position,
+        int* other_positions,
+        musly_trackid* other_ids,
+        int length,
+        const float* sim,
+        std::vector<neighbor>& heap,
+        int k)
+{
+    const int size = norm_mu.size();
+    if (seed_position < 0 || seed_position >= size) {
+        return -1;
+    }
+
+    // normalize chunk by chunk, then collect the results that make the heap
+    float mu[chunk];
+    float std[chunk];
+    float s[chunk];
+    for (int start = 0; start < length; start += chunk) {
+        const int count = std::min(chunk, length - start);
+        const int* positions = other_positions + start;
+        for (int i = 0; i < count; i++) {
+            if (positions[i] < 0 || positions[i] >= size) {
+                return -1;
+            }
+            mu[i] = norm_mu[positions[i]];
+            std[i] = norm_std[positions[i]];
+            s[i] = sim[start + i];
+        }
+        normalize_columns(norm_mu[seed_position], norm_std[seed_position],
+                seed_position, positions, mu, std, count, s);
 
+        for (int i = 0; i < count; i++) {
+            if (std::isnan(s[i])) {
+                continue;
+            }
+            if ((int)heap.size() < k) {
+                heap.push_back(std::make_pair(s[i], other_ids[start + i]));
+                std::push_heap(heap.begin(), heap.end(), neighbor_less);
+            }
+            else if (s[i] < heap.front().first) {
+                std::pop_heap(heap.begin(), heap.end(), neighbor_less);
+                heap.back() = std::make_pair(s[i], other_ids[start + i]);
+                std::push_heap(heap.begin(), heap.end(), neighbor_less);
+            }
+        }
+    }
+    return 0;
+}
 
 } /* namespace musly */
@@ -14,13 +14,26 @@
 #define MUSLY_MUTUALPROXIMITY_H_
 
 #include <vector>
+#include <utility>
 #include "musly/musly_types.h"
 #include "method.h"
+#include "mappedarray.h"
 
 namespace musly {
 
 class mutualproximity {
 public:
+    /** A (similarity, trackid) pair as collected by normalize_topk().
+     */
+    typedef std::pair<float, musly_trackid> neighbor;
+
+    /** Orders neighbors by similarity only, like musly_findmin() does.
+     */
+    static bool
+    neighbor_less(
+            const neighbor& lhs,
+            const neighbor& rhs);
+
     mutualproximity(method* m);
     virtual ~mutualproximity();
 
@@ -62,6 +75,37 @@ public:
     trim_normfacts(
             int count);
 
+    /** Use the normfacts of \p count positions at \p mu and \p std in
+     * place, until they change. The memory must stay valid until then.
+     */
+    void
+    map_normfacts(
+            const float* mu,
+            const float* std,
+            int count);
+
+    /** Return the number of positions with normfacts.
+     */
+    int
+    get_normfacts_count() const;
+
+    /** Return the normfacts as columns by position, of
+     * get_normfacts_count() floats each.
+     */
+    const float*
+    get_norm_mu() const;
+
+    const float*
+    get_norm_std() const;
+
+    /** Normalizes the raw similarities \p sim of the track at position
+     * \p seed_position to the tracks at \p other_positions in place. The
+     * normal distributions are evaluated in single precision, with an
+     * absolute error below 2e-7 each, so the results are within 4e-7 of the
+     * exact mutual proximity. The seed itself gets a similarity of 0, NaN
+     * similarities stay NaN. Returns 0 on success, -1 on an invalid
+     * position.
+     */
     int
     normalize(
             int seed_position,
@@ -69,23 +113,59 @@ public:
             int length,
             float* sim);
 
+    /** Normalizes like normalize(), for the \p length tracks at the
+     * consecutive positions starting at \p first_position. Saves looking
+     * up their normfacts one by one.
+     */
+    int
+    normalize_range(
+            int seed_position,
+            int first_position,
+            int length,
+            float* sim);
+
+    /** Normalizes the raw similarities \p sim like normalize(), but instead
+     * of writing them back, collects the \p k smallest results along with
+     * their \p other_ids in \p heap, a max-heap on the similarity. The
+     * heap carries over between calls, so a long list of tracks can be
+     * processed block by block. NaN similarities are skipped. Returns 0 on
+     * success, -1 on an error.
+     */
+    int
+    normalize_topk(
+            int seed_position,
+            int* other_positions,
+            musly_trackid* other_ids,
+            int length,
+            const float* sim,
+            std::vector<neighbor>& heap,
+            int k);
+
+    /** Return the raw similarity to the seed at which a candidate can no
+     * longer enter \p heap in normalize_topk(), or FLT_MAX if any
+     * candidate still can.
+     */
+    float
+    topk_radius(
+            int seed_position,
+            const std::vector<neighbor>& heap,
+            int k);
+
 private:
     method* m;
     std::vector<musly_track*> norm_tracks;
-    struct normfact {
-        float mu;
-        float std;
-    };
-    std::vector<normfact> norm_facts;
+    /** the normfacts by position, as columns for normalize_range() */
+    mapped_array<float> norm_mu;
+    mapped_array<float> norm_std;
 
 
     void
     new_cache(
             int size);
 
-    double
-    normcdf(
-            double x);
+    float
+    skip_bound(
+            float worst);
 
 };
 
@@ -0,0 +1,220 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *                2014, Jan Schlueter <jan.schlueter@ofai.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+
+#include "parallel.h"
+
+namespace musly {
+
+namespace {
+
+/** Whether the thread is running a job of the pool as its worker 0, to run
+ * nested jobs inline rather than locking job_lock again.
+ */
+thread_local bool running_job = false;
+
+} /* anonymous namespace */
+
+threadpool::threadpool() :
+        num_threads(0),
+        stop(false),
+        generation(0),
+        task(NULL),
+        job_threads(0),
+        active(0)
+{
+}
+
+threadpool&
+threadpool::get()
+{
+    // Never destroyed: joining threads from static destructors can hang
+    // when the library is unloaded, and the waiting workers end with the
+    // process anyway.
+    static threadpool* pool = new threadpool();
+    return *pool;
+}
+
+int
+threadpool::set_threads(
+        int num_threads)
+{
+    if (num_threads < 0) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> job(job_lock);
+    if (num_threads != this->num_threads) {
+        stop_workers();
+        std::lock_guard<std::mutex> state(state_lock);
+        this->num_threads = num_threads;
+    }
+    return 0;
+}
+
+int
+threadpool::get_threads()
+{
+    std::lock_guard<std::mutex> state(state_lock);
+    if (num_threads > 0) {
+        return num_threads;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void
+threadpool::stop_workers()
+{
+    {
+        std::lock_guard<std::mutex> state(state_lock);
+        stop = true;
+    }
+    wake.notify_all();
+    for (int i = 0; i < (int)workers.size(); i++) {
+        workers[i].join();
+    }
+    workers.clear();
+    ranges.reset();
+    std::lock_guard<std::mutex> state(state_lock);
+    stop = false;
+}
+
+void
+threadpool::run(
+        int num_tasks,
+        const task_function& task,
+        int max_workers)
+{
+    if (num_tasks <= 0) {
+        return;
+    }
+
+    // the number of threads can only change while no job holds job_lock
+    std::unique_lock<std::mutex> job(job_lock, std::defer_lock);
+    const bool inline_job = running_job || !job.try_lock();
+    const int pool_size = get_threads();
+    const int threads = std::min(std::min(num_tasks, pool_size),
+            max_workers);
+    if (inline_job || (threads <= 1)) {
+        for (int i = 0; i < num_tasks; i++) {
+            task(i, 0);
+        }
+        return;
+    }
+
+    // start the workers on first use
+    if (!ranges) {
+        ranges.reset(new range[pool_size]);
+        for (int w = 1; w < pool_size; w++) {
+            workers.emplace_back(&threadpool::worker_main, this, w,
+                    generation);
+        }
+    }
+
+    // split the tasks evenly
+    for (int w = 0; w < threads; w++) {
+        std::lock_guard<std::mutex> lock(ranges[w].lock);
+        ranges[w].begin = (int)((long long)num_tasks * w / threads);
+        ranges[w].end = (int)((long long)num_tasks * (w + 1) / threads);
+    }
+
+    {
+        std::lock_guard<std::mutex> state(state_lock);
+        this->task = &task;
+        job_threads = threads;
+        active = threads - 1;
+        generation++;
+    }
+    wake.notify_all();
+
+    running_job = true;
+    work(0);
+    running_job = false;
+
+    std::unique_lock<std::mutex> state(state_lock);
+    done.wait(state, [this]() { return active == 0; });
+    this->task = NULL;
+}
+
+void
+threadpool::worker_main(
+        int worker,
+        int seen)
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> state(state_lock);
+            wake.wait(state, [&]() { return stop || (generation != seen); });
+            if (stop) {
+                return;
+            }
+            seen = generation;
+            if (worker >= job_threads) {
+                continue;
+            }
+        }
+
+        work(worker);
+
+        std::lock_guard<std::mutex> state(state_lock);
+        if (--active == 0) {
+            done.notify_one();
+        }
+    }
+}
+
+void
+threadpool::work(
+        int worker)
+{
+    range& own = ranges[worker];
+    for (;;) {
+        int i;
+        {
+            std::lock_guard<std::mutex> lock(own.lock);
+            i = (own.begin < own.end) ? own.begin++ : -1;
+        }
+        if (i >= 0) {
+            (*task)(i, worker);
+        } else if (!steal(worker)) {
+            return;
+        }
+    }
+}
+
+bool
+threadpool::steal(
+        int worker)
+{
+    for (int v = 1; v < job_threads; v++) {
+        range& victim = ranges[(worker + v) % job_threads];
+        int begin;
+        int end;
+        {
+            std::lock_guard<std::mutex> lock(victim.lock);
+            int left = victim.end - victim.begin;
+            if (left <= 0) {
+                continue;
+            }
+            end = victim.end;
+            begin = end - (left + 1) / 2;
+            victim.end = begin;
+        }
+        std::lock_guard<std::mutex> lock(ranges[worker].lock);
+        ranges[worker].begin = begin;
+        ranges[worker].end = end;
+        return true;
+    }
+    return false;
+}
+
+} /* namespace musly */
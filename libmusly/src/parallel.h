@@ -0,0 +1,233 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *                2014, Jan Schlueter <jan.schlueter@ofai.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_PARALLEL_H_
+#define MUSLY_PARALLEL_H_
+
+#include <climits>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace musly {
+
+/** The worker threads the library runs its parallel computations on. The
+ * threads are started on first use and kept waiting for work in between.
+ *
+ * A job of n tasks is split into one contiguous range of task indices per
+ * thread. Each thread works through its own range from the front; once
+ * done, it steals the back half of the range of another thread. Tasks of
+ * very different durations are thus balanced, while the threads only
+ * contend for a range when stealing.
+ *
+ * The pool runs one job at a time. A job started while another one is
+ * running, from another thread or from within one of its tasks, is run on
+ * the calling thread alone.
+ */
+class threadpool {
+public:
+    /** A task of a job, called with the task index and the index of the
+     * worker running it, which is smaller than the max_workers passed to
+     * run(). The calling thread of run() is worker 0. Tasks must not throw.
+     */
+    typedef std::function<void(int task, int worker)> task_function;
+
+    /** Return the pool of the library.
+     */
+    static threadpool&
+    get();
+
+    /** Set the number of threads to run jobs on, including the calling
+     * thread, or 0 for one per hardware thread. Waits for a running job.
+     * \returns 0 on success, -1 if \p num_threads is negative.
+     */
+    int
+    set_threads(
+            int num_threads);
+
+    /** Return the number of threads jobs are run on.
+     */
+    int
+    get_threads();
+
+    /** Call \p task for each task index in [0, \p num_tasks) on at most
+     * \p max_workers threads, and return when all tasks are done. Callers
+     * keeping state per worker size it by \p max_workers, as the number of
+     * threads may change until the job starts.
+     */
+    void
+    run(
+            int num_tasks,
+            const task_function& task,
+            int max_workers = INT_MAX);
+
+private:
+    /** The task indices a worker has yet to run, [begin, end), on a cache
+     * line of its own.
+     */
+    struct alignas(64) range {
+        std::mutex lock;
+        int begin;
+        int end;
+    };
+
+    /** Held while a job runs.
+     */
+    std::mutex job_lock;
+
+    /** Guards the following members.
+     */
+    std::mutex state_lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::vector<std::thread> workers;
+    int num_threads;
+    bool stop;
+
+    /** The current job: incremented with each job, so the workers notice
+     * a new one.
+     */
+    int generation;
+    const task_function* task;
+    int job_threads;
+    int active;
+
+    std::unique_ptr<range[]> ranges;
+
+    threadpool();
+
+    /** Join the worker threads. Requires job_lock.
+     */
+    void
+    stop_workers();
+
+    /** The loop of the thread of \p worker, waiting for the jobs after
+     * generation \p seen.
+     */
+    void
+    worker_main(
+            int worker,
+            int seen);
+
+    /** Run the tasks of worker \p worker and steal others, until there
+     * are none left.
+     */
+    void
+    work(
+            int worker);
+
+    /** Move the back half of the tasks of another worker to \p worker.
+     * \returns false if there are no tasks left to steal.
+     */
+    bool
+    steal(
+            int worker);
+};
+
+/** Calls \p task(i) for each i in [0, \p num_tasks) on the threadpool,
+ * including the calling thread. Returns when all tasks are done. Tasks
+ * must not throw.
+ */
+template<typename Task>
+void
+parallel_for(
+        int num_tasks,
+        Task task)
+{
+    threadpool::get().run(num_tasks, [&](int i, int) {
+        task(i);
+    });
+}
+
+/** A queue passing items between threads, holding at most a fixed number of
+ * them: push() waits while the queue is full, pop() while it is empty. Once
+ * closed, pop() returns the remaining items and then fails, so the consumers
+ * know the producers are done. The items are kept in a ring allocated once.
+ */
+template<typename T>
+class bounded_queue {
+public:
+    explicit bounded_queue(
+            int capacity) :
+            items(capacity),
+            first(0),
+            count(0),
+            closed(false)
+    {
+    }
+
+    /** Append \p item, waiting for space if the queue is full.
+     */
+    void
+    push(
+            const T& item)
+    {
+        std::unique_lock<std::mutex> lock(this->lock);
+        not_full.wait(lock, [this]() {
+            return count < (int)items.size();
+        });
+        items[(first + count) % items.size()] = item;
+        count++;
+        lock.unlock();
+        not_empty.notify_one();
+    }
+
+    /** Remove the first item into \p item, waiting for one if the queue is
+     * empty.
+     * \returns false if the queue is empty and closed.
+     */
+    bool
+    pop(
+            T& item)
+    {
+        std::unique_lock<std::mutex> lock(this->lock);
+        not_empty.wait(lock, [this]() {
+            return closed || (count > 0);
+        });
+        if (count == 0) {
+            return false;
+        }
+        item = items[first];
+        first = (first + 1) % items.size();
+        count--;
+        lock.unlock();
+        not_full.notify_one();
+        return true;
+    }
+
+    /** Let pop() fail once the queue is empty.
+     */
+    void
+    close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->lock);
+            closed = true;
+        }
+        not_empty.notify_all();
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    std::vector<T> items;
+    int first;
+    int count;
+    bool closed;
+};
+
+} /* namespace musly */
+#endif /* MUSLY_PARALLEL_H_ */
@@ -0,0 +1,125 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *                2014, Jan Schlueter <jan.schlueter@ofai.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+#include "pivottable.h"
+
+namespace musly {
+
+pivottable::pivottable() :
+        pivots(0),
+        step(1),
+        rows(0)
+{
+}
+
+void
+pivottable::reset(
+        int num_pivots,
+        float step)
+{
+    pivots = num_pivots;
+    this->step = step;
+    rows = 0;
+    table.own().clear();
+}
+
+void
+pivottable::resize(
+        int size)
+{
+    table.own().resize((size_t)size * pivots, unknown);
+    rows = size;
+}
+
+void
+pivottable::map(
+        int size,
+        const unsigned char* codes)
+{
+    table.map(codes, (size_t)size * pivots);
+    rows = size;
+}
+
+void
+pivottable::set_row(
+        int row,
+        const float* distances)
+{
+    unsigned char* c = table.own().data() + (size_t)row * pivots;
+    for (int p = 0; p < pivots; p++) {
+        float d = distances[p];
+        if (!(d >= 0) || (d == FLT_MAX) || std::isinf(d)) {
+            clear_row(row);
+            return;
+        }
+        // round to the nearest code, so a code c stands for distances
+        // within half a step of c * step
+        float q = d / step;
+        c[p] = (q >= levels - 0.5f) ? levels : (unsigned char)std::lround(q);
+    }
+}
+
+void
+pivottable::clear_row(
+        int row)
+{
+    std::vector<unsigned char>& t = table.own();
+    std::fill(t.begin() + (size_t)row * pivots,
+            t.begin() + (size_t)(row + 1) * pivots, unknown);
+}
+
+void
+pivottable::swap_rows(
+        int row_a,
+        int row_b)
+{
+    std::vector<unsigned char>& t = table.own();
+    std::swap_ranges(t.begin() + (size_t)row_a * pivots,
+            t.begin() + (size_t)(row_a + 1) * pivots,
+            t.begin() + (size_t)row_b * pivots);
+}
+
+void
+pivottable::set_codes(
+        int row,
+        const unsigned char* codes)
+{
+    std::copy(codes, codes + pivots,
+            table.own().begin() + (size_t)row * pivots);
+}
+
+float
+pivottable::lower_bound(
+        int row_a,
+        int row_b) const
+{
+    const unsigned char* a = codes(row_a);
+    const unsigned char* b = codes(row_b);
+    if ((pivots == 0) || (a[0] == unknown) || (b[0] == unknown)) {
+        return 0;
+    }
+    // Codes c and c' stand for distances of at least (|c - c'| - 1) steps
+    // apart, also if one of them is the open-ended last code. The loop
+    // has no branches, so it is vectorized.
+    int largest = 0;
+    for (int p = 0; p < pivots; p++) {
+        largest = std::max(largest, std::abs((int)a[p] - (int)b[p]));
+    }
+    return std::max(0, largest - 1) * step;
+}
+
+} /* namespace musly */
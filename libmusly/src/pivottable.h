@@ -0,0 +1,140 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *                2014, Jan Schlueter <jan.schlueter@ofai.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_PIVOTTABLE_H_
+#define MUSLY_PIVOTTABLE_H_
+
+#include <vector>
+#include "mappedarray.h"
+
+namespace musly {
+
+/** The distances of tracks to a fixed set of pivot tracks, quantized to one
+ * byte each, with rows corresponding to the positions of an
+ * ordered_idpool. By the triangle inequality, two tracks are at least as
+ * far apart as the largest difference of their distances to any pivot.
+ * This gives a lower bound of their distance without computing it:
+ * L. Mico, J. Oncina and E. Vidal: A new version of the nearest-neighbour
+ * approximating and eliminating search algorithm (AESA) with linear
+ * preprocessing time and memory requirements. Pattern Recognition Letters
+ * 15(1), 1994.
+ *
+ * All pivots share one quantization step, so the bound only needs the
+ * largest difference of the byte codes. Distances beyond the quantization
+ * range get the largest code. Rows of tracks whose distances are unknown,
+ * or not trusted to obey the triangle inequality, bound nothing.
+ */
+class pivottable {
+public:
+    /** The number of codes for distances, one more for the rest of the
+     * range.
+     */
+    static constexpr int levels = 254;
+
+    pivottable();
+
+    /** Use \p num_pivots pivots and quantize distances in steps of \p step.
+     * Removes all rows.
+     */
+    void
+    reset(
+            int num_pivots,
+            float step);
+
+    inline int
+    get_pivots() const {
+        return pivots;
+    }
+
+    inline float
+    get_step() const {
+        return step;
+    }
+
+    /** Return the number of rows
+     */
+    inline int
+    get_size() const {
+        return rows;
+    }
+
+    /** Grow or shrink to \p size rows. New rows bound nothing.
+     */
+    void
+    resize(
+            int size);
+
+    /** Use the get_pivots() byte codes of each of \p size rows at \p codes
+     * in place, until they change. The memory must stay valid until then.
+     */
+    void
+    map(
+            int size,
+            const unsigned char* codes);
+
+    /** Quantize the distances of the track in row \p row to the pivots.
+     * If any distance is negative, not finite or the largest float, the
+     * row bounds nothing.
+     */
+    void
+    set_row(
+            int row,
+            const float* distances);
+
+    /** Make row \p row bound nothing.
+     */
+    void
+    clear_row(
+            int row);
+
+    /** Exchange two rows
+     */
+    void
+    swap_rows(
+            int row_a,
+            int row_b);
+
+    /** Return the byte codes of row \p row, get_pivots() bytes.
+     */
+    inline const unsigned char*
+    codes(
+            int row) const {
+        return table.data() + (size_t)row * pivots;
+    }
+
+    /** Overwrite the byte codes of row \p row with the ones in \p codes.
+     */
+    void
+    set_codes(
+            int row,
+            const unsigned char* codes);
+
+    /** Return a lower bound of the distance between the tracks in rows
+     * \p row_a and \p row_b.
+     */
+    float
+    lower_bound(
+            int row_a,
+            int row_b) const;
+
+private:
+    /** The code of rows that bound nothing */
+    static constexpr unsigned char unknown = 255;
+
+    int pivots;
+    float step;
+    int rows;
+    mapped_array<unsigned char> table;
+};
+
+} /* namespace musly */
+#endif /* MUSLY_PIVOTTABLE_H_ */
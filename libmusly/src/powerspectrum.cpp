@@ -23,64 +23,112 @@ powerspectrum::powerspectrum(
     this->win_funct = win_funct;
     this->win_size = win_funct.size();
     this->hop_size = hop*win_size;
+}
+
+powerspectrum::workspace::workspace(
+        int win_size,
+        const std::string& backend) :
+        fft(realfft::create(win_size, backend)),
+        frame(win_size),
+        win_size(win_size)
+{
+    if (!fft) {
+        fft = realfft::create(win_size);
+    }
+}
 
-    // initialize kiss fft
-    kiss_pcm = (kiss_fft_scalar*)malloc(sizeof(kiss_fft_scalar) * win_size);
-    kiss_freq = (kiss_fft_cpx*)malloc(sizeof(kiss_fft_cpx) * (win_size/2 + 1));
-    kiss_status = kiss_fftr_alloc(win_size, 0, NULL, NULL);
+powerspectrum::workspace::~workspace()
+{
+    delete fft;
+}
+
+int
+powerspectrum::get_winsize() const
+{
+    return win_size;
+}
+
+int
+powerspectrum::get_hopsize() const
+{
+    return hop_size;
+}
+
+float
+powerspectrum::get_scale(
+        float peak)
+{
+    // scale signal to 96db (16bit)
+    return std::pow(10.0f, 96.0f/20.0f) / peak;
 }
 
 Eigen::MatrixXf
-powerspectrum::from_pcm(const Eigen::VectorXf& pcm_samples)
+powerspectrum::from_pcm(const Eigen::VectorXf& pcm_samples) const
+{
+    workspace ws(win_size);
+    return from_pcm(pcm_samples, ws);
+}
+
+Eigen::MatrixXf
+powerspectrum::from_pcm(
+        const Eigen::VectorXf& pcm_samples,
+        workspace& ws) const
 {
     MINILOG(logTRACE) << "Powerspectrum computation. input samples="
             << pcm_samples.size();
     // check if inputs are sane
-    if ((pcm_samples.size() < win_size) || (hop_size > win_size)) {
+    if ((pcm_samples.size() < win_size) || (hop_size > win_size) ||
+            (ws.win_size != win_size)) {
         return Eigen::MatrixXf(0, 0);
     }
     size_t frames = (pcm_samples.size() - (win_size-hop_size)) / hop_size;
-    size_t freq_bins = win_size/2 + 1;
-
-    // initialize power spectrum
-    Eigen::MatrixXf ps(freq_bins, frames);
 
     // peak normalization value
-    float pcm_scale = std::max(fabs(pcm_samples.minCoeff()),
-            fabs(pcm_samples.maxCoeff()));
-
-    // scale signal to 96db (16bit)
-    pcm_scale =  std::pow(10.0f, 96.0f/20.0f) / pcm_scale;
+    float pcm_scale = get_scale(std::max(fabs(pcm_samples.minCoeff()),
+            fabs(pcm_samples.maxCoeff())));
 
     // compute the power spectrum
-    for (size_t i = 0; i < frames; i++) {
-
-        // fill pcm
-        for (int j = 0; j < win_size; j++) {
-            kiss_pcm[j] = pcm_samples(i*hop_size+j) * pcm_scale * win_funct(j);
-        }
-
-        // fft
-        kiss_fftr(kiss_status, kiss_pcm, kiss_freq);
-
-        // save powerspectrum frame
-        Eigen::MatrixXf::ColXpr psc(ps.col(i));
-        for (int j = 0; j < win_size/2+1; j++) {
-            psc(j) =
-                    std::pow(kiss_freq[j].r, 2) + std::pow(kiss_freq[j].i, 2);
-        }
-    }
+    Eigen::MatrixXf ps;
+    from_frames(pcm_samples.data(), frames, pcm_scale, ws, ps);
 
     MINILOG(logTRACE) << "Powerspectrum finished. size=" << ps.rows() << "x"
             << ps.cols();
     return ps;
 }
 
+void
+powerspectrum::from_frames(
+        const float* pcm,
+        int frames,
+        float pcm_scale,
+        workspace& ws,
+        Eigen::MatrixXf& ps) const
+{
+    ps.resize(win_size/2 + 1, frames);
+    for (int i = 0; i < frames; i++) {
+        from_frame(pcm + i*hop_size, pcm_scale, ws, ps.col(i).data());
+    }
+}
+
+void
+powerspectrum::from_frame(
+        const float* pcm,
+        float pcm_scale,
+        workspace& ws,
+        float* ps) const
+{
+    // fill pcm
+    float* frame = ws.frame.data();
+    for (int j = 0; j < win_size; j++) {
+        frame[j] = pcm[j] * pcm_scale * win_funct(j);
+    }
+
+    // fft
+    ws.fft->power(&frame, 1, ps);
+}
+
 powerspectrum::~powerspectrum()
 {
-    free(kiss_status);
-    free(kiss_pcm);
-    free(kiss_freq);
 }
 
 
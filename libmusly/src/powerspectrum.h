@@ -12,10 +12,10 @@
 #ifndef MUSLY_POWERSPECTRUM_H_
 #define MUSLY_POWERSPECTRUM_H_
 
+#include <string>
+#include <vector>
 #include <Eigen/Core>
-extern "C" {
-    #include <kissfft/kiss_fftr.h>
-}
+#include "realfft.h"
 
 
 namespace musly {
@@ -35,19 +35,44 @@ private:
      */
     Eigen::VectorXf win_funct;
 
-    /** KissFFT internal representation of the PCM data.
+public:
+    /** The FFT backend and scratch buffer from_pcm() computes the FFTs
+     * with. Backends write to their buffers while transforming, so each
+     * thread needs a workspace of its own.
      */
-    kiss_fft_scalar* kiss_pcm;
+    class workspace {
+    private:
+        /** The FFT backend, see realfft.
+         */
+        realfft* fft;
 
-    /** KissFFT internal of the frequency spectrum.
-     */
-    kiss_fft_cpx* kiss_freq;
+        /** The windowed samples of the frame to transform.
+         */
+        std::vector<float> frame;
 
-    /** KissFFT internal of the FFT status.
-     */
-    kiss_fftr_cfg kiss_status;
+        /** The window size the workspace was allocated for.
+         */
+        int win_size;
+
+        friend class powerspectrum;
+
+    public:
+        /** Allocate a workspace for FFTs of \p win_size samples, with the
+         * FFT backend \p backend, or the default one if empty (see
+         * realfft::create()). An unknown backend falls back to the default.
+         */
+        explicit workspace(
+                int win_size,
+                const std::string& backend = "");
+
+        workspace(const workspace&) = delete;
+        workspace& operator=(const workspace&) = delete;
+
+        /** Frees the FFT backend.
+         */
+        ~workspace();
+    };
 
-public:
     /** Initialize the powerspectrum with the window function and hop size.
      * \param win_funct The window function as a vector of scalars. It is
      * multipled with the signal before the FFT. The length of the vector
@@ -67,10 +92,71 @@ public:
      * column major format.
      */
     Eigen::MatrixXf from_pcm(
-            const Eigen::VectorXf& pcm_samples);
+            const Eigen::VectorXf& pcm_samples) const;
 
-    /** Cleanup. Frees the internal KissFFT variables.
+    /** Get the powerspectrum like from_pcm(), computing the FFTs in the
+     * given workspace instead of a temporary one. Calls with distinct
+     * workspaces may run concurrently.
+     * \param pcm_samples A vector of PCM samles.
+     * \param ws A workspace allocated for the window size, see
+     * get_winsize().
+     * \returns The powerspectrum, or an empty matrix if \p ws does not
+     * match the window size.
      */
+    Eigen::MatrixXf from_pcm(
+            const Eigen::VectorXf& pcm_samples,
+            workspace& ws) const;
+
+    /** Compute the powerspectrum of the single frame starting at \p pcm.
+     * \param pcm The get_winsize() PCM samples of the frame.
+     * \param pcm_scale The factor to scale the samples with, see
+     * get_scale().
+     * \param ws A workspace allocated for the window size.
+     * \param ps The output array of get_winsize()/2+1 frequency bins.
+     */
+    void
+    from_frame(
+            const float* pcm,
+            float pcm_scale,
+            workspace& ws,
+            float* ps) const;
+
+    /** Compute the powerspectra of \p frames consecutive frames, one hop
+     * apart, without any normalization of their own. This is the building
+     * block of from_pcm() for signals that arrive in chunks.
+     * \param pcm The PCM samples, at least get_winsize() samples plus a hop
+     * for each further frame.
+     * \param frames The number of frames to compute.
+     * \param pcm_scale The factor to scale the samples with, see
+     * get_scale().
+     * \param ws A workspace allocated for the window size.
+     * \param ps The output matrix, resized to (Frequency, \p frames).
+     */
+    void
+    from_frames(
+            const float* pcm,
+            int frames,
+            float pcm_scale,
+            workspace& ws,
+            Eigen::MatrixXf& ps) const;
+
+    /** Return the factor from_pcm() scales a signal with the given peak
+     * amplitude by, to reach 96dB (16bit).
+     */
+    static float
+    get_scale(
+            float peak);
+
+    /** Return the window size in samples.
+     */
+    int
+    get_winsize() const;
+
+    /** Return the hop size in samples.
+     */
+    int
+    get_hopsize() const;
+
     virtual ~powerspectrum();
 };
 
@@ -0,0 +1,646 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+extern "C" {
+    #include <kissfft/kiss_fftr.h>
+}
+
+#include "minilog.h"
+#include "realfft.h"
+#include "simd.h"
+
+#ifndef MUSLY_FFT_DEFAULT
+#define MUSLY_FFT_DEFAULT "unrolled"
+#endif
+
+namespace musly {
+
+namespace {
+
+/** The number of frames the batched unrolled FFT transforms at once. Eight
+ * floats fill an AVX register.
+ */
+const int lanes = 8;
+
+/** The frame sizes the unrolled FFT is instantiated for: the window of the
+ * methods at 22050 Hz, and the ones of the same duration at 44100 Hz and
+ * 88200 Hz, which the methods also use at 48000 Hz and 96000 Hz.
+ */
+const int unrolled_size = 1024;
+const int unrolled_size_2x = 2048;
+const int unrolled_size_4x = 4096;
+
+/** One radix-4 decimation-in-frequency pass of a Stockham FFT: splits the
+ * \p s interleaved complex transforms of \p n points in x into 4*s
+ * interleaved transforms of n/4 points in y. Complex numbers are stored as
+ * separate real and imaginary parts; \p tw holds the twiddle factors w^p,
+ * w^2p and w^3p for p < n/4, each as m real parts followed by m imaginary
+ * parts.
+ */
+template <int n, int s>
+MUSLY_INLINE void
+pass4(
+        const float* MUSLY_RESTRICT tw,
+        const float* MUSLY_RESTRICT xr,
+        const float* MUSLY_RESTRICT xi,
+        float* MUSLY_RESTRICT yr,
+        float* MUSLY_RESTRICT yi)
+{
+    const int m = n / 4;
+    for (int p = 0; p < m; p++) {
+        const float w1r = tw[p];
+        const float w1i = tw[m + p];
+        const float w2r = tw[2*m + p];
+        const float w2i = tw[3*m + p];
+        const float w3r = tw[4*m + p];
+        const float w3i = tw[5*m + p];
+        for (int q = 0; q < s; q++) {
+            const float ar = xr[s*p + q];
+            const float ai = xi[s*p + q];
+            const float br = xr[s*(p + m) + q];
+            const float bi = xi[s*(p + m) + q];
+            const float cr = xr[s*(p + 2*m) + q];
+            const float ci = xi[s*(p + 2*m) + q];
+            const float dr = xr[s*(p + 3*m) + q];
+            const float di = xi[s*(p + 3*m) + q];
+
+            // a + c, a - c, b + d and -i(b - d)
+            const float apcr = ar + cr;
+            const float apci = ai + ci;
+            const float amcr = ar - cr;
+            const float amci = ai - ci;
+            const float bpdr = br + dr;
+            const float bpdi = bi + di;
+            const float jbmdr = bi - di;
+            const float jbmdi = dr - br;
+
+            const float y1r = amcr + jbmdr;
+            const float y1i = amci + jbmdi;
+            const float y2r = apcr - bpdr;
+            const float y2i = apci - bpdi;
+            const float y3r = amcr - jbmdr;
+            const float y3i = amci - jbmdi;
+
+            yr[s*(4*p) + q] = apcr + bpdr;
+            yi[s*(4*p) + q] = apci + bpdi;
+            yr[s*(4*p + 1) + q] = y1r*w1r - y1i*w1i;
+            yi[s*(4*p + 1) + q] = y1r*w1i + y1i*w1r;
+            yr[s*(4*p + 2) + q] = y2r*w2r - y2i*w2i;
+            yi[s*(4*p + 2) + q] = y2r*w2i + y2i*w2r;
+            yr[s*(4*p + 3) + q] = y3r*w3r - y3i*w3i;
+            yi[s*(4*p + 3) + q] = y3r*w3i + y3i*w3r;
+        }
+    }
+}
+
+/** The passes of \p s interleaved complex FFTs of \p n points, a power of
+ * two. The data is transformed back and forth between x and y; `in_y`
+ * tells where the transforms end up, in natural order.
+ */
+template <int n, int s>
+struct stockham {
+    typedef stockham<n/4, 4*s> next;
+    static const bool in_y = !next::in_y;
+
+    static MUSLY_INLINE void
+    run(
+            const float* tw,
+            float* xr,
+            float* xi,
+            float* yr,
+            float* yi)
+    {
+        pass4<n, s>(tw, xr, xi, yr, yi);
+        next::run(tw + 6*(n/4), yr, yi, xr, xi);
+    }
+};
+
+/** A final radix-2 pass, for sizes that are odd powers of two.
+ */
+template <int s>
+struct stockham<2, s> {
+    static const bool in_y = true;
+
+    static MUSLY_INLINE void
+    run(
+            const float*,
+            float* xr,
+            float* xi,
+            float* yr,
+            float* yi)
+    {
+        for (int q = 0; q < s; q++) {
+            yr[q] = xr[q] + xr[s + q];
+            yi[q] = xi[q] + xi[s + q];
+            yr[s + q] = xr[q] - xr[s + q];
+            yi[s + q] = xi[q] - xi[s + q];
+        }
+    }
+};
+
+template <int s>
+struct stockham<1, s> {
+    static const bool in_y = false;
+
+    static MUSLY_INLINE void
+    run(
+            const float*,
+            float*,
+            float*,
+            float*,
+            float*)
+    {
+    }
+};
+
+/** One radix-4 decimation-in-frequency pass of \p l interleaved complex
+ * FFTs of \p n points, in place: the transform of the points 4k+r ends up
+ * at the positions r*n/4 to (r+1)*n/4 - 1, so the final spectra are in
+ * digit-reversed order. The twiddle factors are those of pass4().
+ */
+template <int n, int l>
+MUSLY_INLINE void
+pass4_inplace(
+        const float* MUSLY_RESTRICT tw,
+        float* MUSLY_RESTRICT xr,
+        float* MUSLY_RESTRICT xi)
+{
+    const int m = n / 4;
+    for (int p = 0; p < m; p++) {
+        const float w1r = tw[p];
+        const float w1i = tw[m + p];
+        const float w2r = tw[2*m + p];
+        const float w2i = tw[3*m + p];
+        const float w3r = tw[4*m + p];
+        const float w3i = tw[5*m + p];
+        float* MUSLY_RESTRICT ar = xr + l*p;
+        float* MUSLY_RESTRICT ai = xi + l*p;
+        float* MUSLY_RESTRICT br = xr + l*(p + m);
+        float* MUSLY_RESTRICT bi = xi + l*(p + m);
+        float* MUSLY_RESTRICT cr = xr + l*(p + 2*m);
+        float* MUSLY_RESTRICT ci = xi + l*(p + 2*m);
+        float* MUSLY_RESTRICT dr = xr + l*(p + 3*m);
+        float* MUSLY_RESTRICT di = xi + l*(p + 3*m);
+        for (int q = 0; q < l; q++) {
+            const float apcr = ar[q] + cr[q];
+            const float apci = ai[q] + ci[q];
+            const float amcr = ar[q] - cr[q];
+            const float amci = ai[q] - ci[q];
+            const float bpdr = br[q] + dr[q];
+            const float bpdi = bi[q] + di[q];
+            const float jbmdr = bi[q] - di[q];
+            const float jbmdi = dr[q] - br[q];
+
+            const float y1r = amcr + jbmdr;
+            const float y1i = amci + jbmdi;
+            const float y2r = apcr - bpdr;
+            const float y2i = apci - bpdi;
+            const float y3r = amcr - jbmdr;
+            const float y3i = amci - jbmdi;
+
+            ar[q] = apcr + bpdr;
+            ai[q] = apci + bpdi;
+            br[q] = y1r*w1r - y1i*w1i;
+            bi[q] = y1r*w1i + y1i*w1r;
+            cr[q] = y2r*w2r - y2i*w2i;
+            ci[q] = y2r*w2i + y2i*w2r;
+            dr[q] = y3r*w3r - y3i*w3i;
+            di[q] = y3r*w3i + y3i*w3r;
+        }
+    }
+}
+
+/** The in-place passes of \p l interleaved complex FFTs of \p total points,
+ * from the sub-transforms of \p n points on. Needs half the memory of
+ * stockham, which matters once the lanes no longer fit the L1 cache.
+ */
+template <int total, int n, int l>
+struct inplace {
+    static MUSLY_INLINE void
+    run(
+            const float* tw,
+            float* xr,
+            float* xi)
+    {
+        for (int b = 0; b < total; b += n) {
+            pass4_inplace<n, l>(tw, xr + b*l, xi + b*l);
+        }
+        inplace<total, n/4, l>::run(tw + 6*(n/4), xr, xi);
+    }
+};
+
+template <int total, int l>
+struct inplace<total, 2, l> {
+    static MUSLY_INLINE void
+    run(
+            const float*,
+            float* MUSLY_RESTRICT xr,
+            float* MUSLY_RESTRICT xi)
+    {
+        for (int b = 0; b < total*l; b += 2*l) {
+            for (int q = 0; q < l; q++) {
+                const float ar = xr[b + q];
+                const float ai = xi[b + q];
+                xr[b + q] = ar + xr[b + l + q];
+                xi[b + q] = ai + xi[b + l + q];
+                xr[b + l + q] = ar - xr[b + l + q];
+                xi[b + l + q] = ai - xi[b + l + q];
+            }
+        }
+    }
+};
+
+template <int total, int l>
+struct inplace<total, 1, l> {
+    static MUSLY_INLINE void
+    run(
+            const float*,
+            float*,
+            float*)
+    {
+    }
+};
+
+/** Pack \p count <= \p l frames of 2*half samples into \p l interleaved
+ * complex sequences of \p half points: the even samples of a frame form the
+ * real parts, the odd samples the imaginary parts. Unused lanes are zeroed.
+ */
+template <int half, int l>
+MUSLY_INLINE void
+pack(
+        const float* const* frames,
+        int count,
+        float* xr,
+        float* xi)
+{
+    for (int q = 0; q < l; q++) {
+        const float* MUSLY_RESTRICT frame = frames[std::min(q, count - 1)];
+        float* MUSLY_RESTRICT pr = xr + q;
+        float* MUSLY_RESTRICT pi = xi + q;
+        const float scale = (q < count) ? 1.0f : 0.0f;
+        for (int j = 0; j < half; j++) {
+            pr[j*l] = frame[2*j] * scale;
+            pi[j*l] = frame[2*j + 1] * scale;
+        }
+    }
+}
+
+/** Untangle the powerspectra of the real frames from the spectra Z of their
+ * packed sequences, X(k) = (Z(k) + conj(Z(h-k)))/2
+ *                          - i w^k (Z(k) - conj(Z(h-k)))/2
+ * with h = \p half and w = exp(-i pi/h), into \p l interleaved columns of
+ * h+1 bins. Z(k) is found at position \p order[k], or at k if \p order is
+ * NULL. The twiddle factors -i w^k are given as h-1 real parts \p twr and
+ * imaginary parts \p twi. The loop only stores forward, so it vectorizes for
+ * a single lane, too.
+ */
+template <int half, int l>
+MUSLY_INLINE void
+untangle(
+        const float* MUSLY_RESTRICT twr,
+        const float* MUSLY_RESTRICT twi,
+        const float* MUSLY_RESTRICT zr,
+        const float* MUSLY_RESTRICT zi,
+        const int* MUSLY_RESTRICT order,
+        float* MUSLY_RESTRICT pw)
+{
+    for (int q = 0; q < l; q++) {
+        const float dc = zr[q] + zi[q];
+        const float nyquist = zr[q] - zi[q];
+        pw[q] = dc*dc;
+        pw[half*l + q] = nyquist*nyquist;
+    }
+    for (int k = 1; k < half; k++) {
+        const int a = (order ? order[k] : k) * l;
+        const int b = (order ? order[half - k] : half - k) * l;
+        for (int q = 0; q < l; q++) {
+            const float fpkr = zr[a + q] + zr[b + q];
+            const float fpki = zi[a + q] - zi[b + q];
+            const float fmkr = zr[a + q] - zr[b + q];
+            const float fmki = zi[a + q] + zi[b + q];
+            const float re = fpkr + fmkr*twr[k - 1] - fmki*twi[k - 1];
+            const float im = fpki + fmkr*twi[k - 1] + fmki*twr[k - 1];
+            pw[k*l + q] = 0.25f * (re*re + im*im);
+        }
+    }
+}
+
+/** Compute the powerspectrum of a frame of \p size samples with the
+ * Stockham FFT, which vectorizes across the butterflies of a pass. \p tw
+ * holds the twiddle factors of the passes followed by those of untangle(),
+ * \p buf the scratch space of 2*size floats.
+ */
+template <int size>
+MUSLY_INLINE void
+power_single(
+        const float* tw,
+        const float* frame,
+        float* buf,
+        float* ps)
+{
+    const int half = size / 2;
+    typedef stockham<half, 1> fft;
+    float* xr = buf;
+    float* xi = buf + half;
+    float* yr = buf + 2*half;
+    float* yi = buf + 3*half;
+    pack<half, 1>(&frame, 1, xr, xi);
+    fft::run(tw, xr, xi, yr, yi);
+    const float* twr = tw + 6*((half - 1)/3);
+    untangle<half, 1>(twr, twr + half - 1, fft::in_y ? yr : xr,
+            fft::in_y ? yi : xi, NULL, ps);
+}
+
+/** Compute the powerspectra of up to `lanes` frames like power_single(),
+ * but with the in-place FFT vectorized across the frames, which leaves the
+ * spectra in the digit-reversed \p order. \p buf is the scratch space of
+ * (3*size/2 + 1)*lanes floats.
+ */
+template <int size>
+MUSLY_INLINE void
+power_lanes(
+        const float* tw,
+        const int* order,
+        const float* const* frames,
+        int count,
+        float* buf,
+        float* ps)
+{
+    const int half = size / 2;
+    float* xr = buf;
+    float* xi = buf + half*lanes;
+    float* pw = buf + 2*half*lanes;
+    pack<half, lanes>(frames, count, xr, xi);
+    inplace<half, half, lanes>::run(tw, xr, xi);
+    const float* twr = tw + 6*((half - 1)/3);
+    untangle<half, lanes>(twr, twr + half - 1, xr, xi, order, pw);
+
+    // unpack the powerspectra
+    const int bins = half + 1;
+    for (int q = 0; q < count; q++) {
+        for (int k = 0; k < bins; k++) {
+            ps[q*bins + k] = pw[k*lanes + q];
+        }
+    }
+}
+
+/** The transforms of each size, compiled for each instruction set. They
+ * are plain functions, as not all compilers can multiversion templates.
+ */
+typedef void (*single_function)(const float*, const float*, float*, float*);
+typedef void (*lanes_function)(const float*, const int*, const float* const*,
+        int, float*, float*);
+
+MUSLY_TARGET_CLONES
+void
+power_single_1024(
+        const float* tw,
+        const float* frame,
+        float* buf,
+        float* ps)
+{
+    power_single<unrolled_size>(tw, frame, buf, ps);
+}
+
+MUSLY_TARGET_CLONES
+void
+power_lanes_1024(
+        const float* tw,
+        const int* order,
+        const float* const* frames,
+        int count,
+        float* buf,
+        float* ps)
+{
+    power_lanes<unrolled_size>(tw, order, frames, count, buf, ps);
+}
+
+MUSLY_TARGET_CLONES
+void
+power_single_2048(
+        const float* tw,
+        const float* frame,
+        float* buf,
+        float* ps)
+{
+    power_single<unrolled_size_2x>(tw, frame, buf, ps);
+}
+
+MUSLY_TARGET_CLONES
+void
+power_lanes_2048(
+        const float* tw,
+        const int* order,
+        const float* const* frames,
+        int count,
+        float* buf,
+        float* ps)
+{
+    power_lanes<unrolled_size_2x>(tw, order, frames, count, buf, ps);
+}
+
+MUSLY_TARGET_CLONES
+void
+power_single_4096(
+        const float* tw,
+        const float* frame,
+        float* buf,
+        float* ps)
+{
+    power_single<unrolled_size_4x>(tw, frame, buf, ps);
+}
+
+MUSLY_TARGET_CLONES
+void
+power_lanes_4096(
+        const float* tw,
+        const int* order,
+        const float* const* frames,
+        int count,
+        float* buf,
+        float* ps)
+{
+    power_lanes<unrolled_size_4x>(tw, order, frames, count, buf, ps);
+}
+
+class unrolled_fft : public realfft {
+private:
+    std::vector<float> twiddles;
+    std::vector<int> order;
+    std::vector<float> buf;
+    single_function single;
+    lanes_function batched;
+
+public:
+    unrolled_fft(
+            int size,
+            single_function single,
+            lanes_function batched) :
+            realfft(size),
+            order(size/2),
+            buf((3*size/2 + 1) * lanes),
+            single(single),
+            batched(batched)
+    {
+        // twiddle factors of the radix-4 passes, for n = size/2, size/8, ...
+        const double pi = 3.14159265358979323846;
+        for (int n = size/2; n >= 4; n /= 4) {
+            const int m = n / 4;
+            const size_t offset = twiddles.size();
+            twiddles.resize(offset + 6*m);
+            for (int r = 1; r <= 3; r++) {
+                for (int p = 0; p < m; p++) {
+                    double phi = -2*pi * r * p / n;
+                    twiddles[offset + (2*r - 2)*m + p] = std::cos(phi);
+                    twiddles[offset + (2*r - 1)*m + p] = std::sin(phi);
+                }
+            }
+        }
+
+        // twiddle factors -i w^k of untangling the real spectrum
+        const int half = size / 2;
+        const size_t offset = twiddles.size();
+        twiddles.resize(offset + 2*(half - 1));
+        for (int k = 1; k < half; k++) {
+            double phi = -pi * ((double)k / half + 0.5);
+            twiddles[offset + k - 1] = std::cos(phi);
+            twiddles[offset + half - 1 + k - 1] = std::sin(phi);
+        }
+
+        // where the in-place passes leave Z(k): each radix-4 pass of n
+        // points moves the points 4j+r to the quarter r of the n positions
+        for (int k = 0; k < half; k++) {
+            int position = 0;
+            int index = k;
+            for (int n = half; n >= 4; n /= 4) {
+                position += (index % 4) * (n/4);
+                index /= 4;
+            }
+            order[k] = position + index;
+        }
+    }
+
+    virtual void
+    power(
+            const float* const* frames,
+            int count,
+            float* ps)
+    {
+        if (count == 1) {
+            single(twiddles.data(), frames[0], buf.data(), ps);
+            return;
+        }
+        const int bins = size/2 + 1;
+        for (int f = 0; f < count; f += lanes) {
+            batched(twiddles.data(), order.data(), frames + f,
+                    std::min(lanes, count - f), buf.data(), ps + f*bins);
+        }
+    }
+};
+
+class kiss_fft : public realfft {
+private:
+    kiss_fftr_cfg cfg;
+    std::vector<kiss_fft_cpx> freq;
+
+public:
+    explicit kiss_fft(
+            int size) :
+            realfft(size),
+            cfg(kiss_fftr_alloc(size, 0, NULL, NULL)),
+            freq(size/2 + 1)
+    {
+    }
+
+    virtual
+    ~kiss_fft()
+    {
+        free(cfg);
+    }
+
+    virtual void
+    power(
+            const float* const* frames,
+            int count,
+            float* ps)
+    {
+        const int bins = size/2 + 1;
+        for (int f = 0; f < count; f++) {
+            kiss_fftr(cfg, frames[f], freq.data());
+            for (int j = 0; j < bins; j++) {
+                ps[f*bins + j] = std::pow(freq[j].r, 2) + std::pow(freq[j].i, 2);
+            }
+        }
+    }
+};
+
+} /* anonymous namespace */
+
+realfft::realfft(
+        int size) :
+        size(size)
+{
+}
+
+realfft::~realfft()
+{
+}
+
+int
+realfft::get_size() const
+{
+    return size;
+}
+
+realfft*
+realfft::create(
+        int size,
+        const std::string& name)
+{
+    std::string backend = name;
+    if (backend.empty()) {
+        const char* env = std::getenv("MUSLY_FFT");
+        backend = env ? env : "";
+        if ((backend != "unrolled") && (backend != "kissfft")) {
+            if (!backend.empty()) {
+                MINILOG(logWARNING) << "Unknown FFT backend: " << backend;
+            }
+            backend = MUSLY_FFT_DEFAULT;
+        }
+    }
+
+    if ((backend == "unrolled") && (size == unrolled_size)) {
+        return new unrolled_fft(size, power_single_1024, power_lanes_1024);
+    }
+    if ((backend == "unrolled") && (size == unrolled_size_2x)) {
+        return new unrolled_fft(size, power_single_2048, power_lanes_2048);
+    }
+    if ((backend == "unrolled") && (size == unrolled_size_4x)) {
+        return new unrolled_fft(size, power_single_4096, power_lanes_4096);
+    }
+    if ((backend == "unrolled") || (backend == "kissfft")) {
+        return new kiss_fft(size);
+    }
+    return NULL;
+}
+
+const std::string&
+realfft::get_backends()
+{
+    static const std::string backends("unrolled,kissfft");
+    return backends;
+}
+
+} /* namespace musly */
@@ -0,0 +1,84 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_REALFFT_H_
+#define MUSLY_REALFFT_H_
+
+#include <string>
+
+namespace musly {
+
+/** A backend computing the powerspectra of real frames of a fixed size, the
+ * only use musly has for an FFT. A backend keeps scratch buffers (and, for
+ * KissFFT, a plan that is written to while transforming), so each thread
+ * needs an instance of its own.
+ *
+ * The backends are selected by name:
+ *  - "unrolled": a radix-4 FFT whose sizes and strides are template
+ *    parameters, so all loops have trip counts known at compile time and
+ *    vectorize across the butterflies of a pass. Given several frames, it
+ *    transforms eight at a time, interleaved so that each butterfly works
+ *    on the same position of all of them in SIMD lanes. On AVX2 and AVX-512
+ *    this batched transform is slower per frame than the single one, as it
+ *    needs eight times the cache, so powerspectrum transforms frame by
+ *    frame. It is available for frames of 1024, 2048 and 4096 samples,
+ *    the windows of the methods at 22050, 44100 and 88200 Hz.
+ *  - "kissfft": KissFFT, for any even size.
+ */
+class realfft {
+protected:
+    /** The number of samples of a frame.
+     */
+    const int size;
+
+    explicit realfft(
+            int size);
+
+public:
+    virtual ~realfft();
+
+    /** Return the number of samples of a frame.
+     */
+    int
+    get_size() const;
+
+    /** Compute the powerspectra |X(k)|^2, k = 0..get_size()/2, of
+     * \p count frames.
+     * \param frames The \p count frames of get_size() samples each.
+     * \param count The number of frames.
+     * \param ps The output array, receiving get_size()/2+1 bins for each
+     * frame, frame after frame.
+     */
+    virtual void
+    power(
+            const float* const* frames,
+            int count,
+            float* ps) = 0;
+
+    /** Create the backend \p name for frames of \p size samples. If \p name
+     * is empty, the backend named by the environment variable MUSLY_FFT is
+     * used, or the one chosen at build time (the CMake option MUSLY_FFT).
+     * If the backend does not support the size, KissFFT is used instead.
+     * \returns The backend, or NULL if \p name is unknown.
+     */
+    static realfft*
+    create(
+            int size,
+            const std::string& name = "");
+
+    /** Return the names of the backends, separated by commas.
+     */
+    static const std::string&
+    get_backends();
+};
+
+} /* namespace musly */
+#endif /* MUSLY_REALFFT_H_ */
@@ -0,0 +1,242 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "simd.h"
+#include "resampler.h"
+
+namespace {
+
+
+/** The cutoff of the lowpass relative to the lower Nyquist frequency.
+ */
+const double rolloff = 0.95;
+
+/** The shape parameter of the Kaiser window, trading the width of the
+ * transition band for the stopband attenuation (about 80 dB).
+ */
+const double kaiser_beta = 8.0;
+
+/** The filters are padded to a multiple of this many taps, which the dot
+ * products accumulate in parallel.
+ */
+const int L = 8;
+
+/** The zeroth order modified Bessel function of the first kind.
+ */
+double
+bessel_i0(
+        double x)
+{
+    double sum = 1;
+    double term = 1;
+    for (int k = 1; term > 1e-12 * sum; k++) {
+        term *= (x / (2*k)) * (x / (2*k));
+        sum += term;
+    }
+    return sum;
+}
+
+/** Compute each output sample as the dot product of \p taps input samples
+ * starting at <tt>in + start[i]</tt> with the filter at \p filter[i].
+ */
+MUSLY_TARGET_CLONES
+void
+convolve(
+        const float* MUSLY_RESTRICT in,
+        const int* start,
+        const float* const* filter,
+        int taps,
+        int count,
+        float* MUSLY_RESTRICT out)
+{
+    for (int i = 0; i < count; i++) {
+        const float* x = in + start[i];
+        const float* h = filter[i];
+        float acc[L] = {0};
+        for (int k = 0; k < taps; k += L) {
+            for (int l = 0; l < L; l++) {
+                acc[l] += x[k + l] * h[k + l];
+            }
+        }
+        float sum = 0;
+        for (int l = 0; l < L; l++) {
+            sum += acc[l];
+        }
+        out[i] = sum;
+    }
+}
+
+} /* anonymous namespace */
+
+namespace musly {
+
+resampler::resampler(
+        int in_rate,
+        int out_rate,
+        int filter_length)
+{
+    int64_t a = in_rate;
+    int64_t b = out_rate;
+    while (b != 0) {
+        int64_t r = a % b;
+        a = b;
+        b = r;
+    }
+    down = in_rate / a;
+    up = out_rate / a;
+    phases = (int)std::min<int64_t>(up, max_phases);
+
+    // A lowpass at the lower of the two Nyquist frequencies, stretched to
+    // the input rate when downsampling.
+    const double cutoff = rolloff * std::min(1.0, (double)up / down);
+    // the filter spans filter_length/2 zero crossings of the sinc on each
+    // side, at the lower of the two rates
+    if (filter_length <= 0) {
+        filter_length = default_filter_length;
+    }
+    const int half = (up == down) ? 1 :
+            (int)std::ceil(0.5 * filter_length / cutoff);
+    const int used = (up == down) ? 1 : 2*half;
+    taps = (used + L - 1) / L * L;
+    before = (used - 1) / 2;
+    const double norm = bessel_i0(kaiser_beta);
+
+    // when approximating, the filter for each remainder of n*down/up
+    if (phases != up) {
+        rounded_phases.resize(up);
+        for (int64_t rem = 0; rem < up; rem++) {
+            rounded_phases[rem] = (int)((rem * phases + up/2) / up);
+        }
+    }
+
+    filters.assign((size_t)phases * taps, 0.0f);
+    for (int p = 0; p < phases; p++) {
+        float* h = &filters[(size_t)p * taps];
+        if (up == down) {
+            h[0] = 1;
+            continue;
+        }
+        const double frac = (double)p / phases;
+        double sum = 0;
+        for (int k = 0; k < used; k++) {
+            const double x = (k - before) - frac;
+            const double r = x / half;
+            const double window = (r*r < 1) ?
+                    bessel_i0(kaiser_beta * std::sqrt(1 - r*r)) / norm : 0;
+            const double arg = M_PI * cutoff * x;
+            const double sinc = (x == 0) ? 1 : std::sin(arg) / arg;
+            h[k] = (float)(sinc * window);
+            sum += h[k];
+        }
+        // unity gain for constant signals
+        for (int k = 0; k < used; k++) {
+            h[k] = (float)(h[k] / sum);
+        }
+    }
+}
+
+void
+resampler::locate(
+        int64_t n,
+        int64_t& in_index,
+        int64_t& rem) const
+{
+    const int64_t num = n * down;
+    in_index = num / up;
+    rem = num % up;
+}
+
+int
+resampler::phase_of(
+        int64_t rem,
+        int64_t& in_index) const
+{
+    if (phases == up) {
+        return (int)rem;
+    }
+    const int phase = rounded_phases[rem];
+    if (phase == phases) {
+        in_index++;
+        return 0;
+    }
+    return phase;
+}
+
+int64_t
+resampler::output_length(
+        int64_t in_length) const
+{
+    return (in_length * up + down - 1) / down;
+}
+
+void
+resampler::input_range(
+        int64_t out_first,
+        int count,
+        int64_t& in_begin,
+        int64_t& in_end) const
+{
+    int64_t first;
+    int64_t last;
+    int64_t rem;
+    locate(out_first, first, rem);
+    phase_of(rem, first);
+    locate(out_first + std::max(count, 1) - 1, last, rem);
+    phase_of(rem, last);
+    in_begin = first - before;
+    in_end = last - before + taps;
+}
+
+void
+resampler::process(
+        const float* in,
+        int64_t out_first,
+        int count,
+        float* out) const
+{
+    int64_t in_begin;
+    int64_t in_end;
+    input_range(out_first, count, in_begin, in_end);
+
+    // Step through the input positions of the outputs without dividing:
+    // each output advances by down/up input samples.
+    int64_t in_index;
+    int64_t rem;
+    locate(out_first, in_index, rem);
+    const int64_t step = down / up;
+    const int64_t step_rem = down % up;
+
+    // locate the filters for a block of outputs, then convolve the block
+    const int block = 256;
+    int start[block];
+    const float* filter[block];
+    for (int done = 0; done < count; done += block) {
+        const int n = std::min(block, count - done);
+        for (int i = 0; i < n; i++) {
+            int64_t index = in_index;
+            const int phase = phase_of(rem, index);
+            start[i] = (int)(index - before - in_begin);
+            filter[i] = &filters[(size_t)phase * taps];
+            in_index += step;
+            rem += step_rem;
+            if (rem >= up) {
+                rem -= up;
+                in_index++;
+            }
+        }
+        convolve(in, start, filter, taps, n, out + done);
+    }
+}
+
+} /* namespace musly */
@@ -0,0 +1,136 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_RESAMPLER_H_
+#define MUSLY_RESAMPLER_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace musly {
+
+/** Converts signals from one sample rate to another with a polyphase
+ * windowed-sinc filter.
+ *
+ * Output sample n lies at the input position t = n * in_rate / out_rate.
+ * It is the dot product of the input samples around t with one of a bank of
+ * precomputed filters, selected by the fractional part of t. If the ratio
+ * of the rates reduces to at most max_phases output samples per cycle, the
+ * bank holds a filter for each of them and the conversion is exact;
+ * otherwise the fractional part is rounded to one of max_phases filters.
+ * When downsampling, the filters are lowpassed below the output Nyquist
+ * frequency.
+ *
+ * The resampler keeps no state besides the filters: process() computes any
+ * range of output samples from the input samples around them, which suits
+ * random access to signals held in memory, and lets several threads share
+ * a resampler.
+ */
+class resampler {
+public:
+    /** The most filters of the bank.
+     */
+    static const int max_phases = 256;
+
+    /** The number of taps of the filters at the lower of the two rates,
+     * unless given otherwise.
+     */
+    static const int default_filter_length = 24;
+
+    /** Create a resampler from \p in_rate to \p out_rate, with filters of
+     * \p filter_length taps at the lower of the two rates, or of
+     * default_filter_length taps if 0. When downsampling, the filters are
+     * stretched to span as many samples at the input rate.
+     */
+    resampler(
+            int in_rate,
+            int out_rate,
+            int filter_length = 0);
+
+    /** Return the number of output samples for \p in_length input samples.
+     */
+    int64_t
+    output_length(
+            int64_t in_length) const;
+
+    /** Return the range [\p in_begin, \p in_end) of input samples that
+     * process() needs to compute the \p count output samples starting at
+     * \p out_first. It may extend before the first or beyond the last input
+     * sample, which are to be given as zeros.
+     */
+    void
+    input_range(
+            int64_t out_first,
+            int count,
+            int64_t& in_begin,
+            int64_t& in_end) const;
+
+    /** Compute the \p count output samples starting at \p out_first.
+     * \param in The input samples of the range given by input_range().
+     * \param out_first The index of the first output sample.
+     * \param count The number of output samples.
+     * \param out The output array of \p count samples.
+     */
+    void
+    process(
+            const float* in,
+            int64_t out_first,
+            int count,
+            float* out) const;
+
+private:
+    /** The input rate and output rate divided by their greatest common
+     * divisor: \p up output samples span \p down input samples.
+     */
+    int64_t down;
+    int64_t up;
+
+    int phases;
+    int taps;
+
+    /** The number of taps before the input sample at or before the output
+     * sample.
+     */
+    int before;
+
+    /** The \p taps coefficients of each of the \p phases filters. The
+     * filter of phase p applies to the \p taps input samples starting at
+     * floor(t) - \p before for t with a fractional part of p / phases; its
+     * trailing taps may be zero padding.
+     */
+    std::vector<float> filters;
+
+    /** The phase nearest to each remainder, if there are fewer phases than
+     * \p up; phases rounded up to \p phases continue at phase 0 of the
+     * next input sample.
+     */
+    std::vector<int> rounded_phases;
+
+    /** Find the input sample at or before output sample \p n, and the
+     * remainder \p rem of its position in units of 1/\p up samples.
+     */
+    void
+    locate(
+            int64_t n,
+            int64_t& in_index,
+            int64_t& rem) const;
+
+    /** Return the filter for the remainder \p rem, advancing \p in_index if
+     * it was rounded up to the next input sample.
+     */
+    int
+    phase_of(
+            int64_t rem,
+            int64_t& in_index) const;
+};
+
+} /* namespace musly */
+#endif /* MUSLY_RESAMPLER_H_ */
@@ -0,0 +1,51 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Helpers for the vectorized inner loops of musly. The loops themselves are
+ * written as plain C++ over fixed-width lanes, so any compiler can
+ * auto-vectorize them. Where the toolchain supports function multiversioning
+ * (GCC and Clang on x86 with ifunc support, see MUSLY_HAVE_TARGET_CLONES in
+ * CMakeLists.txt), a function marked with MUSLY_TARGET_CLONES is compiled for
+ * AVX-512, AVX2 and the SSE2 baseline, and the best variant for the CPU is
+ * picked once at load time.
+ */
+
+#ifndef MUSLY_SIMD_H_
+#define MUSLY_SIMD_H_
+
+#ifdef MUSLY_HAVE_TARGET_CLONES
+#define MUSLY_TARGET_CLONES \
+    __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define MUSLY_TARGET_CLONES
+#endif
+
+/** Helpers of a MUSLY_TARGET_CLONES function are only compiled for each
+ * instruction set when they are inlined into it, which MUSLY_INLINE forces.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define MUSLY_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define MUSLY_INLINE __forceinline
+#else
+#define MUSLY_INLINE inline
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MUSLY_RESTRICT __restrict__
+#elif defined(_MSC_VER)
+#define MUSLY_RESTRICT __restrict
+#else
+#define MUSLY_RESTRICT
+#endif
+
+#endif /* MUSLY_SIMD_H_ */
@@ -0,0 +1,142 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <cmath>
+#include <cstdint>
+
+#include "minilog.h"
+#include "windowfunction.h"
+#include "spectrumbank.h"
+
+namespace musly {
+
+namespace {
+
+/** Return whether \p n has no prime factors above 5.
+ */
+bool
+is_smooth(
+        int n)
+{
+    const int primes[] = {2, 3, 5};
+    for (int p : primes) {
+        while (n % p == 0) {
+            n /= p;
+        }
+    }
+    return n == 1;
+}
+
+/** How much longer or shorter than the window of the reference rate a
+ * window whose size is a power of two may be. The unrolled FFT is several
+ * times faster than the others, and the features match those of the
+ * resampled signal as closely.
+ */
+const double max_stretch = 0.1;
+
+} /* anonymous namespace */
+
+spectrumbank::rate::rate(
+        int sample_rate,
+        int window_size,
+        float hop,
+        int mel_bins,
+        int reference_rate,
+        int reference_window) :
+        sample_rate(sample_rate),
+        ps(windowfunction::hann(window_size), hop),
+        mel(window_size/2 + 1, mel_bins, sample_rate, reference_rate),
+        // the power of a frame grows with the square of the window size,
+        // for tones as for the noise in the band of the reference rate
+        scale((float)reference_window / window_size)
+{
+}
+
+spectrumbank::spectrumbank(
+        int sample_rate,
+        int window_size,
+        float hop,
+        int mel_bins) :
+        reference_rate(sample_rate),
+        reference_window(window_size),
+        hop(hop),
+        mel_bins(mel_bins),
+        reference(sample_rate, window_size, hop, mel_bins, sample_rate,
+                window_size)
+{
+}
+
+int
+spectrumbank::get_reference_rate() const
+{
+    return reference_rate;
+}
+
+int
+spectrumbank::window_size(
+        int sample_rate) const
+{
+    const int64_t scaled = (int64_t)reference_window * sample_rate;
+    const double exact = (double)scaled / reference_rate;
+
+    // a power of two close enough, such as 2048 for 48000 Hz
+    int power = 2;
+    while (2*power <= exact) {
+        power *= 2;
+    }
+    if (2*power - exact < exact - power) {
+        power *= 2;
+    }
+    if (std::abs(power - exact) <= max_stretch * exact) {
+        return power;
+    }
+
+    if ((scaled % reference_rate == 0) &&
+            ((scaled / reference_rate) % 2 == 0)) {
+        return (int)(scaled / reference_rate);
+    }
+
+    // search outwards from the exact size for an even, smooth one
+    int below = (int)std::floor(exact / 2) * 2;
+    int above = below + 2;
+    while (!is_smooth(below)) {
+        below -= 2;
+    }
+    while (!is_smooth(above)) {
+        above += 2;
+    }
+    return (exact - below <= above - exact) ? below : above;
+}
+
+const spectrumbank::rate*
+spectrumbank::get(
+        int sample_rate) const
+{
+    if (sample_rate == reference_rate) {
+        return &reference;
+    }
+    if ((sample_rate < reference_rate) || (sample_rate > max_rate)) {
+        return NULL;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    std::unique_ptr<rate>& r = rates[sample_rate];
+    if (!r) {
+        const int size = window_size(sample_rate);
+        MINILOG(logTRACE) << "Window and filters for " << sample_rate
+                << " Hz: window size=" << size;
+        r.reset(new rate(sample_rate, size, hop, mel_bins, reference_rate,
+                reference_window));
+    }
+    return r.get();
+}
+
+} /* namespace musly */
@@ -0,0 +1,121 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_SPECTRUMBANK_H_
+#define MUSLY_SPECTRUMBANK_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include "powerspectrum.h"
+#include "melspectrum.h"
+
+namespace musly {
+
+/** The windows and mel filterbanks to analyze signals of any sample rate
+ * like signals of the reference rate the methods are designed for, so they
+ * need not be resampled first.
+ *
+ * At a higher rate, the window spans about the same duration, so the
+ * frames and the frequencies of the powerspectrum bins are about those of
+ * the reference rate, and the mel filters cover the frequencies up to the
+ * Nyquist frequency of the reference rate; the bins above do not
+ * contribute. The samples are scaled so the powerspectra of a signal match
+ * those of it resampled to the reference rate. The MFCCs thus match up to
+ * the differences of the signal and its resampled version. Lower rates are
+ * not supported, as the mel filters above their Nyquist frequency would
+ * stay empty.
+ *
+ * The window and filters of a rate are computed when it is first asked
+ * for, and kept for the lifetime of the bank.
+ */
+class spectrumbank {
+public:
+    /** The window and filters of one sample rate.
+     */
+    class rate {
+    public:
+        rate(
+                int sample_rate,
+                int window_size,
+                float hop,
+                int mel_bins,
+                int reference_rate,
+                int reference_window);
+
+        const int sample_rate;
+        const powerspectrum ps;
+        const melspectrum mel;
+
+        /** The factor to scale the samples by, in addition to the
+         * normalization of their peak.
+         */
+        const float scale;
+    };
+
+    /** The highest sample rate supported; the lowest is the reference
+     * rate.
+     */
+    static const int max_rate = 384000;
+
+    /** Create a bank for windows of \p window_size samples, \p hop windows
+     * apart, at the reference rate \p sample_rate, and \p mel_bins mel
+     * filters.
+     */
+    spectrumbank(
+            int sample_rate,
+            int window_size,
+            float hop,
+            int mel_bins);
+
+    /** Return the window and filters of \p sample_rate, computing them if
+     * needed. Safe to call concurrently.
+     * \returns The window and filters, valid for the lifetime of the bank,
+     * or NULL if the rate is not supported.
+     */
+    const rate*
+    get(
+            int sample_rate) const;
+
+    /** Return the reference rate.
+     */
+    int
+    get_reference_rate() const;
+
+    /** Return the window size for \p sample_rate: the power of two closest
+     * to the reference window size scaled to the rate, if within 10% of
+     * it, or else the scaled size, if it is a whole even number, or else
+     * the closest even size with no prime factors above 5, for which FFTs
+     * are fast.
+     */
+    int
+    window_size(
+            int sample_rate) const;
+
+private:
+    const int reference_rate;
+    const int reference_window;
+    const float hop;
+    const int mel_bins;
+
+    /** The reference rate, created up front as every method analyzes at
+     * it.
+     */
+    const rate reference;
+
+    /** The other rates asked for so far.
+     */
+    mutable std::mutex lock;
+    mutable std::map<int, std::unique_ptr<rate>> rates;
+};
+
+} /* namespace musly */
+#endif /* MUSLY_SPECTRUMBANK_H_ */
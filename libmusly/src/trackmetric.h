@@ -0,0 +1,40 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *                2014, Jan Schlueter <jan.schlueter@ofai.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_TRACKMETRIC_H_
+#define MUSLY_TRACKMETRIC_H_
+
+#include "musly/musly_types.h"
+
+namespace musly {
+
+/** Computes the distances between tracks for a neighbor index.
+ */
+class track_metric
+{
+public:
+    virtual ~track_metric() {};
+
+    /** Write the distances from track \p from to the \p length tracks
+     * \p to into \p distances. Tracks the distance cannot be computed for
+     * (e.g., because their features are unknown) get FLT_MAX.
+     */
+    virtual void
+    distances(
+            musly_trackid from,
+            const musly_trackid* to,
+            int length,
+            float* distances) = 0;
+};
+
+} /* namespace musly */
+#endif /* MUSLY_TRACKMETRIC_H_ */
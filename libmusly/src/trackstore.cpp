@@ -0,0 +1,163 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *                2014, Jan Schlueter <jan.schlueter@ofai.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <cstdint>
+
+#include "trackstore.h"
+
+namespace musly {
+
+trackstore::trackstore() :
+        rows(0),
+        capacity(0),
+        num_present(0),
+        mapped(false)
+{
+}
+
+int
+trackstore::add_column(
+        int track_offset,
+        int num_floats,
+        covar_encoding encoding)
+{
+    column c;
+    c.track_offset = track_offset;
+    c.num_floats = num_floats;
+    c.encoding = encoding;
+    c.size = (covar_encoded_size(encoding, num_floats) + sizeof(float) - 1)
+            / sizeof(float);
+    // pad rows to whole cache lines
+    c.stride = (c.size + align_floats - 1) / align_floats * align_floats;
+    c.data = NULL;
+    columns.push_back(c);
+    return columns.size() - 1;
+}
+
+void
+trackstore::reserve(
+        int size)
+{
+    if (size <= capacity) {
+        return;
+    }
+    // grow geometrically to keep adding tracks one by one cheap
+    capacity = std::max(size, capacity + capacity / 2);
+    for (int c = 0; c < (int)columns.size(); c++) {
+        column& col = columns[c];
+        std::vector<float> buffer(
+                (size_t)capacity * col.stride + align_floats - 1);
+        // align the first row to 64 bytes
+        const uintptr_t alignment = align_floats * sizeof(float);
+        float* data = buffer.data() + ((alignment - (reinterpret_cast<uintptr_t>(
+                buffer.data()) % alignment)) % alignment) / sizeof(float);
+        if (col.data) {
+            std::copy(col.data, col.data + (size_t)rows * col.stride, data);
+        }
+        col.buffer.swap(buffer);
+        col.data = data;
+    }
+}
+
+void
+trackstore::own()
+{
+    if (!mapped) {
+        return;
+    }
+    // reserve() copies the rows from where the columns are now
+    mapped = false;
+    const int size = capacity;
+    capacity = 0;
+    reserve(size);
+}
+
+void
+trackstore::map(
+        int size,
+        const float* const* data,
+        const unsigned char* present)
+{
+    for (int c = 0; c < (int)columns.size(); c++) {
+        std::vector<float>().swap(columns[c].buffer);
+        columns[c].data = const_cast<float*>(data[c]);
+    }
+    this->present.map(present, size);
+    rows = size;
+    capacity = size;
+    num_present = 0;
+    for (int i = 0; i < size; i++) {
+        num_present += (present[i] != 0);
+    }
+    mapped = true;
+}
+
+void
+trackstore::resize(
+        int size)
+{
+    own();
+    reserve(size);
+    for (int i = size; i < rows; i++) {
+        num_present -= present[i];
+    }
+    present.own().resize(size, 0);
+    rows = size;
+}
+
+void
+trackstore::set_track(
+        int row,
+        const musly_track* track)
+{
+    own();
+    for (int c = 0; c < (int)columns.size(); c++) {
+        const column& col = columns[c];
+        encode_covar(col.encoding, track + col.track_offset, col.num_floats,
+                col.data + (size_t)row * col.stride);
+    }
+    if (!present[row]) {
+        present.own()[row] = 1;
+        num_present++;
+    }
+}
+
+void
+trackstore::get_track(
+        int row,
+        musly_track* track) const
+{
+    for (int c = 0; c < (int)columns.size(); c++) {
+        const column& col = columns[c];
+        decode_covar(col.encoding, col.data + (size_t)row * col.stride,
+                col.num_floats, track + col.track_offset);
+    }
+}
+
+void
+trackstore::swap_rows(
+        int row_a,
+        int row_b)
+{
+    own();
+    for (int c = 0; c < (int)columns.size(); c++) {
+        column& col = columns[c];
+        std::swap_ranges(col.data + (size_t)row_a * col.stride,
+                col.data + (size_t)row_a * col.stride + col.size,
+                col.data + (size_t)row_b * col.stride);
+    }
+    std::vector<unsigned char>& p = present.own();
+    std::swap(p[row_a], p[row_b]);
+}
+
+} /* namespace musly */
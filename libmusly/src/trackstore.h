@@ -0,0 +1,204 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *                2014, Jan Schlueter <jan.schlueter@ofai.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_TRACKSTORE_H_
+#define MUSLY_TRACKSTORE_H_
+
+#include <vector>
+#include "musly/musly_types.h"
+#include "mappedarray.h"
+#include "compactcovar.h"
+
+namespace musly {
+
+/** A contiguous store for the features of the tracks registered with a
+ * jukebox, laid out as a structure of arrays. Each feature of a musly_track
+ * (e.g., the mean, the covariance and its log-determinant) is kept in a
+ * column of its own, and the rows of the store correspond to the positions
+ * of an ordered_idpool. All columns start at a 64-byte boundary, and rows
+ * are padded to a multiple of 64 bytes, so scanning a column streams
+ * through memory in whole cache lines.
+ *
+ * Rows of tracks that were registered without features (e.g., when
+ * restoring a jukebox state) are kept, but marked as not present.
+ *
+ * A column of covariances can keep them encoded compactly (see
+ * covar_encoding) to save memory and bandwidth. Its rows then hold the
+ * encoded bytes, still counted in floats by get_stride().
+ *
+ * The columns can also be used in place from memory owned by someone
+ * else, such as a memory-mapped jukebox file; they are copied before the
+ * first change.
+ */
+class trackstore {
+public:
+    /** The alignment of columns and rows in floats (64 bytes).
+     */
+    static const int align_floats = 16;
+
+    trackstore();
+
+    /** Add a column for a feature of \p num_floats floats starting at
+     * \p track_offset in a musly_track. Returns the column index. A feature
+     * that is the packed upper triangle of a covariance can be stored with
+     * another \p encoding. Columns have to be added before any rows.
+     */
+    int
+    add_column(
+            int track_offset,
+            int num_floats,
+            covar_encoding encoding = covar_float32);
+
+    /** Return the number of rows
+     */
+    inline int
+    get_size() const {
+        return rows;
+    }
+
+    /** Return the number of floats from one row of column \p column to the
+     * next. For encoded columns, this counts the encoded bytes in units of
+     * the size of a float.
+     */
+    inline int
+    get_stride(
+            int column) const {
+        return columns[column].stride;
+    }
+
+    /** Return how column \p column is stored.
+     */
+    inline covar_encoding
+    get_encoding(
+            int column) const {
+        return columns[column].encoding;
+    }
+
+    /** Return the number of columns
+     */
+    inline int
+    get_columns() const {
+        return columns.size();
+    }
+
+    /** Return the rows of column \p column, get_size() * get_stride()
+     * floats.
+     */
+    inline const float*
+    column_data(
+            int column) const {
+        return columns[column].data;
+    }
+
+    /** Return whether features have been stored, a byte for each row.
+     */
+    inline const unsigned char*
+    present_data() const {
+        return present.data();
+    }
+
+    /** Use \p size rows in place until they change: the rows of each
+     * column at \p data, laid out like column_data(), each aligned to 64
+     * bytes, and whether they are present at \p present. The memory must
+     * stay valid until then.
+     */
+    void
+    map(
+            int size,
+            const float* const* data,
+            const unsigned char* present);
+
+    /** Grow or shrink to \p size rows. New rows are marked as not present.
+     */
+    void
+    resize(
+            int size);
+
+    /** Copy the features of \p track into row \p row, encoding them.
+     */
+    void
+    set_track(
+            int row,
+            const musly_track* track);
+
+    /** Copy the features of row \p row into \p track, decoding them.
+     */
+    void
+    get_track(
+            int row,
+            musly_track* track) const;
+
+    /** Return whether features have been stored for row \p row.
+     */
+    inline bool
+    is_present(
+            int row) const {
+        return present[row] != 0;
+    }
+
+    /** Return whether features have been stored for all rows.
+     */
+    inline bool
+    all_present() const {
+        return num_present == rows;
+    }
+
+    /** Exchange two rows
+     */
+    void
+    swap_rows(
+            int row_a,
+            int row_b);
+
+    /** Return the features of column \p column in row \p row, to be read
+     * only. For encoded columns, they are the encoded bytes.
+     */
+    inline float*
+    at(
+            int column,
+            int row) {
+        return columns[column].data + (size_t)row * columns[column].stride;
+    }
+
+private:
+    struct column {
+        int track_offset;
+        int num_floats;
+        covar_encoding encoding;
+        /** the floats the encoded feature takes up */
+        int size;
+        int stride;
+        std::vector<float> buffer;
+        float* data;
+    };
+
+    std::vector<column> columns;
+    mapped_array<unsigned char> present;
+    int rows;
+    int capacity;
+    int num_present;
+
+    /** Whether the columns are used in place */
+    bool mapped;
+
+    /** Copy mapped columns into buffers of our own.
+     */
+    void
+    own();
+
+    void
+    reserve(
+            int size);
+};
+
+} /* namespace musly */
+#endif /* MUSLY_TRACKSTORE_H_ */
@@ -0,0 +1,220 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *                2014, Jan Schlueter <jan.schlueter@ofai.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include <utility>
+
+#include "vptree.h"
+
+namespace musly {
+
+namespace {
+
+// Distances are computed in single precision, so the triangle inequality
+// may appear violated by a few rounding errors. Only skip subtrees that
+// are farther away than that.
+inline float
+slack(
+        float radius)
+{
+    return 1e-3f * (1.0f + radius);
+}
+
+inline bool
+known(
+        float distance)
+{
+    return (distance >= 0) && (distance != FLT_MAX);
+}
+
+} /* anonymous namespace */
+
+vptree::vptree(
+        track_metric* metric) :
+        metric(metric),
+        rng(42)
+{
+}
+
+int
+vptree::get_size() const
+{
+    return tracks.size() + unindexed.size();
+}
+
+int
+vptree::get_unindexed() const
+{
+    return unindexed.size();
+}
+
+void
+vptree::clear()
+{
+    nodes.clear();
+    tracks.clear();
+    unindexed.clear();
+}
+
+void
+vptree::build(
+        const musly_trackid* ids,
+        int length,
+        const musly_trackid* unindexed,
+        int num_unindexed)
+{
+    clear();
+    tracks.assign(ids, ids + length);
+    this->unindexed.assign(unindexed, unindexed + num_unindexed);
+    if (length > 0) {
+        std::vector<float> distances(length);
+        build_node(0, length, distances);
+    }
+}
+
+int
+vptree::build_node(
+        int first,
+        int last,
+        std::vector<float>& distances)
+{
+    int n = nodes.size();
+    nodes.push_back(node());
+    if (last - first <= leaf_size) {
+        nodes[n].vantage = -1;
+        nodes[n].first = first;
+        nodes[n].second = last;
+        return n;
+    }
+
+    // pick a random vantage track and sort the others by their distance
+    // to it, up to the median
+    std::uniform_int_distribution<int> pick(first, last - 1);
+    std::swap(tracks[first], tracks[pick(rng)]);
+    musly_trackid vantage = tracks[first];
+    int count = last - first - 1;
+    metric->distances(vantage, &tracks[first + 1], count, distances.data());
+    std::vector<std::pair<float, musly_trackid> > sorted(count);
+    for (int i = 0; i < count; i++) {
+        sorted[i] = std::make_pair(distances[i], tracks[first + 1 + i]);
+    }
+    int half = count / 2;
+    std::nth_element(sorted.begin(), sorted.begin() + half, sorted.end());
+    float bounds[4] = {FLT_MAX, 0, FLT_MAX, 0};
+    for (int i = 0; i < count; i++) {
+        tracks[first + 1 + i] = sorted[i].second;
+        float* range = (i < half) ? bounds : bounds + 2;
+        range[0] = std::min(range[0], sorted[i].first);
+        range[1] = std::max(range[1], sorted[i].first);
+        if (!known(sorted[i].first)) {
+            // nothing can be inferred about tracks the distance to the
+            // vantage track is unknown for, so never skip their side
+            range[0] = 0;
+            range[1] = FLT_MAX;
+        }
+    }
+
+    int inner = build_node(first + 1, first + 1 + half, distances);
+    int outer = build_node(first + 1 + half, last, distances);
+    node& v = nodes[n];
+    v.vantage = vantage;
+    v.first = inner;
+    v.second = outer;
+    v.inner_min = bounds[0];
+    v.inner_max = bounds[1];
+    v.outer_min = bounds[2];
+    v.outer_max = bounds[3];
+    return n;
+}
+
+int
+vptree::search(
+        musly_trackid query,
+        vptree_visitor& visitor)
+{
+    std::vector<musly_trackid> ids;
+    std::vector<float> distances;
+    int count = visit_tracks(unindexed.data(), unindexed.size(), query,
+            visitor, ids, distances);
+    if (!nodes.empty()) {
+        count += search_node(0, query, visitor, ids, distances);
+    }
+    return count;
+}
+
+int
+vptree::search_node(
+        int n,
+        musly_trackid query,
+        vptree_visitor& visitor,
+        std::vector<musly_trackid>& ids,
+        std::vector<float>& distances)
+{
+    const node& v = nodes[n];
+    if (v.vantage < 0) {
+        return visit_tracks(&tracks[v.first], v.second - v.first, query,
+                visitor, ids, distances);
+    }
+
+    float d;
+    metric->distances(query, &v.vantage, 1, &d);
+    int count = 1;
+    if (visitor.accepts(v.vantage)) {
+        visitor.visit(&v.vantage, &d, 1);
+    }
+
+    // descend into the side of the query first, it is more likely to
+    // shrink the radius; check the other side against the updated radius
+    int sides[2] = {v.first, v.second};
+    float lower[2] = {
+            std::max(v.inner_min - d, d - v.inner_max),
+            std::max(v.outer_min - d, d - v.outer_max)};
+    if (lower[1] < lower[0]) {
+        std::swap(sides[0], sides[1]);
+        std::swap(lower[0], lower[1]);
+    }
+    for (int i = 0; i < 2; i++) {
+        float radius = visitor.radius();
+        if (!known(d) || (radius == FLT_MAX) ||
+                (lower[i] <= radius + slack(radius))) {
+            count += search_node(sides[i], query, visitor, ids, distances);
+        }
+    }
+    return count;
+}
+
+int
+vptree::visit_tracks(
+        const musly_trackid* candidates,
+        int length,
+        musly_trackid query,
+        vptree_visitor& visitor,
+        std::vector<musly_trackid>& ids,
+        std::vector<float>& distances)
+{
+    ids.clear();
+    for (int i = 0; i < length; i++) {
+        if (visitor.accepts(candidates[i])) {
+            ids.push_back(candidates[i]);
+        }
+    }
+    if (ids.empty()) {
+        return 0;
+    }
+    distances.resize(ids.size());
+    metric->distances(query, ids.data(), ids.size(), distances.data());
+    visitor.visit(ids.data(), distances.data(), ids.size());
+    return ids.size();
+}
+
+} /* namespace musly */
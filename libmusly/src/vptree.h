@@ -0,0 +1,163 @@
+/**
+ * Copyright 2013-2014, Dominik Schnitzer <dominik@schnitzer.at>
+ *                2014, Jan Schlueter <jan.schlueter@ofai.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MUSLY_VPTREE_H_
+#define MUSLY_VPTREE_H_
+
+#include <vector>
+#include <random>
+#include "musly/musly_types.h"
+#include "trackmetric.h"
+
+namespace musly {
+
+/** Receives the tracks found by a vptree search and decides how far from
+ * the query tracks still have to be looked at.
+ */
+class vptree_visitor
+{
+public:
+    virtual ~vptree_visitor() {};
+
+    /** Return whether track \p id is a candidate at all. Tracks that are
+     * not are never compared to the query, unless needed to navigate the
+     * tree.
+     */
+    virtual bool
+    accepts(
+            musly_trackid id) = 0;
+
+    /** Return the largest distance to the query a track may have to still
+     * be of interest. May shrink as tracks are visited.
+     */
+    virtual float
+    radius() = 0;
+
+    /** Receive \p length candidates along with their distances to the
+     * query, as computed by the track_metric.
+     */
+    virtual void
+    visit(
+            const musly_trackid* ids,
+            const float* distances,
+            int length) = 0;
+};
+
+/** A vantage point tree over track ids, to find the exact nearest
+ * neighbors of a track while skipping most of the distance computations:
+ * P. N. Yianilos: Data structures and algorithms for nearest neighbor
+ * search in general metric spaces. Proc. SODA, 1993.
+ *
+ * Each inner node splits its tracks at the median distance to a vantage
+ * track and remembers the range of distances on either side. By the
+ * triangle inequality, a side can be skipped when the distance of the
+ * query to the vantage track shows all of its tracks to be farther away
+ * than the visitor's radius. Leaves are compared to the query as a whole,
+ * in a single call to the track_metric.
+ *
+ * Negative distances and the largest float are taken to be unknown: they
+ * are passed on to the visitor, but never used to skip tracks. Tracks for
+ * which the metric is not trusted to obey the triangle inequality can be
+ * given to build() separately. They are not put into the tree, but
+ * compared to every query.
+ */
+class vptree
+{
+public:
+    vptree(
+            track_metric* metric);
+
+    /** Return the number of tracks, including the ones kept outside of
+     * the tree.
+     */
+    int
+    get_size() const;
+
+    /** Return the number of tracks kept outside of the tree.
+     */
+    int
+    get_unindexed() const;
+
+    /** Build the tree over the \p length tracks \p ids, and keep the
+     * \p num_unindexed tracks \p unindexed outside of it. Replaces
+     * the previous contents.
+     */
+    void
+    build(
+            const musly_trackid* ids,
+            int length,
+            const musly_trackid* unindexed,
+            int num_unindexed);
+
+    /** Remove all tracks.
+     */
+    void
+    clear();
+
+    /** Pass all tracks within the visitor's radius of the track \p query to
+     * the visitor, along with some that are not. Returns the number of
+     * distances computed.
+     */
+    int
+    search(
+            musly_trackid query,
+            vptree_visitor& visitor);
+
+private:
+    struct node {
+        /** the vantage track of an inner node, or -1 for a leaf */
+        musly_trackid vantage;
+        /** the inner nodes' children, or the leaves' range of tracks */
+        int first;
+        int second;
+        /** the range of distances to the vantage track on either side */
+        float inner_min;
+        float inner_max;
+        float outer_min;
+        float outer_max;
+    };
+
+    /** the number of tracks below which a subtree becomes a leaf */
+    static const int leaf_size = 64;
+
+    track_metric* metric;
+    std::mt19937 rng;
+    std::vector<node> nodes;
+    std::vector<musly_trackid> tracks;
+    std::vector<musly_trackid> unindexed;
+
+    int
+    build_node(
+            int first,
+            int last,
+            std::vector<float>& distances);
+
+    int
+    search_node(
+            int n,
+            musly_trackid query,
+            vptree_visitor& visitor,
+            std::vector<musly_trackid>& ids,
+            std::vector<float>& distances);
+
+    int
+    visit_tracks(
+            const musly_trackid* candidates,
+            int length,
+            musly_trackid query,
+            vptree_visitor& visitor,
+            std::vector<musly_trackid>& ids,
+            std::vector<float>& distances);
+};
+
+} /* namespace musly */
+#endif /* MUSLY_VPTREE_H_ */
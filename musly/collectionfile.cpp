@@ -10,7 +10,14 @@
  */
  
 #include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include <stdint.h>
+#include <algorithm>
+#include <climits>
 #include <cstdio>
 #include <cstring>
 #include <vector>
@@ -20,13 +27,92 @@
 #include "tools.h"
 #include "collectionfile.h"
 
+namespace {
+
+/** The footer at the end of a collection file of version 1. The offsets
+ * are from the start of the file.
+ */
+struct collection_footer {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+
+    /** the size of a track in bytes */
+    uint32_t track_size;
+    uint32_t reserved;
+    uint64_t track_count;
+
+    /** the tracks, track_count * track_size bytes */
+    uint64_t features_offset;
+
+    /** the NUL-terminated file names */
+    uint64_t paths_offset;
+    uint64_t paths_size;
+
+    /** the offsets of the file names from paths_offset, a uint64 per
+     * track, followed by the footer */
+    uint64_t index_offset;
+};
+static_assert(sizeof(collection_footer) == 64, "footer must be 64 bytes");
+
+const char footer_magic[8] = {'M', 'U', 'S', 'L', 'Y', 'C', 'O', 'L'};
+const uint32_t byteorder = 0x01020304;
+
+// the tracks start at a multiple of this many bytes
+const uint64_t features_alignment = 64;
+
+/** Write what was written to \p fid through to the disk, so it is there
+ * before anything written after. Returns 0 on success.
+ */
+int
+sync_file(
+        FILE* fid)
+{
+    if (fflush(fid) != 0) {
+        return -1;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(fid));
+#else
+    return fsync(fileno(fid));
+#endif
+}
+
+/** Cut \p fid off after \p size bytes. Returns 0 on success.
+ */
+int
+truncate_file(
+        FILE* fid,
+        uint64_t size)
+{
+    if (fflush(fid) != 0) {
+        return -1;
+    }
+#ifdef _WIN32
+    return _chsize_s(_fileno(fid), (__int64)size);
+#else
+    return ftruncate(fileno(fid), (off_t)size);
+#endif
+}
+
+} /* anonymous namespace */
+
 collection_file::collection_file(
         const std::string& coll) :
     coll(coll),
     version("0"),
     header("MUSLY"),
     dash("-"),
-    fid(0)
+    fid(0),
+    mapping(NULL),
+    track_size(0),
+    track_count(0),
+    features_offset(0),
+    paths_offset(0),
+    paths_size(0),
+    index_offset(0),
+    filemap_ready(false),
+    pending_count(0)
 {
 }
 
@@ -34,8 +120,10 @@ collection_file::collection_file(
 collection_file::~collection_file()
 {
     if (fid) {
+        flush();
         fclose(fid);
     }
+    unmap();
 }
 
 
@@ -63,10 +151,126 @@ collection_file::exists()
 
 
 bool
-collection_file::write_header(const std::string& method)
+collection_file::write_header(
+        const std::string& method,
+        int track_size)
 {
-    fwritestr(fid, header+dash+version+dash+method);
+    version = "1";
+    const std::string headerstring = header+dash+version+dash+method;
+    if ((track_size <= 0) || (fwritestr(fid, headerstring) < 0)) {
+        return false;
+    }
+
+    // no tracks yet, but where they will go
+    uint64_t header_size = headerstring.length() + 1;
+    std::vector<unsigned char> padding(features_alignment -
+            (header_size - 1) % features_alignment - 1, 0);
+    if (!padding.empty() && (fwrite(padding.data(), 1, padding.size(), fid)
+            != padding.size())) {
+        return false;
+    }
+    this->method = method;
+    this->track_size = track_size;
+    track_count = 0;
+    features_offset = header_size + padding.size();
+    return write_index(features_offset, "", std::vector<uint64_t>());
+}
 
+bool
+collection_file::write_index(
+        uint64_t tracks_end,
+        const std::string& paths,
+        const std::vector<uint64_t>& offsets)
+{
+    collection_footer footer;
+    std::memcpy(footer.magic, footer_magic, sizeof(footer.magic));
+    footer.version = 1;
+    footer.byteorder = byteorder;
+    footer.track_size = track_size;
+    footer.reserved = 0;
+    footer.track_count = track_count;
+    footer.features_offset = features_offset;
+    footer.paths_offset = tracks_end;
+    footer.paths_size = paths.size();
+    footer.index_offset = tracks_end + paths.size();
+
+    if ((fseek64(fid, tracks_end) != 0) ||
+            (fwrite(paths.data(), 1, paths.size(), fid) != paths.size()) ||
+            (!offsets.empty() &&
+                    (fwrite(offsets.data(), sizeof(uint64_t), offsets.size(),
+                    fid) != offsets.size())) ||
+            (fwrite(&footer, sizeof(footer), 1, fid) != 1) ||
+            (fflush(fid) != 0)) {
+        return false;
+    }
+    paths_offset = footer.paths_offset;
+    paths_size = footer.paths_size;
+    index_offset = footer.index_offset;
+    return true;
+}
+
+void
+collection_file::unmap()
+{
+    musly_mappedfile_close(mapping);
+    mapping = NULL;
+}
+
+bool
+collection_file::read_index()
+{
+    unmap();
+    mapping = musly_mappedfile_open(coll.c_str());
+    if (musly_mappedfile_size(mapping) < sizeof(collection_footer)) {
+        unmap();
+        return false;
+    }
+    const unsigned char* data = musly_mappedfile_data(mapping);
+    const uint64_t size = musly_mappedfile_size(mapping);
+    collection_footer footer;
+    std::memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+    if ((std::memcmp(footer.magic, footer_magic, sizeof(footer.magic)) != 0) ||
+            (footer.version != 1) || (footer.byteorder != byteorder) ||
+            (footer.track_size == 0) || (footer.track_size % sizeof(float)) ||
+            (footer.features_offset % features_alignment) ||
+            (footer.track_count > INT_MAX) ||
+            (footer.features_offset > size) ||
+            (footer.track_count > (size - footer.features_offset) /
+                    footer.track_size) ||
+            (footer.features_offset + footer.track_count * footer.track_size
+                    > footer.paths_offset) ||
+            (footer.paths_size > size - footer.paths_offset) ||
+            (footer.paths_offset + footer.paths_size != footer.index_offset) ||
+            (footer.track_count > (size - footer.index_offset) /
+                    sizeof(uint64_t)) ||
+            (footer.index_offset + footer.track_count * sizeof(uint64_t)
+                    + sizeof(footer) != size)) {
+        unmap();
+        return false;
+    }
+
+    // every file name must start within the names, which end with a NUL
+    if ((footer.track_count > 0) &&
+            (data[footer.paths_offset + footer.paths_size - 1] != 0)) {
+        unmap();
+        return false;
+    }
+    for (uint64_t i = 0; i < footer.track_count; i++) {
+        uint64_t offset;
+        std::memcpy(&offset, data + footer.index_offset + i*sizeof(uint64_t),
+                sizeof(offset));
+        if (offset >= footer.paths_size) {
+            unmap();
+            return false;
+        }
+    }
+
+    track_size = footer.track_size;
+    track_count = footer.track_count;
+    features_offset = footer.features_offset;
+    paths_offset = footer.paths_offset;
+    paths_size = footer.paths_size;
+    index_offset = footer.index_offset;
     return true;
 }
 
@@ -81,13 +285,20 @@ collection_file::read_header()
         return false;
     }
 
-    if ((headersplit[0] !=  header) || (headersplit[1] != version)) {
+    if ((headersplit[0] !=  header) ||
+            ((headersplit[1] != "0") && (headersplit[1] != "1"))) {
         return false;
     }
 
     // save method
+    version = headersplit[1];
     method = headersplit[2];
 
+    // files of version 1 are used in place
+    if (version == "1") {
+        return read_index();
+    }
+
     return true;
 }
 
@@ -104,9 +315,52 @@ collection_file::get_file()
     return coll;
 }
 
+int
+collection_file::get_version()
+{
+    return (version == "1") ? 1 : 0;
+}
+
+int
+collection_file::get_track_size()
+{
+    return track_size;
+}
+
+int
+collection_file::get_track_count()
+{
+    return track_count;
+}
+
+const float*
+collection_file::get_track(int i)
+{
+    return (const float*)(musly_mappedfile_data(mapping) + features_offset +
+            (uint64_t)i * track_size);
+}
+
+const char*
+collection_file::get_track_file(int i)
+{
+    uint64_t offset;
+    const unsigned char* data = musly_mappedfile_data(mapping);
+    std::memcpy(&offset, data + index_offset + i*sizeof(uint64_t),
+            sizeof(offset));
+    return (const char*)(data + paths_offset + offset);
+}
+
 bool
 collection_file::contains_track(const std::string& trackfile)
 {
+    // the names of a mapped file are only looked at when needed
+    if ((version == "1") && !filemap_ready) {
+        for (int i = 0; i < (int)track_count; i++) {
+            filemap[get_track_file(i)] = 1;
+        }
+        filemap_ready = true;
+    }
+
     // check if we have analyzed the file already
     std::map<std::string, int>::iterator fm_iter = filemap.find(trackfile);
     if (fm_iter == filemap.end()) {
@@ -176,6 +430,20 @@ collection_file::append_track(
         const unsigned char* bindata,
         int size)
 {
+    // version 1 only keeps tracks that could be analyzed, and writes them
+    // with flush()
+    if (version == "1") {
+        if ((size != (int)track_size) || !bindata) {
+            return false;
+        }
+        contains_track(filename);
+        filemap[filename] = 1;
+        pending_tracks.insert(pending_tracks.end(), bindata, bindata + size);
+        pending_paths.append(filename.c_str(), filename.length() + 1);
+        pending_count++;
+        return true;
+    }
+
     // write the filename
     fwritestr(fid, filename);
 
@@ -200,3 +468,53 @@ collection_file::append_track(
     return true;
 }
 
+bool
+collection_file::flush()
+{
+    if ((version != "1") || (pending_count == 0) || !fid) {
+        return true;
+    }
+
+    // the names and their offsets are written anew after the new tracks
+    const unsigned char* data = musly_mappedfile_data(mapping);
+    const uint64_t file_size = musly_mappedfile_size(mapping);
+    const std::string old_paths((const char*)data + paths_offset, paths_size);
+    std::vector<uint64_t> offsets(track_count + pending_count);
+    if (track_count > 0) {
+        std::memcpy(offsets.data(), data + index_offset,
+                track_count * sizeof(uint64_t));
+    }
+    for (int i = 0, pos = 0; i < pending_count; i++) {
+        offsets[track_count + i] = old_paths.size() + pos;
+        pos += std::strlen(pending_paths.c_str() + pos) + 1;
+    }
+    const std::string paths = old_paths + pending_paths;
+    unmap();
+
+    // The new tracks overwrite the names and the index. So that the file
+    // stays valid if we do not get to the end, we first copy them to the
+    // end of the file, beyond where the new ones will end, then write the
+    // tracks and the new index, and only then cut off the copy.
+    const uint64_t tracks_end = features_offset + track_count * track_size;
+    const uint64_t new_tracks_end = tracks_end + pending_tracks.size();
+    const uint64_t new_end = new_tracks_end + paths.size() +
+            offsets.size() * sizeof(uint64_t) + sizeof(collection_footer);
+    const std::vector<uint64_t> old_offsets(offsets.begin(),
+            offsets.begin() + track_count);
+    bool ok = write_index(std::max(file_size, new_end), old_paths,
+            old_offsets) && (sync_file(fid) == 0);
+    ok = ok && (fseek64(fid, tracks_end) == 0) &&
+            (fwrite(pending_tracks.data(), 1, pending_tracks.size(), fid) ==
+                    pending_tracks.size());
+    if (ok) {
+        track_count += pending_count;
+        ok = write_index(new_tracks_end, paths, offsets) &&
+                (sync_file(fid) == 0) && (truncate_file(fid, new_end) == 0) &&
+                (sync_file(fid) == 0);
+    }
+    std::vector<unsigned char>().swap(pending_tracks);
+    pending_paths.clear();
+    pending_count = 0;
+
+    return ok && read_index();
+}
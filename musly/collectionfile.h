@@ -11,9 +11,33 @@
 #ifndef MUSLY_COLLECTIONFILE_H_
 #define MUSLY_COLLECTIONFILE_H_
 
+#include <stdint.h>
+#include <cstdio>
 #include <string>
+#include <vector>
 #include <map>
 
+#include "musly/musly.h"
+
+/** A collection file of analyzed tracks and the files they were analyzed
+ * from. Both versions start with the NUL-terminated string
+ * "MUSLY-<version>-<method>".
+ *
+ * In version 0, records of a NUL-terminated file name, the uint32 size of
+ * the track and the track serialized with musly_track_tobin() follow, to be
+ * read one by one with read_track().
+ *
+ * Version 1 is laid out to be memory-mapped and used in place: the tracks
+ * as they are in memory, one after the other from an offset aligned to 64
+ * bytes, then the NUL-terminated file names, then the uint64 offsets of the
+ * file names from the start of the names, one per track, and a footer of 64
+ * bytes telling where everything is (see collectionfile.cpp). The numbers
+ * are in the byte order of the machine that wrote the file. Tracks are
+ * appended in memory and written with flush(), which first copies the
+ * names, offsets and footer to beyond where the new ones will end, then
+ * writes the tracks and the new names, offsets and footer after them, and
+ * cuts off the copy last, so the file always ends in a valid footer.
+ */
 class collection_file {
 private:
     std::string coll;
@@ -29,6 +53,35 @@ private:
     bool
     exists();
 
+    /** Version 1: the mapped file and its index */
+    musly_mappedfile* mapping;
+    uint32_t track_size;
+    uint64_t track_count;
+    uint64_t features_offset;
+    uint64_t paths_offset;
+    uint64_t paths_size;
+    uint64_t index_offset;
+
+    /** Version 1: whether the file names are in filemap yet */
+    bool filemap_ready;
+
+    /** Version 1: the tracks appended since the last flush(), and their
+     * NUL-terminated file names */
+    std::vector<unsigned char> pending_tracks;
+    std::string pending_paths;
+    int pending_count;
+
+    bool
+    read_index();
+
+    void
+    unmap();
+
+    bool
+    write_index(
+            uint64_t tracks_end,
+            const std::string& paths,
+            const std::vector<uint64_t>& offsets);
 
 public:
     collection_file(
@@ -40,25 +93,40 @@ public:
     bool
     open(std::string mode);
 
+    /** Start a new collection file of version 1 for \p method, whose tracks
+     * are \p track_size bytes.
+     */
     bool
     write_header(
-            const std::string& method);
+            const std::string& method,
+            int track_size);
 
     bool
     read_header();
 
+    /** Append a track, serialized with musly_track_tobin() in version 0,
+     * or as it is in memory in version 1.
+     */
     bool
     append_track(
             const std::string& filename,
             const unsigned char* bindata,
             int size);
 
+    /** Read the next track of a file of version 0.
+     */
     int
     read_track(
             unsigned char* buffer,
             int buffersize,
             std::string& file);
 
+    /** Write the tracks appended to a file of version 1. Tracks returned by
+     * get_track() before are invalidated.
+     */
+    bool
+    flush();
+
     bool
     contains_track(const std::string& trackfile);
 
@@ -67,6 +135,25 @@ public:
 
     std::string
     get_file();
+
+    int
+    get_version();
+
+    /** Version 1: the size of a track in bytes */
+    int
+    get_track_size();
+
+    /** Version 1: the number of tracks */
+    int
+    get_track_count();
+
+    /** Version 1: track \p i, in place in the mapped file */
+    const float*
+    get_track(int i);
+
+    /** Version 1: the file track \p i was analyzed from */
+    const char*
+    get_track_file(int i);
 };
 
 #endif /* MUSLY_COLLECTIONFILE_H_ */
@@ -74,6 +74,46 @@ int read_collectionfile(
                   << std::endl;
     }
 
+    // files of version 1 are used in place: the tracks need not be parsed
+    // or copied, and are valid as long as the collection file is
+    if (cf.get_version() == 1)
+    {
+        if (cf.get_track_size() != musly_track_size(mj))
+        {
+            std::cerr << "Collection file: " << cf.get_file()
+                      << " has tracks of the wrong size." << std::endl;
+            return -1;
+        }
+        std::cout << "Reading collection file: " << cf.get_file() << std::endl;
+        const int count = cf.get_track_count();
+        if (mode == 't')
+        {
+            tracks->reserve(count);
+            tracks_files->reserve(count);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            musly_track *current_mt = const_cast<float *>(cf.get_track(i));
+            if (mode == 'l')
+            {
+                std::cout << "track-id: " << i << ", track-size: "
+                          << cf.get_track_size() << " bytes, track-origin: "
+                          << cf.get_track_file(i) << std::endl;
+            }
+            else if (mode == 'd')
+            {
+                std::cout << cf.get_track_file(i) << std::endl;
+                std::cout << musly_track_tostr(mj, current_mt) << std::endl;
+            }
+            else if (mode == 't')
+            {
+                tracks->push_back(current_mt);
+                tracks_files->push_back(cf.get_track_file(i));
+            }
+        }
+        return count;
+    }
+
     // skip files && read files/tracks in database
     std::string current_file;
     int buffersize = musly_track_binsize(mj);
@@ -127,9 +167,17 @@ int read_collectionfile(
     return count;
 }
 
-bool read_jukebox(std::string &filename, musly_jukebox **jukebox, int *last_reinit)
+// A jukebox file holds the jukebox state and the number of tracks it was
+// initialized for, followed by journal records of the tracks added since.
+// Once the records take up more than this fraction of the state, the file
+// is written anew.
+const float max_journal_fraction = 0.25f;
+
+bool read_jukebox(std::string &filename, musly_jukebox **jukebox, int *last_reinit,
+                  bool *appendable)
 {
     std::cout << "Reading jukebox file: " << filename << std::endl;
+    *appendable = false;
     if (FILE *f = fopen(filename.c_str(), "rb"))
     {
         *jukebox = musly_jukebox_fromstream(f);
@@ -137,6 +185,27 @@ bool read_jukebox(std::string &filename, musly_jukebox **jukebox, int *last_rein
         {
             *last_reinit = 0;
         }
+        else if (*jukebox)
+        {
+            // replay the journal, and append to it unless it is damaged or
+            // has grown too large
+            long state_size = ftell(f);
+            int records = musly_jukebox_journal_replay(*jukebox, f);
+            if (records < 0)
+            {
+                std::cout << "Jukebox file has a damaged journal; it will be rewritten."
+                          << std::endl;
+            }
+            else
+            {
+                long journal_size = ftell(f) - state_size;
+                *appendable = (journal_size <= state_size * max_journal_fraction);
+                if (records > 0)
+                {
+                    std::cout << "Replayed " << records << " journal record(s)." << std::endl;
+                }
+            }
+        }
         fclose(f);
         return (*jukebox != NULL);
     }
@@ -155,8 +224,23 @@ bool write_jukebox(std::string &filename, musly_jukebox* jukebox, int last_reini
     return false;
 }
 
+bool append_jukebox(std::string &filename, musly_jukebox* jukebox,
+                    const musly_trackid *trackids, int num_tracks)
+{
+    std::cout << "Appending to jukebox file: " << filename << std::endl;
+    if (FILE *f = fopen(filename.c_str(), "ab"))
+    {
+        bool result = musly_jukebox_journal_addtracks(jukebox, f, trackids, num_tracks) > 0;
+        fclose(f);
+        return result;
+    }
+    return false;
+}
+
 void tracks_add(collection_file &cf, std::string directory_or_file, std::string extension)
 {
+    // files of version 1 keep the tracks as they are in memory
+    const bool as_is = (cf.get_version() == 1);
     fileiterator fi(directory_or_file, extension);
     std::string afile;
     if (!fi.get_nextfilename(afile))
@@ -179,6 +263,8 @@ void tracks_add(collection_file &cf, std::string directory_or_file, std::string
             unsigned char *buffer =
                 new unsigned char[buffersize];
             musly_track *mt = musly_track_alloc(mj);
+            // each thread analyzes with scratch memory of its own
+            musly_analyzer *ma = musly_analyzer_create(mj);
 #ifdef _OPENMP
 // do a parallel for loop over the collected file names
 // use a dynamic schedule because computation may differ per file
@@ -210,7 +296,7 @@ void tracks_add(collection_file &cf, std::string directory_or_file, std::string
                 std::cout << "Analyzing [" << i + 1 << "]: "
                           << limit_string(file, 60) << std::flush;
 #endif
-                int ret = musly_track_analyze_audiofile(mj, file.c_str(), 30, -48, mt);
+                int ret = musly_analyzer_analyze_audiofile(ma, file.c_str(), 30, -48, mt);
 #ifdef _OPENMP
 #pragma omp critical
                 {
@@ -219,9 +305,14 @@ void tracks_add(collection_file &cf, std::string directory_or_file, std::string
 #endif
                     if (ret == 0)
                     {
-                        int serialized_buffersize =
+                        int serialized_buffersize = as_is ? musly_track_size(mj) :
                             musly_track_tobin(mj, mt, buffer);
-                        if (serialized_buffersize == buffersize)
+                        if (as_is && cf.append_track(file,
+                                (const unsigned char *)mt, serialized_buffersize))
+                        {
+                            std::cout << " - [OK]" << std::endl;
+                        }
+                        else if (!as_is && (serialized_buffersize == buffersize))
                         {
                             cf.append_track(file, buffer, buffersize);
                             std::cout << " - [OK]" << std::endl;
@@ -244,6 +335,7 @@ void tracks_add(collection_file &cf, std::string directory_or_file, std::string
 #endif
             delete[] buffer;
             musly_track_free(mt);
+            musly_analyzer_free(ma);
         } // pragma omp parallel
     }
 }
@@ -296,9 +388,30 @@ bool tracks_initialize(
     return true;
 }
 
+void store_tracks(
+    std::vector<musly_track *> &tracks)
+{
+    // a jukebox read from a file does not hold the features of its tracks;
+    // hand them over to allow for the trackid-based similarity functions
+    std::vector<musly_trackid> trackids(tracks.size());
+    for (int i = 0; i < (int)trackids.size(); i++)
+    {
+        trackids[i] = i;
+    }
+    musly_jukebox_storetracks(mj, tracks.data(), trackids.data(),
+                              tracks.size());
+}
+
 void tracks_free(
+    collection_file &cf,
     std::vector<musly_track *> &tracks)
 {
+    // tracks of collection files of version 1 are used in place
+    if (cf.get_version() == 1)
+    {
+        return;
+    }
+
     // free the tracks
     for (int i = 0; i < (int)tracks.size(); i++)
     {
@@ -307,6 +420,113 @@ void tracks_free(
     }
 }
 
+struct mirex_band_writer
+{
+    std::ofstream *f;
+    FILE *spill;
+    size_t n;
+    size_t band_rows;
+    int rows_written;
+};
+
+int write_mirex_band(
+    void *user_data,
+    int first_row,
+    int num_rows,
+    const float *similarities)
+{
+    // Rows arrive in order, as bands of the upper triangle. The similarities
+    // left of the diagonal are those of the earlier bands in the band's
+    // columns. Each band spills the square tile of them for every later band
+    // to a temporary file, transposed and grouped by the band they are for,
+    // so a band reads them back in one go and only bands are held in memory.
+    mirex_band_writer *w = reinterpret_cast<mirex_band_writer *>(user_data);
+    const size_t n = w->n;
+    const size_t b = w->band_rows;
+    const size_t first = first_row;
+    const size_t rows = num_rows;
+    if (first % b != 0)
+    {
+        return -1;
+    }
+    // band k keeps its tiles from bands 0..k-1 starting at tile k*(k-1)/2
+    const size_t band = first / b;
+    const size_t num_bands = (n + b - 1) / b;
+    std::vector<size_t> row_start(rows);
+    for (size_t r = 1; r < rows; r++)
+    {
+        row_start[r] = row_start[r - 1] + (n - 1 - (first + r - 1));
+    }
+    std::vector<float> tile(b * b, 0);
+    for (size_t later = band + 1; later < num_bands; later++)
+    {
+        const size_t columns = std::min(b, n - later * b);
+        for (size_t c = 0; c < columns; c++)
+        {
+            const size_t j = later * b + c;
+            for (size_t r = 0; r < rows; r++)
+            {
+                tile[c * b + r] =
+                    similarities[row_start[r] + j - (first + r) - 1];
+            }
+        }
+        const size_t offset = (later * (later - 1) / 2 + band) * b * b;
+        if ((fseek64(w->spill, offset * sizeof(float)) != 0) ||
+            (fwrite(tile.data(), sizeof(float), tile.size(), w->spill) !=
+             tile.size()))
+        {
+            return -1;
+        }
+    }
+
+    std::vector<float> rows_out(rows * n, 0);
+    if (band > 0)
+    {
+        std::vector<float> tiles(band * b * b);
+        const size_t offset = band * (band - 1) / 2 * b * b;
+        if ((fseek64(w->spill, offset * sizeof(float)) != 0) ||
+            (fread(tiles.data(), sizeof(float), tiles.size(), w->spill) !=
+             tiles.size()))
+        {
+            return -1;
+        }
+        for (size_t earlier = 0; earlier < band; earlier++)
+        {
+            const float *t = &tiles[earlier * b * b];
+            for (size_t r = 0; r < rows; r++)
+            {
+                std::copy(t + r * b, t + (r + 1) * b,
+                          &rows_out[r * n + earlier * b]);
+            }
+        }
+    }
+    for (size_t r = 0; r < rows; r++)
+    {
+        const size_t i = first + r;
+        const float *sim = similarities + row_start[r];
+        for (size_t j = i + 1; j < n; j++, sim++)
+        {
+            rows_out[r * n + j] = *sim;
+            if (j < first + rows)
+            {
+                rows_out[(j - first) * n + i] = *sim;
+            }
+        }
+    }
+
+    for (size_t r = 0; r < rows; r++)
+    {
+        *w->f << first + r + 1;
+        for (size_t j = 0; j < n; j++)
+        {
+            *w->f << '\t' << rows_out[r * n + j];
+        }
+        *w->f << std::endl;
+    }
+    w->rows_written += num_rows;
+    return 0;
+}
+
 int write_mirex_full(
     std::vector<musly_track *> &tracks,
     std::vector<std::string> &tracks_files,
@@ -341,43 +561,65 @@ int write_mirex_full(
         alltrackids[i] = i;
     }
 
-#ifdef _OPENMP
-#pragma omp parallel
+    // compute each pair only once, writing the matrix by bands of rows
+    mirex_band_writer w = {&f, std::tmpfile(), tracks.size(), 256, 0};
+    if (w.spill)
     {
-#endif
-        std::vector<float> similarities(tracks.size());
-#ifdef _OPENMP
-#pragma omp for schedule(static) ordered
-#endif
-        for (int i = 0; i < (int)tracks.size(); i++)
+        int ret = musly_jukebox_similarity_allpairs(mj, alltrackids.data(),
+                                                    tracks.size(),
+                                                    w.band_rows,
+                                                    write_mirex_band, &w);
+        fclose(w.spill);
+        if (ret == 0)
         {
-            int ret = musly_jukebox_similarity(mj, tracks[i], i,
-                                               tracks.data(), alltrackids.data(),
-                                               tracks.size(), similarities.data());
-            if (ret != 0)
-            {
-                fill(similarities.begin(), similarities.end(),
-                     std::numeric_limits<float>::max());
-            }
+            f.close();
+            return 0;
+        }
+    }
 
+    // otherwise, compute the rest of the matrix in batches of rows;
+    // musly_jukebox_similarity_batch() tiles and parallelizes the computation
+    // internally, for methods that do not support it, we compute the rows
+    // one by one
+    const int batch = 32;
+    std::vector<float> similarities((size_t)batch * tracks.size());
+    for (int b = w.rows_written; b < (int)tracks.size(); b += batch)
+    {
+        int rows = std::min(batch, (int)tracks.size() - b);
+        int ret = musly_jukebox_similarity_batch(mj, &alltrackids[b], rows,
+                                                 alltrackids.data(), tracks.size(),
+                                                 similarities.data());
+        if (ret != 0)
+        {
 #ifdef _OPENMP
-#pragma omp ordered
-            {
+#pragma omp parallel for schedule(static)
 #endif
-                // write to file
-                f << i + 1;
-                for (int j = 0; j < (int)similarities.size(); j++)
+            for (int r = 0; r < rows; r++)
+            {
+                float* row = &similarities[(size_t)r * tracks.size()];
+                int row_ret = musly_jukebox_similarity(mj, tracks[b + r], b + r,
+                                                       tracks.data(), alltrackids.data(),
+                                                       tracks.size(), row);
+                if (row_ret != 0)
                 {
-                    f << '\t' << similarities[j];
+                    std::fill(row, row + tracks.size(),
+                              std::numeric_limits<float>::max());
                 }
-                f << std::endl;
-#ifdef _OPENMP
-            } // pragma omp ordered
-#endif
+            }
         }
-#ifdef _OPENMP
-    } // pragma omp parallel
-#endif
+
+        // write to file
+        for (int r = 0; r < rows; r++)
+        {
+            const float* row = &similarities[(size_t)r * tracks.size()];
+            f << b + r + 1;
+            for (int j = 0; j < (int)tracks.size(); j++)
+            {
+                f << '\t' << row[j];
+            }
+            f << std::endl;
+        }
+    }
 
     f.close();
 
@@ -769,7 +1011,7 @@ int main(int argc, char *argv[])
                   << std::endl;
         std::cout << "Initializing new collection: " << po.get_option_str("c") << std::endl;
         std::cout << "Initialization result: " << std::flush;
-        if (cf.write_header(musly_jukebox_methodname(mj)))
+        if (cf.write_header(musly_jukebox_methodname(mj), musly_track_size(mj)))
         {
             std::cout << "OK." << std::endl;
         }
@@ -795,6 +1037,11 @@ int main(int argc, char *argv[])
 
         // search for new files, analyze and add them
         tracks_add(cf, po.get_option_str("a"), po.get_option_str("x"));
+        if (!cf.flush())
+        {
+            std::cerr << "Writing the collection file failed." << std::endl;
+            ret = 1;
+        }
 
         // -l: list files in collection file
     }
@@ -843,7 +1090,8 @@ int main(int argc, char *argv[])
         if (!jukebox_file.empty())
         {
             musly_jukebox* mj2 = NULL;
-            if (!read_jukebox(jukebox_file, &mj2, &last_reinit))
+            bool appendable = false;
+            if (!read_jukebox(jukebox_file, &mj2, &last_reinit, &appendable))
             {
                 std::cout << "Reading failed.";
             }
@@ -864,6 +1112,7 @@ int main(int argc, char *argv[])
                 // everything is fine, use loaded jukebox directly
                 musly_jukebox_poweroff(mj);
                 mj = mj2;
+                store_tracks(tracks);
             }
             else if (track_count > (int)(last_reinit * 1.1f))
             {
@@ -887,9 +1136,16 @@ int main(int argc, char *argv[])
                     // updating went fine, use loaded jukebox
                     musly_jukebox_poweroff(mj);
                     mj = mj2;
-                    // and write updated jukebox
-                    write_jukebox(jukebox_file, mj, last_reinit);
+                    store_tracks(tracks);
+                    // and journal the new tracks, or write the updated
+                    // jukebox anew
+                    if (!appendable ||
+                        !append_jukebox(jukebox_file, mj, trackids, num_new))
+                    {
+                        write_jukebox(jukebox_file, mj, last_reinit);
+                    }
                 }
+                delete[] trackids;
             }
             if (mj != mj2)
             {
@@ -908,7 +1164,7 @@ int main(int argc, char *argv[])
             if (!tracks_initialize(tracks))
             {
                 std::cerr << "Initialization failed! Aborting" << std::endl;
-                tracks_free(tracks);
+                tracks_free(cf, tracks);
                 musly_jukebox_poweroff(mj);
                 return -1;
             }
@@ -996,7 +1252,7 @@ int main(int argc, char *argv[])
             if (it == tracks_files.end())
             {
                 std::cerr << "File not found in collection! Aborting." << std::endl;
-                tracks_free(tracks);
+                tracks_free(cf, tracks);
                 musly_jukebox_poweroff(mj);
                 return -1;
             }
@@ -1025,7 +1281,7 @@ int main(int argc, char *argv[])
         }
 
         // cleanup
-        tracks_free(tracks);
+        tracks_free(cf, tracks);
     }
 
     // cleanup
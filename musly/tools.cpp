@@ -53,6 +53,19 @@ fwritestr(
 }
 
 
+int
+fseek64(
+        FILE* fid,
+        uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(fid, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(fid, (off_t)offset, SEEK_SET);
+#endif
+}
+
+
 std::vector<std::string>&
 split(
         const std::string &s,
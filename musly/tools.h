@@ -12,6 +12,7 @@
 #ifndef MUSLY_TOOLS_H_
 #define MUSLY_TOOLS_H_
 
+#include <stdint.h>
 #include <cstdio>
 #include <string>
 #include <sstream>
@@ -26,6 +27,12 @@ fwritestr(FILE* fid, const std::string& str);
 std::string
 freadstr(FILE* fid, int max_size);
 
+/** Seek \p fid to \p offset bytes from its start, also beyond 2 GiB.
+ * Returns 0 on success.
+ */
+int
+fseek64(FILE* fid, uint64_t offset);
+
 std::vector<std::string>&
 split(
         const std::string &s,
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2014, Jan Schlueter <jan.schlueter@ofai.at>
+ *
+ * This file is part of Musly, a program for high performance music
+ * similarity computation: http://www.musly.org/.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla
+ * Public License v. 2.0. If a copy of the MPL was not distributed
+ * with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Times the FFT backends of libmusly/src/realfft.h on the frames of the
+ * analysis: 1024 samples, with a hop of 512 samples. Usage:
+ *
+ *     fftbench [frames]
+ *
+ * For each backend and each number of frames transformed per call, the
+ * best time of several rounds is reported, in microseconds per frame.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "realfft.h"
+
+/** Return the best time of some rounds of computing the powerspectra of all
+ * \p frames, \p batch at a time, in microseconds per frame. */
+double time_backend(musly::realfft* fft, const std::vector<const float*>& frames, int batch) {
+    const int bins = fft->get_size()/2 + 1;
+    std::vector<float> ps(batch * bins);
+    double best = 0;
+    for (int round = 0; round < 20; round++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int f = 0; f < (int)frames.size(); f += batch) {
+            int count = std::min(batch, (int)frames.size() - f);
+            fft->power(&frames[f], count, ps.data());
+        }
+        double us = std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - start).count() / frames.size();
+        if ((round == 0) || (us < best)) {
+            best = us;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    const int size = 1024;
+    const int hop = size / 2;
+    // about 30 seconds at 22050 Hz by default
+    int count = (argc > 1) ? std::atoi(argv[1]) : 1290;
+    if (count < 1) {
+        std::cerr << "Usage: " << argv[0] << " [frames]" << std::endl;
+        return 1;
+    }
+
+    std::vector<float> pcm((count - 1) * hop + size);
+    srand(42);
+    for (int i = 0; i < (int)pcm.size(); i++) {
+        pcm[i] = 32768.0f * ((float)rand() / RAND_MAX - 0.5f);
+    }
+    std::vector<const float*> frames(count);
+    for (int f = 0; f < count; f++) {
+        frames[f] = &pcm[f * hop];
+    }
+
+    const char* backends[] = {"kissfft", "unrolled"};
+    const int batches[] = {1, 8};
+    double reference = 0;
+    std::cout << "backend    frames/call  us/frame  speedup" << std::endl;
+    for (int b = 0; b < 2; b++) {
+        musly::realfft* fft = musly::realfft::create(size, backends[b]);
+        for (int i = 0; i < 2; i++) {
+            double us = time_backend(fft, frames, batches[i]);
+            if (reference == 0) {
+                reference = us;
+            }
+            std::cout << std::left << std::setw(11) << backends[b]
+                    << std::right << std::setw(11) << batches[i]
+                    << std::fixed << std::setprecision(3)
+                    << std::setw(10) << us
+                    << std::setprecision(2) << std::setw(9) << reference / us
+                    << std::endl;
+        }
+        delete fft;
+    }
+    return 0;
+}
@@ -15,8 +15,14 @@
 #include <cstdio>
 #include <ctime>
 #include <cmath>
+#include <cfloat>
+#include <cstring>
 #include <vector>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
 
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32)
 #define WIN32_LEAN_AND_MEAN
@@ -27,6 +33,15 @@
 #include "musly/musly.h"
 #include "tools.h"
 #include "idpool.h"
+#include "gaussianstatistics.h"
+#include "mutualproximity.h"
+#include "hnsw.h"
+#include "vptree.h"
+#include "pivottable.h"
+#include "parallel.h"
+#include "realfft.h"
+#include "resampler.h"
+#include "collectionfile.h"
 
 /** poor man's test framework */
 int FAILED = 0;
@@ -87,11 +102,25 @@ void test_unordered_idpool() {
 
 
 void check_ordered_idpool_mapping(musly::ordered_idpool<int>& pool) {
-    REQUIRE( "size consistency", pool.get_size() == (int) pool.posmap().size() );
     REQUIRE( "size consistency", pool.get_size() == (int) pool.idlist().size() );
     for (int i = 0; i < pool.get_size(); i++) {
         REQUIRE( "mapping consistency", pool.position_of(pool.idlist()[i]) == i );
     }
+    std::vector<int> positions(pool.get_size());
+    pool.positions_of(pool.idlist().data(), pool.get_size(), positions.data());
+    for (int i = 0; i < pool.get_size(); i++) {
+        REQUIRE( "batch mapping consistency", positions[i] == i );
+    }
+    // no id is mapped that is not registered
+    int mapped = 0;
+    for (int id = -1; id <= pool.get_max_seen() + 1; id++) {
+        int pos = pool.position_of(id);
+        if (pos >= 0) {
+            REQUIRE( "mapped id registered", pool.idlist()[pos] == id );
+            mapped++;
+        }
+    }
+    REQUIRE( "size consistency", pool.get_size() == mapped );
 }
 
 
@@ -170,6 +199,38 @@ void test_ordered_idpool() {
     REQUIRE( "generated 13", generate_more[0] == 13 );
     REQUIRE( "position 13", pool.position_of(13) == 8 );
     check_ordered_idpool_mapping(pool);
+
+    // We add ids too sparse for a flat index, and remove most of them again
+    musly::ordered_idpool<int> sparse;
+    std::vector<int> sparse_ids;
+    for (int i = 0; i < 3000; i++) {
+        sparse_ids.push_back((i % 2) ? -7 * i - 1 : 100003 * i + 5000);
+    }
+    count = sparse.add_ids(&sparse_ids[0], sparse_ids.size());
+    REQUIRE( "added sparse ids", count == 3000 );
+    for (int i = 0; i < 3000; i += 2) {
+        sparse.remove_ids(&sparse_ids[i], 1);
+    }
+    REQUIRE( "removed sparse ids", sparse.get_size() == 1500 );
+    for (int i = 0; i < 3000; i++) {
+        int pos = sparse.position_of(sparse_ids[i]);
+        REQUIRE( "sparse mapping consistency", (i % 2) ? (sparse.idlist()[pos] == sparse_ids[i]) : (pos == -1) );
+    }
+    REQUIRE( "unknown sparse id", sparse.position_of(100003 + 5001) == -1 );
+
+    // We add dense ids, which take over the sparse ones they cover
+    int dense_ids[] = {10, 5000, 3, 100003 * 2 + 5000};
+    sparse.add_ids(dense_ids, 4);
+    for (int i = 0; i < 4; i++) {
+        REQUIRE( "dense mapping consistency", sparse.position_of(dense_ids[i]) == 1500 + i );
+    }
+    for (int i = 0; i < sparse.get_size(); i++) {
+        REQUIRE( "mapping consistency", sparse.position_of(sparse.idlist()[i]) == i );
+    }
+    int shuffled[] = {sparse.idlist()[5], 123456789, sparse.idlist()[7]};
+    int positions[3];
+    sparse.positions_of(shuffled, 3, positions, 5);
+    REQUIRE( "batch mapping of unordered ids", (positions[0] == 5) && (positions[1] == -1) && (positions[2] == 7) );
 }
 
 
@@ -213,12 +274,682 @@ void test_findmin() {
 }
 
 
-void generate_music(float* out, int length, unsigned int seed = 0) {
+void test_gaussian_statistics() {
+    std::cout << "Testing component \"gaussian_statistics\"..." << std::endl;
+
+    // Estimate some random Gaussians; 40 of them give two full blocks of
+    // jensenshannon_batch() lanes and a partial one
+    const int d = 25;
+    const int count = 40;
+    musly::gaussian_statistics gs(d);
+    std::vector<float> data(count * (d + gs.get_covarelems() + 1));
+    std::vector<gaussian> g(count);
+    srand(42);
+    for (int i = 0; i < count; i++) {
+        float* base = &data[i * (d + gs.get_covarelems() + 1)];
+        g[i].mu = base;
+        g[i].covar = base + d;
+        g[i].covar_inverse = NULL;
+        g[i].covar_logdet = base + d + gs.get_covarelems();
+        Eigen::MatrixXf m = Eigen::MatrixXf::Random(d, 200);
+        m.row(i % d) *= 1.0f + i;
+        REQUIRE( "estimated gaussian", gs.estimate_gaussian(m, g[i]) );
+    }
+
+    // Compare the batched kernel to the scalar reference implementation
+    std::vector<float> tmp_data(d + gs.get_covarelems() + 1);
+    gaussian tmp = {&tmp_data[0], &tmp_data[d], NULL, &tmp_data[d + gs.get_covarelems()]};
+    std::vector<float> jsd(count);
+    gs.jensenshannon_batch(g[3], g.data(), count, jsd.data());
+    REQUIRE( "jensenshannon_batch of identical gaussian", jsd[3] == 0 );
+    for (int i = 0; i < count; i++) {
+        float ref = gs.jensenshannon(g[3], g[i], tmp);
+        REQUIRE( "jensenshannon_batch matches scalar reference", std::abs(jsd[i] - ref) <= 1e-3f * std::max(1.0f, ref) );
+    }
+
+    // Compare the kernel on compactly stored covariances to the float32 one
+    const musly::covar_encoding encodings[2] = {musly::covar_float16, musly::covar_int8};
+    const float tolerances[2] = {2e-3f, 5e-2f};
+    const int elems = gs.get_covarelems();
+    for (int e = 0; e < 2; e++) {
+        const size_t size = musly::covar_encoded_size(encodings[e], elems);
+        REQUIRE( "encoded covariance takes at most half", size <= elems * sizeof(float) / 2 );
+        std::vector<unsigned char> encoded(count * size);
+        std::vector<float> decoded(elems);
+        std::vector<gaussian> ge(g);
+        for (int i = 0; i < count; i++) {
+            musly::encode_covar(encodings[e], g[i].covar, elems, &encoded[i * size]);
+            ge[i].covar = (float*)&encoded[i * size];
+            musly::decode_covar(encodings[e], &encoded[i * size], elems, decoded.data());
+            // halfs are off by half a unit in the last of their 11 bits,
+            // int8 codes by half a step of 1/127 of the standard deviations
+            const float* c = g[i].covar;
+            bool close = true;
+            for (int r = 0, idx = 0, idx_rr = 0; r < d; idx_rr += d - r, r++) {
+                for (int s = r, idx_ss = idx_rr; s < d; idx_ss += d - s, s++, idx++) {
+                    float bound = (e == 0) ? 4.9e-4f * std::abs(c[idx]) + 6.2e-5f
+                            : 4.1e-3f * std::sqrt(c[idx_rr] * c[idx_ss]);
+                    close = close && (std::abs(decoded[idx] - c[idx]) <= bound);
+                }
+            }
+            REQUIRE( "decoded covariance close to original", close );
+        }
+        std::vector<float> jsd_encoded(count);
+        gs.jensenshannon_batch(ge[3], ge.data(), count, jsd_encoded.data(), encodings[e]);
+        REQUIRE( "jensenshannon_batch of identical encoded gaussian", jsd_encoded[3] == 0 );
+        for (int i = 0; i < count; i++) {
+            REQUIRE( "jensenshannon_batch of encoded covariances close to float32", std::abs(jsd_encoded[i] - jsd[i]) <= tolerances[e] * std::max(1.0f, jsd[i]) );
+        }
+    }
+}
+
+void test_realfft() {
+    std::cout << "Testing component \"realfft\"..." << std::endl;
+
+    // the sizes the unrolled FFT is instantiated for
+    const int sizes[] = {1024, 2048};
+    for (int size : sizes) {
+        const int bins = size/2 + 1;
+        musly::realfft* kiss = musly::realfft::create(size, "kissfft");
+        musly::realfft* unrolled = musly::realfft::create(size, "unrolled");
+        REQUIRE( "created kissfft", kiss && (kiss->get_size() == size) );
+        REQUIRE( "created unrolled", unrolled && (unrolled->get_size() == size) );
+        REQUIRE( "unknown backend", musly::realfft::create(size, "none") == NULL );
+
+        // random frames, including a pure tone and silence; 11 frames give a
+        // full batch of lanes and a partial one
+        const int count = 11;
+        std::vector<float> pcm(count * size);
+        srand(42);
+        for (int i = 0; i < (int)pcm.size(); i++) {
+            pcm[i] = 32768.0f * ((float)rand() / RAND_MAX - 0.5f);
+        }
+        for (int j = 0; j < size; j++) {
+            pcm[j] = 1000.0f * std::cos(2 * M_PI * 37 * j / size);
+            pcm[size + j] = 0;
+        }
+        std::vector<const float*> frames(count);
+        for (int f = 0; f < count; f++) {
+            frames[f] = &pcm[f * size];
+        }
+
+        std::vector<float> expected(count * bins);
+        kiss->power(frames.data(), count, expected.data());
+        REQUIRE( "kissfft pure tone", std::abs(expected[37] / std::pow(500.0f * size, 2.0f) - 1) < 1e-4f );
+        REQUIRE( "kissfft silence", expected[bins + 100] == 0 );
+
+        // one frame at a time, and in batches
+        std::vector<float> single(count * bins);
+        std::vector<float> batched(count * bins);
+        for (int f = 0; f < count; f++) {
+            unrolled->power(&frames[f], 1, &single[f * bins]);
+        }
+        unrolled->power(frames.data(), count, batched.data());
+        bool single_close = true;
+        bool batched_close = true;
+        for (int f = 0; f < count; f++) {
+            float peak = *std::max_element(&expected[f * bins], &expected[(f + 1) * bins]);
+            for (int k = 0; k < bins; k++) {
+                float e = expected[f * bins + k];
+                single_close &= std::abs(single[f * bins + k] - e) <= 1e-5f * peak;
+                batched_close &= std::abs(batched[f * bins + k] - e) <= 1e-5f * peak;
+            }
+        }
+        REQUIRE( "unrolled matches kissfft", single_close );
+        REQUIRE( "batched unrolled matches kissfft", batched_close );
+
+        // other sizes fall back to kissfft
+        musly::realfft* other = musly::realfft::create(size + 2, "unrolled");
+        std::vector<float> other_ps((size + 2)/2 + 1);
+        other->power(&frames[0], 1, other_ps.data());
+        REQUIRE( "fallback size", other->get_size() == size + 2 );
+        REQUIRE( "fallback pure tone", other_ps[0] > 0 );
+
+        delete other;
+        delete unrolled;
+        delete kiss;
+    }
+}
+
+void test_mutualproximity() {
+    std::cout << "Testing component \"mutualproximity\"..." << std::endl;
+    const int count = 1000;
+    musly::mutualproximity mp(NULL);
+    mp.append_normfacts(count);
+    srand(5);
+    for (int i = 0; i < count; i++) {
+        mp.set_normfacts(i, 1 + rand() / (float)RAND_MAX, 0.05f + rand() / (float)RAND_MAX);
+    }
+
+    // We compare the normalized similarities to a double precision reference
+    std::vector<int> positions(count);
+    std::vector<float> raw(count);
+    for (int i = 0; i < count; i++) {
+        positions[i] = (i * 7) % count;
+        raw[i] = 4.0f * rand() / RAND_MAX - 0.5f;
+    }
+    raw[3] = NAN;
+    std::vector<float> sim(raw);
+    REQUIRE( "normalized", mp.normalize(0, &positions[0], count, &sim[0]) == 0 );
+    float seed_mu, seed_std;
+    mp.get_normfacts(0, &seed_mu, &seed_std);
+    float largest_error = 0;
+    for (int i = 0; i < count; i++) {
+        if ((positions[i] == 0) || (i == 3)) {
+            continue;
+        }
+        float mu, std;
+        mp.get_normfacts(positions[i], &mu, &std);
+        double p1 = 0.5 * std::erfc((raw[i] - seed_mu) / seed_std / std::sqrt(2.0));
+        double p2 = 0.5 * std::erfc((raw[i] - mu) / std / std::sqrt(2.0));
+        largest_error = std::max(largest_error, (float)std::abs(sim[i] - (1 - p1 * p2)));
+    }
+    REQUIRE( "normalized within 4e-7", largest_error <= 4e-7f );
+    REQUIRE( "seed normalized to 0", sim[0] == 0 );
+    REQUIRE( "NaN stays NaN", std::isnan(sim[3]) );
+    REQUIRE( "rejected invalid position", mp.normalize(count, &positions[0], count, &sim[0]) == -1 );
+
+    // We normalize consecutive positions, and collect the top 10 instead
+    for (int i = 0; i < count; i++) {
+        positions[i] = i;
+    }
+    std::vector<float> sim2(raw);
+    sim = raw;
+    mp.normalize(5, &positions[0], count, &sim[0]);
+    REQUIRE( "normalized range", mp.normalize_range(5, 0, count, &sim2[0]) == 0 );
+    REQUIRE( "rejected invalid range", mp.normalize_range(5, 1, count, &sim2[0]) == -1 );
+    std::vector<musly::mutualproximity::neighbor> heap;
+    REQUIRE( "collected top 10", mp.normalize_topk(5, &positions[0], &positions[0], count, &raw[0], heap, 10) == 0 );
+    std::sort_heap(heap.begin(), heap.end(), musly::mutualproximity::neighbor_less);
+    std::vector<std::pair<float, int> > ranked;
+    for (int i = 0; i < count; i++) {
+        REQUIRE( "consistent range", (sim[i] == sim2[i]) || (std::isnan(sim[i]) && std::isnan(sim2[i])) );
+        if (!std::isnan(sim[i])) {
+            ranked.push_back(std::make_pair(sim[i], i));
+        }
+    }
+    std::partial_sort(ranked.begin(), ranked.begin() + 10, ranked.end());
+    REQUIRE( "found top 10", heap.size() == 10 );
+    for (int i = 0; i < (int)heap.size(); i++) {
+        REQUIRE( "consistent top 10", heap[i].first == ranked[i].first );
+    }
+}
+
+
+/** Euclidean distances between random points in the plane */
+class point_metric : public musly::track_metric {
+public:
+    std::vector<float> x;
+    std::vector<float> y;
+
+    void distances(musly_trackid from, const musly_trackid* to, int length, float* d) {
+        for (int i = 0; i < length; i++) {
+            d[i] = std::sqrt((x[from] - x[to[i]]) * (x[from] - x[to[i]]) + (y[from] - y[to[i]]) * (y[from] - y[to[i]]));
+        }
+    }
+};
+
+void test_hnsw() {
+    std::cout << "Testing component \"hnsw\"..." << std::endl;
+
+    const int count = 600;
+    point_metric metric;
+    srand(7);
+    for (int i = 0; i < count; i++) {
+        metric.x.push_back(rand() / (float)RAND_MAX);
+        metric.y.push_back(rand() / (float)RAND_MAX);
+    }
+
+    musly::hnsw index(&metric);
+    REQUIRE( "initially empty", index.get_size() == 0 );
+    REQUIRE( "set m", index.set_m(8) == 0 );
+    for (int i = 0; i < count; i++) {
+        index.insert(i);
+    }
+    index.insert(5);
+    REQUIRE( "inserted all", index.get_size() == count );
+    REQUIRE( "cannot change m of filled index", index.set_m(16) == -1 );
+
+    // We remove every third point
+    std::vector<musly_trackid> removed;
+    for (int i = 0; i < count; i += 3) {
+        removed.push_back(i);
+    }
+    index.remove(&removed[0], removed.size());
+    REQUIRE( "removed some", index.get_size() == count - (int)removed.size() );
+    REQUIRE( "removed point not contained", !index.contains(3) );
+    REQUIRE( "remaining point contained", index.contains(4) );
+
+    // We compare the results for 50 queries to a brute force search
+    int hits = 0;
+    int total = 0;
+    for (int q = 1; q < 150; q += 3) {
+        musly_trackid found[10];
+        REQUIRE( "found 10 neighbors", index.search(q, 10, found) == 10 );
+        std::vector<std::pair<float, int> > ranked;
+        for (int i = 0; i < count; i++) {
+            if ((i % 3 != 0) && (i != q)) {
+                float d;
+                metric.distances(q, &i, 1, &d);
+                ranked.push_back(std::make_pair(d, i));
+            }
+        }
+        std::partial_sort(ranked.begin(), ranked.begin() + 10, ranked.end());
+        for (int i = 0; i < 10; i++) {
+            REQUIRE( "found only remaining points", (found[i] % 3 != 0) && (found[i] != q) );
+            for (int j = 0; j < 10; j++) {
+                if (found[i] == ranked[j].second) {
+                    hits++;
+                }
+            }
+            total++;
+        }
+    }
+    REQUIRE( "recall of at least 95%", hits >= 0.95 * total );
+
+    // We serialize and restore the index
+    std::vector<unsigned char> buffer(index.serialize(NULL));
+    REQUIRE( "serialized index", index.serialize(&buffer[0]) == (int)buffer.size() );
+    musly::hnsw index2(&metric);
+    REQUIRE( "deserialized index", index2.deserialize(&buffer[0], buffer.size()) == (int)buffer.size() );
+    REQUIRE( "restored size", index2.get_size() == index.get_size() );
+    REQUIRE( "restored m", index2.get_m() == 8 );
+    for (int q = 2; q < 100; q += 3) {
+        musly_trackid found[10];
+        musly_trackid found2[10];
+        index.search(q, 10, found);
+        index2.search(q, 10, found2);
+        REQUIRE( "consistent results of restored index", std::equal(found, found + 10, found2) );
+    }
+    bool truncated_refused = true;
+    for (int size = 0; size < (int)buffer.size(); size += 7) {
+        musly::hnsw index3(&metric);
+        truncated_refused &= (index3.deserialize(&buffer[0], size) == -1);
+    }
+    REQUIRE( "refused truncated index", truncated_refused );
+
+    // A damaged graph is refused rather than searched out of bounds. The
+    // graph below has track 10 on two levels, linked to track 11 on the
+    // bottom level, and track 11 on the bottom level only.
+    const int graph[] = {2, 64, 64, 2, 0,  10, 2, 1, 1, 0,  11, 1, 1, 0};
+    const int graph_size = sizeof(graph);
+    std::vector<int> damaged(graph, graph + graph_size / sizeof(int));
+    musly::hnsw index4(&metric);
+    REQUIRE( "deserialized small index", index4.deserialize((const unsigned char*)graph, graph_size) == graph_size );
+    damaged[0] = 1;
+    REQUIRE( "refused m of 1", index4.deserialize((const unsigned char*)damaged.data(), graph_size) == -1 );
+    damaged[0] = 2;
+    damaged[4] = -1;
+    REQUIRE( "refused missing entry point", index4.deserialize((const unsigned char*)damaged.data(), graph_size) == -1 );
+    damaged[4] = 0;
+    damaged[10] = 10;
+    REQUIRE( "refused duplicate track", index4.deserialize((const unsigned char*)damaged.data(), graph_size) == -1 );
+    damaged[10] = 11;
+    damaged[7] = 0;
+    damaged[9] = 1;
+    damaged[8] = 1;
+    REQUIRE( "refused link to a node without the level", index4.deserialize((const unsigned char*)damaged.data(), graph_size) == -1 );
+}
+
+
+void test_vptree() {
+    std::cout << "Testing component \"vptree\"..." << std::endl;
+    const int count = 2000;
+    point_metric metric;
+    srand(11);
+    std::vector<musly_trackid> ids;
+    for (int i = 0; i < count; i++) {
+        metric.x.push_back(rand() / (float)RAND_MAX);
+        metric.y.push_back(rand() / (float)RAND_MAX);
+        ids.push_back(i);
+    }
+
+    // We keep a few points out of the tree
+    musly::vptree tree(&metric);
+    tree.build(&ids[10], count - 10, &ids[0], 10);
+    REQUIRE( "built tree", tree.get_size() == count );
+    REQUIRE( "kept points outside", tree.get_unindexed() == 10 );
+
+    // We compare the results for 50 queries to a brute force search
+    struct collector : public musly::vptree_visitor {
+        musly_trackid query;
+        std::vector<std::pair<float, int> > heap;
+        bool accepts(musly_trackid id) { return id != query; }
+        float radius() { return (heap.size() < 10) ? FLT_MAX : heap.front().first; }
+        void visit(const musly_trackid* ids, const float* d, int length) {
+            for (int i = 0; i < length; i++) {
+                heap.push_back(std::make_pair(d[i], ids[i]));
+                std::push_heap(heap.begin(), heap.end());
+                if (heap.size() > 10) {
+                    std::pop_heap(heap.begin(), heap.end());
+                    heap.pop_back();
+                }
+            }
+        }
+    };
+    int evaluated = 0;
+    for (int q = 0; q < count; q += 40) {
+        collector c;
+        c.query = q;
+        evaluated += tree.search(q, c);
+        std::sort_heap(c.heap.begin(), c.heap.end());
+        std::vector<std::pair<float, int> > ranked;
+        for (int i = 0; i < count; i++) {
+            if (i != q) {
+                float d;
+                metric.distances(q, &i, 1, &d);
+                ranked.push_back(std::make_pair(d, i));
+            }
+        }
+        std::partial_sort(ranked.begin(), ranked.begin() + 10, ranked.end());
+        REQUIRE( "found 10 neighbors", c.heap.size() == 10 );
+        for (int i = 0; i < 10; i++) {
+            REQUIRE( "found exact neighbors", c.heap[i] == ranked[i] );
+        }
+    }
+    REQUIRE( "skipped most distances", evaluated < 50 * count / 4 );
+}
+
+void test_pivottable() {
+    std::cout << "Testing component \"pivottable\"..." << std::endl;
+    const int count = 500;
+    const int num_pivots = 8;
+    point_metric metric;
+    srand(13);
+    for (int i = 0; i < count; i++) {
+        metric.x.push_back(rand() / (float)RAND_MAX);
+        metric.y.push_back(rand() / (float)RAND_MAX);
+    }
+
+    // We quantize the distances of all points to the first few
+    musly::pivottable table;
+    table.reset(num_pivots, 1.5f / musly::pivottable::levels);
+    table.resize(count);
+    REQUIRE( "resized table", table.get_size() == count );
+    std::vector<musly_trackid> pivots;
+    for (int p = 0; p < num_pivots; p++) {
+        pivots.push_back(p);
+    }
+    for (int i = 0; i < count; i++) {
+        float d[num_pivots];
+        metric.distances(i, &pivots[0], num_pivots, d);
+        table.set_row(i, d);
+    }
+    float invalid[num_pivots] = {0, 0, -1, 0, 0, 0, 0, 0};
+    table.set_row(count - 1, invalid);
+
+    // We compare the bounds to the true distances
+    int sound = 0;
+    int useful = 0;
+    int total = 0;
+    for (int i = 0; i < count - 1; i++) {
+        for (int j = i + 1; j < count - 1; j += 7) {
+            float d;
+            metric.distances(i, &j, 1, &d);
+            float bound = table.lower_bound(i, j);
+            sound += (bound <= d + 1e-6f);
+            useful += (bound > 0.5f * d);
+            total++;
+        }
+    }
+    REQUIRE( "bounds below distances", sound == total );
+    REQUIRE( "bounds mostly tight", useful > total / 2 );
+    REQUIRE( "invalid distances bound nothing", table.lower_bound(0, count - 1) == 0 );
+
+    // We swap rows and shrink the table
+    float bound = table.lower_bound(1, 2);
+    table.swap_rows(2, count - 1);
+    REQUIRE( "swapped rows", table.lower_bound(1, count - 1) == bound );
+    REQUIRE( "swapped invalid row", table.lower_bound(1, 2) == 0 );
+    table.resize(count - 1);
+    table.resize(count);
+    REQUIRE( "new rows bound nothing", table.lower_bound(1, count - 1) == 0 );
+}
+
+std::vector<float> resample(const musly::resampler& r, const std::vector<float>& in,
+        int64_t first, int count) {
+    int64_t begin, end;
+    r.input_range(first, count, begin, end);
+    std::vector<float> padded(end - begin, 0.0f);
+    for (int64_t i = std::max(begin, (int64_t)0); i < std::min(end, (int64_t)in.size()); i++) {
+        padded[i - begin] = in[i];
+    }
+    std::vector<float> out(count);
+    r.process(padded.data(), first, count, out.data());
+    return out;
+}
+
+void test_resampler() {
+    std::cout << "Testing resampler..." << std::endl;
+    // exact rational ratios, an upsampling one, and one with too many
+    // phases that is approximated
+    const int rates[] = {44100, 48000, 16000, 22050, 44056};
+    for (int r = 0; r < 5; r++) {
+        const int rate = rates[r];
+        musly::resampler resampler(rate, 22050);
+        std::vector<float> tone(rate);
+        std::vector<float> high(rate);
+        for (int i = 0; i < rate; i++) {
+            tone[i] = 0.5f * std::sin(2*M_PI * 1000 * i / rate);
+            high[i] = 0.5f * std::sin(2*M_PI * 15000 * i / rate);
+        }
+        const int64_t length = resampler.output_length(rate);
+        REQUIRE( "resampled length", std::abs(length - 22050) <= 1 );
+
+        // a tone in the passband is kept
+        std::vector<float> out = resample(resampler, tone, 0, length);
+        float error = 0;
+        for (int i = 100; i < length - 100; i++) {
+            error = std::max(error, std::abs(out[i] - 0.5f * (float)std::sin(2*M_PI * 1000 * i / 22050.0)));
+        }
+        REQUIRE( "resampled tone", error < 2e-3f );
+
+        // blocks give the same samples as the whole signal
+        std::vector<float> part = resample(resampler, tone, 777, 5000);
+        REQUIRE( "resampled block", std::equal(part.begin(), part.end(), out.begin() + 777) );
+
+        // so does a longer filter
+        musly::resampler longer(rate, 22050, 48);
+        out = resample(longer, tone, 0, length);
+        float longer_error = 0;
+        for (int i = 100; i < length - 100; i++) {
+            longer_error = std::max(longer_error, std::abs(out[i] - 0.5f * (float)std::sin(2*M_PI * 1000 * i / 22050.0)));
+        }
+        REQUIRE( "resampled tone with longer filter", longer_error < 2e-3f );
+
+        // a tone above the output Nyquist frequency is removed
+        if (rate > 30000) {
+            out = resample(resampler, high, 0, length);
+            float peak = 0;
+            for (int i = 100; i < length - 100; i++) {
+                peak = std::max(peak, std::abs(out[i]));
+            }
+            REQUIRE( "removed alias", peak < 1e-3f );
+        }
+    }
+}
+
+void test_threadpool() {
+    std::cout << "Testing threadpool..." << std::endl;
+    musly::threadpool& pool = musly::threadpool::get();
+    REQUIRE( "rejected negative thread count", pool.set_threads(-1) == -1 );
+    REQUIRE( "set thread count", pool.set_threads(4) == 0 );
+    REQUIRE( "got thread count", pool.get_threads() == 4 );
+
+    // every task runs exactly once, on a valid worker, also when the tasks
+    // take very different times and steal from each other
+    const int num_tasks = 1000;
+    std::vector<std::atomic<int> > runs(num_tasks);
+    std::atomic<int> bad_worker(0);
+    for (int i = 0; i < num_tasks; i++) {
+        runs[i] = 0;
+    }
+    pool.run(num_tasks, [&](int i, int worker) {
+        if ((worker < 0) || (worker >= 4)) {
+            bad_worker++;
+        }
+        if (i < 10) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        runs[i]++;
+    });
+    bool once = true;
+    for (int i = 0; i < num_tasks; i++) {
+        once = once && (runs[i] == 1);
+    }
+    REQUIRE( "ran each task once", once );
+    REQUIRE( "ran tasks on valid workers", bad_worker == 0 );
+
+    // nested jobs run on the calling worker
+    std::atomic<int> nested(0);
+    musly::parallel_for(8, [&](int) {
+        musly::parallel_for(8, [&](int) {
+            nested++;
+        });
+    });
+    REQUIRE( "ran nested tasks", nested == 64 );
+
+    // workers stay below the bound of the job, also while another thread
+    // changes the number of threads
+    std::atomic<bool> resizing(true);
+    std::thread resizer([&]() {
+        for (int i = 0; resizing; i++) {
+            pool.set_threads((i % 2) ? 2 : 8);
+        }
+    });
+    for (int job = 0; job < 200; job++) {
+        const int max_workers = 1 + job % 4;
+        pool.run(64, [&](int, int worker) {
+            if ((worker < 0) || (worker >= max_workers)) {
+                bad_worker++;
+            }
+        }, max_workers);
+    }
+    resizing = false;
+    resizer.join();
+    REQUIRE( "ran tasks below the worker bound", bad_worker == 0 );
+
+    REQUIRE( "reset thread count", pool.set_threads(0) == 0 );
+}
+
+void test_collection_file() {
+    std::cout << "Testing collection_file..." << std::endl;
+    const std::string path = (std::filesystem::temp_directory_path() /
+            "musly-selftest-collection.mcf").string();
+    const int dim = 6;
+    std::vector<float> tracks(5 * dim);
+    for (int i = 0; i < (int)tracks.size(); i++) {
+        tracks[i] = 0.5f * i;
+    }
+    const char* files[] = {"a.mp3", "b/b.mp3", "c.ogg", "d.wav", "e.flac"};
+
+    // a new collection is written in version 1, the tracks as they are
+    {
+        collection_file cf(path);
+        REQUIRE( "created collection", cf.open("wb") );
+        REQUIRE( "wrote header", cf.write_header("timbre", dim * sizeof(float)) );
+    }
+    {
+        collection_file cf(path);
+        REQUIRE( "opened collection", cf.open("r+b") );
+        REQUIRE( "read header", cf.read_header() );
+        REQUIRE( "version 1", cf.get_version() == 1 );
+        REQUIRE( "method", cf.get_method() == "timbre" );
+        REQUIRE( "no tracks", cf.get_track_count() == 0 );
+        for (int i = 0; i < 3; i++) {
+            REQUIRE( "appended track", cf.append_track(files[i], (const unsigned char*)&tracks[i * dim], dim * sizeof(float)) );
+        }
+        REQUIRE( "refused track of wrong size", !cf.append_track("x.mp3", (const unsigned char*)&tracks[0], sizeof(float)) );
+        REQUIRE( "contains appended track", cf.contains_track("b/b.mp3") );
+        REQUIRE( "wrote tracks", cf.flush() );
+        REQUIRE( "3 tracks after flush", cf.get_track_count() == 3 );
+    }
+
+    // a flush cut short after copying the index beyond the end of the new
+    // tracks, and after writing some of them, still leaves the old tracks
+    {
+        std::vector<unsigned char> file(std::filesystem::file_size(path));
+        FILE* f = fopen(path.c_str(), "rb");
+        REQUIRE( "read collection", fread(file.data(), 1, file.size(), f) == file.size() );
+        fclose(f);
+        uint64_t paths_offset;
+        std::memcpy(&paths_offset, &file[file.size() - 24], sizeof(uint64_t));
+        const uint64_t copy_offset = file.size() + 3 * dim * sizeof(float);
+        std::vector<unsigned char> index(file.begin() + paths_offset, file.end());
+        for (int field = 24; field > 0; field -= 16) {
+            uint64_t offset;
+            std::memcpy(&offset, &index[index.size() - field], sizeof(uint64_t));
+            offset += copy_offset - paths_offset;
+            std::memcpy(&index[index.size() - field], &offset, sizeof(uint64_t));
+        }
+        file.resize(copy_offset);
+        std::memcpy(&file[paths_offset], &tracks[3 * dim], dim * sizeof(float));
+        file.insert(file.end(), index.begin(), index.end());
+        f = fopen(path.c_str(), "wb");
+        REQUIRE( "wrote interrupted collection", fwrite(file.data(), 1, file.size(), f) == file.size() );
+        fclose(f);
+        collection_file cf(path);
+        REQUIRE( "read interrupted collection", cf.open("r+b") && cf.read_header() );
+        REQUIRE( "3 tracks after interrupted flush", cf.get_track_count() == 3 );
+        REQUIRE( "file names after interrupted flush", (std::string(cf.get_track_file(2)) == files[2]) && !cf.contains_track("d.wav") );
+    }
+
+    // appending to it rewrites the names and the index after the tracks
+    {
+        collection_file cf(path);
+        REQUIRE( "opened collection", cf.open("r+b") && cf.read_header() );
+        REQUIRE( "3 tracks", cf.get_track_count() == 3 );
+        REQUIRE( "contains track", cf.contains_track("c.ogg") && !cf.contains_track("d.wav") );
+        for (int i = 3; i < 5; i++) {
+            REQUIRE( "appended track", cf.append_track(files[i], (const unsigned char*)&tracks[i * dim], dim * sizeof(float)) );
+        }
+    }
+    {
+        collection_file cf(path);
+        REQUIRE( "opened collection", cf.open("r+b") && cf.read_header() );
+        REQUIRE( "5 tracks", cf.get_track_count() == 5 );
+        REQUIRE( "cut off copy of the index", std::filesystem::file_size(path) == 64 + 5 * dim * sizeof(float) + 33 + 5 * sizeof(uint64_t) + 64 );
+        REQUIRE( "track size", cf.get_track_size() == dim * (int)sizeof(float) );
+        for (int i = 0; i < 5; i++) {
+            REQUIRE( "file name", std::string(cf.get_track_file(i)) == files[i] );
+            REQUIRE( "track in place", std::equal(cf.get_track(i), cf.get_track(i) + dim, &tracks[i * dim]) );
+            REQUIRE( "aligned track", ((uintptr_t)cf.get_track(i) % sizeof(float)) == 0 );
+        }
+    }
+
+    // a truncated collection is refused
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 8);
+    {
+        collection_file cf(path);
+        REQUIRE( "refused truncated collection", cf.open("r+b") && !cf.read_header() );
+    }
+
+    // collections of version 0 are still read record by record
+    {
+        FILE* f = fopen(path.c_str(), "wb");
+        fwritestr(f, "MUSLY-0-timbre");
+        fwritestr(f, files[0]);
+        uint32_t size = 4;
+        fwrite(&size, sizeof(size), 1, f);
+        fwrite("abcd", 1, 4, f);
+        fclose(f);
+        collection_file cf(path);
+        unsigned char buffer[8];
+        std::string file;
+        REQUIRE( "read version 0 header", cf.open("r+b") && cf.read_header() );
+        REQUIRE( "version 0", cf.get_version() == 0 );
+        REQUIRE( "read version 0 track", cf.read_track(buffer, sizeof(buffer), file) == 4 );
+        REQUIRE( "version 0 track", (file == files[0]) && (std::memcmp(buffer, "abcd", 4) == 0) );
+        REQUIRE( "end of version 0 tracks", cf.read_track(buffer, sizeof(buffer), file) == -1 );
+    }
+    std::filesystem::remove(path);
+}
+
+void generate_music(float* out, int length, unsigned int seed = 0, float sample_rate = 22050.0f) {
     if (!seed) {
         seed = time(NULL);
     }
     srand(seed);
-    const float sample_rate = 22050.0f;
     // Create a signal by adding up some sine waves
     std::fill(out, &out[length], 0.0f);
     for (int i = 5 + rand() % 20; i >= 0; i--) {
@@ -248,6 +979,80 @@ void generate_music(float* out, int length, unsigned int seed = 0) {
 }
 
 
+/** Collects the rows passed by musly_jukebox_similarity_allpairs() */
+struct upper_triangle {
+    int num_tracks;
+    std::vector<std::vector<float> > rows;
+};
+
+int collect_upper_triangle(void* user_data, int first_row, int num_rows, const float* similarities) {
+    upper_triangle* triangle = (upper_triangle*) user_data;
+    if ((int)triangle->rows.size() != first_row) {
+        return 1;  // out of order
+    }
+    for (int i = first_row; i < first_row + num_rows; i++) {
+        int length = triangle->num_tracks - 1 - i;
+        triangle->rows.push_back(std::vector<float>(similarities, similarities + length));
+        similarities += length;
+    }
+    return 0;
+}
+
+int abort_upper_triangle(void* user_data, int first_row, int num_rows, const float* similarities) {
+    return 1;
+}
+
+/** Analyzes the given signal chunk by chunk, in chunks of growing sizes */
+int analyze_in_chunks(musly_analyzer* analyzer, const std::vector<float>& pcm, int length, float peak, musly_track* track) {
+    if (musly_analyzer_begin(analyzer, length, peak) != 0) {
+        return -1;
+    }
+    size_t pos = 0;
+    for (int chunk = 1; pos < pcm.size(); chunk = 3*chunk + 7) {
+        int count = std::min((size_t)chunk, pcm.size() - pos);
+        if (musly_analyzer_feed(analyzer, &pcm[pos], count) != 0) {
+            return -1;
+        }
+        pos += count;
+    }
+    return musly_analyzer_finish(analyzer, track);
+}
+
+/** Checks whether two tracks agree up to a relative tolerance */
+bool tracks_close(musly_jukebox* box, const musly_track* a, const musly_track* b, float tolerance) {
+    for (int i = 0; i < musly_track_size(box) / (int)sizeof(float); i++) {
+        if (!(std::abs(a[i] - b[i]) <= tolerance * (1 + std::abs(b[i])))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct audiofile_results {
+    std::vector<int> calls;
+    std::vector<unsigned char> expected;
+    bool same;
+};
+
+int collect_audiofile(void* user_data, int index, int result,
+        const musly_track*, const unsigned char* bin) {
+    audiofile_results* results = static_cast<audiofile_results*>(user_data);
+    results->calls[index]++;
+    bool missing = (index == 1);
+    if (missing != (result != 0)) {
+        results->same = false;
+    } else if (!missing) {
+        results->same = results->same && (std::memcmp(bin,
+                results->expected.data(), results->expected.size()) == 0);
+    }
+    return 0;
+}
+
+int abort_audiofile(void*, int, int, const musly_track*,
+        const unsigned char*) {
+    return 1;
+}
+
 void test_method(std::string method) {
     std::cout << "Testing method \"" << method << "\"..." << std::endl;
     musly_jukebox* box = musly_jukebox_poweron(method.c_str(), NULL);
@@ -274,6 +1079,20 @@ void test_method(std::string method) {
 
     // First, we create a jukebox
     REQUIRE( "initially empty", musly_jukebox_trackcount(box) == 0 );
+    REQUIRE( "unknown option", musly_jukebox_getoption(box, "no.such.option") == -1 );
+    REQUIRE( "cannot set unknown option", musly_jukebox_setoption(box, "no.such.option", 1) == -1 );
+    int index_m = musly_jukebox_getoption(box, "hnsw.m");
+    if (index_m > 0) {
+        REQUIRE( "set index option", musly_jukebox_setoption(box, "hnsw.ef_search", 80) == 0 );
+        REQUIRE( "got index option", musly_jukebox_getoption(box, "hnsw.ef_search") == 80 );
+        REQUIRE( "rejected invalid index option", musly_jukebox_setoption(box, "hnsw.ef_search", 0) == -1 );
+    }
+    bool pivots = (musly_jukebox_getoption(box, "pivots.count") >= 0);
+    if (pivots) {
+        REQUIRE( "rejected invalid pivot count", musly_jukebox_setoption(box, "pivots.count", -1) == -1 );
+        REQUIRE( "set pivot count", musly_jukebox_setoption(box, "pivots.count", 16) == 0 );
+        REQUIRE( "got pivot count", musly_jukebox_getoption(box, "pivots.count") == 16 );
+    }
 
     // We generate some tracks to play with
     float* song = new float[22050 * 30];
@@ -283,12 +1102,185 @@ void test_method(std::string method) {
     }
     delete[] song;
 
+    // Analyzers running in parallel compute the same features, also when
+    // reused for several songs
+    {
+        const int num_threads = 4;
+        const int num_songs = 8;
+        std::vector<std::vector<float> > songs(num_songs,
+                std::vector<float>(22050 * 30));
+        std::vector<musly_track*> parallel_tracks(num_songs);
+        std::vector<int> results(num_songs, -1);
+        for (int i = 0; i < num_songs; i++) {
+            generate_music(songs[i].data(), 22050 * 30, 42*i + 1);
+            parallel_tracks[i] = musly_track_alloc(box);
+        }
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; t++) {
+            threads.push_back(std::thread([&, t]() {
+                musly_analyzer* analyzer = musly_analyzer_create(box);
+                for (int i = t; i < num_songs; i += num_threads) {
+                    results[i] = musly_analyzer_analyze_pcm(analyzer,
+                            songs[i].data(), songs[i].size(), parallel_tracks[i]);
+                }
+                musly_analyzer_free(analyzer);
+            }));
+        }
+        for (int t = 0; t < num_threads; t++) {
+            threads[t].join();
+        }
+        for (int i = 0; i < num_songs; i++) {
+            REQUIRE( "analyzed song in parallel", results[i] == 0 );
+            REQUIRE( "same features in parallel", std::memcmp(parallel_tracks[i], tracks[i], musly_track_size(box)) == 0 );
+            musly_track_free(parallel_tracks[i]);
+        }
+        REQUIRE( "no analyzer without jukebox", musly_analyzer_create(NULL) == NULL );
+    }
+
+    // Batch analysis on the thread pool computes the same features, and
+    // reports the signals it cannot analyze
+    {
+        const int num_songs = 10;
+        std::vector<std::vector<float> > songs(num_songs,
+                std::vector<float>(22050 * 30));
+        std::vector<float*> pcm(num_songs);
+        std::vector<int> lengths(num_songs);
+        std::vector<musly_track*> batch_tracks(num_songs);
+        for (int i = 0; i < num_songs; i++) {
+            generate_music(songs[i].data(), 22050 * 30, 42*i + 1);
+            pcm[i] = songs[i].data();
+            lengths[i] = songs[i].size();
+            batch_tracks[i] = musly_track_alloc(box);
+        }
+        pcm[3] = NULL;
+        lengths[7] = 100;
+        REQUIRE( "rejected negative thread count", musly_set_threads(-1) == -1 );
+        REQUIRE( "rejected negative batch size", musly_track_analyze_pcm_batch(box, pcm.data(), lengths.data(), batch_tracks.data(), -1, NULL) == -1 );
+        for (int threads = 3; threads >= 1; threads -= 2) {
+            std::vector<int> results(num_songs, -2);
+            REQUIRE( "set thread count", musly_set_threads(threads) == 0 );
+            REQUIRE( "analyzed batch", musly_track_analyze_pcm_batch(box, pcm.data(), lengths.data(), batch_tracks.data(), num_songs, results.data()) == 2 );
+            REQUIRE( "failed missing signal", results[3] == -1 );
+            REQUIRE( "failed short signal", results[7] != 0 );
+            bool same = true;
+            for (int i = 0; i < num_songs; i++) {
+                if ((i != 3) && (i != 7)) {
+                    same = same && (results[i] == 0) &&
+                            (std::memcmp(batch_tracks[i], tracks[i], musly_track_size(box)) == 0);
+                }
+            }
+            REQUIRE( "same features in batch", same );
+        }
+        REQUIRE( "reset thread count", musly_set_threads(0) == 0 );
+        const char* files[] = {"no-such-file.mp3"};
+        REQUIRE( "rejected missing buffer", musly_track_analyze_audiobuffer(box, NULL, 100, 30, 0, tracks[0]) == -1 );
+        REQUIRE( "rejected missing sink", musly_track_analyze_audiofiles(box, files, 1, 30, 0, 0, 0, 0, NULL, NULL) == -1 );
+        REQUIRE( "rejected negative file count", musly_track_analyze_audiofiles(box, files, -1, 30, 0, 0, 0, 0, abort_audiofile, NULL) == -1 );
+        REQUIRE( "rejected negative thread count for files", musly_track_analyze_audiofiles(box, files, 1, 30, 0, -1, 0, 0, abort_audiofile, NULL) == -1 );
+        for (int i = 0; i < num_songs; i++) {
+            musly_track_free(batch_tracks[i]);
+        }
+    }
+
+    // Analyzing a song chunk by chunk gives the same features as analyzing
+    // it at once, up to rounding, with or without knowing its peak. (The
+    // moments are accumulated differently, which shows most in inverse
+    // covariances and log-determinants of nearly singular covariances, so
+    // the tolerance is generous; a misaligned or misscaled signal is off by
+    // far more.)
+    {
+        musly_analyzer* analyzer = musly_analyzer_create(box);
+        musly_track* whole = musly_track_alloc(box);
+        musly_track* streamed = musly_track_alloc(box);
+        std::vector<float> pcm(22050 * 30);
+        generate_music(pcm.data(), pcm.size(), 1);
+        REQUIRE( "cannot feed before begin", musly_analyzer_feed(analyzer, pcm.data(), 100) == -1 );
+        REQUIRE( "cannot finish before begin", musly_analyzer_finish(analyzer, streamed) == -1 );
+        REQUIRE( "rejected negative length", musly_analyzer_begin(analyzer, -1, 0) == -1 );
+        REQUIRE( "streamed song with known peak", analyze_in_chunks(analyzer, pcm, pcm.size(), 1.0f, streamed) == 0 );
+        REQUIRE( "same features when streamed", tracks_close(box, streamed, tracks[0], 2e-2f) );
+        REQUIRE( "streamed song with unknown length and peak", analyze_in_chunks(analyzer, pcm, 0, 0, streamed) == 0 );
+        REQUIRE( "same features when streamed blindly", tracks_close(box, streamed, tracks[0], 2e-2f) );
+
+        for (int i = 0; i < (int)pcm.size(); i++) {
+            pcm[i] *= 0.05f;
+        }
+        REQUIRE( "analyzed quiet song", musly_analyzer_analyze_pcm(analyzer, pcm.data(), pcm.size(), whole) == 0 );
+        REQUIRE( "streamed quiet song", analyze_in_chunks(analyzer, pcm, pcm.size(), 0, streamed) == 0 );
+        REQUIRE( "same features for quiet song", tracks_close(box, streamed, whole, 2e-2f) );
+
+        // only the central part of a long song is analyzed
+        std::vector<float> long_pcm;
+        for (int i = 0; i < 3; i++) {
+            long_pcm.insert(long_pcm.end(), pcm.begin(), pcm.end());
+        }
+        long_pcm[22050 * 20] = 0.9f;
+        REQUIRE( "analyzed long song", musly_analyzer_analyze_pcm(analyzer, long_pcm.data(), long_pcm.size(), whole) == 0 );
+        REQUIRE( "streamed long song", analyze_in_chunks(analyzer, long_pcm, long_pcm.size(), 0, streamed) == 0 );
+        REQUIRE( "same features for long song", tracks_close(box, streamed, whole, 2e-2f) );
+
+        pcm.resize(1000);
+        REQUIRE( "too short to stream", analyze_in_chunks(analyzer, pcm, 0, 0, streamed) > 0 );
+        musly_track_free(whole);
+        musly_track_free(streamed);
+        musly_analyzer_free(analyzer);
+    }
+
+    // We serialize tracks one by one and as a batch, to the same bytes
+    {
+        const int binsize = musly_track_binsize(box);
+        const int tracksize = musly_track_size(box);
+        std::vector<unsigned char> single(10 * binsize);
+        std::vector<unsigned char> batch(10 * binsize);
+        std::vector<unsigned char> native(10 * binsize);
+        for (int i = 0; i < 10; i++) {
+            musly_track_tobin(box, tracks[i], &single[i * binsize]);
+        }
+        REQUIRE( "serialized batch", musly_tracks_tobin_batch(box, tracks, 10, batch.data(), 0) == 10 );
+        REQUIRE( "batch equals single tracks", single == batch );
+        REQUIRE( "serialized native batch", musly_tracks_tobin_batch(box, tracks, 10, native.data(), 1) == 10 );
+        bool same = true;
+        for (int i = 0; i < 10; i++) {
+            same = same && (std::memcmp(&native[i * binsize], tracks[i], tracksize) == 0);
+        }
+        REQUIRE( "native batch is a copy", same );
+
+        musly_track* copies[10];
+        for (int i = 0; i < 10; i++) {
+            copies[i] = musly_track_alloc(box);
+        }
+        REQUIRE( "deserialized batch", musly_tracks_frombin_batch(box, batch.data(), 10, copies, 0) == 10 );
+        same = true;
+        for (int i = 0; i < 10; i++) {
+            same = same && (std::memcmp(copies[i], tracks[i], tracksize) == 0);
+        }
+        REQUIRE( "deserialized batch equals tracks", same );
+        REQUIRE( "deserialized native batch", musly_tracks_frombin_batch(box, native.data(), 10, copies, 1) == 10 );
+        same = true;
+        for (int i = 0; i < 10; i++) {
+            same = same && (std::memcmp(copies[i], tracks[i], tracksize) == 0);
+        }
+        REQUIRE( "deserialized native batch equals tracks", same );
+        REQUIRE( "deserialized unaligned batch", musly_tracks_frombin_batch(box, &single[1], 1, copies, 0) == 1 );
+        REQUIRE( "empty batch", musly_tracks_tobin_batch(box, NULL, 0, NULL, 0) == 0 );
+        REQUIRE( "refused batch without buffer", musly_tracks_frombin_batch(box, NULL, 1, copies, 0) == -1 );
+        for (int i = 0; i < 10; i++) {
+            musly_track_free(copies[i]);
+        }
+    }
+
     // We initialize the jukebox
     REQUIRE( "set music style", musly_jukebox_setmusicstyle(box, tracks, 25) == 0 );
 
     // We add 50 tracks with automatically generated ids
     REQUIRE( "added tracks", musly_jukebox_addtracks(box, tracks, trackids, 50, true) == 0 );
     REQUIRE( "track count 50", musly_jukebox_trackcount(box) == 50 );
+    if (index_m > 0) {
+        REQUIRE( "index structure fixed after adding tracks", musly_jukebox_setoption(box, "hnsw.m", index_m + 1) == -1 );
+    }
+    if (pivots) {
+        REQUIRE( "pivots fixed after adding tracks", musly_jukebox_setoption(box, "pivots.count", 8) == -1 );
+    }
     REQUIRE( "max seen 49", musly_jukebox_maxtrackid(box) == 49 );
     for (int i = 0; i < 50; i++) {
         REQUIRE( "generated track ids", trackids[i] == i );
@@ -310,10 +1302,65 @@ void test_method(std::string method) {
         }
     }
 
+    // Songs analyzed at 44100 and 48000 Hz without resampling are most
+    // similar to the same songs resampled to 22050 Hz. At 22050 Hz, the
+    // features are the same as without a rate, and lower rates are
+    // rejected. (The resampled songs are compared in a jukebox of their
+    // own, with the id of another track as the seed, as similarity()
+    // treats tracks of the seed id as the seed itself.)
+    {
+        musly_track* native = musly_track_alloc(box);
+        musly_analyzer* analyzer = musly_analyzer_create(box);
+        musly_jukebox* resampled_box = musly_jukebox_poweron(method.c_str(), NULL);
+        REQUIRE( "set music style for resampled songs", musly_jukebox_setmusicstyle(resampled_box, tracks, 25) == 0 );
+        const int rates[] = {44100, 48000};
+        for (int rate : rates) {
+            musly_track* resampled[6] = {tracks[0]};
+            musly_trackid resampled_ids[6];
+            std::vector<std::vector<float> > songs(5, std::vector<float>(rate * 30));
+            for (int i = 0; i < 5; i++) {
+                generate_music(songs[i].data(), songs[i].size(), 42*(40 + i) + 1, rate);
+                std::vector<float> pcm = resample(musly::resampler(rate, 22050), songs[i], 0, 30 * 22050);
+                resampled[i + 1] = musly_track_alloc(box);
+                REQUIRE( "analyzed resampled song", musly_track_analyze_pcm(box, pcm.data(), pcm.size(), resampled[i + 1]) == 0 );
+            }
+            REQUIRE( "added resampled songs", musly_jukebox_addtracks(resampled_box, resampled, resampled_ids, 6, true) == 0 );
+            for (int i = 0; i < 5; i++) {
+                REQUIRE( "analyzed song at its rate", musly_track_analyze_pcm_rate(box, songs[i].data(), songs[i].size(), rate, native) == 0 );
+                REQUIRE( "computed similarities at its rate", musly_jukebox_similarity(resampled_box, native, resampled_ids[0], &resampled[1], &resampled_ids[1], 5, similarities) == 0 );
+                REQUIRE( "most similar to resampled song", std::min_element(similarities, similarities + 5) - similarities == i );
+            }
+            REQUIRE( "removed resampled songs", musly_jukebox_removetracks(resampled_box, resampled_ids, 6) == 0 );
+            for (int i = 1; i < 6; i++) {
+                musly_track_free(resampled[i]);
+            }
+        }
+        musly_jukebox_poweroff(resampled_box);
+        std::vector<float> pcm(22050 * 30);
+        generate_music(pcm.data(), pcm.size(), 1);
+        REQUIRE( "analyzed song at 22050 Hz", musly_analyzer_analyze_pcm_rate(analyzer, pcm.data(), pcm.size(), 22050, native) == 0 );
+        REQUIRE( "same features at 22050 Hz", std::memcmp(native, tracks[0], musly_track_size(box)) == 0 );
+        REQUIRE( "rejected lower rate", musly_track_analyze_pcm_rate(box, pcm.data(), pcm.size(), 16000, native) == -1 );
+        REQUIRE( "rejected missing signal", musly_track_analyze_pcm_rate(box, NULL, 100, 44100, native) == -1 );
+        musly_analyzer_free(analyzer);
+        musly_track_free(native);
+    }
+
     // We check whether similarity and candidate computation work
     REQUIRE( "computed similarities", musly_jukebox_similarity(box, tracks[42], trackids[42], tracks, trackids, 90, similarities) == 0 );
     num_neighbors_guessed = musly_jukebox_guessneighbors(box, trackids[30], candidates, 20);
     REQUIRE( "guessed neighbors", (num_neighbors_guessed == -1) || (num_neighbors_guessed == 20) );
+    if (num_neighbors_guessed > 0) {
+        // guessed neighbors should mostly agree with an exhaustive search
+        musly_trackid exact[20];
+        REQUIRE( "guessed neighbors among all tracks", musly_jukebox_guessneighbors_filtered(box, trackids[30], exact, 20, trackids, 90) == 20 );
+        int hits = 0;
+        for (int i = 0; i < 20; i++) {
+            REQUIRE( "guessed neighbor other than seed", candidates[i] != trackids[30] );
+            hits += std::count(exact, exact + 20, candidates[i]);
+        }
+        REQUIRE( "guessed neighbors with good recall", hits >= 18 );
+    }
     num_neighbors_guessed_flt = musly_jukebox_guessneighbors_filtered(box, trackids[30], candidates_flt, filter_ids.size() / 2, &filter_ids[0], filter_ids.size());
     REQUIRE( "guessed filtered neighbors", (num_neighbors_guessed_flt == -1) || (num_neighbors_guessed_flt == (int) filter_ids.size() / 2) );
     if (num_neighbors_guessed_flt > 0) {
@@ -374,6 +1421,92 @@ void test_method(std::string method) {
     for (int i = 0; i < 90; i++) {
         REQUIRE( "consistent similarities", similarities[i] == similarities2[i] );
     }
+
+    // We check whether similarities by trackid match those given the tracks
+    int num_byid = musly_jukebox_similarity_byid(box, trackids[42], trackids, 90, similarities2);
+    REQUIRE( "computed similarities by id (or not supported)", (num_byid == 0) || (num_byid == -1) );
+    if (num_byid == 0) {
+        for (int i = 0; i < 90; i++) {
+            REQUIRE( "consistent similarities by id", similarities[i] == similarities2[i] );
+        }
+        std::vector<musly_trackid> allids(90);
+        REQUIRE( "got track ids", musly_jukebox_gettrackids(box, &allids[0]) == 90 );
+        REQUIRE( "computed similarities to all tracks by id", musly_jukebox_similarity_byid(box, trackids[42], NULL, 90, similarities2) == 0 );
+        for (int i = 0; i < 90; i++) {
+            int pos = std::find(trackids, trackids + 90, allids[i]) - trackids;
+            REQUIRE( "consistent similarities to all tracks by id", similarities[pos] == similarities2[i] );
+        }
+        REQUIRE( "rejected unknown seed id", musly_jukebox_similarity_byid(box, 5000, trackids, 90, similarities2) == -1 );
+
+        // We check whether the fused top-k query agrees with findmin
+        float min_values[20], knn_values[20];
+        musly_trackid min_ids[20], knn_ids[20];
+        for (int k = 1; k <= 20; k += 19) {
+            REQUIRE( "found minima", musly_findmin(similarities, trackids, 90, min_values, min_ids, k, true) == k );
+            REQUIRE( "found nearest neighbors", musly_jukebox_knn(box, trackids[42], trackids, 90, knn_values, knn_ids, k) == k );
+            for (int i = 0; i < k; i++) {
+                REQUIRE( "consistent nearest neighbor similarities", knn_values[i] == min_values[i] );
+            }
+            REQUIRE( "seed is its own nearest neighbor", knn_ids[0] == trackids[42] );
+        }
+        REQUIRE( "found nearest neighbors among all tracks", musly_jukebox_knn(box, trackids[42], NULL, 90, knn_values, knn_ids, 20) == 20 );
+        for (int i = 0; i < 20; i++) {
+            REQUIRE( "consistent nearest neighbors among all tracks", knn_values[i] == min_values[i] );
+        }
+        // We check whether batches of seeds agree with single seeds
+        musly_trackid seeds[3] = {trackids[42], trackids[3], trackids[77]};
+        std::vector<float> batch(3 * 90);
+        REQUIRE( "computed similarities of a batch of seeds", musly_jukebox_similarity_batch(box, seeds, 3, trackids, 90, &batch[0]) == 0 );
+        for (int s = 0; s < 3; s++) {
+            REQUIRE( "computed similarities by id", musly_jukebox_similarity_byid(box, seeds[s], trackids, 90, similarities2) == 0 );
+            for (int i = 0; i < 90; i++) {
+                REQUIRE( "consistent similarities of a batch of seeds", batch[s * 90 + i] == similarities2[i] );
+            }
+        }
+        // We check whether all pairs agree with single seeds
+        upper_triangle triangle;
+        triangle.num_tracks = 90;
+        REQUIRE( "computed similarities of all pairs", musly_jukebox_similarity_allpairs(box, trackids, 90, 7, collect_upper_triangle, &triangle) == 0 );
+        REQUIRE( "collected all rows", triangle.rows.size() == 90 );
+        for (int s = 0; s < 90; s += 11) {
+            REQUIRE( "computed similarities by id", musly_jukebox_similarity_byid(box, trackids[s], trackids, 90, similarities2) == 0 );
+            for (int i = s + 1; i < 90; i++) {
+                REQUIRE( "consistent similarities of all pairs", triangle.rows[s][i - s - 1] == similarities2[i] );
+            }
+        }
+        REQUIRE( "aborted computing all pairs", musly_jukebox_similarity_allpairs(box, trackids, 90, 7, abort_upper_triangle, NULL) == -1 );
+
+        REQUIRE( "found all tracks for large k", musly_jukebox_knn(box, trackids[42], trackids, 5, knn_values, knn_ids, 20) == 5 );
+
+        // We check whether the exact index agrees with exhaustive searches
+        if (musly_jukebox_getoption(box, "vptree.enabled") == 0) {
+            musly_trackid exact[20], exact_flt[20];
+            int num_exact_flt = std::min<int>(20, filter_ids.size() - 1);
+            REQUIRE( "ranked all tracks", musly_jukebox_guessneighbors_filtered(box, trackids[30], exact, 20, trackids, 90) == 20 );
+            REQUIRE( "ranked filtered tracks", musly_jukebox_guessneighbors_filtered(box, trackids[30], exact_flt, num_exact_flt, &filter_ids[0], filter_ids.size()) == num_exact_flt );
+            REQUIRE( "enabled exact index", musly_jukebox_setoption(box, "vptree.enabled", 1) == 0 );
+            REQUIRE( "exact index enabled", musly_jukebox_getoption(box, "vptree.enabled") == 1 );
+            REQUIRE( "found exact neighbors", musly_jukebox_guessneighbors(box, trackids[30], candidates2, 20) == 20 );
+            for (int i = 0; i < 20; i++) {
+                REQUIRE( "consistent exact neighbors", candidates2[i] == exact[i] );
+            }
+            REQUIRE( "found exact filtered neighbors", musly_jukebox_guessneighbors_filtered(box, trackids[30], candidates2_flt, num_exact_flt, &filter_ids[0], filter_ids.size()) == num_exact_flt );
+            for (int i = 0; i < num_exact_flt; i++) {
+                REQUIRE( "consistent exact filtered neighbors", candidates2_flt[i] == exact_flt[i] );
+            }
+            REQUIRE( "found nearest neighbors with exact index", musly_jukebox_knn(box, trackids[42], NULL, 90, knn_values, knn_ids, 20) == 20 );
+            for (int i = 0; i < 20; i++) {
+                REQUIRE( "consistent nearest neighbors with exact index", knn_values[i] == min_values[i] );
+            }
+            REQUIRE( "found filtered nearest neighbors with exact index", musly_jukebox_knn(box, trackids[42], trackids, 5, knn_values, knn_ids, 20) == 5 );
+            REQUIRE( "counted distances", musly_jukebox_getoption(box, "vptree.distances") > 0 );
+            REQUIRE( "counted candidates", musly_jukebox_getoption(box, "vptree.candidates") >= 2*89 + num_exact_flt );
+            REQUIRE( "reset counters", musly_jukebox_setoption(box, "vptree.distances", 0) == 0 );
+            REQUIRE( "counters reset", musly_jukebox_getoption(box, "vptree.candidates") == 0 );
+            REQUIRE( "disabled exact index", musly_jukebox_setoption(box, "vptree.enabled", 0) == 0 );
+        }
+    }
+
     REQUIRE( "re-guessed neighbors", musly_jukebox_guessneighbors(box, trackids[30], candidates2, 20) == num_neighbors_guessed );
     if (num_neighbors_guessed > 0) {
         // the ids of the first 30 tracks have changed; we need to adapt `candidates`
@@ -432,10 +1565,22 @@ void test_method(std::string method) {
 
     // We check whether the re-imported jukebox is consistent with the original one
     REQUIRE( "max seen 1040 (imported jukebox)", musly_jukebox_maxtrackid(box2) == 1040 );
+    if (pivots) {
+        REQUIRE( "restored pivot count", musly_jukebox_getoption(box2, "pivots.count") == 16 );
+    }
     REQUIRE( "computed similarities (imported jukebox)", musly_jukebox_similarity(box2, tracks[42], trackids[42], tracks, trackids, 90, similarities2) == 0 );
     for (int i = 0; i < 90; i++) {
         REQUIRE( "consistent similarities", similarities[i] == similarities2[i] );
     }
+    if (num_byid == 0) {
+        // features are not exported, so they have to be given again
+        REQUIRE( "no similarities by id before storing tracks (imported jukebox)", musly_jukebox_similarity_byid(box2, trackids[42], trackids, 90, similarities2) == -1 );
+        REQUIRE( "stored tracks (imported jukebox)", musly_jukebox_storetracks(box2, tracks, trackids, 90) == 90 );
+        REQUIRE( "computed similarities by id (imported jukebox)", musly_jukebox_similarity_byid(box2, trackids[42], trackids, 90, similarities2) == 0 );
+        for (int i = 0; i < 90; i++) {
+            REQUIRE( "consistent similarities by id", similarities[i] == similarities2[i] );
+        }
+    }
     REQUIRE( "guessed neighbors (imported jukebox)", musly_jukebox_guessneighbors(box2, trackids[30], candidates2, 20) == num_neighbors_guessed );
     if (num_neighbors_guessed > 0) {
         std::sort(candidates2, candidates2 + num_neighbors_guessed);
@@ -451,6 +1596,217 @@ void test_method(std::string method) {
         }
     }
 
+    // We read the state written by musly 2.0.0, which lacks the format
+    // version and all fields after the mutual proximity tracks, and refuse
+    // states whose header ends early
+    if (pivots) {
+        musly_jukebox* box6 = musly_jukebox_poweron(method.c_str(), NULL);
+        musly_trackid ids6[90];
+        REQUIRE( "set music style (format 0)", musly_jukebox_setmusicstyle(box6, tracks, 25) == 0 );
+        REQUIRE( "added tracks (format 0)", musly_jukebox_addtracks(box6, tracks, ids6, 90, 1) == 0 );
+        const std::string state_path = (std::filesystem::temp_directory_path() /
+                ("musly-selftest-" + method + ".jbox")).string();
+        REQUIRE( "wrote jukebox state (format 0)", musly_jukebox_tofile(box6, state_path.c_str()) > 0 );
+        std::vector<char> state;
+        FILE* f = fopen(state_path.c_str(), "rb");
+        for (int c; (c = fgetc(f)) != EOF; ) {
+            state.push_back((char)c);
+        }
+        fclose(f);
+        const size_t prefix = strlen(musly_version()) + 1 + 1 + 4 + method.size() + 1
+                + strlen(musly_jukebox_decodername(box6)) + 1;
+        int size_head, version;
+        std::memcpy(&size_head, &state[prefix], sizeof(int));
+        std::memcpy(&version, &state[prefix + sizeof(int)], sizeof(int));
+        REQUIRE( "format version written", version == -1 );
+        auto load = [&](int size, const char* header, int header_bytes, bool tracks) {
+            std::vector<char> out(state.begin(), state.begin() + prefix);
+            out.insert(out.end(), (const char*)&size, (const char*)&size + sizeof(int));
+            out.insert(out.end(), header, header + header_bytes);
+            if (tracks) {
+                out.insert(out.end(), state.begin() + prefix + sizeof(int) + size_head, state.end());
+            }
+            FILE* f = fopen(state_path.c_str(), "wb");
+            fwrite(out.data(), 1, out.size(), f);
+            fclose(f);
+            return musly_jukebox_fromfile(state_path.c_str());
+        };
+        const char* header = &state[prefix + sizeof(int)];
+        const int size0 = sizeof(int) + sizeof(musly_trackid) + sizeof(int) + 25 * musly_track_size(box6);
+        musly_jukebox* box7 = load(size0, header + sizeof(int), size0, true);
+        REQUIRE( "read jukebox state (format 0)", box7 );
+        if (box7) {
+            REQUIRE( "track count (format 0)", musly_jukebox_trackcount(box7) == 90 );
+            REQUIRE( "no pivots (format 0)", musly_jukebox_getoption(box7, "pivots.count") == 0 );
+            std::vector<float> sim6(90), sim7(90);
+            REQUIRE( "computed similarities", musly_jukebox_similarity(box6, tracks[42], ids6[42], tracks, ids6, 90, sim6.data()) == 0 );
+            REQUIRE( "computed similarities (format 0)", musly_jukebox_similarity(box7, tracks[42], ids6[42], tracks, ids6, 90, sim7.data()) == 0 );
+            REQUIRE( "consistent similarities (format 0)", sim6 == sim7 );
+            REQUIRE( "stored tracks (format 0)", musly_jukebox_storetracks(box7, tracks, ids6, 90) == 90 );
+            musly_trackid guessed6[20], guessed7[20];
+            int num_guessed = musly_jukebox_guessneighbors(box6, ids6[30], guessed6, 20);
+            REQUIRE( "guessed neighbors (format 0)", musly_jukebox_guessneighbors(box7, ids6[30], guessed7, 20) == num_guessed );
+            REQUIRE( "consistent neighbors (format 0)", (num_guessed <= 0) || std::equal(guessed6, guessed6 + num_guessed, guessed7) );
+            musly_jukebox_poweroff(box7);
+        }
+        bool refused = true;
+        for (int size = 0; size < size_head; size += 97) {
+            musly_jukebox* box8 = load(size, header, size, true);
+            refused &= !box8;
+            if (box8) {
+                musly_jukebox_poweroff(box8);
+            }
+        }
+        // every size within the fields after the mutual proximity tracks
+        for (int size = size0 + 4; size < size0 + 4 + 40; size++) {
+            musly_jukebox* box8 = load(size, header, size, true);
+            refused &= !box8;
+            if (box8) {
+                musly_jukebox_poweroff(box8);
+            }
+        }
+        REQUIRE( "refused truncated jukebox state", refused );
+        REQUIRE( "refused jukebox state with trailing bytes", !load(size_head + 4, header, size_head + 4, false) );
+        REQUIRE( "refused unknown format version", !load(size_head, std::string("\xfe\xff\xff\xff", 4).append(header + 4, size_head - 4).data(), size_head, true) );
+        std::filesystem::remove(state_path);
+        musly_jukebox_poweroff(box6);
+    }
+
+    // We write the jukebox to a mapped file and restore it from there; the
+    // stored features are part of the file, and are used in place
+    const std::string mapped_path = (std::filesystem::temp_directory_path() /
+            ("musly-selftest-" + method + ".jbx")).string();
+    int num_mapped = musly_jukebox_tommap(box, mapped_path.c_str());
+    REQUIRE( "wrote mapped jukebox (or not supported)", (num_mapped == 0) || (num_mapped == -1) );
+    musly_jukebox* box3 = NULL;
+    if (num_mapped == 0) {
+        REQUIRE( "mapped jukebox", (box3 = musly_jukebox_frommmap(mapped_path.c_str())) );
+    }
+    if (box3) {
+        REQUIRE( "max seen 1040 (mapped jukebox)", musly_jukebox_maxtrackid(box3) == 1040 );
+        REQUIRE( "track count (mapped jukebox)", musly_jukebox_trackcount(box3) == musly_jukebox_trackcount(box) );
+        std::vector<musly_trackid> ids(musly_jukebox_trackcount(box));
+        std::vector<musly_trackid> ids3(ids.size());
+        musly_jukebox_gettrackids(box, ids.data());
+        REQUIRE( "track ids (mapped jukebox)", musly_jukebox_gettrackids(box3, ids3.data()) == (int)ids.size() && ids == ids3 );
+        if (pivots) {
+            REQUIRE( "restored pivot count (mapped jukebox)", musly_jukebox_getoption(box3, "pivots.count") == 16 );
+        }
+        REQUIRE( "computed similarities (mapped jukebox)", musly_jukebox_similarity(box3, tracks[42], trackids[42], tracks, trackids, 90, similarities2) == 0 );
+        for (int i = 0; i < 90; i++) {
+            REQUIRE( "consistent similarities (mapped jukebox)", similarities[i] == similarities2[i] );
+        }
+        if (num_byid == 0) {
+            REQUIRE( "computed similarities by id (mapped jukebox)", musly_jukebox_similarity_byid(box3, trackids[42], trackids, 90, similarities2) == 0 );
+            for (int i = 0; i < 90; i++) {
+                REQUIRE( "consistent similarities by id (mapped jukebox)", similarities[i] == similarities2[i] );
+            }
+        }
+        num_neighbors_guessed = musly_jukebox_guessneighbors(box, trackids[30], candidates, 20);
+        REQUIRE( "guessed neighbors (mapped jukebox)", musly_jukebox_guessneighbors(box3, trackids[30], candidates2, 20) == num_neighbors_guessed );
+        if (num_neighbors_guessed > 0) {
+            std::sort(candidates, candidates + num_neighbors_guessed);
+            std::sort(candidates2, candidates2 + num_neighbors_guessed);
+            for (int i = 0; i < num_neighbors_guessed; i++) {
+                REQUIRE( "consistent neighbor candidates (mapped jukebox)", candidates[i] == candidates2[i] );
+            }
+        }
+
+        // writing the mapped jukebox over its own file leaves its mapping
+        // intact
+        REQUIRE( "rewrote mapped jukebox", musly_jukebox_tommap(box3, mapped_path.c_str()) == 0 );
+        REQUIRE( "computed similarities (rewritten mapped jukebox)", musly_jukebox_similarity(box3, tracks[42], trackids[42], tracks, trackids, 90, similarities2) == 0 );
+        REQUIRE( "consistent similarities (rewritten mapped jukebox)", std::equal(similarities, similarities + 90, similarities2) );
+        musly_jukebox* rewritten = musly_jukebox_frommmap(mapped_path.c_str());
+        REQUIRE( "mapped rewritten jukebox", rewritten && (musly_jukebox_trackcount(rewritten) == musly_jukebox_trackcount(box)) );
+        REQUIRE( "no temporary file left", !std::filesystem::exists(mapped_path + ".tmp") );
+        if (rewritten) {
+            musly_jukebox_poweroff(rewritten);
+        }
+    }
+
+    // A file that is not a mapped jukebox, or a truncated one, is refused
+    REQUIRE( "refused missing mapped jukebox", !musly_jukebox_frommmap((mapped_path + ".missing").c_str()) );
+    if (num_mapped == 0) {
+        std::filesystem::path truncated = mapped_path + ".truncated";
+        std::filesystem::copy_file(mapped_path, truncated, std::filesystem::copy_options::overwrite_existing);
+        std::filesystem::resize_file(truncated, std::filesystem::file_size(truncated) / 2);
+        REQUIRE( "refused truncated mapped jukebox", !musly_jukebox_frommmap(truncated.string().c_str()) );
+        std::filesystem::resize_file(truncated, 256);
+        REQUIRE( "refused damaged mapped jukebox", !musly_jukebox_frommmap(truncated.string().c_str()) );
+        std::filesystem::remove(truncated);
+    }
+
+    // We store the covariances compactly, re-ranking the nearest neighbors
+    // with the float32 ones; with all tracks re-ranked, they are exact
+    if (musly_jukebox_getoption(box, "covar.encoding") == 0) {
+        REQUIRE( "no re-ranking by default", musly_jukebox_getoption(box, "covar.rerank") == 0 );
+        REQUIRE( "covariance encoding fixed after adding tracks", musly_jukebox_setoption(box, "covar.encoding", 1) == -1 );
+        for (int encoding = 1; encoding <= 2; encoding++) {
+            musly_jukebox* box5 = musly_jukebox_poweron(method.c_str(), NULL);
+            REQUIRE( "rejected invalid covariance encoding", musly_jukebox_setoption(box5, "covar.encoding", 3) == -1 );
+            REQUIRE( "rejected invalid re-ranking", musly_jukebox_setoption(box5, "covar.rerank", -1) == -1 );
+            REQUIRE( "set covariance encoding", musly_jukebox_setoption(box5, "covar.encoding", encoding) == 0 );
+            REQUIRE( "set re-ranking", musly_jukebox_setoption(box5, "covar.rerank", 80) == 0 );
+            REQUIRE( "set music style (compact covariances)", musly_jukebox_setmusicstyle(box5, tracks, 25) == 0 );
+            musly_trackid ids5[90];
+            REQUIRE( "added tracks (compact covariances)", musly_jukebox_addtracks(box5, tracks, ids5, 90, 1) == 0 );
+            REQUIRE( "re-ranking fixed after adding tracks", musly_jukebox_setoption(box5, "covar.rerank", 0) == -1 );
+            REQUIRE( "computed similarities (compact covariances)", musly_jukebox_similarity(box5, tracks[42], ids5[42], tracks, ids5, 90, similarities2) == 0 );
+            float min_values[10], knn_values[10];
+            musly_trackid min_ids[10], knn_ids[10];
+            REQUIRE( "found minima (compact covariances)", musly_findmin(similarities2, ids5, 90, min_values, min_ids, 10, true) == 10 );
+            REQUIRE( "found nearest neighbors (compact covariances)", musly_jukebox_knn(box5, ids5[42], NULL, 90, knn_values, knn_ids, 10) == 10 );
+            for (int i = 0; i < 10; i++) {
+                REQUIRE( "re-ranked nearest neighbors exact", knn_values[i] == min_values[i] );
+            }
+            REQUIRE( "computed similarities by id (compact covariances)", musly_jukebox_similarity_byid(box5, ids5[42], ids5, 90, similarities2) == 0 );
+            REQUIRE( "seed most similar to itself (compact covariances)", similarities2[42] == *std::min_element(similarities2, similarities2 + 90) );
+
+            // the encoding is part of the jukebox state
+            const std::string compact_state = mapped_path + ".compact.jbox";
+            REQUIRE( "wrote jukebox state (compact covariances)", musly_jukebox_tofile(box5, compact_state.c_str()) > 0 );
+            musly_jukebox* box7 = musly_jukebox_fromfile(compact_state.c_str());
+            REQUIRE( "read jukebox state (compact covariances)", box7 );
+            if (box7) {
+                REQUIRE( "read covariance encoding", musly_jukebox_getoption(box7, "covar.encoding") == encoding );
+                REQUIRE( "read re-ranking", musly_jukebox_getoption(box7, "covar.rerank") == 80 );
+                musly_jukebox_poweroff(box7);
+            }
+            std::filesystem::remove(compact_state);
+
+            // the encoding and the compact covariances survive a mapped file
+            if (num_mapped == 0) {
+                const std::string compact_path = mapped_path + ".compact";
+                REQUIRE( "wrote mapped jukebox (compact covariances)", musly_jukebox_tommap(box5, compact_path.c_str()) == 0 );
+                musly_jukebox* box6 = musly_jukebox_frommmap(compact_path.c_str());
+                REQUIRE( "mapped jukebox (compact covariances)", box6 );
+                if (box6) {
+                    REQUIRE( "restored covariance encoding", musly_jukebox_getoption(box6, "covar.encoding") == encoding );
+                    REQUIRE( "restored re-ranking", musly_jukebox_getoption(box6, "covar.rerank") == 80 );
+                    std::vector<float> similarities6(90);
+                    REQUIRE( "computed similarities by id (mapped compact covariances)", musly_jukebox_similarity_byid(box6, ids5[42], ids5, 90, similarities6.data()) == 0 );
+                    for (int i = 0; i < 90; i++) {
+                        REQUIRE( "consistent similarities by id (mapped compact covariances)", similarities6[i] == similarities2[i] );
+                    }
+                    REQUIRE( "found nearest neighbors (mapped compact covariances)", musly_jukebox_knn(box6, ids5[42], NULL, 90, knn_values, knn_ids, 10) == 10 );
+                    for (int i = 0; i < 10; i++) {
+                        REQUIRE( "re-ranked nearest neighbors exact (mapped)", knn_values[i] == min_values[i] );
+                    }
+                    musly_jukebox_poweroff(box6);
+                }
+                std::filesystem::remove(compact_path);
+            }
+            musly_jukebox_poweroff(box5);
+        }
+    }
+
+    // We keep the jukebox state to journal the changes to it below
+    const std::string journal_path = (std::filesystem::temp_directory_path() /
+            ("musly-selftest-" + method + ".jbox")).string();
+    FILE* journal = fopen(journal_path.c_str(), "w+b");
+    REQUIRE( "wrote jukebox state to journal", journal && musly_jukebox_tostream(box, journal) > 0 );
+
     // We check if the two jukeboxes are also consistent when adding new tracks
     // (so the music style state has been exported and imported properly)
     REQUIRE( "added 10 tracks to first jukebox", musly_jukebox_addtracks(box, &tracks[90], &trackids[90], 10, true) == 0 );
@@ -466,6 +1822,31 @@ void test_method(std::string method) {
     for (int i = 0; i < 100; i++) {
         REQUIRE( "consistent similarities", similarities[i] == similarities2[i] );
     }
+    if (box3) {
+        // adding tracks copies the mapped columns before changing them
+        REQUIRE( "added 10 tracks to mapped jukebox", musly_jukebox_addtracks(box3, &tracks[90], &trackids[90], 10, true) == 0 );
+        for (int i = 0; i < 10; i++) {
+            REQUIRE( "generated track ids (mapped jukebox)", trackids[90 + i] == 1041 + i );
+        }
+        REQUIRE( "computed similarities (mapped jukebox)", musly_jukebox_similarity(box3, tracks[10], trackids[10], tracks, trackids, 100, similarities2) == 0 );
+        for (int i = 0; i < 100; i++) {
+            REQUIRE( "consistent similarities (mapped jukebox)", similarities[i] == similarities2[i] );
+        }
+        REQUIRE( "removed tracks from mapped jukebox", musly_jukebox_removetracks(box3, &trackids[20], 5) == 0 );
+        REQUIRE( "track count after removing (mapped jukebox)", musly_jukebox_trackcount(box3) == musly_jukebox_trackcount(box) - 5 );
+        REQUIRE( "computed similarities after removing (mapped jukebox)", musly_jukebox_similarity(box3, tracks[10], trackids[10], &tracks[30], &trackids[30], 70, similarities2) == 0 );
+        for (int i = 0; i < 70; i++) {
+            REQUIRE( "consistent similarities after removing (mapped jukebox)", similarities[30 + i] == similarities2[i] );
+        }
+        if (num_byid == 0) {
+            REQUIRE( "computed similarities by id after removing (mapped jukebox)", musly_jukebox_similarity_byid(box3, trackids[10], &trackids[30], 70, similarities2) == 0 );
+            for (int i = 0; i < 70; i++) {
+                REQUIRE( "consistent similarities by id after removing (mapped jukebox)", similarities[30 + i] == similarities2[i] );
+            }
+        }
+        musly_jukebox_poweroff(box3);
+    }
+    std::filesystem::remove(mapped_path);
     num_neighbors_guessed = musly_jukebox_guessneighbors(box, trackids[23], candidates, 20);
     REQUIRE( "guessed neighbors (both jukeboxes or none)", musly_jukebox_guessneighbors(box2, trackids[23], candidates2, 20) == num_neighbors_guessed );
     if (num_neighbors_guessed > 0) {
@@ -476,6 +1857,61 @@ void test_method(std::string method) {
         }
     }
 
+    // We journal the tracks added and removed since the state was written,
+    // replay them on a restored jukebox and compare it to the original one
+    REQUIRE( "journaled added tracks", musly_jukebox_journal_addtracks(box, journal, &trackids[90], 10) > 0 );
+    musly_trackid unknown_id = 99999;
+    REQUIRE( "refused to journal unknown tracks", musly_jukebox_journal_addtracks(box, journal, &unknown_id, 1) == -1 );
+    REQUIRE( "removed tracks", musly_jukebox_removetracks(box, &trackids[5], 3) == 0 );
+    REQUIRE( "journaled removed tracks", musly_jukebox_journal_removetracks(box, journal, &trackids[5], 3) > 0 );
+    rewind(journal);
+    musly_jukebox* box4 = musly_jukebox_fromstream(journal);
+    REQUIRE( "restored jukebox state before journal", box4 && musly_jukebox_trackcount(box4) == 90 );
+    REQUIRE( "replayed journal", musly_jukebox_journal_replay(box4, journal) == 2 );
+    REQUIRE( "track count after replaying", musly_jukebox_trackcount(box4) == 97 );
+    REQUIRE( "max seen after replaying", musly_jukebox_maxtrackid(box4) == 1050 );
+    REQUIRE( "computed similarities (replayed jukebox)", musly_jukebox_similarity(box4, tracks[10], trackids[10], &tracks[8], &trackids[8], 92, similarities2) == 0 );
+    REQUIRE( "computed similarities (first jukebox)", musly_jukebox_similarity(box, tracks[10], trackids[10], &tracks[8], &trackids[8], 92, similarities) == 0 );
+    for (int i = 0; i < 92; i++) {
+        REQUIRE( "consistent similarities (replayed jukebox)", similarities[i] == similarities2[i] );
+    }
+    if (num_byid == 0) {
+        REQUIRE( "stored tracks (replayed jukebox)", musly_jukebox_storetracks(box4, &tracks[8], &trackids[8], 92) == 92 );
+        num_neighbors_guessed = musly_jukebox_guessneighbors(box, trackids[95], candidates, 20);
+        REQUIRE( "guessed neighbors of replayed track", musly_jukebox_guessneighbors(box4, trackids[95], candidates2, 20) == num_neighbors_guessed );
+    }
+    musly_jukebox_poweroff(box4);
+
+    // an interrupted record is refused, keeping the records before
+    fseek(journal, 0, SEEK_END);
+    const long record_start = ftell(journal);
+    REQUIRE( "journaled more tracks", musly_jukebox_journal_addtracks(box, journal, &trackids[50], 2) > 0 );
+    fflush(journal);
+    std::filesystem::resize_file(journal_path, std::filesystem::file_size(journal_path) - 4);
+    rewind(journal);
+    box4 = musly_jukebox_fromstream(journal);
+    REQUIRE( "refused interrupted journal record", box4 && musly_jukebox_journal_replay(box4, journal) == -1 );
+    REQUIRE( "kept journal records before", musly_jukebox_trackcount(box4) == 97 );
+    musly_jukebox_poweroff(box4);
+
+    // a record adding a track twice is refused before it replaces any track
+    const musly_trackid twice[2] = {trackids[50], trackids[50]};
+    REQUIRE( "refused to journal a track twice", musly_jukebox_journal_addtracks(box, journal, twice, 2) == -1 );
+    fseek(journal, record_start, SEEK_SET);
+    REQUIRE( "journaled tracks again", musly_jukebox_journal_addtracks(box, journal, &trackids[50], 2) > 0 );
+    fseek(journal, record_start + 16 + sizeof(musly_trackid), SEEK_SET);
+    fwrite(&trackids[50], sizeof(musly_trackid), 1, journal);
+    fflush(journal);
+    rewind(journal);
+    box4 = musly_jukebox_fromstream(journal);
+    REQUIRE( "refused journal record adding a track twice", box4 && musly_jukebox_journal_replay(box4, journal) == -1 );
+    std::vector<musly_trackid> kept(musly_jukebox_trackcount(box4));
+    musly_jukebox_gettrackids(box4, kept.data());
+    REQUIRE( "kept tracks of refused record", (kept.size() == 97) && (std::count(kept.begin(), kept.end(), trackids[50]) == 1) );
+    musly_jukebox_poweroff(box4);
+    fclose(journal);
+    std::filesystem::remove(journal_path);
+
     // Clean up whatever is left on the heap
     for (int i = 0; i < 100; i++) {
         musly_track_free(tracks[i]);
@@ -485,7 +1921,7 @@ void test_method(std::string method) {
 }
 
 
-void test_decoder(const std::string& decoder)
+void test_decoder(const std::string& decoder, const std::string& sample)
 {
     std::cout << "Testing decoder '" << decoder << "'..." << std::endl;
 
@@ -493,21 +1929,256 @@ void test_decoder(const std::string& decoder)
     REQUIRE("jukebox initialized with decoder", box != nullptr);
 
     musly_track* track = musly_track_alloc(box);
-    REQUIRE("analyze file", musly_track_analyze_audiofile(box, "fixtures/sample-15s.mp3", 15, 0, track) == 0);
+    REQUIRE("analyze file", musly_track_analyze_audiofile(box, sample.c_str(), 15, 0, track) == 0);
+
+    // decoding from memory gives the same features as decoding the file
+    FILE* f = fopen(sample.c_str(), "rb");
+    REQUIRE("opened sample", f != NULL);
+    std::vector<unsigned char> encoded;
+    unsigned char chunk[65536];
+    for (size_t n; f && (n = fread(chunk, 1, sizeof(chunk), f)) > 0; ) {
+        encoded.insert(encoded.end(), chunk, chunk + n);
+    }
+    if (f) {
+        fclose(f);
+    }
+    musly_track* from_memory = musly_track_alloc(box);
+    REQUIRE("analyze buffer", musly_track_analyze_audiobuffer(box, encoded.data(), encoded.size(), 15, 0, from_memory) == 0);
+    REQUIRE("same features from buffer", std::memcmp(from_memory, track, musly_track_size(box)) == 0);
+    REQUIRE("rejected garbage buffer", musly_track_analyze_audiobuffer(box, encoded.data() + encoded.size()/2, 100, 15, 0, from_memory) != 0);
+    musly_track_free(from_memory);
+
+    // the pipeline gives the same features, and reports missing files
+    std::vector<unsigned char> expected(musly_track_binsize(box));
+    musly_track_tobin(box, track, expected.data());
+    const char* files[] = {sample.c_str(), "fixtures/no-such-file",
+            sample.c_str(), sample.c_str()};
+    audiofile_results results = {std::vector<int>(4, 0), expected, true};
+    REQUIRE("analyze files", musly_track_analyze_audiofiles(box, files, 4, 15, 0, 2, 2, 1, collect_audiofile, &results) == 1);
+    REQUIRE("reported each file once", results.calls == std::vector<int>(4, 1));
+    REQUIRE("same features from pipeline", results.same);
+    REQUIRE("aborted analyzing files", musly_track_analyze_audiofiles(box, files, 4, 15, 0, 1, 1, 1, abort_audiofile, NULL) == -1);
+
+    // the decoder options start at the defaults, can be changed and
+    // reset, and files still decode with all of them set
+    musly_decoder_options options;
+    REQUIRE("got decoder options", musly_jukebox_getdecoderoptions(box, &options) == 0);
+    REQUIRE("default decoder options", options.probe_size == 0 && options.analyze_duration == 0 &&
+            options.codec_threads == 0 && options.codec_thread_type == 0 &&
+            options.skip_to_excerpt == 0 && options.resampler_filter_length == 0 &&
+            options.native_sample_rate == 0);
+    options.probe_size = 65536;
+    options.analyze_duration = 1;
+    options.codec_threads = 2;
+    options.codec_thread_type = MUSLY_DECODER_THREAD_FRAME;
+    options.skip_to_excerpt = 1;
+    options.resampler_filter_length = 16;
+    options.native_sample_rate = 1;
+    REQUIRE("set decoder options", musly_jukebox_setdecoderoptions(box, &options) == 0);
+    musly_decoder_options changed = {};
+    musly_jukebox_getdecoderoptions(box, &changed);
+    REQUIRE("changed decoder options", std::memcmp(&changed, &options, sizeof(options)) == 0);
+    REQUIRE("analyze file with options", musly_track_analyze_audiofile(box, sample.c_str(), 10, 3, track) == 0);
+    REQUIRE("reset decoder options", musly_jukebox_setdecoderoptions(box, NULL) == 0);
+    musly_jukebox_getdecoderoptions(box, &changed);
+    REQUIRE("reset to defaults", changed.probe_size == 0 && changed.skip_to_excerpt == 0);
+    REQUIRE("rejected missing jukebox", musly_jukebox_setdecoderoptions(NULL, &options) == -1 &&
+            musly_jukebox_getdecoderoptions(NULL, &options) == -1);
 
     musly_track_free(track);
 
     musly_jukebox_poweroff(box);
 }
 
+/** Write \p pcm to a WAV file, in each of \p channels, encoded as
+ * \p format_tag (1 for integer PCM, 3 for float) with \p bytes per
+ * sample. A \p data_size of 0 writes the size of the samples.
+ */
+bool write_wav(const std::string& path, const std::vector<float>& pcm,
+        int channels, int rate, int format_tag, int bytes,
+        uint32_t data_size = 0) {
+    std::vector<unsigned char> data;
+    for (size_t i = 0; i < pcm.size(); i++) {
+        for (int c = 0; c < channels; c++) {
+            uint64_t bits;
+            if (format_tag == 3 && bytes == 4) {
+                float v = pcm[i];
+                uint32_t b;
+                std::memcpy(&b, &v, 4);
+                bits = b;
+            } else if (format_tag == 3) {
+                double v = pcm[i];
+                std::memcpy(&bits, &v, 8);
+            } else {
+                double scale = std::ldexp(1.0, 8*bytes - 1);
+                int64_t v = std::max(std::min((int64_t)std::lrint(pcm[i] * scale),
+                        (int64_t)scale - 1), -(int64_t)scale);
+                bits = (bytes == 1) ? (uint64_t)(v + 128) : (uint64_t)v;
+            }
+            for (int b = 0; b < bytes; b++) {
+                data.push_back((bits >> (8*b)) & 0xff);
+            }
+        }
+    }
+    auto u32 = [](std::vector<unsigned char>& out, uint32_t v) {
+        for (int b = 0; b < 4; b++) {
+            out.push_back((v >> (8*b)) & 0xff);
+        }
+    };
+    auto u16 = [](std::vector<unsigned char>& out, uint32_t v) {
+        out.push_back(v & 0xff);
+        out.push_back((v >> 8) & 0xff);
+    };
+    std::vector<unsigned char> file = {'R', 'I', 'F', 'F'};
+    u32(file, 4 + 8 + 16 + 8 + 6 + 8 + data.size());
+    file.insert(file.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+    u32(file, 16);
+    u16(file, format_tag);
+    u16(file, channels);
+    u32(file, rate);
+    u32(file, rate * channels * bytes);
+    u16(file, channels * bytes);
+    u16(file, 8 * bytes);
+    // a chunk to skip, with an odd size and a pad byte
+    file.insert(file.end(), {'L', 'I', 'S', 'T'});
+    u32(file, 5);
+    file.insert(file.end(), {'a', 'b', 'c', 'd', 'e', 0});
+    file.insert(file.end(), {'d', 'a', 't', 'a'});
+    u32(file, data_size ? data_size : data.size());
+    file.insert(file.end(), data.begin(), data.end());
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    bool written = (fwrite(file.data(), 1, file.size(), f) == file.size());
+    return (fclose(f) == 0) && written;
+}
+
+/** Round \p pcm to integer samples of \p bytes bytes.
+ */
+std::vector<float> quantize(const std::vector<float>& pcm, int bytes) {
+    const double scale = std::ldexp(1.0, 8*bytes - 1);
+    std::vector<float> out(pcm.size());
+    for (size_t i = 0; i < pcm.size(); i++) {
+        out[i] = std::max(std::min(std::lrint(pcm[i] * scale), (long)scale - 1),
+                -(long)scale) / (float)scale;
+    }
+    return out;
+}
+
+void test_wav_decoder(const std::string& dir)
+{
+    std::cout << "Testing WAV files..." << std::endl;
+    musly_jukebox* box = musly_jukebox_poweron("timbre", "wav");
+    const std::string path = dir + "/musly-selftest-formats.wav";
+    musly_track* expected = musly_track_alloc(box);
+    musly_track* track = musly_track_alloc(box);
+
+    // The excerpt of 30 seconds starting at 15 seconds gives the same
+    // features as the same part of the signal, passed through unchanged at
+    // 22050 Hz and resampled otherwise, for all encodings and any number
+    // of channels.
+    const int formats[][4] = {
+        // format tag, bytes, channels, rate
+        {3, 4, 1, 22050}, {1, 2, 2, 22050}, {1, 1, 3, 22050},
+        {3, 8, 2, 22050}, {1, 3, 1, 22050}, {1, 2, 2, 44100},
+        {3, 4, 1, 48000}, {1, 2, 1, 16000}
+    };
+    for (int i = 0; i < 8; i++) {
+        const int rate = formats[i][3];
+        std::vector<float> song(rate * 60);
+        generate_music(song.data(), song.size(), 7, rate);
+        float peak = 0;
+        for (size_t j = 0; j < song.size(); j++) {
+            peak = std::max(peak, std::abs(song[j]));
+        }
+        for (size_t j = 0; j < song.size(); j++) {
+            song[j] *= 0.9f / peak;
+        }
+        REQUIRE("wrote file", write_wav(path, song, formats[i][2], rate, formats[i][0], formats[i][1]));
+        if (formats[i][0] == 1) {
+            song = quantize(song, formats[i][1]);
+        }
+        std::vector<float> excerpt;
+        if (rate != 22050) {
+            excerpt = resample(musly::resampler(rate, 22050), song, 15 * 22050, 30 * 22050);
+        } else {
+            excerpt = std::vector<float>(&song[15 * 22050], &song[45 * 22050]);
+        }
+        REQUIRE("analyzed signal", musly_track_analyze_pcm(box, excerpt.data(), excerpt.size(), expected) == 0);
+        REQUIRE("analyzed file", musly_track_analyze_audiofile(box, path.c_str(), 30, -48, track) == 0);
+        REQUIRE("same features from file", std::memcmp(track, expected, musly_track_size(box)) == 0);
+
+        // the decoder options choose the length of the resampling filter
+        if (rate != 22050) {
+            musly_decoder_options options = {};
+            options.resampler_filter_length = 48;
+            musly_jukebox_setdecoderoptions(box, &options);
+            excerpt = resample(musly::resampler(rate, 22050, 48), song, 15 * 22050, 30 * 22050);
+            REQUIRE("analyzed signal", musly_track_analyze_pcm(box, excerpt.data(), excerpt.size(), expected) == 0);
+            REQUIRE("analyzed file", musly_track_analyze_audiofile(box, path.c_str(), 30, -48, track) == 0);
+            REQUIRE("same features with longer filter", std::memcmp(track, expected, musly_track_size(box)) == 0);
+            musly_jukebox_setdecoderoptions(box, NULL);
+        }
+
+        // files above 22050 Hz can be analyzed at their own rate instead,
+        // and the others are still resampled
+        if (rate != 22050) {
+            musly_decoder_options options = {};
+            options.native_sample_rate = 1;
+            musly_jukebox_setdecoderoptions(box, &options);
+            if (rate > 22050) {
+                excerpt = std::vector<float>(&song[15 * rate], &song[45 * rate]);
+                REQUIRE("analyzed signal", musly_track_analyze_pcm_rate(box, excerpt.data(), excerpt.size(), rate, expected) == 0);
+            } else {
+                excerpt = resample(musly::resampler(rate, 22050), song, 15 * 22050, 30 * 22050);
+                REQUIRE("analyzed signal", musly_track_analyze_pcm(box, excerpt.data(), excerpt.size(), expected) == 0);
+            }
+            REQUIRE("analyzed file", musly_track_analyze_audiofile(box, path.c_str(), 30, -48, track) == 0);
+            REQUIRE("same features at native rate", std::memcmp(track, expected, musly_track_size(box)) == 0);
+            musly_jukebox_setdecoderoptions(box, NULL);
+        }
+    }
+
+    // a data chunk size left as a placeholder by streaming writers is
+    // clamped to the file
+    std::vector<float> song(22050 * 60);
+    generate_music(song.data(), song.size(), 7);
+    REQUIRE("wrote streamed file", write_wav(path, song, 1, 22050, 3, 4, 0xffffffff));
+    REQUIRE("analyzed signal", musly_track_analyze_pcm(box, &song[15 * 22050], 30 * 22050, expected) == 0);
+    REQUIRE("analyzed streamed file", musly_track_analyze_audiofile(box, path.c_str(), 30, -48, track) == 0);
+    REQUIRE("same features from streamed file", std::memcmp(track, expected, musly_track_size(box)) == 0);
+
+    // compressed or broken files are rejected
+    REQUIRE("wrote compressed file", write_wav(path, song, 1, 22050, 2, 2));
+    REQUIRE("rejected compressed file", musly_track_analyze_audiofile(box, path.c_str(), 30, -48, track) == -1);
+    REQUIRE("rejected mp3 file", musly_track_analyze_audiofile(box, "fixtures/sample-15s.mp3", 30, -48, track) == -1);
+    REQUIRE("rejected missing file", musly_track_analyze_audiofile(box, "fixtures/no-such-file.wav", 30, -48, track) == -1);
+
+    std::remove(path.c_str());
+    musly_track_free(expected);
+    musly_track_free(track);
+    musly_jukebox_poweroff(box);
+}
+
 int main() {
     musly_debug(1);  // set verbosity level to logERROR
 
     // Unit tests
-    std::cout << "Components to test: unordered_idpool,ordered_idpool,findmin" << std::endl;
+    std::cout << "Components to test: unordered_idpool,ordered_idpool,findmin,gaussian_statistics,realfft,mutualproximity,hnsw,vptree,pivottable,resampler,threadpool,collection_file" << std::endl;
     test_unordered_idpool();
     test_ordered_idpool();
     test_findmin();
+    test_gaussian_statistics();
+    test_realfft();
+    test_mutualproximity();
+    test_hnsw();
+    test_vptree();
+    test_pivottable();
+    test_resampler();
+    test_threadpool();
+    test_collection_file();
     std::cout << std::endl;
 
     // Tests of the full library
@@ -525,10 +2196,24 @@ int main() {
         [](auto &decoder) { return decoder != "none"; }
     );
 
+    // the WAV decoder reads a WAV version of the sample written at runtime
+    const std::string temp_dir = std::filesystem::temp_directory_path().string();
+    const std::string wav_sample = temp_dir + "/musly-selftest-sample.wav";
+    std::vector<float> sample(22050 * 20);
+    generate_music(sample.data(), sample.size(), 3);
+    for (size_t i = 0; i < sample.size(); i++) {
+        sample[i] *= 0.1f;
+    }
+    write_wav(wav_sample, sample, 2, 22050, 1, 2);
+
     std::cout << "Decoders to test: " << join(decoders_to_test, ',') << std::endl;
     for (auto decoder : decoders_to_test) {
-        test_decoder(decoder);
+        test_decoder(decoder, (decoder == "wav") ? wav_sample : "fixtures/sample-15s.mp3");
+        if (decoder == "wav") {
+            test_wav_decoder(temp_dir);
+        }
     }
+    std::remove(wav_sample.c_str());
 
     SUMMARY();
 }